@@ -0,0 +1,65 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef BGEN_INDEX_HPP
+#define BGEN_INDEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Identifying data of every variant in a bgen file (--bgen-index), so that
+// loading the variants doesn't require a pass through the whole bgen file.
+// Unlike the .bgi of bgenix, this is not a SQLite database, but a header
+// (with the size and modification time of the bgen file) followed by one
+// entry per variant in file order: the offset of its genotype data block,
+// its position, RS ID, chromosome, first and last allele. The entries are
+// read and written sequentially so that the index is never held in memory
+class Bgen_Index
+{
+public:
+    Bgen_Index() {}
+    Bgen_Index(const Bgen_Index&) = delete;            // disable copying
+    Bgen_Index& operator=(const Bgen_Index&) = delete; // disable assignment
+    // open file_name for reading. Return false if the file doesn't exist or
+    // was generated from a different bgen file (key)
+    bool load(const std::string& file_name, const std::string& key,
+              const size_t num_variant);
+    // start a new index, written to file_name by finish. Return false if
+    // the file cannot be written
+    bool create(const std::string& file_name, const std::string& key,
+                const size_t num_variant);
+    // read the next variant of a loaded index
+    void next(std::string& rsid, std::string& chr, uint32_t& loc,
+              std::vector<std::string>& alleles, std::streampos& byte_pos);
+    // add the next variant to a created index
+    void add(const std::string& rsid, const std::string& chr,
+             const uint32_t loc, const std::vector<std::string>& alleles,
+             const std::streampos byte_pos);
+    void finish();
+
+private:
+    static const char magic[9];
+    static const uint32_t version = 1;
+    std::ifstream m_in;
+    std::ofstream m_out;
+    std::vector<char> m_buffer;
+    std::string m_file_name;
+};
+
+#endif // BGEN_INDEX_HPP
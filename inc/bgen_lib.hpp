@@ -15,8 +15,12 @@
 #include <limits>
 #include <stdexcept>
 #include <stdint.h>
+#include <string>
 #include <vector>
 #include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 /*
  * This file contains a reference implementation of the BGEN file format
@@ -120,6 +124,27 @@ void zlib_uncompress(std::vector<byte_t> const& source, std::vector<T>* dest)
     zlib_uncompress(begin, end, dest);
 }
 
+#ifdef HAVE_ZSTD
+// Uncompress zstd compressed data (BGEN v1.3). As with zlib_uncompress, the
+// destination must be large enough to fit the uncompressed data, and it will
+// be resized to exactly fit the uncompressed data.
+template <typename T>
+void zstd_uncompress(byte_t const* begin, byte_t const* const end,
+                     std::vector<T>* dest)
+{
+    std::size_t const result =
+        ZSTD_decompress(&dest->operator[](0), dest->size() * sizeof(T), begin,
+                        end - begin);
+    if (ZSTD_isError(result)) {
+        throw std::runtime_error(
+            std::string("Error: Cannot decompress zstd data: ")
+            + ZSTD_getErrorName(result));
+    }
+    assert(result % sizeof(T) == 0);
+    dest->resize(result / sizeof(T));
+}
+#endif
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////
 // INTERFACE
@@ -0,0 +1,66 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef BGEN_PREFETCH_HPP
+#define BGEN_PREFETCH_HPP
+
+#include "bgen_lib.hpp"
+#include "thread_pool.hpp"
+#include <cstddef>
+#include <istream>
+#include <memory>
+#include <vector>
+
+// Inflate the probability data of the next few variants on the thread pool
+// while the caller parses the current one. The caller reads the compressed
+// blocks in order with push (so the file is only ever read by one thread) and
+// takes the inflated blocks back in the same order with front and pop. When
+// the pool has no worker, or depth is 1, the blocks are inflated in push
+class Bgen_Prefetcher
+{
+public:
+    explicit Bgen_Prefetcher(size_t depth);
+    ~Bgen_Prefetcher();
+    Bgen_Prefetcher(const Bgen_Prefetcher&) = delete; // disable copying
+    Bgen_Prefetcher&
+    operator=(const Bgen_Prefetcher&) = delete; // disable assignment
+    bool full() const { return m_size == m_depth; }
+    bool empty() const { return m_size == 0; }
+    // read the genotype data block at the current position of bgen_file and
+    // queue it for inflation. Must not be called when full
+    void push(std::istream& bgen_file, const genfile::bgen::Context& context);
+    // wait for the oldest block to be inflated and return its probability
+    // data. Throw std::runtime_error if the block cannot be inflated
+    const std::vector<genfile::byte_t>& front();
+    // done with the oldest block
+    void pop();
+
+private:
+    struct Block
+    {
+        std::vector<genfile::byte_t> compressed;
+        std::vector<genfile::byte_t> data;
+        Thread_Pool::Task_Group group;
+        bool inflated = false;
+    };
+    std::unique_ptr<Block[]> m_blocks;
+    size_t m_depth;
+    size_t m_head = 0;
+    size_t m_size = 0;
+    bool m_serial;
+};
+
+#endif // BGEN_PREFETCH_HPP
@@ -16,7 +16,10 @@
 #ifndef BinaryGEN_H
 #define BinaryGEN_H
 
+#include "bgen_index.hpp"
 #include "bgen_lib.hpp"
+#include "bgen_prefetch.hpp"
+#include "dosage_cache.hpp"
 #include "genotype.hpp"
 #include <stdexcept>
 #include <zlib.h>
@@ -35,7 +38,7 @@ public:
               const std::string& multi_input, const size_t thread = 1,
               const bool ignore_fid = false, const bool keep_nonfounder = false,
               const bool keep_ambig = false, const bool is_ref = false,
-              const bool intermediate = false);
+              const bool intermediate = false, const bool use_index = false);
     ~BinaryGen();
 
 private:
@@ -45,7 +48,13 @@ private:
     std::ifstream m_bgen_file;
     std::string m_cur_file;
     std::string m_intermediate_file;
+    Dosage_Cache m_dosage_cache;
+    // pooled ID of the dosage cache file name, which is the file name of the
+    // SNPs read from the cache
+    uint32_t m_dosage_cache_id = 0;
     bool m_intermediate = false;
+    // read the variants from the bgen index (--bgen-index)
+    bool m_use_index = false;
     bool m_target_plink = false;
     bool m_ref_plink = false;
     std::vector<Sample_ID> gen_sample_vector();
@@ -59,10 +68,34 @@ private:
                                     const std::string& out_prefix,
                                     Genotype* target = nullptr);
     void get_context(std::string& prefix);
+    // the bgen files, the samples included and the filters used, which
+    // decide the content of the dosage cache
+    std::string dosage_cache_key(const double geno, const double maf,
+                                 const double info_score,
+                                 const double hard_threshold) const;
+    // convert the probability data of a variant into a dosage cache record
+    // of width bits per value. Return false if the variant can't be stored
+    // without changing its probabilities
+    bool dosage_record(const genfile::bgen::Context& context,
+                       const std::vector<genfile::byte_t>& data,
+                       std::vector<unsigned char>& record,
+                       uint32_t& width) const;
+    bool in_dosage_cache(const SNP& snp) const
+    {
+        return m_dosage_cache.is_open() && snp.file_id() == m_dosage_cache_id;
+    }
     bool check_sample_consistent(const std::string& bgen_name,
                                  const genfile::bgen::Context& context);
 
 
+    std::vector<std::string> genotype_file_names() const
+    {
+        std::vector<std::string> file_names;
+        for (auto&& prefix : m_genotype_files) {
+            file_names.push_back(prefix + ".bgen");
+        }
+        return file_names;
+    }
     inline void read_genotype(uintptr_t* genotype,
                               const std::streampos byte_pos,
                               const std::string& file_name)
@@ -162,13 +195,95 @@ private:
         return 0;
     }
 
-    void read_score(std::vector<size_t>& index, bool reset_zero);
-    void hard_code_score(std::vector<size_t>& index, int32_t homcom_weight,
-                         uint32_t het_weight, uint32_t homrar_weight,
-                         bool set_zero);
-    void dosage_score(std::vector<size_t>& index, uint32_t homcom_weight,
-                      uint32_t het_weight, uint32_t homrar_weight,
-                      bool set_zero);
+    // number of variant blocks read and inflated ahead of the one being
+    // processed
+    size_t prefetch_depth() const { return (m_thread > 1) ? 4 * m_thread : 1; }
+    // queue the genotype data block at byte_pos of prefix.bgen for
+    // inflation, reading through m_bgen_file
+    void prefetch_block(Bgen_Prefetcher& prefetch, const std::string& prefix,
+                        const std::streampos byte_pos)
+    {
+        if (m_cur_file.empty() || prefix.compare(m_cur_file) != 0
+            || !m_bgen_file.is_open())
+        {
+            if (m_bgen_file.is_open()) m_bgen_file.close();
+            std::string bgen_name = prefix + ".bgen";
+            m_bgen_file.open(bgen_name.c_str(), std::ifstream::binary);
+            if (!m_bgen_file.is_open()) {
+                std::string error_message =
+                    "Error: Cannot open bgen file: " + prefix;
+                throw std::runtime_error(error_message);
+            }
+            m_cur_file = prefix;
+        }
+        m_bgen_file.seekg(byte_pos, std::ios_base::beg);
+        prefetch.push(m_bgen_file, context(prefix));
+    }
+    // open file_name with the file handle of scratch, unless it is already
+    // the current file
+    std::ifstream& genotype_file(Score_Scratch& scratch,
+                                 const std::string& file_name) const
+    {
+        if (scratch.cur_file != file_name || !scratch.genotype_file.is_open())
+        {
+            if (scratch.genotype_file.is_open()) scratch.genotype_file.close();
+            scratch.genotype_file.open(file_name.c_str(),
+                                       std::ifstream::binary);
+            if (!scratch.genotype_file.is_open()) {
+                std::string error_message =
+                    "Error: Cannot open bgen file: " + file_name;
+                throw std::runtime_error(error_message);
+            }
+            scratch.cur_file = file_name;
+        }
+        return scratch.genotype_file;
+    }
+    const genfile::bgen::Context& context(const std::string& prefix) const
+    {
+        auto&& context = m_context_map.find(prefix);
+        if (context == m_context_map.end()) {
+            throw std::runtime_error("Error: Unknown bgen file: " + prefix);
+        }
+        return context->second;
+    }
+    // same as load_and_collapse_incl, but only use the buffers and the file
+    // handle of scratch so that multiple threads can read at the same time
+    void load_and_collapse_incl(Score_Scratch& scratch,
+                                const std::streampos byte_pos,
+                                const std::string& file_name,
+                                uintptr_t* __restrict mainbuf,
+                                bool intermediate) const
+    {
+        if (!intermediate) {
+            auto&& bgen_file = genotype_file(scratch, file_name + ".bgen");
+            bgen_file.seekg(byte_pos, std::ios_base::beg);
+            PLINK_generator setter(&m_sample_include, mainbuf,
+                                   m_hard_threshold);
+            genfile::bgen::read_and_parse_genotype_data_block<PLINK_generator>(
+                bgen_file, context(file_name), setter, &scratch.buffer1,
+                &scratch.buffer2, false);
+        }
+        else
+        {
+            const uintptr_t unfiltered_sample_ct4 =
+                (m_unfiltered_sample_ct + 3) / 4;
+            auto&& bgen_file = genotype_file(scratch, file_name);
+            bgen_file.seekg(byte_pos, std::ios_base::beg);
+            if (!bgen_file.read((char*) mainbuf, unfiltered_sample_ct4)) {
+                throw std::runtime_error("Error: Cannot read the bgen file!");
+            }
+        }
+    }
+
+    void read_score(Score_Scratch& scratch, const std::vector<size_t>& index,
+                    bool reset_zero) const;
+    void hard_code_score(Score_Scratch& scratch,
+                         const std::vector<size_t>& index,
+                         int32_t homcom_weight, uint32_t het_weight,
+                         uint32_t homrar_weight, bool set_zero) const;
+    void dosage_score(Score_Scratch& scratch, const std::vector<size_t>& index,
+                      uint32_t homcom_weight, uint32_t het_weight,
+                      uint32_t homrar_weight, bool set_zero) const;
     void read_score(size_t start_index, size_t end_bound,
                     const size_t region_index, bool set_zero);
     void hard_code_score(size_t start_index, size_t end_bound,
@@ -187,8 +302,8 @@ private:
     struct PRS_Interpreter
     {
         ~PRS_Interpreter(){};
-        PRS_Interpreter(std::vector<PRS>* sample_prs,
-                        std::vector<uintptr_t>* sample_inclusion,
+        PRS_Interpreter(PRS* sample_prs,
+                        const std::vector<uintptr_t>* sample_inclusion,
                         MISSING_SCORE missing)
             : m_sample_prs(sample_prs)
             , m_sample_inclusion(sample_inclusion)
@@ -248,7 +363,8 @@ private:
         void set_value(uint32_t, double value)
         {
             int geno = 2 - m_entry_i;
-            auto&& sample_prs = (*m_sample_prs)[m_prs_sample_i];
+            auto&& sample_prs = m_sample_prs->prs[m_prs_sample_i];
+            auto&& sample_num_snp = m_sample_prs->num_snp[m_prs_sample_i];
             // for bgen 1.1, we will still get set_value even for missing data
             // however, all values will be 0
             // Therefore for missing sample, we would've add 1, which is ok if
@@ -256,22 +372,22 @@ private:
             switch (geno)
             {
             default:
-                sample_prs.num_snp =
-                    sample_prs.num_snp * (m_not_first || m_start_geno) + 1;
-                sample_prs.prs = sample_prs.prs * (m_not_first || m_start_geno)
-                                 + m_homcom_weight * value * m_stat * 0.5;
+                sample_num_snp =
+                    sample_num_snp * (m_not_first || m_start_geno) + 1;
+                sample_prs = sample_prs * (m_not_first || m_start_geno)
+                             + m_homcom_weight * value * m_stat * 0.5;
                 break;
             case 1:
-                sample_prs.num_snp =
-                    sample_prs.num_snp * (m_not_first || m_start_geno) + 1;
-                sample_prs.prs = sample_prs.prs * (m_not_first || m_start_geno)
-                                 + m_het_weight * value * m_stat * 0.5;
+                sample_num_snp =
+                    sample_num_snp * (m_not_first || m_start_geno) + 1;
+                sample_prs = sample_prs * (m_not_first || m_start_geno)
+                             + m_het_weight * value * m_stat * 0.5;
                 break;
             case 2:
-                sample_prs.num_snp =
-                    sample_prs.num_snp * (m_not_first || m_start_geno) + 1;
-                sample_prs.prs = sample_prs.prs * (m_not_first || m_start_geno)
-                                 + m_homrar_weight * value * m_stat * 0.5;
+                sample_num_snp =
+                    sample_num_snp * (m_not_first || m_start_geno) + 1;
+                sample_prs = sample_prs * (m_not_first || m_start_geno)
+                             + m_homrar_weight * value * m_stat * 0.5;
             }
             m_total_prob += value * geno;
             ++m_entry_i;
@@ -290,12 +406,77 @@ private:
                 // this is a missing sample
                 m_sample_missing_index.push_back(m_prs_sample_i);
                 // remove the problematic count if needed
-                (*m_sample_prs)[m_prs_sample_i].num_snp -= m_miss_count;
+                m_sample_prs->num_snp[m_prs_sample_i] -= m_miss_count;
             }
             // go to next sample
             ++m_prs_sample_i;
         }
 
+        // Fast path for the most common data: layout 2, unphased, bi-allelic
+        // and diploid, with 8 or 16 bits per probability. Every sample then
+        // stores exactly two values at a fixed offset, so we unpack them all
+        // at once and apply the weights in a single pass, instead of going
+        // through set_sample / set_value for every probability. The PRS is
+        // the same as with parse_probability_data (same operations in the
+        // same order). Return false, without reading anything, if the block
+        // is not of this form
+        bool parse_dense(genfile::bgen::Context const& context,
+                         genfile::byte_t const* buffer,
+                         genfile::byte_t const* const end)
+        {
+            if ((context.flags & genfile::bgen::e_Layout)
+                != genfile::bgen::e_Layout2)
+                return false;
+            genfile::bgen::v12::GenotypeDataBlock pack(context, buffer, end);
+            const uint32_t num_sample = pack.numberOfSamples;
+            const uint32_t bits = pack.bits;
+            if (pack.phased || pack.numberOfAlleles != 2
+                || pack.ploidyExtent[0] != 2 || pack.ploidyExtent[1] != 2
+                || (bits != 8 && bits != 16)
+                || (size_t)(pack.end - pack.buffer)
+                       < (size_t) num_sample * 2 * bits / 8)
+                return false;
+            initialise(num_sample, 2);
+            m_probability.resize(2 * (size_t) num_sample);
+            score_kernel::unpack_probability(pack.buffer, 2 * num_sample, bits,
+                                             m_probability.data());
+            // the first value is the probability of homozygous first allele
+            const double weight[3] = {m_homrar_weight * m_stat * 0.5,
+                                      m_het_weight * m_stat * 0.5,
+                                      m_homcom_weight * m_stat * 0.5};
+            const uintptr_t* inclusion = m_sample_inclusion->data();
+            for (uint32_t i = 0; i < num_sample; ++i) {
+                if (!IS_SET(inclusion, i)) continue;
+                // missing samples have all stored values set to 0
+                add_dense_sample(weight, m_probability[2 * i],
+                                 m_probability[2 * i + 1],
+                                 pack.ploidy[i] & 0x80);
+            }
+            finalise();
+            return true;
+        }
+
+        // Same as parse_dense, for a record of the dosage cache which has
+        // the two probabilities of each sample included, with width bits
+        // per value. Both values are the maximum for missing samples
+        void parse_cache(const unsigned char* record, const uint32_t width)
+        {
+            const size_t num_sample = m_sample_prs->size();
+            initialise(num_sample, 2);
+            m_probability.resize(2 * num_sample);
+            score_kernel::unpack_probability(record, 2 * num_sample, width,
+                                             m_probability.data());
+            const double weight[3] = {m_homrar_weight * m_stat * 0.5,
+                                      m_het_weight * m_stat * 0.5,
+                                      m_homcom_weight * m_stat * 0.5};
+            for (size_t i = 0; i < num_sample; ++i) {
+                const double p0 = m_probability[2 * i];
+                const double p1 = m_probability[2 * i + 1];
+                add_dense_sample(weight, p0, p1, p0 == 1.0 && p1 == 1.0);
+            }
+            finalise();
+        }
+
         void finalise()
         {
             size_t num_miss = m_sample_missing_index.size();
@@ -313,7 +494,7 @@ private:
             default:
                 // centre score
                 for (auto&& index : m_sample_missing_index) {
-                    (*m_sample_prs)[index].prs += expected_value;
+                    m_sample_prs->prs[index] += expected_value;
                 }
                 break;
             case MISSING_SCORE::CENTER:
@@ -322,7 +503,7 @@ private:
                         ++miss_index;
                         continue;
                     }
-                    (*m_sample_prs)[m_prs_sample_i].prs -= expected_value;
+                    m_sample_prs->prs[i] -= expected_value;
                 }
                 break;
             case MISSING_SCORE::SET_ZERO:
@@ -332,9 +513,45 @@ private:
         }
 
     private:
-        std::vector<PRS>* m_sample_prs;
-        std::vector<uintptr_t>* m_sample_inclusion;
+        // add the probabilities of the next sample to its PRS
+        inline void add_dense_sample(const double weight[3], const double p0,
+                                     const double p1, const bool missing)
+        {
+            auto&& sample_prs = m_sample_prs->prs[m_prs_sample_i];
+            auto&& sample_num_snp = m_sample_prs->num_snp[m_prs_sample_i];
+            if (missing) {
+                m_sample_missing_index.push_back(m_prs_sample_i);
+                sample_num_snp -= m_miss_count;
+                ++m_prs_sample_i;
+                return;
+            }
+            const double p2 = 1.0 - (p0 + p1);
+            if (m_not_first) {
+                sample_num_snp += 3;
+                sample_prs += weight[0] * p0;
+            }
+            else
+            {
+                // multiply instead of assign, same as set_value, so that
+                // we even get the same sign of zero
+                sample_num_snp = 3;
+                sample_prs = sample_prs * 0 + weight[0] * p0;
+            }
+            sample_prs += weight[1] * p1;
+            sample_prs += weight[2] * p2;
+            m_total_prob += p0 * 2;
+            m_total_prob += p1;
+            if (p0 + p1 + p2 == 0.0) {
+                m_sample_missing_index.push_back(m_prs_sample_i);
+                sample_num_snp -= m_miss_count;
+            }
+            ++m_prs_sample_i;
+        }
+        PRS* m_sample_prs;
+        const std::vector<uintptr_t>* m_sample_inclusion;
         std::vector<uint32_t> m_sample_missing_index;
+        // unpacked probabilities for parse_dense
+        std::vector<double> m_probability;
         double m_stat = 0.0;
         double m_total_prob = 0.0;
         double m_sum = 0.0;
@@ -352,11 +569,35 @@ private:
         bool m_start_geno = false;
     };
 
+    // read the probabilities of the variant at the current position of
+    // bgen_file into setter, with the dense decoder whenever the data allows
+    static void read_dosage(std::istream& bgen_file,
+                            genfile::bgen::Context const& context,
+                            PRS_Interpreter& setter,
+                            std::vector<genfile::byte_t>* buffer1,
+                            std::vector<genfile::byte_t>* buffer2)
+    {
+        genfile::bgen::read_genotype_data_block(bgen_file, context, buffer1);
+        genfile::bgen::uncompress_probability_data(context, *buffer1, buffer2);
+        parse_dosage(context, *buffer2, setter);
+    }
+    // parse the uncompressed probability data of a variant into setter
+    static void parse_dosage(genfile::bgen::Context const& context,
+                             const std::vector<genfile::byte_t>& data,
+                             PRS_Interpreter& setter)
+    {
+        genfile::byte_t const* begin = data.data();
+        genfile::byte_t const* end = begin + data.size();
+        if (!setter.parse_dense(context, begin, end)) {
+            genfile::bgen::parse_probability_data<PRS_Interpreter>(
+                begin, end, context, setter);
+        }
+    }
 
     struct PLINK_generator
     {
-        PLINK_generator(std::vector<uintptr_t>* sample, uintptr_t* genotype,
-                        double hard_threshold)
+        PLINK_generator(const std::vector<uintptr_t>* sample,
+                        uintptr_t* genotype, double hard_threshold)
             : m_sample(sample)
             , m_genotype(genotype)
             , m_hard_threshold(hard_threshold)
@@ -430,7 +671,7 @@ private:
         }
 
     private:
-        std::vector<uintptr_t>* m_sample;
+        const std::vector<uintptr_t>* m_sample;
         uintptr_t* m_genotype;
         misc::RunningStat rs;
         double m_hard_threshold = 0.0;
@@ -21,6 +21,9 @@
 #include "commander.hpp"
 #include "genotype.hpp"
 #include "misc.hpp"
+#include "mmap_file.hpp"
+#include <cstring>
+#include <unordered_map>
 
 class BinaryPlink : public Genotype
 {
@@ -34,8 +37,10 @@ public:
 
 private:
     std::string m_cur_file;
-    std::ifstream m_bed_file;
-    std::streampos m_prev_loc = 0;
+    // bed files are memory mapped and kept open for the whole run so that
+    // repeated calls to read_score don't need to re-open and seek the file
+    std::unordered_map<std::string, MemoryMappedFile> m_bed_files;
+    MemoryMappedFile* m_cur_bed = nullptr;
     uintptr_t m_bed_offset = 3;
 
     std::vector<Sample_ID> gen_sample_vector();
@@ -47,41 +52,81 @@ private:
                                     Genotype* target = nullptr);
 
     void check_bed(const std::string& bed_name, size_t num_marker);
+    inline MemoryMappedFile& bed_file(const std::string& file_name)
+    {
+        if (m_cur_bed == nullptr || m_cur_file.compare(file_name) != 0) {
+            auto&& bed = m_bed_files[file_name];
+            if (!bed.is_open()) bed.open(file_name + ".bed");
+            m_cur_bed = &bed;
+            m_cur_file = file_name;
+        }
+        return *m_cur_bed;
+    }
     // this is for ld calculation only
     inline void read_genotype(uintptr_t* genotype,
                               const std::streampos byte_pos,
                               const std::string& file_name)
     {
         uintptr_t final_mask = get_final_mask(m_founder_ct);
-        uintptr_t unfiltered_sample_ct4 = (m_unfiltered_sample_ct + 3) / 4;
-        if (m_cur_file.empty() || m_cur_file.compare(file_name) != 0) {
-            if (m_bed_file.is_open()) {
-                m_bed_file.close();
-            }
-            std::string bedname = file_name + ".bed";
-            m_bed_file.open(bedname.c_str(), std::ios::binary);
-            m_prev_loc = 0;
-            m_cur_file = file_name;
-        }
-        if ((m_prev_loc != byte_pos)
-            && !m_bed_file.seekg(byte_pos, std::ios_base::beg))
-        {
-            throw std::runtime_error("Error: Cannot read the bed file!");
-        }
-        // so that we don't jump if we don't need to
-        m_prev_loc = byte_pos + (std::streampos) unfiltered_sample_ct4;
+        auto&& bed = bed_file(file_name);
+        // clumping visit the SNPs in p-value order
+        bed.advise_random();
         if (load_and_collapse_incl(m_unfiltered_sample_ct, m_founder_ct,
                                    m_founder_info.data(), final_mask, false,
-                                   m_bed_file, m_tmp_genotype.data(), genotype))
+                                   bed, byte_pos, m_tmp_genotype.data(),
+                                   genotype))
         {
             throw std::runtime_error("Error: Cannot read the bed file!");
         }
     };
+    std::vector<std::string> genotype_file_names() const
+    {
+        std::vector<std::string> file_names;
+        for (auto&& prefix : m_genotype_files) {
+            file_names.push_back(prefix + ".bed");
+        }
+        return file_names;
+    }
+    std::vector<std::string> variant_file_names() const
+    {
+        std::vector<std::string> file_names;
+        for (auto&& prefix : m_genotype_files) {
+            file_names.push_back(prefix + ".bim");
+        }
+        return file_names;
+    }
+    bool
+    prepare_concurrent_read(const std::unordered_set<std::string>& file_names)
+    {
+        for (auto&& file_name : file_names) {
+            bed_file(file_name).advise_random();
+        }
+        return true;
+    }
+    // only look up the bed files opened by prepare_concurrent_read so that
+    // this can be called from multiple threads
+    void read_genotype_concurrent(uintptr_t* genotype,
+                                  const std::streampos byte_pos,
+                                  const std::string& file_name,
+                                  uintptr_t* rawbuf) const
+    {
+        uintptr_t final_mask = get_final_mask(m_founder_ct);
+        auto&& bed = m_bed_files.find(file_name);
+        if (bed == m_bed_files.end()
+            || load_and_collapse_incl(m_unfiltered_sample_ct, m_founder_ct,
+                                      m_founder_info.data(), final_mask, false,
+                                      bed->second, byte_pos, rawbuf, genotype))
+        {
+            throw std::runtime_error("Error: Cannot read the bed file!");
+        }
+    }
 
-    void read_score(std::vector<size_t>& index, bool reset_zero);
-    void read_score(std::vector<size_t>& index_bound, uint32_t homcom_weight,
-                    uint32_t het_weight, uint32_t homrar_weight,
-                    bool reset_zero);
+    void read_score(Score_Scratch& scratch, const std::vector<size_t>& index,
+                    bool reset_zero) const;
+    void read_score(Score_Scratch& scratch,
+                    const std::vector<size_t>& index_bound,
+                    uint32_t homcom_weight, uint32_t het_weight,
+                    uint32_t homrar_weight, bool reset_zero) const;
     void read_score(size_t start_index, size_t end_bound,
                     const size_t region_index, bool reset_zero);
     void read_score(size_t start_index, size_t end_bound,
@@ -119,6 +164,52 @@ private:
         // mainbuf should contains the information
         return 0;
     }
+    // same as above, but read directly from the memory mapped bed file
+    uint32_t load_and_collapse_incl(uint32_t unfiltered_sample_ct,
+                                    uint32_t sample_ct,
+                                    const uintptr_t* __restrict sample_include,
+                                    uintptr_t final_mask, uint32_t do_reverse,
+                                    const MemoryMappedFile& bedfile,
+                                    const std::streampos byte_pos,
+                                    uintptr_t* __restrict rawbuf,
+                                    uintptr_t* __restrict mainbuf) const
+    {
+        assert(unfiltered_sample_ct);
+        const uint32_t unfiltered_sample_ct4 = (unfiltered_sample_ct + 3) / 4;
+        const uint64_t offset = byte_pos;
+        if (!bedfile.contains(offset, unfiltered_sample_ct4)) {
+            return RET_READ_FAIL;
+        }
+        const unsigned char* src = bedfile.data() + offset;
+        if (unfiltered_sample_ct == sample_ct) {
+            std::memcpy(mainbuf, src, unfiltered_sample_ct4);
+            mainbuf[(unfiltered_sample_ct - 1) / BITCT2] &= final_mask;
+        }
+        else
+        {
+            const uintptr_t* raw = rawbuf;
+#if defined(__x86_64__) || defined(__i386__)
+            // unaligned load is fine on x86, so we can subset straight from
+            // the mapping as long as the last word is still within the file
+            if (bedfile.contains(offset, QUATERCT_TO_WORDCT(unfiltered_sample_ct)
+                                             * sizeof(uintptr_t)))
+            {
+                raw = reinterpret_cast<const uintptr_t*>(src);
+            }
+            else
+#endif
+            {
+                std::memcpy(rawbuf, src, unfiltered_sample_ct4);
+            }
+            copy_quaterarr_nonempty_subset(raw, sample_include,
+                                           unfiltered_sample_ct, sample_ct,
+                                           mainbuf);
+        }
+        if (do_reverse) {
+            reverse_loadbuf(sample_ct, (unsigned char*) mainbuf);
+        }
+        return 0;
+    }
 };
 
 #endif
@@ -0,0 +1,115 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CHUNK_READER_HPP
+#define CHUNK_READER_HPP
+
+#include "mmap_file.hpp"
+#include "thread_queue.hpp"
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+// Read a text file in large blocks of complete lines, so that the lines can
+// be tokenized in place (and by multiple threads) instead of going through
+// std::getline. Plain files are memory mapped and the blocks point directly
+// into the mapping. gz files are inflated on a separate thread, ahead of the
+// caller, into the buffer provided by the caller. When the gz file is BGZF
+// (e.g. from bgzip), its blocks are independent and are inflated by up to
+// num_thread threads
+class Chunk_Reader
+{
+public:
+    Chunk_Reader() {}
+    ~Chunk_Reader() { close(); }
+    Chunk_Reader(const Chunk_Reader&) = delete;            // disable copying
+    Chunk_Reader& operator=(const Chunk_Reader&) = delete; // disable assignment
+    // open file_name, which is treated as gz compressed if it ends with .gz.
+    // Return false if the file cannot be opened
+    bool open(const std::string& file_name);
+    void close();
+    bool is_gz() const { return m_gz_input; }
+    bool is_bgzf() const { return m_bgzf; }
+    // read a single line without the new line character (e.g. the header)
+    bool getline(std::string& line);
+    // get the next block of complete lines as [begin, end), of about
+    // chunk_size bytes unless a line is longer than that. buffer holds the
+    // data for gz input, so the block is valid for as long as buffer is not
+    // modified. Return false when the end of file is reached
+    bool next(std::vector<char>& buffer, const char*& begin, const char*& end);
+    // percentage of the file read so far. For gz input, this is based on the
+    // compressed bytes used by the blocks returned so far
+    double progress() const;
+    // both need to be set before open
+    void set_chunk_size(const size_t chunk_size) { m_chunk_size = chunk_size; }
+    void set_thread(const size_t num_thread)
+    {
+        m_num_thread = (num_thread == 0) ? 1 : num_thread;
+    }
+
+private:
+    // a block of inflated data, and the compressed offset it ends at
+    struct Gz_Block
+    {
+        std::vector<char> data;
+        std::string error;
+        size_t offset = 0;
+        bool last = false;
+    };
+    // location of a BGZF block within m_mmap
+    struct Bgzf_Block
+    {
+        size_t offset;
+        size_t length;
+        size_t inflated_length;
+    };
+    // producer for normal gz files, one gzread at a time
+    void inflate_gz();
+    // producer for BGZF files, blocks are inflated in parallel
+    void inflate_bgzf();
+    // inflate blocks [begin, end) of bgzf_blocks into output
+    void inflate_bgzf_blocks(const std::vector<Bgzf_Block>& bgzf_blocks,
+                             size_t begin, size_t end,
+                             std::vector<char>& output) const;
+    // append the next inflated block to buffer. Return false when there are no
+    // more blocks
+    bool fetch(std::vector<char>& buffer);
+    static bool is_bgzf_header(const unsigned char* data, size_t size,
+                               size_t& block_size);
+    // number of blocks the producer can be ahead of the caller
+    static const size_t max_queued_blocks = 4;
+    MemoryMappedFile m_mmap;
+    gzFile m_gz = nullptr;
+    Thread_Queue<Gz_Block> m_queue;
+    std::thread m_producer;
+    std::atomic<bool> m_stop{false};
+    // partial line left over from the previous gz block, starting at
+    // m_remain_start
+    std::vector<char> m_remain;
+    std::string m_file_name;
+    size_t m_remain_start = 0;
+    size_t m_offset = 0;
+    size_t m_file_size = 0;
+    size_t m_chunk_size = 1 << 22;
+    size_t m_num_thread = 1;
+    bool m_gz_input = false;
+    bool m_bgzf = false;
+    bool m_eof = false;
+};
+
+#endif // CHUNK_READER_HPP
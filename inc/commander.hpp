@@ -17,6 +17,7 @@
 #ifndef COMMANDER_H
 #define COMMANDER_H
 
+#include "chunk_reader.hpp"
 #include "gzstream.h"
 #include "misc.hpp"
 #include "storage.hpp"
@@ -60,6 +61,8 @@ public:
 
     // clump
     bool no_clump() const { return clumping.no_clump; };
+    bool clump_sweep() const { return clumping.sweep; };
+    std::string ld_cache() const { return clumping.ld_cache; };
     bool use_proxy() const { return clumping.provided_proxy; };
     double proxy() const { return clumping.proxy; };
     double clump_p() const { return clumping.p_value; };
@@ -104,6 +107,7 @@ public:
                 || !reference_panel.multi_name.empty());
     };
     bool intermediate() const { return reference_panel.allow_inter; };
+    bool bgen_index() const { return reference_panel.bgen_index; };
     // misc
     std::string out() const { return misc.out; };
     std::string exclusion_range() const { return misc.exclusion_range; };
@@ -111,6 +115,7 @@ public:
     bool cumulate() const { return !misc.non_cumulate; };
     bool ignore_fid() const { return misc.ignore_fid; };
     bool logit_perm() const { return misc.logit_perm; };
+    bool score_perm() const { return misc.score_perm; };
     bool print_snp() const { return misc.print_snp; };
     bool pearson() const { return misc.pearson; };
     int permutation() const { return misc.permutation; };
@@ -211,6 +216,7 @@ public:
     };
     std::string target_list() const { return target.multi_name; };
     std::string target_type() const { return target.type; };
+    std::string dosage_cache() const { return target.dosage_cache; };
     std::string pheno_file() const { return target.pheno_file; };
     std::string pheno_col(size_t index) const
     {
@@ -266,6 +272,8 @@ private:
     struct Clump
     {
         int no_clump;
+        int sweep;
+        std::string ld_cache;
         double proxy;
         double p_value;
         double r2;
@@ -290,6 +298,7 @@ private:
         int print_all_scores;
         int ignore_fid;
         int logit_perm;
+        int score_perm;
         int pearson;
         int permutation;
         int print_snp;
@@ -308,6 +317,7 @@ private:
         std::string keep_file;
         std::string remove_file;
         int allow_inter;
+        int bgen_index;
     } reference_panel;
 
     struct Ref_filtering
@@ -379,6 +389,7 @@ private:
     struct Target
     {
         std::string name;
+        std::string dosage_cache;
         std::string keep_file;
         std::string multi_name;
         std::string pheno_file;
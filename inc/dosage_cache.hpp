@@ -0,0 +1,107 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef DOSAGE_CACHE_HPP
+#define DOSAGE_CACHE_HPP
+
+#include "mmap_file.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Genotype probabilities of the retained bgen variants stored on disk
+// (--dosage-cache), so that the scoring passes read them through a memory
+// map instead of inflating and parsing the bgen blocks again, and so that
+// later runs with the same input can skip the QC of the bgen file.
+// The file consists of a header with the key of the input (bgen files,
+// samples included and QC thresholds), the QC outcome of every variant in
+// the bgen files and one fixed size record per cached variant. A record has
+// two values (probability of the first homozygote and of the heterozygote)
+// of width bits for every sample included, missing samples have both values
+// set to the maximum. The values are little endian, as in the bgen, and the
+// header is in the native byte order
+class Dosage_Cache
+{
+public:
+    // QC outcome of a variant
+    enum class Status : uint8_t
+    {
+        UNCHECKED = 0,
+        MAF_FILTERED,
+        GENO_FILTERED,
+        INFO_FILTERED,
+        CACHED,
+        NOT_CACHED
+    };
+    Dosage_Cache() {}
+    Dosage_Cache(const Dosage_Cache&) = delete;            // disable copying
+    Dosage_Cache& operator=(const Dosage_Cache&) = delete; // disable assignment
+    // map file_name. Return false if the file doesn't exist or was generated
+    // from different input (key)
+    bool load(const std::string& file_name, const std::string& key,
+              const size_t num_sample, const size_t num_variant);
+    // start a new cache, written to file_name by finish
+    void create(const std::string& file_name, const std::string& key,
+                const size_t num_sample, const size_t num_variant);
+    // append a record of width bits per value to a cache started by create
+    // and return its offset in the file. The first record sets the width
+    uint64_t add(const unsigned char* record, const uint32_t width);
+    void set_status(const size_t variant, const Status status)
+    {
+        m_status[variant] = status;
+    }
+    Status status(const size_t variant) const { return m_status[variant]; }
+    // write the cache started by create and map it
+    void finish();
+    bool is_open() const { return m_mmap.is_open(); }
+    // stop reading the records, e.g. when some are missing from a loaded cache
+    void close() { m_mmap.close(); }
+    // true when the cache was loaded instead of created
+    bool reused() const { return m_reused; }
+    const std::string& file_name() const { return m_file_name; }
+    // 0 if there is no record
+    uint32_t width() const { return m_width; }
+    size_t record_size() const { return 2 * m_num_sample * m_width / 8; }
+    // offset of the i-th record in the file
+    uint64_t record_offset(const uint64_t i_record) const
+    {
+        return m_data_offset + i_record * record_size();
+    }
+    const unsigned char* record(const uint64_t offset) const
+    {
+        return m_mmap.data() + offset;
+    }
+
+private:
+    static const char magic[9];
+    static const uint32_t version = 1;
+    // size of the header and the status, rounded up to the cache line
+    uint64_t data_offset() const;
+    MemoryMappedFile m_mmap;
+    std::ofstream m_records;
+    std::vector<Status> m_status;
+    std::string m_file_name;
+    std::string m_key;
+    uint64_t m_num_sample = 0;
+    uint64_t m_num_record = 0;
+    uint64_t m_data_offset = 0;
+    uint32_t m_width = 0;
+    bool m_reused = false;
+};
+
+#endif // DOSAGE_CACHE_HPP
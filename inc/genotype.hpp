@@ -17,23 +17,33 @@
 #ifndef GENOTYPE_H
 #define GENOTYPE_H
 
+#include "chunk_reader.hpp"
 #include "commander.hpp"
+#include "genotype_cache.hpp"
+#include "ld_cache.hpp"
+#include "ld_kernel.hpp"
 #include "misc.hpp"
 #include "plink_common.hpp"
 #include "region.hpp"
 #include "reporter.hpp"
+#include "score_kernel.hpp"
 #include "snp.hpp"
+#include "snp_index.hpp"
 #include "storage.hpp"
+#include "thread_pool.hpp"
 #include <Eigen/Dense>
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <cstdio>
 #include <cstring>
 #include <deque>
 #include <fstream>
+#include <map>
 #include <memory>
 #include <random>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -80,10 +90,6 @@ public:
         return m_chr_order;
     };
 
-    std::unordered_map<std::string, size_t> index() const
-    {
-        return m_existed_snps_index;
-    };
     std::vector<double> get_thresholds() const { return m_thresholds; };
     std::vector<Sample_ID> sample_names() const { return m_sample_id; };
     size_t max_category() const { return m_max_category; };
@@ -103,18 +109,27 @@ public:
     void print_snp(std::string& output, double threshold,
                    const size_t region_index);
     size_t num_threshold() const { return m_num_threshold; };
+    // load the SNP IDs of the base file before load_snps, so that the
+    // genotype QC is only done for target SNPs that are in the base file
+    void load_base_snps(const Commander& c_commander);
     void read_base(const Commander& c_commander, Region& region,
                    Reporter& reporter);
     // void clump(Genotype& reference);
     void efficient_clumping(Genotype& reference, Reporter& reporter,
                             bool const use_pearson);
     void set_info(const Commander& c_commander, const bool ld = false);
+    // chromosomes of this run that are not covered by the LD cache
+    // (--ld-cache) of reference
+    std::vector<int> ld_cache_missing(Genotype& reference, Reporter& reporter);
+    // calculate the LD of chrs between every variant of this object (loaded
+    // without base file) and write it to the LD cache
+    void build_ld_cache(const std::vector<int>& chrs, Reporter& reporter);
     bool get_snp_loc(const std::string& rs_id, int& chr, int& loc) const
     {
-        auto&& snp_index = m_existed_snps_index.find(rs_id);
-        if (snp_index == m_existed_snps_index.end()) return false;
-        chr = m_existed_snps[snp_index->second].chr();
-        loc = m_existed_snps[snp_index->second].loc();
+        const size_t snp_index = m_existed_snps_index.find(m_existed_snps, rs_id);
+        if (snp_index == SNP_Index::npos) return false;
+        chr = m_existed_snps[snp_index].chr();
+        loc = m_existed_snps[snp_index].loc();
         return true;
     }
     void reset_sample_pheno()
@@ -160,30 +175,8 @@ public:
 
     double calculate_score(SCORING score_type, size_t i) const
     {
-        if (i > m_prs_info.size())
-            throw std::out_of_range("Sample name vector out of range");
-        double prs = m_prs_info[i].prs;
-        int num_snp = m_prs_info[i].num_snp;
-        double avg = prs;
-        if (num_snp == 0) {
-            avg = 0.0;
-        }
-        else
-        {
-            avg = prs / (double) num_snp;
-        }
-
-        switch (score_type)
-        {
-        case SCORING::SUM: return m_prs_info[i].prs; break;
-        case SCORING::STANDARDIZE:
-            return (avg - m_mean_score) / m_score_sd;
-            break;
-        default:
-            // default is avg
-            return avg;
-            break;
-        }
+        return calculate_score(m_prs_info, m_mean_score, m_score_sd,
+                               score_type, i);
     }
 
     uintptr_t founder_ct() const { return m_founder_ct; }
@@ -230,12 +223,39 @@ public:
         region.post_clump_count(result);
     };
 
-    void get_null_score(const size_t& set_size, const size_t& num_selected_snps,
-                        const std::vector<size_t>& background_list,
-                        const bool require_standardize);
-    void get_null_score(const size_t& set_size, const size_t& prev_size,
+    // everything needed to calculate a null PRS from the background SNPs:
+    // the PRS itself, the scoring tile and a handle to the genotype file.
+    // Each thread running get_null_score needs its own
+    struct Score_Scratch
+    {
+        PRS prs_info;
+        score_kernel::SNP_Block score_block;
+        std::vector<uintptr_t> tmp_genotype;
+        std::ifstream genotype_file;
+        std::string cur_file;
+        std::vector<uint8_t> buffer1, buffer2;
+        double mean_score = 0.0;
+        double score_sd = 0.0;
+    };
+    // open the genotype files of the background SNPs, so that
+    // get_null_score can be called from multiple threads. Must be called
+    // before those threads start
+    void prepare_null_score();
+    void init_null_score(Score_Scratch& scratch) const;
+    // calculate the PRS of background_list[prev_size, set_size) in scratch,
+    // adding to the current PRS unless first_run. This doesn't change the
+    // Genotype object, so each thread can work on its own scratch
+    void get_null_score(Score_Scratch& scratch, const size_t& set_size,
+                        const size_t& prev_size,
                         const std::vector<size_t>& background_list,
-                        const bool first_run, const bool require_standardize);
+                        const bool first_run,
+                        const bool require_standardize) const;
+    double calculate_score(const Score_Scratch& scratch, SCORING score_type,
+                           size_t i) const
+    {
+        return calculate_score(scratch.prs_info, scratch.mean_score,
+                               scratch.score_sd, score_type, i);
+    }
     size_t num_background() const { return m_background_snp_index.size(); };
     std::vector<size_t> background_index() const
     {
@@ -244,6 +264,11 @@ public:
     uint32_t max_chr() const { return m_max_code; };
 
     void expect_reference() { m_expect_reference = true; }
+    // only used by the bgen target
+    void use_dosage_cache(const std::string& file_name)
+    {
+        m_dosage_cache_file = file_name;
+    }
 
 protected:
     friend class BinaryPlink;
@@ -251,16 +276,26 @@ protected:
     // need to consider cacheline efficiency, so we need to organize the member
     // variable in most efficient way
 
+    // maximum number of blocks of the base file parsed at once. Each block
+    // holds one chunk of the file (4MB by default) in memory
+    static const size_t max_base_chunks = 32;
 
     // vector storing all the genotype files
     // std::vector<Sample> m_sample_names;
     std::vector<SNP> m_existed_snps;
-    std::unordered_map<std::string, size_t> m_existed_snps_index;
+    SNP_Index m_existed_snps_index;
+    // SNP IDs of the base file, only used by load_snps (see load_base_snps)
+    SNP_ID_Set m_base_snps;
+    // region membership of m_existed_snps, BITCT_TO_WORDCT(region size) words
+    // per SNP. Each SNP points to its own row
+    std::vector<uintptr_t> m_region_flags;
     std::unordered_map<std::string, int> m_chr_order;
     std::unordered_set<std::string> m_sample_selection_list;
     std::unordered_set<std::string> m_snp_selection_list;
     std::vector<Sample_ID> m_sample_id;
-    std::vector<PRS> m_prs_info;
+    PRS m_prs_info;
+    // tile of SNPs used by read_score
+    score_kernel::SNP_Block m_score_block;
     std::vector<std::string> m_genotype_files;
     std::vector<double> m_thresholds;
     std::vector<uintptr_t> m_tmp_genotype;
@@ -277,12 +312,20 @@ protected:
     // std::vector<int32_t> m_chrom_start;
     // sample file name. Fam for plink
     std::string m_sample_file;
+    // --ld-cache file, empty if not used
+    std::string m_ld_cache;
+    // ld_cache_key is expensive, so it is only calculated once
+    mutable std::string m_ld_cache_key;
+    // --dosage-cache file, empty if not used
+    std::string m_dosage_cache_file;
     double m_mean_score = 0.0;
     double m_score_sd = 0.0;
     double m_hard_threshold = 0.0;
     double m_clump_r2 = 0.0;
     double m_clump_proxy = 0.0;
     double m_clump_p = 0.0;
+    // memory allowed by --memory, or the total RAM
+    size_t m_max_memory = 0;
     uintptr_t m_unfiltered_sample_ct = 0; // number of unfiltered samples
     uintptr_t m_unfiltered_marker_ct = 0;
     uintptr_t m_clump_distance = 0;
@@ -303,17 +346,20 @@ protected:
     uint32_t m_num_maf_filter = 0;
     uint32_t m_num_geno_filter = 0;
     uint32_t m_num_info_filter = 0;
+    uint32_t m_num_not_in_base = 0;
     uint32_t m_num_male = 0;
     uint32_t m_num_female = 0;
     uint32_t m_num_ambig_sex = 0;
     uint32_t m_num_non_founder = 0;
     bool m_use_proxy = false;
+    bool m_clump_sweep = false;
     bool m_ignore_fid = false;
     bool m_is_ref = false;
     bool m_keep_nonfounder = false;
     bool m_keep_ambig = false;
     bool m_remove_sample = true;
     bool m_exclude_snp = true;
+    bool m_base_filter = false;
     bool m_hard_coded = false;
     bool m_expect_reference = false;
     bool m_mismatch_file_output = false;
@@ -346,6 +392,49 @@ protected:
     // for loading the SNP inclusion / exclusion set
     std::unordered_set<std::string> load_snp_list(std::string input,
                                                   Reporter& reporter);
+    // a line of the base file. Lines are tokenized and their fields parsed
+    // by parse_base_chunk, possibly on another thread, while the QC, which
+    // depends on the lines before (e.g. duplicates), is done by read_base in
+    // file order
+    struct Base_Record
+    {
+        // only used for error messages
+        const char* line = nullptr;
+        const char* ref = nullptr;
+        const char* alt = nullptr;
+        size_t line_length = 0;
+        size_t ref_length = 0;
+        size_t alt_length = 0;
+        size_t snp_index = 0;
+        double maf = 1.0;
+        double maf_case = 1.0;
+        double info_score = 1.0;
+        double pvalue = 2.0;
+        double stat = 0.0;
+        int32_t chr_code = -1;
+        int loc = -1;
+        // the line has fewer columns than required
+        bool column_error = false;
+        bool loc_ok = false;
+        bool maf_ok = false;
+        bool maf_case_ok = false;
+        bool info_ok = false;
+        bool pvalue_ok = false;
+        bool stat_ok = false;
+    };
+    // a block of lines from the base file. records only contain the lines
+    // with a SNP found in m_existed_snps, and stop at the first line with
+    // too few columns
+    struct Base_Chunk
+    {
+        const char* begin = nullptr;
+        const char* end = nullptr;
+        std::vector<Base_Record> records;
+        size_t num_line = 0;
+        size_t num_not_found = 0;
+    };
+    void parse_base_chunk(const std::vector<int>& index,
+                          Base_Chunk& chunk) const;
     double get_r2(bool core_missing, bool pair_missing,
                   std::vector<uint32_t>& core_tot,
                   std::vector<uint32_t>& pair_tot,
@@ -357,12 +446,155 @@ protected:
     /** Misc information **/
     // uint32_t m_hh_exists;
     void pearson_clump(Genotype& reference, Reporter& reporter);
+    // set the clumping window of each SNP and m_max_window_size.
+    // m_existed_snps must be sorted by chromosome and coordinate
+    void set_clump_bounds();
+    // memory used by one clumping thread
+    struct Clump_Workspace
+    {
+        std::vector<uintptr_t> index_data;
+        std::vector<uint32_t> index_tots;
+        std::vector<uintptr_t> rawbuf;
+        Genotype_Cache cache;
+        // true if the current index SNP has no missing founder
+        bool index_complete = false;
+    };
+    // genotype of a SNP from the cache of the workspace, read from the
+    // reference if it isn't cached
+    uintptr_t* clump_genotype(Genotype& reference, const size_t snp_index,
+                              uintptr_t* founder_include2,
+                              const bool concurrent,
+                              Clump_Workspace& workspace);
+    // prepare the masks of the index SNP in the workspace
+    void set_clump_index(Genotype& reference, const size_t cur_snp_index,
+                         uintptr_t* founder_include2, const bool concurrent,
+                         Clump_Workspace& workspace);
+    // r2 between the index SNP in the workspace and a pair SNP, -1 if it
+    // can't be estimated
+    double clump_r2(Genotype& reference, const size_t pair_snp_index,
+                    uintptr_t* founder_include2, const bool concurrent,
+                    Clump_Workspace& workspace);
+    void clump_index_snp(Genotype& reference, const size_t cur_snp_index,
+                         uintptr_t* founder_include2, const double min_r2,
+                         const bool concurrent, Clump_Workspace& workspace);
+    void clump_in_batches(Genotype& reference,
+                          uintptr_t* founder_include2,
+                          const double min_r2,
+                          std::vector<Clump_Workspace>& workspace,
+                          std::vector<bool>& remain_core,
+                          uintptr_t& num_core_snps);
+    // allocate one workspace per clumping thread. When window_only is set,
+    // the genotype cache only holds one clumping window
+    void init_clump_workspace(Genotype& reference, Reporter& reporter,
+                              const bool window_only,
+                              std::vector<Clump_Workspace>& workspace);
+    // sparse LD between SNPs of m_existed_snps. The pairs of SNP i are
+    // neighbour[offset[i]] to neighbour[offset[i+1]-1], in genomic order
+    struct LD_Graph
+    {
+        std::vector<size_t> offset;
+        std::vector<size_t> neighbour;
+        std::vector<double> r2;
+    };
+    void build_ld_graph(Genotype& reference, uintptr_t* founder_include2,
+                        const double min_r2,
+                        std::vector<Clump_Workspace>& workspace,
+                        const bool all_pairs,
+                        const std::vector<bool>& skip_snp, LD_Graph& graph);
+    void clump_ld_graph(const LD_Graph& graph, std::vector<bool>& remain_core,
+                        uintptr_t& num_core_snps);
+    void cached_clumping(Genotype& reference, Reporter& reporter,
+                         uintptr_t* founder_include2, const double min_r2,
+                         std::vector<bool>& remain_core,
+                         uintptr_t& num_core_snps);
+    // index of the first SNP of each chromosome in m_existed_snps, followed
+    // by m_existed_snps.size()
+    std::vector<size_t> chr_start() const;
+    // find the SNPs of block in m_existed_snps[first, last), snp_index is
+    // m_existed_snps.size() for those not in this run. Return false if the
+    // block doesn't have every SNP or was calculated with a smaller window or
+    // a larger r2 floor than this run needs
+    bool match_ld_block(const LD_Cache::Block& block, const size_t first,
+                        const size_t last,
+                        std::vector<size_t>& snp_index) const;
+    // lowest r2 needed by the clumping
+    double clump_r2_floor() const
+    {
+        return (m_use_proxy) ? std::min(m_clump_proxy, m_clump_r2)
+                             : m_clump_r2;
+    }
+    // identify the genotype and founders used for LD calculation, so that
+    // the LD cache is invalidated when either changes
+    std::string ld_cache_key() const;
+    // the genotype files (with extension) of this object
+    virtual std::vector<std::string> genotype_file_names() const
+    {
+        return std::vector<std::string>();
+    }
+    // files describing the variants that are stored apart from the genotypes
+    virtual std::vector<std::string> variant_file_names() const
+    {
+        return std::vector<std::string>();
+    }
     virtual inline void read_genotype(uintptr_t* genotype,
                                       const std::streampos byte_pos,
                                       const std::string& file_name){};
+    // for multi-threaded clumping. Open all the files in advance so that
+    // read_genotype_concurrent can be called from multiple threads at the
+    // same time. Return false if the file format can't be read concurrently
+    virtual bool
+    prepare_concurrent_read(const std::unordered_set<std::string>& file_names)
+    {
+        return false;
+    };
+    // rawbuf must be at least 2 * BITCT_TO_WORDCT(m_unfiltered_sample_ct)
+    // long and must not be shared between threads
+    virtual void read_genotype_concurrent(uintptr_t* genotype,
+                                          const std::streampos byte_pos,
+                                          const std::string& file_name,
+                                          uintptr_t* rawbuf) const {};
     virtual void read_score(size_t start_index, size_t end_bound,
                             const size_t region_index, bool reset_zero){};
-    virtual void read_score(std::vector<size_t>& index, bool reset_zero){};
+    // score the SNPs in index into scratch, for the null PRS
+    virtual void read_score(Score_Scratch& scratch,
+                            const std::vector<size_t>& index,
+                            bool reset_zero) const {};
+    // calculate m_mean_score and m_score_sd from the current PRS
+    void update_score_statistic()
+    {
+        update_score_statistic(m_prs_info, m_mean_score, m_score_sd);
+    }
+    void update_score_statistic(const PRS& prs_info, double& mean_score,
+                                double& score_sd) const;
+    static double calculate_score(const PRS& prs_info, const double mean_score,
+                                  const double score_sd, SCORING score_type,
+                                  size_t i)
+    {
+        if (i > prs_info.size())
+            throw std::out_of_range("Sample name vector out of range");
+        double prs = prs_info.prs[i];
+        int num_snp = prs_info.num_snp[i];
+        double avg = prs;
+        if (num_snp == 0) {
+            avg = 0.0;
+        }
+        else
+        {
+            avg = prs / (double) num_snp;
+        }
+
+        switch (score_type)
+        {
+        case SCORING::SUM: return prs_info.prs[i]; break;
+        case SCORING::STANDARDIZE:
+            return (avg - mean_score) / score_sd;
+            break;
+        default:
+            // default is avg
+            return avg;
+            break;
+        }
+    }
 
 
     // hh_exists
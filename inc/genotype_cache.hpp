@@ -0,0 +1,85 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef GENOTYPE_CACHE_HPP
+#define GENOTYPE_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Ring buffer of decoded genotypes used by clumping, keyed by the index of
+// the SNP. SNP i always goes to slot i % capacity, so as long as the capacity
+// is at least the size of the clumping window, every SNP in a window can be
+// held at the same time, and a SNP is only read again after it has been
+// pushed out by a SNP at least capacity positions away
+class Genotype_Cache
+{
+public:
+    Genotype_Cache() {}
+    // genotype_words should be a multiple of the vector size so that all
+    // slots keep the alignment required by the LD functions
+    void init(const size_t capacity, const size_t genotype_words)
+    {
+        m_capacity = capacity;
+        m_genotype_words = genotype_words;
+        m_snp_index.assign(capacity, size_t(empty_slot));
+        m_counts.assign(capacity * 3, 0);
+        // extra space for aligning the buffer to the cache line
+        m_storage.assign(capacity * genotype_words + cacheline_words, 0);
+        m_offset = 0;
+        while (reinterpret_cast<uintptr_t>(m_storage.data() + m_offset)
+               % (cacheline_words * sizeof(uintptr_t)))
+        {
+            ++m_offset;
+        }
+    }
+    size_t capacity() const { return m_capacity; }
+    // return the genotype of SNP snp_index, or nullptr if it isn't cached
+    uintptr_t* find(const size_t snp_index)
+    {
+        const size_t slot = snp_index % m_capacity;
+        if (m_snp_index[slot] != snp_index) return nullptr;
+        return &(m_storage[m_offset + slot * m_genotype_words]);
+    }
+    // give the slot of SNP snp_index to the caller, who must then fill in
+    // the genotype
+    uintptr_t* insert(const size_t snp_index)
+    {
+        const size_t slot = snp_index % m_capacity;
+        m_snp_index[slot] = snp_index;
+        return &(m_storage[m_offset + slot * m_genotype_words]);
+    }
+    // missing, het and homset count of a cached SNP, filled in by the caller
+    // after insert
+    uint32_t* counts(const size_t snp_index)
+    {
+        return &(m_counts[(snp_index % m_capacity) * 3]);
+    }
+
+private:
+    static const size_t empty_slot = std::numeric_limits<size_t>::max();
+    static const size_t cacheline_words = 64 / sizeof(uintptr_t);
+    std::vector<uintptr_t> m_storage;
+    std::vector<size_t> m_snp_index;
+    std::vector<uint32_t> m_counts;
+    size_t m_offset = 0;
+    size_t m_capacity = 0;
+    size_t m_genotype_words = 0;
+};
+
+#endif // GENOTYPE_CACHE_HPP
@@ -45,6 +45,7 @@ public:
         std::string sample_file = "";
         std::string binary_file = prefix;
         const bool intermediate = commander.intermediate();
+        const bool bgen_index = commander.bgen_index();
         if (external_sample.size() > 1) {
             sample_file = external_sample[1];
             binary_file = external_sample[0];
@@ -87,7 +88,7 @@ public:
             if (sample_file.empty()) sample_file = commander.pheno_file();
             return new BinaryGen(binary_file, sample_file, multi_input, thread,
                                  ignore_fid, keep_nonfounder, keep_ambig,
-                                 is_ref, intermediate);
+                                 is_ref, intermediate, bgen_index);
         }
         default:
             throw std::invalid_argument("ERROR: Only support bgen and bed");
@@ -0,0 +1,84 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LD_CACHE_HPP
+#define LD_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Sparse r2 of a LD reference stored on disk (--ld-cache), so that later runs
+// with the same reference can clump without reading any genotype.
+// The file consists of a header with the key of the reference (checksum of
+// the genotype files and the founders used), followed by an index of the
+// chromosomes and one zlib compressed block per chromosome. Each block can
+// be read and replaced on its own, so only the chromosomes that are not
+// covered by the cache need to be calculated again.
+// All values are stored in the native byte order
+class LD_Cache
+{
+public:
+    // LD of one chromosome. The r2 are directional: r2[i] is the r2 obtained
+    // with SNP i as the index SNP, for the pair SNP neighbour[i]. Only pairs
+    // within distance and with r2 >= r2_floor are stored
+    struct Block
+    {
+        std::vector<std::string> snp_id;
+        // edges of SNP i are [offset[i], offset[i+1])
+        std::vector<uint64_t> offset;
+        std::vector<uint32_t> neighbour;
+        std::vector<double> r2;
+        uint64_t distance = 0;
+        double r2_floor = 0.0;
+    };
+    LD_Cache() {}
+    // read the index of file_name. Return false if the file doesn't exist
+    // or was generated with a different reference (key), in which case the
+    // cache starts empty
+    bool load(const std::string& file_name, const std::string& key);
+    // return false if chr is not in the cache
+    bool get(const int chr, Block& block) const;
+    // add or replace the LD of chr
+    void set(const int chr, const Block& block);
+    // write the cache to file_name. The blocks not replaced by set are copied
+    // over from the loaded file
+    void save(const std::string& file_name);
+    // CRC32 of the whole file, with the file size, as a hex string
+    static std::string checksum(const std::string& file_name);
+    // CRC32 of a memory region, as a hex string
+    static std::string checksum(const void* data, const size_t size);
+
+private:
+    struct Index
+    {
+        uint64_t file_offset = 0;
+        uint64_t compressed_size = 0;
+        uint64_t raw_size = 0;
+        // compressed data of blocks added by set
+        std::vector<unsigned char> data;
+    };
+    static const char magic[9];
+    static const uint32_t version = 1;
+    std::vector<unsigned char> read_block(const Index& index) const;
+    std::map<int, Index> m_index;
+    std::string m_file_name;
+    std::string m_key;
+};
+
+#endif // LD_CACHE_HPP
@@ -0,0 +1,61 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LD_KERNEL_HPP
+#define LD_KERNEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Kernels for the genotype counting in the inner loop of clumping. The
+// implementation (AVX-512 VPOPCNTDQ, AVX2 or the SSE2 code from PLINK) is
+// selected on first use according to the CPU we are running on
+namespace ld_kernel
+{
+// Same as calling genovec_3freq on geno_vec with each of the three masks
+// index_data, index_data + mask_stride and index_data + 2 * mask_stride
+// (the output of vec_datamask for the index SNP), but with a single pass
+// over geno_vec. For mask k, counts[3k], counts[3k+1] and counts[3k+2] are
+// the missing, het and homset count returned by genovec_3freq.
+// All arrays must be 16 bytes aligned and padded to mask_stride words
+void genovec_3x3freq(const uintptr_t* __restrict geno_vec,
+                     const uintptr_t* __restrict index_data,
+                     const uintptr_t mask_stride, const uintptr_t sample_ctl2,
+                     uint32_t counts[9]);
+// Fast path for when neither SNP has missing calls among the founders.
+// het_plane and hom_plane are the het and homset masks of the index SNP,
+// with a bit set at the low position of every sample in the class. counts
+// receives the number of het and homset calls in geno_vec within het_plane,
+// followed by the same within hom_plane. These are the values genovec_3freq
+// would return, using four popcounts per word instead of nine. The
+// samples in neither plane are obtained by subtracting from the totals of
+// geno_vec
+void genovec_bitplane_freq(const uintptr_t* __restrict geno_vec,
+                           const uintptr_t* __restrict het_plane,
+                           const uintptr_t* __restrict hom_plane,
+                           const uintptr_t sample_ctl2, uint32_t counts[4]);
+// Same update of return_vals as Genotype::ld_dot_prod (for --pearson) over
+// word_ct words of vec1, vec2 and their missing masks mask1 and mask2. Return
+// false without touching return_vals if there is no kernel wider than the
+// SSE2 one of Genotype for this CPU
+bool ld_dot_prod(const uintptr_t* __restrict vec1,
+                 const uintptr_t* __restrict vec2,
+                 const uintptr_t* __restrict mask1,
+                 const uintptr_t* __restrict mask2, const uintptr_t word_ct,
+                 int32_t return_vals[5]);
+}
+
+#endif // LD_KERNEL_HPP
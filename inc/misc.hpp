@@ -305,6 +305,16 @@ double qnorm(double p, double mu = 0.0, double sigma = 1.0,
 std::vector<std::string> split(const std::string& seq,
                                const std::string& separators = "\t ");
 
+// Parse [begin, end) without any copy, accepting the same input as
+// convert<double> and convert<int> (no leading or trailing characters, no
+// inf / nan). Return false if the input cannot be converted
+bool parse_double(const char* begin, const char* end, double& value);
+bool parse_int(const char* begin, const char* end, int& value);
+
+// size and modification time of a file, as a string. Used to check if the
+// caches and indices generated from a file are still up to date
+std::string file_signature(const std::string& file_name);
+
 template <typename T>
 inline T convert(const std::string& str)
 {
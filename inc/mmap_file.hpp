@@ -0,0 +1,100 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MMAP_FILE_HPP
+#define MMAP_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// Read only memory map of a whole file. Used for the genotype files so that
+// we don't need a seekg + read (and the associated syscalls) for every SNP.
+// The mapping stays valid until close is called or the object is destroyed
+class MemoryMappedFile
+{
+public:
+    MemoryMappedFile() {}
+    MemoryMappedFile(const std::string& file_name) { open(file_name); }
+    ~MemoryMappedFile() { close(); }
+    MemoryMappedFile(const MemoryMappedFile&) = delete; // disable copying
+    MemoryMappedFile&
+    operator=(const MemoryMappedFile&) = delete; // disable assignment
+    MemoryMappedFile(MemoryMappedFile&& other) noexcept { swap(other); }
+    MemoryMappedFile& operator=(MemoryMappedFile&& other) noexcept
+    {
+        if (this != &other) {
+            close();
+            swap(other);
+        }
+        return *this;
+    }
+
+    void open(const std::string& file_name);
+    void close();
+    bool is_open() const { return m_data != nullptr; }
+    const std::string& file_name() const { return m_file_name; }
+    size_t size() const { return m_size; }
+    const unsigned char* data() const { return m_data; }
+    // check if [offset, offset+length) is inside the file
+    bool contains(uint64_t offset, uint64_t length) const
+    {
+        return (offset <= m_size) && (length <= m_size - offset);
+    }
+    // access pattern hints to the kernel. Sequential is for the scoring pass
+    // where SNPs are sorted by their position in the file, random is for
+    // clumping where SNPs are visited in p-value order
+    void advise_sequential();
+    void advise_random();
+    // hint the kernel that [offset, offset+length) will be needed soon
+    void will_need(uint64_t offset, uint64_t length);
+
+private:
+    void swap(MemoryMappedFile& other)
+    {
+        std::swap(m_file_name, other.m_file_name);
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        std::swap(m_advice, other.m_advice);
+#ifdef _WIN32
+        std::swap(m_file, other.m_file);
+        std::swap(m_map, other.m_map);
+#endif
+    }
+    enum class Advice
+    {
+        NORMAL,
+        SEQUENTIAL,
+        RANDOM
+    };
+    std::string m_file_name;
+    unsigned char* m_data = nullptr;
+    size_t m_size = 0;
+    // avoid repeating the madvise call when the pattern didn't change
+    Advice m_advice = Advice::NORMAL;
+#ifdef _WIN32
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_map = nullptr;
+#endif
+};
+
+#endif // MMAP_FILE_HPP
@@ -23,12 +23,15 @@
 #include "plink_common.hpp"
 #include "region.hpp"
 #include "regression.hpp"
+#include "ring_buffer.hpp"
 #include "reporter.hpp"
 #include "snp.hpp"
 #include "storage.hpp"
+#include "thread_pool.hpp"
 #include "thread_queue.hpp"
 #include <Eigen/Dense>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <errno.h>
 #include <fstream>
@@ -83,6 +86,7 @@ public:
     {
 
         m_logit_perm = commander.logit_perm();
+        m_score_perm = commander.score_perm();
         // we calculate the number of permutation we can run at one time
         bool perm = (commander.permutation() > 0);
         m_seed = commander.seed();
@@ -221,6 +225,14 @@ private:
         double prevalence;
     };
 
+    // null PRS of a random set, passed from produce_null_prs to consume_prs
+    struct Null_PRS
+    {
+        std::vector<double> prs;
+        uint32_t set_size = 0;
+        bool last = false;
+    };
+
     struct Pheno_Info
     {
         std::vector<int> col;
@@ -234,6 +246,7 @@ private:
     bool m_ignore_fid = false;
     bool m_prset = false;
     bool m_logit_perm = false;
+    bool m_score_perm = false;
 
     double m_null_r2 = 0.0;
     double m_null_p = 1.0;
@@ -292,6 +305,25 @@ private:
     Eigen::MatrixXd m_independent_variables;
     Eigen::VectorXd m_phenotype;
     std::vector<double> m_perm_result;
+    // Permuted phenotypes, generated once per phenotype and shared by every
+    // threshold and region. Only as many as --memory allow are kept, the rest
+    // are regenerated from m_perm_rng, the generator state after the bank
+    Eigen::MatrixXd m_perm_bank;
+    // RSS of m_perm_bank regressed on the intercept and covariates
+    Eigen::VectorXd m_perm_null_rss;
+    // orthonormal basis of the intercept and covariates
+    Eigen::MatrixXd m_cov_basis;
+    // null model of m_perm_bank for the score test
+    std::vector<Regression::Logit_Score_Null> m_perm_score_null;
+    // intercept and covariates, i.e. m_independent_variables without the PRS
+    Eigen::MatrixXd m_covariates;
+    // residual of m_phenotype on m_cov_basis
+    Eigen::VectorXd m_pheno_residual;
+    // linear predictor of the null glm, empty if it doesn't converge
+    Eigen::VectorXd m_null_eta;
+    Regression::GLM_Workspace m_glm_workspace;
+    double m_pheno_total_ss = 0.0;
+    std::mt19937 m_perm_rng;
     std::vector<double> m_permuted_pheno;
     std::mutex m_thread_mutex;
     // Functions
@@ -337,16 +369,22 @@ private:
                             size_t num_selected_snps, double original_p,
                             bool require_standardize);
   */
+    // take blocks of permutations from next_block until all num_perm are
+    // done (or stop is set), and pass their null PRS to the consumers.
+    // Multiple producers can run at the same time, each with its own scratch
     void
-    produce_null_prs(Thread_Queue<std::pair<std::vector<double>, uint32_t>>& q,
-                     Genotype& target, size_t num_consumer,
-                     std::map<uint32_t, std::vector<uint32_t>>& set_index,
-                     const size_t num_perm, const bool require_standardize);
+    produce_null_prs(Slot_Ring<Null_PRS>& q, const Genotype& target,
+                     Genotype::Score_Scratch& scratch,
+                     const std::map<uint32_t, std::vector<uint32_t>>& set_index,
+                     std::atomic<size_t>& next_block, const size_t num_perm,
+                     const bool require_standardize,
+                     const std::atomic<bool>& stop);
+    void stop_consumers(Slot_Ring<Null_PRS>& q, size_t num_consumer);
     /*
     void consume_prs(Thread_Queue<std::vector<double>>& q, double original_p,
                      int& num_significant, bool is_binary, bool store_p);
     */
-    void consume_prs(Thread_Queue<std::pair<std::vector<double>, uint32_t>>& q,
+    void consume_prs(Slot_Ring<Null_PRS>& q,
                      std::map<uint32_t, std::vector<uint32_t>>& set_index,
                      std::vector<double>& ori_t_value,
                      std::vector<uint32_t>& set_perm_res, const bool is_binary);
@@ -363,16 +401,40 @@ private:
                             bool store_p);
 
 
-    void gen_null_pheno(Thread_Queue<std::pair<Eigen::VectorXd, size_t>>& q,
-                        size_t num_consumer);
-
-    void
-    consume_null_pheno(Thread_Queue<std::pair<Eigen::VectorXd, size_t>>& q,
-                       Eigen::ColPivHouseholderQR<Eigen::MatrixXd>& decomposed,
-                       int rank, const Eigen::VectorXd& pre_se, bool run_glm);
-    void run_null_perm_no_thread(
-        Eigen::ColPivHouseholderQR<Eigen::MatrixXd>& decomposed, int rank,
-        const Eigen::VectorXd& pre_se, bool run_glm);
+    // logistic permutation (--logit-perm), in blocks on the thread pool
+    void run_null_perm_glm(const size_t n_thread);
+    void run_null_perm_no_thread();
+    // linear permutation, regress blocks of permuted phenotypes at once
+    void run_null_perm_linear(const size_t n_thread);
+    // generate m_perm_bank for the current phenotype
+    void build_perm_bank(const Commander& c_commander, const bool is_binary);
+    // fit the null logistic model of each permuted phenotype in perm_pheno
+    // for the score test
+    void fit_score_null(const Eigen::MatrixXd& perm_pheno,
+                        std::vector<Regression::Logit_Score_Null>& null_model,
+                        size_t n_thread) const;
+    // logistic permutation using the score test (--score-perm)
+    void run_null_perm_score(const size_t n_thread);
+    // project the phenotype onto the covariates, so that the regression of
+    // each threshold only need to residualize the PRS. For binary phenotype,
+    // also fit the null model used as the starting point of the glm
+    void init_projection(const bool is_binary);
+    // starting linear predictor for the glm of the permuted phenotypes
+    Eigen::VectorXd perm_eta_start() const;
+    // linear regression of m_phenotype on independent, which must only differ
+    // from m_independent_variables by the PRS column. Fall back to the QR if
+    // the PRS is collinear with the covariates
+    void fast_linear_regression(const Eigen::MatrixXd& independent,
+                                double& p_value, double& r2, double& r2_adjust,
+                                double& coeff, double& standard_error,
+                                size_t thread = 1) const;
+    // RSS of each permuted phenotype regressed on the covariates
+    Eigen::VectorXd
+    null_rss(const Eigen::Ref<const Eigen::MatrixXd>& perm_pheno) const;
+    // get the i_perm th permuted phenotype, from the bank or generated with
+    // rand_gen, which should start as m_perm_rng. Must be called in order
+    void next_perm_pheno(std::mt19937& rand_gen, const size_t i_perm,
+                         Eigen::VectorXd& perm_pheno) const;
 };
 
 #endif // PRSICE_H
@@ -57,7 +57,7 @@ public:
     };
 
     void update_flag(const int chr, const std::string& rs, size_t loc,
-                     std::vector<uintptr_t>& flag);
+                     uintptr_t* flag);
     size_t size() const { return m_region_name.size(); };
     std::string get_name(size_t i) const { return m_region_name.at(i); };
     std::vector<std::string> names() const { return m_region_name; };
@@ -32,9 +32,63 @@ void linear_regression(const Eigen::VectorXd& y, const Eigen::MatrixXd& A,
                        double& p_value, double& r2, double& r2_adjust,
                        double& coeff, double& standard_error, size_t thread = 1,
                        bool intercept = true);
+// true if x_residual_ss, the sum of square of x after regressing out the
+// covariates, is too small compared to x_ss (the sum of square of x) for the
+// coefficient of x to be estimated from the projection
+inline bool collinear(const double x_residual_ss, const double x_ss)
+{
+    return !(x_residual_ss > x_ss * 1e-8);
+}
+// Linear regression of y on [intercept, x, covariates] when only x changes
+// between calls. cov_basis is an orthonormal basis of the intercept and
+// covariates, y_residual is the residual of y on cov_basis and total_ss is
+// the total sum of square of y. Return false without touching the outputs if
+// x is (nearly) collinear with the covariates
+bool projected_linear_regression(const Eigen::VectorXd& y_residual,
+                                 const double total_ss,
+                                 const Eigen::MatrixXd& cov_basis,
+                                 const Eigen::Ref<const Eigen::VectorXd>& x,
+                                 double& p_value, double& r2,
+                                 double& r2_adjust, double& coeff,
+                                 double& standard_error);
+// Storage for the IRLS, keep it around to avoid reallocating the matrices in
+// every call of glm
+struct GLM_Workspace
+{
+    Eigen::MatrixXd weighted_x;
+    Eigen::VectorXd eta, mu, mu_eta_val, z, w, beta;
+    Eigen::ColPivHouseholderQR<Eigen::MatrixXd> qr;
+    double deviance = 0.0;
+    bool converge = false;
+};
+// Null (covariate only) logistic model required by the score test
+struct Logit_Score_Null
+{
+    Eigen::VectorXd residual, weight;
+    Eigen::LDLT<Eigen::MatrixXd> information;
+};
+// Fit the logistic regression of y on x with IRLS. Start from eta_start when
+// it has the same length as y (e.g. the linear predictor of the null model),
+// otherwise from the usual mustart. Result is stored in workspace
+void glm_fit(const Eigen::VectorXd& y, const Eigen::MatrixXd& x,
+             const Eigen::VectorXd& eta_start, GLM_Workspace& workspace,
+             size_t max_iter = 25);
 void glm(const Eigen::VectorXd& y, const Eigen::MatrixXd& x, double& p_value,
          double& r2, double& coeff, double& standard_error,
          size_t max_iter = 25, size_t thread = 1, bool intercept = true);
+void glm(const Eigen::VectorXd& y, const Eigen::MatrixXd& x,
+         const Eigen::VectorXd& eta_start, GLM_Workspace& workspace,
+         double& p_value, double& r2, double& coeff, double& standard_error,
+         size_t max_iter = 25, size_t thread = 1, bool intercept = true);
+// Fit the null model of y on the covariates cov for logit_score_test
+void logit_score_null(const Eigen::VectorXd& y, const Eigen::MatrixXd& cov,
+                      GLM_Workspace& workspace, Logit_Score_Null& null_model,
+                      size_t max_iter = 25);
+// Score test statistic (signed, ~N(0,1) under the null) of adding x to the
+// null logistic model
+double logit_score_test(const Logit_Score_Null& null_model,
+                        const Eigen::MatrixXd& cov,
+                        const Eigen::Ref<const Eigen::VectorXd>& x);
 Eigen::VectorXd logit_linkinv(const Eigen::VectorXd& eta);
 Eigen::VectorXd logit_variance(const Eigen::VectorXd& eta);
 Eigen::VectorXd logit_mu_eta(const Eigen::VectorXd& eta);
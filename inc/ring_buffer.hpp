@@ -0,0 +1,184 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RING_BUFFER_HPP
+#define RING_BUFFER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#ifdef _WIN32
+#include <mingw.thread.h>
+#else
+#include <thread>
+#endif
+
+namespace ring_buffer_detail
+{
+// spin for a while, then start sleeping so that a long wait (e.g. for the
+// genotype reading) doesn't burn a core
+inline void backoff(size_t& num_spin)
+{
+    if (++num_spin < 64)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+}
+
+// Bounded lock free multi-producer multi-consumer queue (Vyukov's bounded
+// MPMC queue). Each cell has a sequence number telling whether it is ready to
+// be written (sequence == position) or read (sequence == position + 1), so
+// producers and consumers only contend on a single atomic counter each
+template <typename T>
+class Ring_Buffer
+{
+public:
+    // capacity is rounded up to a power of 2
+    explicit Ring_Buffer(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        m_mask = size - 1;
+        m_cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; ++i)
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    Ring_Buffer(const Ring_Buffer&) = delete;            // disable copying
+    Ring_Buffer& operator=(const Ring_Buffer&) = delete; // disable assignment
+    bool try_push(const T& item)
+    {
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &m_cells[pos & m_mask];
+            const size_t seq = cell->sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t diff = (std::ptrdiff_t) seq - (std::ptrdiff_t) pos;
+            if (diff == 0) {
+                if (m_enqueue_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false; // full
+            }
+            else
+            {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = item;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    bool try_pop(T& item)
+    {
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &m_cells[pos & m_mask];
+            const size_t seq = cell->sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t diff =
+                (std::ptrdiff_t) seq - (std::ptrdiff_t)(pos + 1);
+            if (diff == 0) {
+                if (m_dequeue_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false; // empty
+            }
+            else
+            {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        item = cell->data;
+        cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+    // blocking version of try_push and try_pop
+    void push(const T& item)
+    {
+        size_t num_spin = 0;
+        while (!try_push(item)) ring_buffer_detail::backoff(num_spin);
+    }
+    void pop(T& item)
+    {
+        size_t num_spin = 0;
+        while (!try_pop(item)) ring_buffer_detail::backoff(num_spin);
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask = 0;
+    // keep the two counters on separate cache lines
+    char m_pad0[64];
+    std::atomic<size_t> m_enqueue_pos{0};
+    char m_pad1[64];
+    std::atomic<size_t> m_dequeue_pos{0};
+    char m_pad2[64];
+};
+
+// Payload slots allocated once and passed around by index: a producer
+// acquires a free slot, fills it in place and publishes it, a consumer takes
+// a published slot and releases it once it has read the payload. So large
+// payloads (e.g. the PRS of every sample) are never copied or reallocated
+template <typename Payload>
+class Slot_Ring
+{
+public:
+    Slot_Ring(size_t num_slot, const Payload& init)
+        : m_slots(num_slot, init), m_free(num_slot), m_filled(num_slot)
+    {
+        for (size_t i = 0; i < num_slot; ++i) m_free.push(i);
+    }
+    Slot_Ring(const Slot_Ring&) = delete;            // disable copying
+    Slot_Ring& operator=(const Slot_Ring&) = delete; // disable assignment
+    // block until a slot is free
+    size_t acquire()
+    {
+        size_t index;
+        m_free.pop(index);
+        return index;
+    }
+    Payload& operator[](size_t index) { return m_slots[index]; }
+    void publish(size_t index) { m_filled.push(index); }
+    // block until a slot is published
+    size_t consume()
+    {
+        size_t index;
+        m_filled.pop(index);
+        return index;
+    }
+    void release(size_t index) { m_free.push(index); }
+
+private:
+    std::vector<Payload> m_slots;
+    Ring_Buffer<size_t> m_free;
+    Ring_Buffer<size_t> m_filled;
+};
+
+#endif // RING_BUFFER_HPP
@@ -0,0 +1,111 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SCORE_KERNEL_HPP
+#define SCORE_KERNEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Kernels for adding the score of one SNP to the PRS of all samples.
+// The genotype is the founder / sample collapsed PLINK 2-bit encoding, which
+// for each sample is:
+//   00 = homozygous first allele
+//   01 = missing
+//   10 = heterozygous
+//   11 = homozygous second allele
+// weight and count are lookup tables indexed by the 2-bit code, so the
+// caller can fold the effect size, allele flipping, the genetic model and the
+// missing score handling into the table once per SNP
+namespace score_kernel
+{
+// The implementation (AVX2, SSE2 or plain C++) is selected on first use
+// according to the CPU we are running on
+// prs[i] (+)= weight[code_i]; num_snp[i] (+)= count[code_i]
+// for i in [0, sample_ct). When reset is true, the current values in prs and
+// num_snp are overwritten instead of added to
+void add_snp(const uintptr_t* genotype, const size_t sample_ct,
+             const double weight[4], const int32_t count[4], double* prs,
+             int32_t* num_snp, const bool reset);
+// the same, but only for samples in [sample_start, sample_end).
+// sample_start must be a multiple of 4 so that we start on a byte boundary
+void add_snp(const uintptr_t* genotype, const size_t sample_start,
+             const size_t sample_end, const double weight[4],
+             const int32_t count[4], double* prs, int32_t* num_snp,
+             const bool reset);
+
+// probability[i] = value_i / (2^bits - 1) where value_i is the i-th
+// little-endian unsigned integer of bits (8 or 16) bits in data. This is how
+// BGEN v1.2 stores its probabilities, and the result is identical to the bit
+// by bit parser of the bgen library
+void unpack_probability(const unsigned char* data, const size_t num_value,
+                        const uint32_t bits, double* probability);
+
+// A tile of SNPs that are applied to the PRS together. Instead of streaming
+// the whole PRS array from memory once per SNP, we go through the samples in
+// chunks small enough to stay in cache and apply every SNP in the tile to
+// each chunk. The per sample order of the SNPs is unchanged, so the result is
+// identical to calling add_snp on each SNP in turn. With more than one
+// thread, the samples are split into shards and each thread applies the
+// whole tile to its own shard
+class SNP_Block
+{
+public:
+    SNP_Block() {}
+    // genotype_words is the size of the buffer required by the genotype
+    // reader for one SNP
+    void init(const size_t sample_ct, const size_t genotype_words,
+              const size_t num_thread = 1,
+              const size_t block_size = default_block_size);
+    // buffer for the genotype of the next SNP. It is only kept when push is
+    // called, so SNPs that fail QC after reading can just be skipped
+    uintptr_t* next_genotype()
+    {
+        return m_genotype.data() + m_num_snp * m_genotype_words;
+    }
+    void push(const double weight[4], const int32_t count[4]);
+    bool full() const { return m_num_snp == m_block_size; }
+    bool empty() const { return m_num_snp == 0; }
+    // add all SNPs in the block to the PRS and empty the block. not_first is
+    // false if the PRS should be reset by the first SNP, and will be set to
+    // true if any SNP was applied
+    void apply(double* prs, int32_t* num_snp, bool& not_first);
+    // smallest number of samples worth a thread of its own
+    static const size_t min_shard_size = 4096;
+
+private:
+    void apply_range(const size_t sample_start, const size_t sample_end,
+                     double* prs, int32_t* num_snp, const bool reset) const;
+    static const size_t default_block_size = 32;
+    // number of samples processed together. 4096 samples = 48KB of PRS
+    // which should stay in L2
+    static const size_t sample_chunk = 4096;
+    // shard boundaries are multiple of 64 samples, so that no two shards
+    // share a cache line of prs, num_snp or genotype
+    static const size_t shard_alignment = 64;
+    std::vector<uintptr_t> m_genotype;
+    std::vector<double> m_weight;
+    std::vector<int32_t> m_count;
+    size_t m_sample_ct = 0;
+    size_t m_genotype_words = 0;
+    size_t m_block_size = 0;
+    size_t m_num_snp = 0;
+    size_t m_num_shard = 1;
+};
+}
+
+#endif // SCORE_KERNEL_HPP
@@ -24,9 +24,12 @@
 #include "storage.hpp"
 #include <algorithm>
 #include <limits.h>
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
 
 class Genotype;
 class SNP
@@ -38,15 +41,15 @@ public:
         const std::string& file_name, const std::streampos byte_pos,
         const uint32_t homcom_ct, const uint32_t het_ct,
         const uint32_t homrar_ct, const uint32_t missing)
-        : m_alt(alt_allele)
-        , m_ref(ref_allele)
-        , m_rs(rs_id)
-        , m_target_file(file_name)
-        , m_ref_file(file_name)
-        , m_target_byte_pos(byte_pos)
+        : m_target_byte_pos(byte_pos)
         , m_ref_byte_pos(byte_pos)
-        , m_chr(chr)
-        , m_loc(loc)
+        , m_chr(static_cast<int32_t>(chr))
+        , m_loc(static_cast<int32_t>(loc))
+        , m_rs(add_rs(rs_id))
+        , m_alt(intern(alt_allele))
+        , m_ref(intern(ref_allele))
+        , m_target_file(intern(file_name))
+        , m_ref_file(m_target_file)
         , m_homcom(homcom_ct)
         , m_het(het_ct)
         , m_homrar(homrar_ct)
@@ -57,15 +60,15 @@ public:
     SNP(const std::string& rs_id, const intptr_t chr, const intptr_t loc,
         const std::string& ref_allele, const std::string& alt_allele,
         const std::string& file_name, const std::streampos byte_pos)
-        : m_alt(alt_allele)
-        , m_ref(ref_allele)
-        , m_rs(rs_id)
-        , m_target_file(file_name)
-        , m_ref_file(file_name)
-        , m_target_byte_pos(byte_pos)
+        : m_target_byte_pos(byte_pos)
         , m_ref_byte_pos(byte_pos)
-        , m_chr(chr)
-        , m_loc(loc)
+        , m_chr(static_cast<int32_t>(chr))
+        , m_loc(static_cast<int32_t>(loc))
+        , m_rs(add_rs(rs_id))
+        , m_alt(intern(alt_allele))
+        , m_ref(intern(ref_allele))
+        , m_target_file(intern(file_name))
+        , m_ref_file(m_target_file)
     {
         m_has_count = false;
     };
@@ -76,31 +79,41 @@ public:
     {
         m_stat = stat;
         m_p_value = p_value;
-        m_category = category;
+        m_category = static_cast<int32_t>(category);
         m_p_threshold = p_threshold;
     };
     void add_reference(const std::string& ref_file,
                        const std::streampos ref_byte_pos)
     {
-        m_ref_file = ref_file;
+        m_ref_file = intern(ref_file);
         m_ref_byte_pos = ref_byte_pos;
     }
 
     void update_target(const std::string& ref_file,
                        const std::streampos ref_byte_pos)
     {
-        m_target_file = ref_file;
+        m_target_file = intern(ref_file);
         m_target_byte_pos = ref_byte_pos;
     }
     inline void set_flipped() { m_flipped = true; };
-    std::string get_rs() const { return m_rs; };
+    std::string get_rs() const { return rs(); };
     static std::vector<size_t> sort_by_p_chr(const std::vector<SNP>& input);
     static void sort_snp_for_perm(std::vector<size_t>& index,
                                   const std::vector<SNP>& input);
+    // Alleles and file names are shared by many SNPs, so each distinct string
+    // is stored once and the SNP only keep its ID. Both can be called from
+    // any thread, pooled doesn't need to lock
+    static uint32_t intern(const std::string& str);
+    static const std::string& pooled(const uint32_t id);
+    // rank of each pooled string in lexicographic order, such that we can sort
+    // by the file name without comparing the strings
+    static std::vector<uint32_t> pooled_rank();
 
     inline bool matching(intptr_t chr, intptr_t loc, std::string& ref,
                          std::string& alt, bool& flipped)
     {
+        const std::string& snp_ref = pooled(m_ref);
+        const std::string& snp_alt = pooled(m_alt);
         // should be trimmed
         if (chr != -1 && m_chr != -1 && chr != m_chr) {
             return false;
@@ -108,28 +121,28 @@ public:
         if (loc != -1 && m_loc != -1 && loc != m_loc) {
             return false;
         }
-        if (m_ref == ref) {
-            if (!m_alt.empty() && !alt.empty()) {
-                return (m_alt == alt);
+        if (snp_ref == ref) {
+            if (!snp_alt.empty() && !alt.empty()) {
+                return (snp_alt == alt);
             }
             else
                 return true;
         }
-        else if (complement(m_ref) == ref)
+        else if (complement(snp_ref) == ref)
         {
-            if (!m_alt.empty() && !alt.empty()) {
-                return (complement(m_alt) == alt);
+            if (!snp_alt.empty() && !alt.empty()) {
+                return (complement(snp_alt) == alt);
             }
             else
                 return true;
         }
-        else if (!m_alt.empty() && !alt.empty())
+        else if (!snp_alt.empty() && !alt.empty())
         {
-            if ((m_ref == alt) && (m_alt == ref)) {
+            if ((snp_ref == alt) && (snp_alt == ref)) {
                 flipped = true;
                 return true;
             }
-            if ((complement(m_ref) == alt) && (complement(m_alt) == ref)) {
+            if ((complement(snp_ref) == alt) && (complement(snp_alt) == ref)) {
                 flipped = true;
                 return true;
             }
@@ -147,12 +160,19 @@ public:
     double get_threshold() const { return m_p_threshold; };
     std::streampos byte_pos() const { return m_target_byte_pos; };
     std::streampos ref_byte_pos() const { return m_ref_byte_pos; };
-    std::string file_name() const { return m_target_file; };
-    std::string ref_file_name() const { return m_ref_file; };
-    std::string rs() const { return m_rs; };
-    std::string ref() const { return m_ref; };
-    std::string alt() const { return m_alt; };
-    bool is_flipped() { return m_flipped; };
+    const std::string& file_name() const { return pooled(m_target_file); };
+    const std::string& ref_file_name() const { return pooled(m_ref_file); };
+    uint32_t file_id() const { return m_target_file; };
+    std::string rs() const { return std::string(rs_data(), rs_size()); };
+    // the rs ID in the arena, not null terminated
+    const char* rs_data() const
+    {
+        return reinterpret_cast<const char*>(rs_entry(m_rs) + 1);
+    };
+    size_t rs_size() const { return *rs_entry(m_rs); };
+    const std::string& ref() const { return pooled(m_ref); };
+    const std::string& alt() const { return pooled(m_alt); };
+    bool is_flipped() const { return m_flipped; };
 
     inline bool in(size_t i) const
     {
@@ -160,11 +180,13 @@ public:
             throw std::out_of_range("Out of range for flag");
         return ((m_flags[i / BITCT] >> (i % BITCT)) & 1);
     }
-    void set_flag(Region& region)
+    // flags is this SNP's row of the region bit matrix held by Genotype, with
+    // BITCT_TO_WORDCT(region.size()) words, all 0
+    void set_flag(Region& region, uintptr_t* flags)
     {
         m_max_flag_index = BITCT_TO_WORDCT(region.size());
-        m_flags.resize(m_max_flag_index);
-        region.update_flag(m_chr, m_rs, m_loc, m_flags);
+        m_flags = flags;
+        region.update_flag(m_chr, rs(), m_loc, m_flags);
     };
 
     void set_clumped() { m_clumped = true; };
@@ -205,11 +227,14 @@ public:
     bool clumped() const { return m_clumped; };
     bool valid() const { return m_valid; };
     void invalidate() { m_valid = false; };
-    void set_low_bound(uintptr_t low) { m_low_bound = low; };
+    void set_low_bound(uintptr_t low)
+    {
+        m_low_bound = static_cast<uint32_t>(low);
+    };
 
-    void set_up_bound(uintptr_t up) { m_up_bound = up; };
+    void set_up_bound(uintptr_t up) { m_up_bound = static_cast<uint32_t>(up); };
     bool get_counts(uint32_t& homcom, uint32_t& het, uint32_t& homrar,
-                    uint32_t& missing)
+                    uint32_t& missing) const
     {
         homcom = m_homcom;
         het = m_het;
@@ -230,43 +255,52 @@ public:
     uintptr_t low_bound() const { return m_low_bound; };
 
 private:
+    // rs IDs are (nearly) unique, so unlike intern they are not deduplicated,
+    // but appended to one arena that is never freed. An ID is its length
+    // followed by its characters, rs_entry returns the length. Like pooled,
+    // rs_entry doesn't need to lock
+    static uint32_t add_rs(const std::string& rs_id);
+    static const uint32_t* rs_entry(const uint32_t id);
     // basic info
-    // actually, the packing of the data is problematic and to enhance
-    // performance we might want to organize the data into way where it is
-    // easier to "cache" also use data types that are more friendly?
-    std::vector<uintptr_t> m_flags;
-    std::string m_alt;
-    std::string m_ref;
-    std::string m_rs;
-    std::string m_target_file;
-    std::string m_ref_file;
-    std::streampos m_target_byte_pos;
-    std::streampos m_ref_byte_pos;
+    // members are ordered by size to avoid padding. The rs ID is in the arena
+    // (see add_rs), other strings are interned (see intern) and the region
+    // flags are a row of the bit matrix owned by Genotype, so a SNP is about
+    // a third of its old size
+    uintptr_t* m_flags = nullptr;
+    // file offsets, std::streampos also carry the conversion state which we
+    // never use
+    std::streamoff m_target_byte_pos = 0;
+    std::streamoff m_ref_byte_pos = 0;
     double m_stat = 0.0;
     double m_p_value = 2.0;
     double m_p_threshold = 0;
-    intptr_t m_chr = -1;
-    intptr_t m_category = -1;
-    intptr_t m_loc = -1;
-    uintptr_t m_low_bound = 0;
-    uintptr_t m_up_bound = 0;
+    int32_t m_chr = -1;
+    int32_t m_category = -1;
+    int32_t m_loc = -1;
+    uint32_t m_rs = 0;
+    uint32_t m_alt = 0;
+    uint32_t m_ref = 0;
+    uint32_t m_target_file = 0;
+    uint32_t m_ref_file = 0;
+    // This indicate where this SNP's bound is at
+    // useful for PRSlice and also clumping
+    // thinking about it. Even if the location isn't given for
+    // PRSet or PRSlice, we can still use the coordinates from
+    // the target / reference file
+    // the bound is [ )
+    uint32_t m_low_bound = 0;
+    uint32_t m_up_bound = 0;
     uint32_t m_homcom = 0;
     uint32_t m_het = 0;
     uint32_t m_homrar = 0;
     uint32_t m_missing = 0;
+    // prset related
+    uint32_t m_max_flag_index = 0;
     bool m_has_count = false;
     bool m_clumped = false;
     bool m_valid = true;
     bool m_remove = false;
     bool m_flipped = false;
-    // This indicate where this SNP's bound is at
-    // useful for PRSlice and also clumping
-    // thinking about it. Even if the location isn't given for
-    // PRSet or PRSlice, we can still use the coordinates from
-    // the target / reference file
-    // the bound is [ )
-    // prset related
-    size_t m_max_flag_index = 0;
 
     inline std::string complement(const std::string& allele) const
     {
@@ -0,0 +1,118 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SNP_INDEX_HPP
+#define SNP_INDEX_HPP
+
+#include "snp.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// FNV-1a, with a final mix so that the low bits are usable as slot
+inline uint64_t snp_id_hash(const char* rs_id, const size_t length)
+{
+    uint64_t result = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i) {
+        result ^= static_cast<unsigned char>(rs_id[i]);
+        result *= 1099511628211ULL;
+    }
+    result ^= result >> 29;
+    result *= 0xbf58476d1ce4e5b9ULL;
+    result ^= result >> 32;
+    return result;
+}
+
+// Map from SNP ID to the index of the SNP in a std::vector<SNP> (e.g.
+// m_existed_snps), looked up by open addressing. The IDs are not copied, each
+// slot only holds the index and part of the hash and the ID is read from the
+// SNP's rs ID arena. So every call takes the vector, which must be the one
+// the SNPs were inserted from
+class SNP_Index
+{
+public:
+    static const size_t npos = ~size_t(0);
+    SNP_Index() {}
+    void clear();
+    void reserve(const size_t num_snp);
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    // add snps[index], or update the index if its ID already exist
+    void insert(const std::vector<SNP>& snps, const size_t index);
+    // return npos if rs_id is not found
+    size_t find(const std::vector<SNP>& snps, const char* rs_id,
+                const size_t length) const;
+    size_t find(const std::vector<SNP>& snps, const std::string& rs_id) const
+    {
+        return find(snps, rs_id.data(), rs_id.size());
+    }
+    bool contains(const std::vector<SNP>& snps, const std::string& rs_id) const
+    {
+        return find(snps, rs_id) != npos;
+    }
+
+private:
+    struct Slot
+    {
+        // 1 + index into the SNP vector, 0 for empty slot
+        uint32_t index = 0;
+        uint32_t hash = 0;
+    };
+    // return the slot of rs_id, or the empty slot where it should go
+    size_t slot(const std::vector<SNP>& snps, const char* rs_id,
+                const size_t length, const uint64_t hash_value) const;
+    void rehash(const std::vector<SNP>& snps, const size_t num_slot);
+    std::vector<Slot> m_slot;
+    size_t m_size = 0;
+};
+
+// Set of SNP IDs that don't belong to any SNP (e.g. the IDs of the base
+// file). The IDs are stored back to back in one arena and looked up by open
+// addressing, so there is no heap node (nor heap string for long IDs) per ID
+// as with std::unordered_set<std::string>
+class SNP_ID_Set
+{
+public:
+    SNP_ID_Set() {}
+    void clear();
+    size_t size() const { return m_entry.size(); }
+    bool empty() const { return m_entry.empty(); }
+    void insert(const char* rs_id, const size_t length);
+    bool contains(const char* rs_id, const size_t length) const;
+    bool contains(const std::string& rs_id) const
+    {
+        return contains(rs_id.data(), rs_id.size());
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t offset;
+        uint32_t length;
+        uint32_t hash;
+    };
+    // return the slot of rs_id, or the empty slot where it should go
+    size_t slot(const char* rs_id, const size_t length,
+                const uint64_t hash_value) const;
+    void rehash(const size_t num_slot);
+    std::vector<char> m_arena;
+    std::vector<Entry> m_entry;
+    // 1 + index into m_entry, 0 for empty slot
+    std::vector<uint32_t> m_slot;
+};
+
+#endif // SNP_INDEX_HPP
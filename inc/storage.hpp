@@ -19,19 +19,27 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 // From http://stackoverflow.com/a/12927952/1441789
 
+// PRS of all samples, stored as structure of arrays so that the scoring
+// kernel can work directly on contiguous score and SNP count arrays
 struct PRS
 {
-    double prs;
-    int num_snp;
-    PRS() : prs(0.0), num_snp(0){};
-    double get_prs() const
+    std::vector<double> prs;
+    std::vector<int32_t> num_snp;
+    void resize(size_t n)
     {
-        if (num_snp == 0)
+        prs.resize(n, 0.0);
+        num_snp.resize(n, 0);
+    }
+    size_t size() const { return prs.size(); }
+    double get_prs(size_t i) const
+    {
+        if (num_snp[i] == 0)
             return 0.0;
         else
-            return prs / (double) num_snp;
+            return prs[i] / (double) num_snp[i];
     };
 };
 
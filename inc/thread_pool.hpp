@@ -0,0 +1,113 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <mingw.condition_variable.h>
+#include <mingw.mutex.h>
+#include <mingw.thread.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+// Work stealing thread pool shared by the whole run, so that threads are
+// started once instead of for every threshold / permutation block. Each
+// worker has its own deque of tasks: it takes from the back of its own deque
+// and steals from the front of the others when it runs out. The thread
+// waiting for a group of tasks also runs tasks until the group is done, so
+// the pool has num_thread - 1 workers, and nested waits don't dead lock.
+// The waiting thread may run any queued task, not only those of its group,
+// so a task must never block on another task (e.g. through a queue) other
+// than by wait. Long lived producers / consumers need their own threads
+class Thread_Pool
+{
+public:
+    // a set of tasks that can be waited on together
+    class Task_Group
+    {
+    public:
+        Task_Group() {}
+        Task_Group(const Task_Group&) = delete;
+        Task_Group& operator=(const Task_Group&) = delete;
+
+    private:
+        friend class Thread_Pool;
+        std::mutex m_mutex;
+        std::condition_variable m_done;
+        std::string m_error;
+        std::atomic<size_t> m_pending{0};
+    };
+    // the pool used by PRSice, which has no worker until set_num_thread is
+    // called (so every task is run by the waiting thread)
+    static Thread_Pool& global();
+    Thread_Pool() {}
+    ~Thread_Pool() { stop(); }
+    Thread_Pool(const Thread_Pool&) = delete;            // disable copying
+    Thread_Pool& operator=(const Thread_Pool&) = delete; // disable assignment
+    // restart the pool with num_thread - 1 workers. Must not be called while
+    // there are tasks in the pool
+    void set_num_thread(size_t num_thread);
+    size_t num_thread() const { return m_workers.size() + 1; }
+    void submit(Task_Group& group, std::function<void()> task);
+    // submit all tasks at once, spreading them across the workers
+    void submit(Task_Group& group, std::vector<std::function<void()>>& tasks);
+    // wait for all tasks in group to finish, running the queued tasks in the
+    // meantime. Throw std::runtime_error with the first error message of the
+    // group if any of its tasks threw
+    void wait(Task_Group& group);
+    // run task(0) ... task(num_task - 1) and wait for them to finish
+    void run(size_t num_task, const std::function<void(size_t)>& task);
+
+private:
+    struct Task
+    {
+        std::function<void()> work;
+        Task_Group* group;
+    };
+    struct Task_Deque
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+    void worker(size_t index);
+    // run one queued task, preferring the back of deque home. Return false
+    // if there was nothing to run
+    bool run_one(size_t home);
+    void execute(Task& task);
+    void push(size_t index, std::vector<Task>& tasks, size_t begin,
+              size_t end);
+    void stop();
+    std::vector<std::unique_ptr<Task_Deque>> m_deques;
+    std::vector<std::thread> m_workers;
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_wake;
+    std::atomic<size_t> m_num_queued{0};
+    std::atomic<size_t> m_next_deque{0};
+    bool m_stop = false;
+};
+
+#endif // THREAD_POOL_HPP
@@ -3,6 +3,7 @@
 #define THREAD_QUEUE_H
 
 #include <queue>
+#include <utility>
 #ifdef _WIN32
 #include <mingw.condition_variable.h>
 #include <mingw.mutex.h>
@@ -51,7 +52,7 @@ public:
         while (max_process <= m_num_processing) {
             m_cond_not_full.wait(mlock);
         }
-        m_storage_queue.push(item);
+        m_storage_queue.push(std::move(item));
         m_num_processing++;
         mlock.unlock();
         m_cond_not_empty.notify_one();
@@ -0,0 +1,149 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "bgen_index.hpp"
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+const char Bgen_Index::magic[9] = "PRSiceBI";
+const uint32_t Bgen_Index::version;
+
+namespace
+{
+// the index is read and written in large chunks
+const size_t buffer_size = 1 << 22;
+
+template <typename T>
+void write(std::ofstream& file, const T& value)
+{
+    file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void write(std::ofstream& file, const std::string& value)
+{
+    write(file, static_cast<uint32_t>(value.size()));
+    file.write(value.data(), value.size());
+}
+
+template <typename T>
+void read(std::ifstream& file, T& value)
+{
+    file.read(reinterpret_cast<char*>(&value), sizeof(T));
+}
+
+void read(std::ifstream& file, std::string& value)
+{
+    uint32_t length = 0;
+    read(file, length);
+    value.resize(length);
+    if (length != 0) file.read(&value[0], length);
+}
+}
+
+bool Bgen_Index::load(const std::string& file_name, const std::string& key,
+                      const size_t num_variant)
+{
+    if (m_in.is_open()) m_in.close();
+    m_buffer.resize(buffer_size);
+    m_in.rdbuf()->pubsetbuf(m_buffer.data(), m_buffer.size());
+    m_in.open(file_name.c_str(), std::ios::binary);
+    if (!m_in.is_open()) return false;
+    char file_magic[sizeof(magic)] = {0};
+    uint32_t file_version = 0;
+    uint64_t file_variant = 0;
+    std::string file_key;
+    m_in.read(file_magic, sizeof(magic) - 1);
+    read(m_in, file_version);
+    if (!m_in || std::strcmp(file_magic, magic) != 0) {
+        throw std::runtime_error("Error: " + file_name
+                                 + " is not a PRSice bgen index file!");
+    }
+    read(m_in, file_key);
+    read(m_in, file_variant);
+    if (!m_in || file_version != version || file_key != key
+        || file_variant != num_variant)
+    {
+        m_in.close();
+        return false;
+    }
+    m_file_name = file_name;
+    return true;
+}
+
+bool Bgen_Index::create(const std::string& file_name, const std::string& key,
+                        const size_t num_variant)
+{
+    m_file_name = file_name;
+    m_buffer.resize(buffer_size);
+    m_out.rdbuf()->pubsetbuf(m_buffer.data(), m_buffer.size());
+    const std::string tmp_name = file_name + ".tmp";
+    m_out.open(tmp_name.c_str(), std::ios::binary | std::ios::trunc);
+    if (!m_out.is_open()) return false;
+    m_out.write(magic, sizeof(magic) - 1);
+    write(m_out, version);
+    write(m_out, key);
+    write(m_out, static_cast<uint64_t>(num_variant));
+    return true;
+}
+
+void Bgen_Index::next(std::string& rsid, std::string& chr, uint32_t& loc,
+                      std::vector<std::string>& alleles,
+                      std::streampos& byte_pos)
+{
+    uint64_t offset = 0;
+    read(m_in, offset);
+    read(m_in, loc);
+    read(m_in, rsid);
+    read(m_in, chr);
+    alleles.resize(2);
+    read(m_in, alleles.front());
+    read(m_in, alleles.back());
+    if (!m_in) {
+        throw std::runtime_error("Error: bgen index file is corrupted: "
+                                 + m_file_name);
+    }
+    byte_pos = static_cast<std::streamoff>(offset);
+}
+
+void Bgen_Index::add(const std::string& rsid, const std::string& chr,
+                     const uint32_t loc,
+                     const std::vector<std::string>& alleles,
+                     const std::streampos byte_pos)
+{
+    write(m_out, static_cast<uint64_t>(static_cast<std::streamoff>(byte_pos)));
+    write(m_out, loc);
+    write(m_out, rsid);
+    write(m_out, chr);
+    write(m_out, alleles.front());
+    write(m_out, alleles.back());
+}
+
+void Bgen_Index::finish()
+{
+    if (!m_out.is_open()) return;
+    const std::string tmp_name = m_file_name + ".tmp";
+    m_out.close();
+    if (!m_out) {
+        throw std::runtime_error("Error: Failed to write the bgen index: "
+                                 + tmp_name);
+    }
+    std::remove(m_file_name.c_str());
+    if (std::rename(tmp_name.c_str(), m_file_name.c_str()) != 0) {
+        throw std::runtime_error("Error: Failed to write the bgen index: "
+                                 + m_file_name);
+    }
+}
@@ -400,9 +400,12 @@ namespace bgen
             }
             else if (compressionType == e_ZstdCompression)
             {
+#ifdef HAVE_ZSTD
+                zstd_uncompress(begin, end, buffer);
+#else
                 throw std::runtime_error(
-                    "Error: zstd compression currently not supported");
-                // zstd_uncompress( begin, end, buffer ) ;
+                    "Error: PRSice was compiled without zstd support");
+#endif
             }
             assert(buffer->size() == uncompressed_data_size);
         }
@@ -0,0 +1,85 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "bgen_prefetch.hpp"
+#include <stdexcept>
+
+Bgen_Prefetcher::Bgen_Prefetcher(size_t depth)
+    : m_blocks(new Block[(depth == 0) ? 1 : depth])
+    , m_depth((depth == 0) ? 1 : depth)
+    , m_serial(m_depth == 1 || Thread_Pool::global().num_thread() == 1)
+{
+}
+
+Bgen_Prefetcher::~Bgen_Prefetcher()
+{
+    // the queued tasks refer to the blocks, so they must finish first
+    while (!empty()) {
+        try
+        {
+            pop();
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+    }
+}
+
+void Bgen_Prefetcher::push(std::istream& bgen_file,
+                           const genfile::bgen::Context& context)
+{
+    if (full()) {
+        throw std::runtime_error("Error: Too many bgen blocks prefetched");
+    }
+    Block& block = m_blocks[(m_head + m_size) % m_depth];
+    genfile::bgen::read_genotype_data_block(bgen_file, context,
+                                            &block.compressed);
+    ++m_size;
+    if (m_serial) {
+        genfile::bgen::uncompress_probability_data(context, block.compressed,
+                                                   &block.data);
+        block.inflated = true;
+        return;
+    }
+    block.inflated = false;
+    // context is owned by the caller and outlives the block
+    const genfile::bgen::Context* block_context = &context;
+    Thread_Pool::global().submit(block.group, [&block, block_context] {
+        genfile::bgen::uncompress_probability_data(
+            *block_context, block.compressed, &block.data);
+    });
+}
+
+const std::vector<genfile::byte_t>& Bgen_Prefetcher::front()
+{
+    Block& block = m_blocks[m_head];
+    if (!block.inflated) {
+        // only wait once, so that an error is only reported once
+        block.inflated = true;
+        Thread_Pool::global().wait(block.group);
+    }
+    return block.data;
+}
+
+void Bgen_Prefetcher::pop()
+{
+    if (empty()) return;
+    // the block can only be reused once its task is done
+    front();
+    m_blocks[m_head].inflated = false;
+    m_head = (m_head + 1) % m_depth;
+    --m_size;
+}
@@ -20,11 +20,12 @@ BinaryGen::BinaryGen(const std::string& prefix, const std::string& sample_file,
                      const std::string& multi_input, const size_t thread,
                      const bool ignore_fid, const bool keep_nonfounder,
                      const bool keep_ambig, const bool is_ref,
-                     const bool intermediate)
+                     const bool intermediate, const bool use_index)
     : Genotype(thread, ignore_fid, keep_nonfounder, keep_ambig, is_ref)
 {
     /** setting the chromosome information **/
     m_intermediate = intermediate;
+    m_use_index = use_index;
     m_xymt_codes.resize(XYMT_OFFSET_CT);
     // we are not using the following script for now as we only support human
     m_haploid_mask.resize(CHROM_MASK_WORDS, 0);
@@ -193,9 +194,7 @@ std::vector<Sample_ID> BinaryGen::gen_sample_vector()
     m_sample_ct = m_founder_ct;
     sample_file.close();
     // m_prs_info.reserve(m_sample_ct);
-    for (size_t i = 0; i < m_sample_ct; ++i) {
-        m_prs_info.emplace_back(PRS());
-    }
+    m_prs_info.resize(m_sample_ct);
     m_in_regression.resize(m_sample_include.size(), 0);
     return sample_name;
 }
@@ -279,13 +278,16 @@ void BinaryGen::get_context(std::string& prefix)
         m_context_map[prefix].flags = context.flags;
         m_context_map[prefix].number_of_samples = context.number_of_samples;
         m_context_map[prefix].number_of_variants = context.number_of_variants;
-
+#ifndef HAVE_ZSTD
         if ((flags & genfile::bgen::e_CompressedSNPBlocks)
             == genfile::bgen::e_ZstdCompression)
         {
             throw std::runtime_error(
-                "Error: zstd compression currently not supported");
+                "Error: " + prefix
+                + ".bgen is zstd compressed but PRSice was compiled without "
+                  "zstd support");
         }
+#endif
     }
     else
     {
@@ -348,12 +350,107 @@ bool BinaryGen::check_sample_consistent(const std::string& bgen_name,
     }
     return true;
 }
+
+std::string BinaryGen::dosage_cache_key(const double geno, const double maf,
+                                        const double info_score,
+                                        const double hard_threshold) const
+{
+    // the bgen files are identified by their size and modification time, as
+    // a checksum would require reading all of them
+    std::string key;
+    for (auto&& file_name : genotype_file_names()) {
+        key.append(file_name + ":" + misc::file_signature(file_name) + ";");
+    }
+    char filters[128];
+    std::snprintf(filters, sizeof(filters), "%.17g;%.17g;%.17g;%.17g", geno,
+                  maf, info_score, hard_threshold);
+    key.append(std::to_string(m_unfiltered_sample_ct) + ";"
+               + std::to_string(m_sample_ct) + ";"
+               + LD_Cache::checksum(m_sample_include.data(),
+                                    m_sample_include.size() * sizeof(uintptr_t))
+               + ";" + filters);
+    return key;
+}
+
+bool BinaryGen::dosage_record(const genfile::bgen::Context& context,
+                              const std::vector<genfile::byte_t>& data,
+                              std::vector<unsigned char>& record,
+                              uint32_t& width) const
+{
+    if ((context.flags & genfile::bgen::e_Layout) != genfile::bgen::e_Layout2)
+        return false;
+    genfile::bgen::v12::GenotypeDataBlock pack(context, data.data(),
+                                               data.data() + data.size());
+    const uint32_t num_sample = pack.numberOfSamples;
+    const uint32_t bits = pack.bits;
+    // the first record decides the width of the cache
+    width = m_dosage_cache.width();
+    if (width == 0) width = (bits != 0 && 8 % bits == 0) ? 8 : 16;
+    // (2^width - 1) is a multiple of (2^bits - 1) when bits divides width,
+    // then the value / (2^bits - 1) read from the bgen is exactly the scaled
+    // value / (2^width - 1) read from the cache
+    if (pack.phased || pack.numberOfAlleles != 2 || pack.ploidyExtent[0] != 2
+        || pack.ploidyExtent[1] != 2 || bits == 0 || width % bits != 0
+        || (size_t)(pack.end - pack.buffer)
+               < ((size_t) num_sample * 2 * bits + 7) / 8)
+        return false;
+    const uint32_t max_value = (1u << width) - 1;
+    const uint32_t scale = max_value / ((1u << bits) - 1);
+    const uint32_t bit_mask = (1u << bits) - 1;
+    record.resize(m_sample_ct * 2 * width / 8);
+    size_t i_record = 0;
+    for (uint32_t i = 0; i < num_sample; ++i) {
+        if (!IS_SET(m_sample_include.data(), i)) continue;
+        for (size_t i_value = 2 * i; i_value < 2 * (size_t) i + 2; ++i_value)
+        {
+            // values are packed from the least significant bit
+            uint32_t value = max_value;
+            if (!(pack.ploidy[i] & 0x80)) {
+                const size_t bit_pos = i_value * bits;
+                const genfile::byte_t* byte = pack.buffer + bit_pos / 8;
+                if (bits == 16)
+                    value = byte[0] | ((uint32_t) byte[1] << 8);
+                else
+                    value = (byte[0] >> (bit_pos % 8)) & bit_mask;
+                value *= scale;
+            }
+            // little endian, same as the bgen
+            if (width == 8) {
+                record[i_record++] = (unsigned char) value;
+            }
+            else
+            {
+                record[i_record++] = (unsigned char) (value & 0xff);
+                record[i_record++] = (unsigned char) (value >> 8);
+            }
+        }
+    }
+    return true;
+}
+
 std::vector<SNP>
 BinaryGen::gen_snp_vector(const double geno, const double maf,
                           const double info_score, const double hard_threshold,
                           const bool hard_coded, Region& exclusion,
                           const std::string& out_prefix, Genotype* target)
 {
+    // a SNP that passed the filters on its identifying data, waiting for the
+    // QC on its genotypes
+    struct Pending_SNP
+    {
+        std::string rsid;
+        std::string ref;
+        std::string alt;
+        std::streampos byte_pos;
+        // index of the variant across all bgen files, and the QC outcome and
+        // record offset from the dosage cache
+        size_t variant;
+        uint64_t cache_offset;
+        uint32_t loc;
+        int chr_code;
+        Dosage_Cache::Status cache_status;
+        bool inflate;
+    };
     std::vector<SNP> snp_res;
     std::unordered_set<std::string> duplicated_snps;
     // should only apply to SNPs that are not removed due to extract/exclude
@@ -370,7 +467,6 @@ BinaryGen::gen_snp_vector(const double geno, const double maf,
     std::string RSID;
     std::string chromosome;
     std::string prev_chr = "";
-    std::string file_name;
     std::string mismatch_snp_record_name = out_prefix + ".mismatch";
     std::string m_intermediate_file = out_prefix + ".inter";
     double cur_maf;
@@ -405,6 +501,8 @@ BinaryGen::gen_snp_vector(const double geno, const double maf,
 
     m_hard_threshold = hard_threshold;
     m_hard_coded = hard_coded;
+    const bool need_genotype =
+        !(maf <= 0.0 && geno >= 1.0 && info_score <= 0.0) || m_intermediate;
 
 
     for (auto prefix : m_genotype_files) {
@@ -421,6 +519,42 @@ BinaryGen::gen_snp_vector(const double geno, const double maf,
     // might need time to reserve large amount of memory for the large number
     // of SNPs included in bgen
     snp_res.reserve(total_unfiltered_snps);
+    // the dosage cache only stores the dosages of the target
+    const bool use_cache =
+        !m_dosage_cache_file.empty() && !m_is_ref && !hard_coded;
+    if (use_cache) {
+        const std::string key =
+            dosage_cache_key(geno, maf, info_score, hard_threshold);
+        if (m_dosage_cache.load(m_dosage_cache_file, key, m_sample_ct,
+                                total_unfiltered_snps))
+        {
+            fprintf(stderr, "Reading dosage cache: %s\n",
+                    m_dosage_cache_file.c_str());
+        }
+        else
+        {
+            m_dosage_cache.create(m_dosage_cache_file, key, m_sample_ct,
+                                  total_unfiltered_snps);
+        }
+        m_dosage_cache_id = SNP::intern(m_dosage_cache_file);
+    }
+    // variants with a QC outcome in the cache don't need their genotypes,
+    // the others are written to the cache when it is created
+    const bool read_cache = use_cache && m_dosage_cache.reused();
+    const bool write_cache = use_cache && !m_dosage_cache.reused();
+    std::vector<unsigned char> cache_record;
+    // bgen location of the SNPs read from the cache, in case some SNPs have
+    // to be read from the bgen files after all
+    struct Cached_SNP
+    {
+        size_t index;
+        uint32_t file;
+        std::streamoff byte_pos;
+    };
+    std::vector<Cached_SNP> cached_snps;
+    bool bgen_dosage = false;
+    size_t i_variant = 0;
+    uint64_t i_cache_record = 0;
     // to allow multiple file for one chromosome, we put these variable outside
     // the for loop
     if (m_intermediate) {
@@ -447,23 +581,277 @@ BinaryGen::gen_snp_vector(const double geno, const double maf,
         bgen_file.seekg(offset + 4);
         num_snp = m_context_map[prefix].number_of_variants;
         auto&& context = m_context_map[prefix];
+        // the identifying data of the variants are read from the index when
+        // it is up to date, otherwise the index is generated from this pass
+        Bgen_Index index;
+        bool read_index = false;
+        bool write_index = false;
+        if (m_use_index) {
+            const std::string index_name = bgen_name + ".idx";
+            const std::string key = misc::file_signature(bgen_name);
+            read_index = index.load(index_name, key, num_snp);
+            if (!read_index) {
+                write_index = index.create(index_name, key, num_snp);
+                if (!write_index) {
+                    fprintf(stderr,
+                            "\nWarning: Cannot write the bgen index: %s\n",
+                            index_name.c_str());
+                }
+            }
+        }
+        Bgen_Prefetcher prefetch(prefetch_depth());
+        std::deque<Pending_SNP> pending;
+        // the QC and recording of a SNP, once its block is inflated (data is
+        // nullptr if the SNP doesn't need the genotypes)
+        auto check_snp = [&](Pending_SNP& snp,
+                             const std::vector<genfile::byte_t>* data) {
+            std::streampos byte_pos = snp.byte_pos;
+            std::string file_name = prefix;
+            switch (snp.cache_status)
+            {
+            case Dosage_Cache::Status::MAF_FILTERED:
+                m_num_maf_filter++;
+                return;
+            case Dosage_Cache::Status::GENO_FILTERED:
+                m_num_geno_filter++;
+                return;
+            case Dosage_Cache::Status::INFO_FILTERED:
+                m_num_info_filter++;
+                return;
+            default: break;
+            }
+            auto cache_status = [&](const Dosage_Cache::Status status) {
+                if (write_cache) m_dosage_cache.set_status(snp.variant, status);
+            };
+            // the block might only be inflated for the dosage cache
+            if (data != nullptr && need_genotype) {
+                genfile::bgen::parse_probability_data<PLINK_generator>(
+                    data->data(), data->data() + data->size(), context,
+                    setter);
+                if (!(maf <= 0.0 && geno >= 1.0 && info_score <= 0.0)) {
+                    // do QC
+                    genovec_3freq(m_tmp_genotype.data(), m_sample_mask.data(),
+                                  pheno_nm_ctv2, &missing_ct, &het_ct,
+                                  &homcom_ct);
+                    nanal = m_sample_ct - missing_ct;
+                    homrar_ct = nanal - het_ct - homcom_ct;
+
+                    if (nanal == 0) {
+                        // still count as MAF filtering (for now)
+                        m_num_maf_filter++;
+                        cache_status(Dosage_Cache::Status::MAF_FILTERED);
+                        return;
+                    }
+
+                    if ((double) missing_ct / (double) m_sample_ct > geno) {
+                        m_num_geno_filter++;
+                        cache_status(Dosage_Cache::Status::GENO_FILTERED);
+                        return;
+                    }
+
+                    cur_maf = ((double) (het_ct + homrar_ct * 2)
+                               / ((double) nanal * 2.0));
+                    if (cur_maf > 0.5) cur_maf = 1.0 - cur_maf;
+                    // remove SNP if maf lower than threshold
+                    if (cur_maf < maf) {
+                        m_num_maf_filter++;
+                        cache_status(Dosage_Cache::Status::MAF_FILTERED);
+                        return;
+                    }
+                    if (setter.info_score() < info_score) {
+                        m_num_info_filter++;
+                        cache_status(Dosage_Cache::Status::INFO_FILTERED);
+                        return;
+                    }
+                }
+                if (m_intermediate
+                    && (m_is_ref || !m_expect_reference
+                        || (!m_is_ref && hard_coded)))
+                {
+                    // we will only generate the intermediate file if the
+                    // following happen:
+                    // 1. User want to generate the intermediate file
+                    // 2. We are dealing with reference file format
+                    // 3. We are dealing with target file and there is no
+                    // reference file
+                    // 4. We are dealing with target file and we are
+                    // expected to use hard_coding
+                    if (m_is_ref || !m_expect_reference) {
+                        // when not expecting reference, we will
+                        // just update the info on the reference field
+                        m_ref_plink = true;
+                        // we can write to the intermediate file directly
+                        // now write to file
+                        inter_out.write((char*) (&m_tmp_genotype[0]),
+                                        m_tmp_genotype.size()
+                                            * sizeof(m_tmp_genotype[0]));
+                    }
+                    else
+                    {
+                        // Not reference, not expecting a reference
+                        // and using hard code, then update both reference
+                        // and target field
+                        m_ref_plink = true;
+                        m_target_plink = true;
+                        byte_pos = inter_out.tellp();
+                        file_name = m_intermediate_file;
+                        inter_out.write((char*) (&m_tmp_genotype[0]),
+                                        m_tmp_genotype.size()
+                                            * sizeof(m_tmp_genotype[0]));
+                    }
+                }
+            }
+            if (!m_is_ref) {
+                // TODO: Update SNP constructor
+                // for now, we focus on PLINK optimization and ignore bgen
+                if (m_target_plink) {
+                    byte_pos = inter_out.tellp();
+                    file_name = m_intermediate_file;
+                }
+                snp_res.emplace_back(SNP(snp.rsid, snp.chr_code, snp.loc,
+                                         snp.ref, snp.alt, file_name,
+                                         byte_pos));
+                m_existed_snps_index.insert(snp_res, snp_res.size() - 1);
+                // the dosages are then read from the cache, the LD is still
+                // read from the bgen
+                uint32_t width;
+                const Cached_SNP cached{snp_res.size() - 1,
+                                        snp_res.back().file_id(), byte_pos};
+                if (snp.cache_status == Dosage_Cache::Status::CACHED) {
+                    cached_snps.push_back(cached);
+                    snp_res.back().update_target(m_dosage_cache_file,
+                                                 snp.cache_offset);
+                }
+                else if (write_cache
+                         && dosage_record(context, *data, cache_record, width))
+                {
+                    cached_snps.push_back(cached);
+                    snp_res.back().update_target(
+                        m_dosage_cache_file,
+                        m_dosage_cache.add(cache_record.data(), width));
+                    cache_status(Dosage_Cache::Status::CACHED);
+                }
+                else
+                {
+                    bgen_dosage = true;
+                    cache_status(Dosage_Cache::Status::NOT_CACHED);
+                }
+            }
+            else
+            {
+                auto&& target_index =
+                    target->m_existed_snps_index.find(target->m_existed_snps,
+                                                      snp.rsid);
+                bool dummy;
+                if (!target->m_existed_snps[target_index].matching(
+                        snp.chr_code, snp.loc, snp.ref, snp.alt, dummy))
+                {
+                    if (!mismatch_snp_record.is_open()) {
+                        // open the file accordingly
+                        if (m_mismatch_file_output) {
+                            mismatch_snp_record.open(
+                                mismatch_snp_record_name.c_str(),
+                                std::ofstream::app);
+                            if (!mismatch_snp_record.is_open()) {
+                                throw std::runtime_error(std::string(
+                                    "Cannot open mismatch file to write: "
+                                    + mismatch_snp_record_name));
+                            }
+                        }
+                        else
+                        {
+                            mismatch_snp_record.open(
+                                mismatch_snp_record_name.c_str());
+                            if (!mismatch_snp_record.is_open()) {
+                                throw std::runtime_error(std::string(
+                                    "Cannot open mismatch file to write: "
+                                    + mismatch_snp_record_name));
+                            }
+                            mismatch_snp_record
+                                << "File_Type\tRS_ID\tCHR_Target\tCHR_"
+                                   "File\tBP_Target\tBP_File\tA1_"
+                                   "Target\tA1_File\tA2_Target\tA2_File\n";
+                        }
+                    }
+                    mismatch_snp_record
+                        << "Reference\t" << snp.rsid << "\t"
+                        << target->m_existed_snps[target_index].chr() << "\t"
+                        << snp.chr_code << "\t"
+                        << target->m_existed_snps[target_index].loc() << "\t"
+                        << snp.loc << "\t"
+                        << target->m_existed_snps[target_index].ref() << "\t"
+                        << "\t" << snp.ref
+                        << target->m_existed_snps[target_index].alt() << "\t"
+                        << snp.alt << "\n";
+
+                    m_num_ref_target_mismatch++;
+                }
+                else
+                {
+                    if (m_ref_plink) {
+                        byte_pos = inter_out.tellp();
+                        file_name = m_intermediate_file;
+                    }
+                    target->m_existed_snps[target_index].add_reference(
+                        file_name, byte_pos);
+                    ref_retain[target_index] = true;
+                    ref_target_match++;
+                }
+            }
+        };
+        // check the oldest pending SNP
+        auto check_next = [&]() {
+            if (pending.front().inflate) {
+                check_snp(pending.front(), &prefetch.front());
+                prefetch.pop();
+            }
+            else
+            {
+                check_snp(pending.front(), nullptr);
+            }
+            pending.pop_front();
+        };
         for (size_t i_snp = 0; i_snp < num_snp; ++i_snp) {
             if (i_snp % 1000 == 0) {
                 fprintf(stderr, "\r%zuK SNPs processed in %s\r", i_snp / 1000,
                         bgen_name.c_str());
             }
             m_unfiltered_marker_ct++;
+            const size_t variant = i_variant++;
+            Dosage_Cache::Status cached = Dosage_Cache::Status::UNCHECKED;
+            uint64_t cache_offset = 0;
+            if (read_cache) {
+                // records are in the order of the variants, including those
+                // we exclude this time
+                cached = m_dosage_cache.status(variant);
+                if (cached == Dosage_Cache::Status::CACHED) {
+                    cache_offset =
+                        m_dosage_cache.record_offset(i_cache_record++);
+                }
+            }
 
-            // directly use the libraryread_snp_identifying_data(
-
-            read_snp_identifying_data(
-                bgen_file, context, &SNPID, &RSID, &chromosome, &SNP_position,
-                [&alleles](std::size_t n) { alleles.resize(n); },
-                [&alleles](std::size_t i, std::string const& allele) {
-                    std::string a = allele;
-                    std::transform(a.begin(), a.end(), a.begin(), ::toupper);
-                    alleles.at(i) = a;
-                });
+            if (read_index) {
+                index.next(RSID, chromosome, SNP_position, alleles, byte_pos);
+            }
+            else
+            {
+                // directly use the libraryread_snp_identifying_data(
+                read_snp_identifying_data(
+                    bgen_file, context, &SNPID, &RSID, &chromosome,
+                    &SNP_position,
+                    [&alleles](std::size_t n) { alleles.resize(n); },
+                    [&alleles](std::size_t i, std::string const& allele) {
+                        std::string a = allele;
+                        std::transform(a.begin(), a.end(), a.begin(),
+                                       ::toupper);
+                        alleles.at(i) = a;
+                    });
+                byte_pos = bgen_file.tellg();
+                if (write_index) {
+                    index.add(RSID, chromosome, SNP_position, alleles,
+                              byte_pos);
+                }
+            }
             exclude_snp = false;
             // but we will not process anything
             if (chromosome != prev_chr) {
@@ -519,9 +907,20 @@ BinaryGen::gen_snp_vector(const double geno, const double maf,
                     user_exclude = true;
                     exclude_snp = true;
                 }
+                else if (m_base_filter && !write_cache
+                         && !m_base_snps.contains(RSID))
+                {
+                    // the genotypes of SNPs not in the base file are never
+                    // inflated, nor are they checked for duplicates. A new
+                    // dosage cache covers all of them, so that it can be
+                    // used with any base file
+                    m_num_not_in_base++;
+                    user_exclude = true;
+                    exclude_snp = true;
+                }
             }
-            else if (target->m_existed_snps_index.find(RSID)
-                     == target->m_existed_snps_index.end())
+            else if (!target->m_existed_snps_index.contains(
+                         target->m_existed_snps, RSID))
             {
                 exclude_snp = true;
             }
@@ -540,167 +939,56 @@ BinaryGen::gen_snp_vector(const double geno, const double maf,
             if (!user_exclude) {
                 duplicate_check_list.insert(RSID);
             }
-            byte_pos = bgen_file.tellg();
-            read_genotype_data_block(bgen_file, context, &m_buffer1);
             // if we want to exclude this SNP, we will not perform decompression
-            if (!exclude_snp && !has_duplicate) {
-                // now filter
-                file_name = prefix;
-                if (!(maf <= 0.0 && geno >= 1.0 && info_score <= 0.0)
-                    || m_intermediate)
-                {
-                    genfile::bgen::uncompress_probability_data(
-                        context, m_buffer1, &m_buffer2);
-                    genfile::bgen::parse_probability_data<PLINK_generator>(
-                        &(m_buffer2)[0], &(m_buffer2)[0] + m_buffer2.size(),
-                        context, setter);
-                    if (!(maf <= 0.0 && geno >= 1.0 && info_score <= 0.0)) {
-                        // do QC
-                        genovec_3freq(m_tmp_genotype.data(),
-                                      m_sample_mask.data(), pheno_nm_ctv2,
-                                      &missing_ct, &het_ct, &homcom_ct);
-                        nanal = m_sample_ct - missing_ct;
-                        homrar_ct = nanal - het_ct - homcom_ct;
-
-                        if (nanal == 0) {
-                            // still count as MAF filtering (for now)
-                            m_num_maf_filter++;
-                            continue;
-                        }
-
-                        if ((double) missing_ct / (double) m_sample_ct > geno) {
-                            m_num_geno_filter++;
-                            continue;
-                        }
-
-                        cur_maf = ((double) (het_ct + homrar_ct * 2)
-                                   / ((double) nanal * 2.0));
-                        if (cur_maf > 0.5) cur_maf = 1.0 - cur_maf;
-                        // remove SNP if maf lower than threshold
-                        if (cur_maf < maf) {
-                            m_num_maf_filter++;
-                            continue;
-                        }
-                        if (setter.info_score() < info_score) {
-                            m_num_info_filter++;
-                            continue;
-                        }
-                    }
-                    if (m_intermediate
-                        && (m_is_ref || !m_expect_reference
-                            || (!m_is_ref && hard_coded)))
-                    {
-                        // we will only generate the intermediate file if the
-                        // following happen:
-                        // 1. User want to generate the intermediate file
-                        // 2. We are dealing with reference file format
-                        // 3. We are dealing with target file and there is no
-                        // reference file
-                        // 4. We are dealing with target file and we are
-                        // expected to use hard_coding
-                        if (m_is_ref || !m_expect_reference) {
-                            // when not expecting reference, we will
-                            // just update the info on the reference field
-                            m_ref_plink = true;
-                            // we can write to the intermediate file directly
-                            // now write to file
-                            inter_out.write((char*) (&m_tmp_genotype[0]),
-                                            m_tmp_genotype.size()
-                                                * sizeof(m_tmp_genotype[0]));
-                        }
-                        else
-                        {
-                            // Not reference, not expecting a reference
-                            // and using hard code, then update both reference
-                            // and target field
-                            m_ref_plink = true;
-                            m_target_plink = true;
-                            byte_pos = inter_out.tellp();
-                            file_name = m_intermediate_file;
-                            inter_out.write((char*) (&m_tmp_genotype[0]),
-                                            m_tmp_genotype.size()
-                                                * sizeof(m_tmp_genotype[0]));
-                        }
-                    }
-                }
-                if (!m_is_ref) {
-                    m_existed_snps_index[RSID] = snp_res.size();
-                    // TODO: Update SNP constructor
-                    // for now, we focus on PLINK optimization and ignore bgen
-                    if (m_target_plink) {
-                        byte_pos = inter_out.tellp();
-                        file_name = m_intermediate_file;
-                    }
-                    snp_res.emplace_back(SNP(RSID, chr_code, SNP_position,
-                                             alleles.front(), alleles.back(),
-                                             file_name, byte_pos));
-                }
-                else
-                {
-                    auto&& target_index = target->m_existed_snps_index[RSID];
-                    bool dummy;
-                    if (!target->m_existed_snps[target_index].matching(
-                            chr_code, SNP_position, alleles.front(),
-                            alleles.back(), dummy))
-                    {
-                        if (!mismatch_snp_record.is_open()) {
-                            // open the file accordingly
-                            if (m_mismatch_file_output) {
-                                mismatch_snp_record.open(
-                                    mismatch_snp_record_name.c_str(),
-                                    std::ofstream::app);
-                                if (!mismatch_snp_record.is_open()) {
-                                    throw std::runtime_error(std::string(
-                                        "Cannot open mismatch file to write: "
-                                        + mismatch_snp_record_name));
-                                }
-                            }
-                            else
-                            {
-                                mismatch_snp_record.open(
-                                    mismatch_snp_record_name.c_str());
-                                if (!mismatch_snp_record.is_open()) {
-                                    throw std::runtime_error(std::string(
-                                        "Cannot open mismatch file to write: "
-                                        + mismatch_snp_record_name));
-                                }
-                                mismatch_snp_record
-                                    << "File_Type\tRS_ID\tCHR_Target\tCHR_"
-                                       "File\tBP_Target\tBP_File\tA1_"
-                                       "Target\tA1_File\tA2_Target\tA2_File\n";
-                            }
-                        }
-                        mismatch_snp_record
-                            << "Reference\t" << RSID << "\t"
-                            << target->m_existed_snps[target_index].chr()
-                            << "\t" << chr_code << "\t"
-                            << target->m_existed_snps[target_index].loc()
-                            << "\t" << SNP_position << "\t"
-                            << target->m_existed_snps[target_index].ref()
-                            << "\t"
-                            << "\t" << alleles.front()
-                            << target->m_existed_snps[target_index].alt()
-                            << "\t" << alleles.back() << "\n";
-
-                        m_num_ref_target_mismatch++;
-                    }
-                    else
-                    {
-                        if (m_ref_plink) {
-                            byte_pos = inter_out.tellp();
-                            file_name = m_intermediate_file;
-                        }
-                        target->m_existed_snps[target_index].add_reference(
-                            file_name, byte_pos);
-                        ref_retain[target_index] = true;
-                        ref_target_match++;
-                    }
-                }
+            if (exclude_snp || has_duplicate) {
+                if (!read_index)
+                    read_genotype_data_block(bgen_file, context, &m_buffer1);
+                continue;
+            }
+            // the genotype blocks are inflated on the thread pool, while the
+            // earlier SNPs are being checked
+            const bool inflate =
+                write_cache
+                || (need_genotype
+                    && (cached == Dosage_Cache::Status::UNCHECKED
+                        || m_intermediate));
+            while (prefetch.full()) check_next();
+            pending.push_back(Pending_SNP{
+                RSID, alleles.front(), alleles.back(), byte_pos, variant,
+                cache_offset, SNP_position, chr_code, cached, inflate});
+            if (inflate) {
+                // with the index, only the blocks we need are read
+                if (read_index) bgen_file.seekg(byte_pos, std::ios_base::beg);
+                prefetch.push(bgen_file, context);
+            }
+            else if (!read_index)
+            {
+                read_genotype_data_block(bgen_file, context, &m_buffer1);
             }
+            while (!pending.empty() && !pending.front().inflate) check_next();
         }
+        while (!pending.empty()) check_next();
+        if (write_index) index.finish();
         bgen_file.close();
         fprintf(stderr, "\n");
     }
+    if (write_cache) {
+        m_dosage_cache.finish();
+        fprintf(stderr, "Dosage cache written to %s\n",
+                m_dosage_cache_file.c_str());
+    }
+    if (bgen_dosage && !cached_snps.empty()) {
+        // the SNPs are sorted by file and offset before scoring. Reading
+        // only some of them from the cache would change the order in which
+        // their dosages are added to the PRS, so read all from the bgen
+        for (auto&& cached : cached_snps) {
+            snp_res[cached.index].update_target(SNP::pooled(cached.file),
+                                                cached.byte_pos);
+        }
+        m_dosage_cache.close();
+        fprintf(stderr, "Warning: Not all variants are in the dosage cache, "
+                        "their dosages are read from the bgen files\n");
+    }
     snp_res.shrink_to_fit(); // so that it will be more suitable
 
     if (m_is_ref && ref_target_match != target->m_existed_snps.size()) {
@@ -760,76 +1048,57 @@ void BinaryGen::dosage_score(size_t start_index, size_t end_bound,
                              bool set_zero)
 {
     m_cur_file = "";
-    std::string bgen_name;
-
     bool not_first = !set_zero;
     PRS_Interpreter setter(&m_prs_info, &m_sample_include, m_missing_score);
+    // blocks of the SNPs in [i_snp, i_read) are being inflated
+    Bgen_Prefetcher prefetch(prefetch_depth());
+    size_t i_read = start_index;
     for (size_t i_snp = start_index; i_snp < end_bound; ++i_snp) {
         auto&& snp = m_existed_snps[i_snp];
         if (!snp.in(region_index)) continue;
-        if (m_cur_file.empty() || snp.file_name().compare(m_cur_file) != 0) {
-            if (m_bgen_file.is_open()) m_bgen_file.close();
-            bgen_name = snp.file_name() + ".bgen";
-            m_bgen_file.open(bgen_name.c_str(), std::ifstream::binary);
-            if (!m_bgen_file.is_open()) {
-                std::string error_message =
-                    "Error: Cannot open bgen file: " + snp.file_name();
-                throw std::runtime_error(error_message);
-            }
-            m_cur_file = snp.file_name();
+        for (; i_read < end_bound && !prefetch.full(); ++i_read) {
+            auto&& next_snp = m_existed_snps[i_read];
+            if (!next_snp.in(region_index) || in_dosage_cache(next_snp))
+                continue;
+            prefetch_block(prefetch, next_snp.file_name(), next_snp.byte_pos());
         }
-        m_bgen_file.seekg(snp.byte_pos(), std::ios_base::beg);
-
-        auto&& context = m_context_map[m_cur_file];
         setter.set_stat(snp.stat(), homcom_weight, het_weight, homrar_weight,
                         snp.is_flipped(), not_first);
         not_first = true;
-        genfile::bgen::read_and_parse_genotype_data_block<PRS_Interpreter>(
-            m_bgen_file, context, setter, &m_buffer1, &m_buffer2, false);
+        if (in_dosage_cache(snp)) {
+            setter.parse_cache(m_dosage_cache.record(snp.byte_pos()),
+                               m_dosage_cache.width());
+            continue;
+        }
+        parse_dosage(context(snp.file_name()), prefetch.front(), setter);
+        prefetch.pop();
     }
 }
 
-void BinaryGen::dosage_score(std::vector<size_t>& index, uint32_t homcom_weight,
-                             uint32_t het_weight, uint32_t homrar_weight,
-                             bool set_zero)
+void BinaryGen::dosage_score(Score_Scratch& scratch,
+                             const std::vector<size_t>& index,
+                             uint32_t homcom_weight, uint32_t het_weight,
+                             uint32_t homrar_weight, bool set_zero) const
 {
-    m_cur_file = "";
-
-    PRS_Interpreter setter(&m_prs_info, &m_sample_include, m_missing_score);
+    PRS_Interpreter setter(&scratch.prs_info, &m_sample_include,
+                           m_missing_score);
     bool not_first = !set_zero;
     for (auto&& i_snp : index) {
-        auto&& snp = m_existed_snps[i_snp];
-        if (m_cur_file.empty() || snp.file_name().compare(m_cur_file) != 0) {
-            if (m_bgen_file.is_open()) m_bgen_file.close();
-            std::string bgen_name = snp.file_name() + ".bgen";
-            m_bgen_file.open(bgen_name.c_str(), std::ifstream::binary);
-            if (!m_bgen_file.is_open()) {
-                std::string error_message =
-                    "Error: Cannot open bgen file: " + snp.file_name();
-                throw std::runtime_error(error_message);
-            }
-            m_cur_file = snp.file_name();
-        }
-        m_bgen_file.seekg(snp.byte_pos(), std::ios_base::beg);
-
-        auto&& context = m_context_map[m_cur_file];
-        /*
-        PRS_Interpreter setter(&m_prs_info, m_model, m_missing_score,
-                               &m_sample_include, snp.stat() * 2,
-                               snp.is_flipped());*/
-
+        const SNP& snp = m_existed_snps[i_snp];
         setter.set_stat(snp.stat(), homcom_weight, het_weight, homrar_weight,
                         snp.is_flipped(), not_first);
         not_first = true;
-        /*
-        PRS_Interpreter setter(&m_sample_names, &g_prs_storage, &g_num_snps,
-                               vector_pad, m_model, m_missing_score,
-                               snp.stat() * 2,
-                               snp.is_flipped()); // Multiple by ploidy
-                               */
-        // after this, m_sample contain the latest PRS score
-        genfile::bgen::read_and_parse_genotype_data_block<PRS_Interpreter>(
-            m_bgen_file, context, setter, &m_buffer1, &m_buffer2, false);
+        if (in_dosage_cache(snp)) {
+            // the cache is mapped, so it can be read by all threads
+            setter.parse_cache(m_dosage_cache.record(snp.byte_pos()),
+                               m_dosage_cache.width());
+            continue;
+        }
+        auto&& bgen_file = genotype_file(scratch, snp.file_name() + ".bgen");
+        bgen_file.seekg(snp.byte_pos(), std::ios_base::beg);
+        // after this, scratch contain the latest PRS score
+        read_dosage(bgen_file, context(snp.file_name()), setter,
+                    &scratch.buffer1, &scratch.buffer2);
     }
 }
 
@@ -842,11 +1111,6 @@ void BinaryGen::hard_code_score(size_t start_index, size_t end_bound,
     const uintptr_t final_mask = get_final_mask(m_sample_ct);
     const uintptr_t unfiltered_sample_ctl =
         BITCT_TO_WORDCT(m_unfiltered_sample_ct);
-    uintptr_t* lbptr;
-    uint32_t uii;
-    uint32_t ujj;
-    uint32_t ukk;
-    uintptr_t ulii = 0;
     uint32_t homrar_ct = 0;
     uint32_t missing_ct = 0;
     uint32_t het_ct = 0;
@@ -865,25 +1129,49 @@ void BinaryGen::hard_code_score(size_t start_index, size_t end_bound,
     double stat, maf, adj_score, miss_score;
 
     m_cur_file = "";
-    std::vector<uintptr_t> genotype(unfiltered_sample_ctl * 2, 0);
+    m_score_block.init(m_sample_ct, unfiltered_sample_ctl * 2, m_thread);
+    // blocks of the SNPs in [i_snp, i_read) are being inflated. Not needed
+    // when reading the hard coded intermediate file
+    Bgen_Prefetcher prefetch(m_target_plink ? 1 : prefetch_depth());
+    size_t i_read = start_index;
 
     for (size_t i_snp = start_index; i_snp < end_bound; ++i_snp)
     { // for each SNP
         auto&& cur_snp = m_existed_snps[i_snp];
+        uintptr_t* genotype = m_score_block.next_genotype();
         if (!cur_snp.in(region_index)) continue;
 
-        if (load_and_collapse_incl(
-                cur_snp.byte_pos(), cur_snp.file_name(), m_unfiltered_sample_ct,
-                m_sample_ct, m_sample_include.data(), final_mask, false,
-                m_tmp_genotype.data(), genotype.data(), m_target_plink))
+        if (m_target_plink) {
+            if (load_and_collapse_incl(
+                    cur_snp.byte_pos(), cur_snp.file_name(),
+                    m_unfiltered_sample_ct, m_sample_ct,
+                    m_sample_include.data(), final_mask, false,
+                    m_tmp_genotype.data(), genotype, m_target_plink))
+            {
+                throw std::runtime_error("Error: Cannot read the bed file!");
+            }
+        }
+        else
         {
-            throw std::runtime_error("Error: Cannot read the bed file!");
+            for (; i_read < end_bound && !prefetch.full(); ++i_read) {
+                auto&& next_snp = m_existed_snps[i_read];
+                if (!next_snp.in(region_index)) continue;
+                prefetch_block(prefetch, next_snp.file_name(),
+                               next_snp.byte_pos());
+            }
+            const std::vector<genfile::byte_t>& data = prefetch.front();
+            PLINK_generator setter(&m_sample_include, genotype,
+                                   m_hard_threshold);
+            genfile::bgen::parse_probability_data<PLINK_generator>(
+                data.data(), data.data() + data.size(),
+                context(cur_snp.file_name()), setter);
+            prefetch.pop();
         }
         bool has_count =
             cur_snp.get_counts(homcom_ct, het_ct, homrar_ct, missing_ct);
 
         if (!has_count) {
-            genovec_3freq(genotype.data(), m_sample_mask.data(), pheno_nm_ctv2,
+            genovec_3freq(genotype, m_sample_mask.data(), pheno_nm_ctv2,
                           &missing_ct, &het_ct, &homcom_ct);
             cur_snp.set_counts(homcom_ct, het_ct, homrar_ct, missing_ct);
         }
@@ -911,66 +1199,30 @@ void BinaryGen::hard_code_score(size_t start_index, size_t end_bound,
         adj_score = stat * maf * is_centre;
         miss_score = stat * maf * mean_impute;
 
-        lbptr = genotype.data();
-        uii = 0;
-        ulii = 0;
-        do
-        {
-            ulii = ~(*lbptr++);
-            if (uii + BITCT2 > m_unfiltered_sample_ct) {
-                ulii &= (ONELU << ((m_unfiltered_sample_ct & (BITCT2 - 1)) * 2))
-                        - ONELU;
-            }
-            ujj = 0;
-            while (ujj < BITCT) {
-                ukk = (ulii >> ujj) & 3;
-                auto&& sample_prs = m_prs_info[uii + (ujj / 2)];
-                // now we will get all genotypes (0, 1, 2, 3)
-                switch (ukk)
-                {
-                default:
-                    sample_prs.num_snp = sample_prs.num_snp * not_first + 1;
-                    sample_prs.prs = sample_prs.prs * not_first
-                                     + homcom_weight * stat * 0.5 - adj_score;
-                    break;
-                case 1:
-                    sample_prs.num_snp = sample_prs.num_snp * not_first + 1;
-                    sample_prs.prs = sample_prs.prs * not_first
-                                     + het_weight * stat * 0.5 - adj_score;
-                    break;
-                case 3:
-                    sample_prs.num_snp = sample_prs.num_snp * not_first + 1;
-                    sample_prs.prs = sample_prs.prs * not_first
-                                     + homrar_weight * stat * 0.5 - adj_score;
-                    break;
-                case 2:
-                    sample_prs.prs = sample_prs.prs * not_first + miss_score;
-                    sample_prs.num_snp =
-                        sample_prs.num_snp * not_first + miss_count;
-                    break;
-                }
-                ulii &= ~((3 * ONELU) << ujj);
-                ujj += 2;
-            }
-            uii += BITCT2;
-        } while (uii < m_sample_ct);
-        not_first = true;
+        // lookup table indexed by the 2-bit PLINK genotype code
+        const double weight[4] = {homrar_weight * stat * 0.5 - adj_score,
+                                  miss_score,
+                                  het_weight * stat * 0.5 - adj_score,
+                                  homcom_weight * stat * 0.5 - adj_score};
+        const int32_t count[4] = {1, (int32_t) miss_count, 1, 1};
+        m_score_block.push(weight, count);
+        if (m_score_block.full()) {
+            m_score_block.apply(m_prs_info.prs.data(),
+                                m_prs_info.num_snp.data(), not_first);
+        }
     }
+    m_score_block.apply(m_prs_info.prs.data(), m_prs_info.num_snp.data(),
+                        not_first);
 }
 
 
-void BinaryGen::hard_code_score(std::vector<size_t>& index, int32_t homcom_wt,
-                                uint32_t het_wt, uint32_t homrar_wt,
-                                bool set_zero)
+void BinaryGen::hard_code_score(Score_Scratch& scratch,
+                                const std::vector<size_t>& index,
+                                int32_t homcom_wt, uint32_t het_wt,
+                                uint32_t homrar_wt, bool set_zero) const
 {
-    const uintptr_t final_mask = get_final_mask(m_sample_ct);
     const uintptr_t unfiltered_sample_ctl =
         BITCT_TO_WORDCT(m_unfiltered_sample_ct);
-    uintptr_t* lbptr;
-    uint32_t uii;
-    uint32_t ujj;
-    uint32_t ukk;
-    uintptr_t ulii = 0;
     uint32_t homrar_ct = 0;
     uint32_t missing_ct = 0;
     uint32_t het_ct = 0;
@@ -987,29 +1239,25 @@ void BinaryGen::hard_code_score(std::vector<size_t>& index, int32_t homcom_wt,
     intptr_t nanal;
     double stat, maf, adj_score, miss_score;
 
-    m_cur_file = "";
-    std::vector<uintptr_t> genotype(unfiltered_sample_ctl * 2, 0);
+    auto&& score_block = scratch.score_block;
+    // the scratch is used by the threads of the competitive permutation, so
+    // its samples are not split across the thread pool
+    score_block.init(m_sample_ct, unfiltered_sample_ctl * 2, 1);
 
     for (auto&& i_snp : index) { // for each SNP
-        auto&& cur_snp = m_existed_snps[i_snp];
-        if (load_and_collapse_incl(
-                cur_snp.byte_pos(), cur_snp.file_name(), m_unfiltered_sample_ct,
-                m_sample_ct, m_sample_include.data(), final_mask, false,
-                m_tmp_genotype.data(), genotype.data(), m_target_plink))
-        {
-            throw std::runtime_error("Error: Cannot read the bed file!");
-        }
+        const SNP& cur_snp = m_existed_snps[i_snp];
+        uintptr_t* genotype = score_block.next_genotype();
+        load_and_collapse_incl(scratch, cur_snp.byte_pos(),
+                               cur_snp.file_name(), genotype, m_target_plink);
+        // the SNPs are shared by all threads, so the counts are not cached
+        // here. They are normally already known from the observed PRS
         cur_snp.get_counts(homcom_ct, het_ct, homrar_ct, missing_ct);
         if (homcom_ct + het_ct + homrar_ct + missing_ct == 0) {
-            genovec_3freq(genotype.data(), m_sample_mask.data(), pheno_nm_ctv2,
+            genovec_3freq(genotype, m_sample_mask.data(), pheno_nm_ctv2,
                           &missing_ct, &het_ct, &homcom_ct);
-            cur_snp.set_counts(homcom_ct, het_ct, homrar_ct, missing_ct);
         }
         nanal = m_sample_ct - missing_ct;
-        if (nanal == 0) {
-            cur_snp.invalidate();
-            continue;
-        }
+        if (nanal == 0) continue;
         homcom_weight = homcom_wt;
         het_weight = het_wt;
         homrar_weight = homrar_wt;
@@ -1031,51 +1279,20 @@ void BinaryGen::hard_code_score(std::vector<size_t>& index, int32_t homcom_wt,
 
         // now we go through the SNP vector
 
-        lbptr = genotype.data();
-        uii = 0;
-        ulii = 0;
-        do
-        {
-            ulii = ~(*lbptr++);
-            if (uii + BITCT2 > m_unfiltered_sample_ct) {
-                ulii &= (ONELU << ((m_unfiltered_sample_ct & (BITCT2 - 1)) * 2))
-                        - ONELU;
-            }
-            ujj = 0;
-            while (ujj < BITCT) {
-                ukk = (ulii >> ujj) & 3;
-                auto&& sample_prs = m_prs_info[uii + (ujj / 2)];
-                // now we will get all genotypes (0, 1, 2, 3)
-                switch (ukk)
-                {
-                default:
-                    sample_prs.num_snp = sample_prs.num_snp * not_first + 1;
-                    sample_prs.prs = sample_prs.prs * not_first
-                                     + homcom_weight * stat * 0.5 - adj_score;
-                    break;
-                case 1:
-                    sample_prs.num_snp = sample_prs.num_snp * not_first + 1;
-                    sample_prs.prs = sample_prs.prs * not_first
-                                     + het_weight * stat * 0.5 - adj_score;
-                    break;
-                case 3:
-                    sample_prs.num_snp = sample_prs.num_snp * not_first + 1;
-                    sample_prs.prs = sample_prs.prs * not_first
-                                     + homrar_weight * stat * 0.5 - adj_score;
-                    break;
-                case 2:
-                    sample_prs.prs = sample_prs.prs * not_first + miss_score;
-                    sample_prs.num_snp =
-                        sample_prs.num_snp * not_first + miss_count;
-                    break;
-                }
-                ulii &= ~((3 * ONELU) << ujj);
-                ujj += 2;
-            }
-            uii += BITCT2;
-        } while (uii < m_sample_ct);
-        not_first = true;
+        // lookup table indexed by the 2-bit PLINK genotype code
+        const double weight[4] = {homrar_weight * stat * 0.5 - adj_score,
+                                  miss_score,
+                                  het_weight * stat * 0.5 - adj_score,
+                                  homcom_weight * stat * 0.5 - adj_score};
+        const int32_t count[4] = {1, (int32_t) miss_count, 1, 1};
+        score_block.push(weight, count);
+        if (score_block.full()) {
+            score_block.apply(scratch.prs_info.prs.data(),
+                              scratch.prs_info.num_snp.data(), not_first);
+        }
     }
+    score_block.apply(scratch.prs_info.prs.data(),
+                      scratch.prs_info.num_snp.data(), not_first);
 }
 
 
@@ -1129,7 +1346,9 @@ void BinaryGen::read_score(size_t start_index, size_t end_bound,
     }
 }
 
-void BinaryGen::read_score(std::vector<size_t>& index, bool reset_zero)
+void BinaryGen::read_score(Score_Scratch& scratch,
+                           const std::vector<size_t>& index,
+                           bool reset_zero) const
 {
     // because I don't want to touch the code in dosage_score, we will reset the
     // sample here
@@ -1139,15 +1358,15 @@ void BinaryGen::read_score(std::vector<size_t>& index, bool reset_zero)
         switch (m_model)
         {
         case MODEL::HETEROZYGOUS:
-            hard_code_score(index, 0, 1, 0, reset_zero);
+            hard_code_score(scratch, index, 0, 1, 0, reset_zero);
             break;
         case MODEL::DOMINANT:
-            hard_code_score(index, 0, 1, 1, reset_zero);
+            hard_code_score(scratch, index, 0, 1, 1, reset_zero);
             break;
         case MODEL::RECESSIVE:
-            hard_code_score(index, 0, 0, 1, reset_zero);
+            hard_code_score(scratch, index, 0, 0, 1, reset_zero);
             break;
-        default: hard_code_score(index, 0, 1, 2, reset_zero); break;
+        default: hard_code_score(scratch, index, 0, 1, 2, reset_zero); break;
         }
     }
     else
@@ -1155,11 +1374,15 @@ void BinaryGen::read_score(std::vector<size_t>& index, bool reset_zero)
         switch (m_model)
         {
         case MODEL::HETEROZYGOUS:
-            dosage_score(index, 0, 1, 0, reset_zero);
+            dosage_score(scratch, index, 0, 1, 0, reset_zero);
+            break;
+        case MODEL::DOMINANT:
+            dosage_score(scratch, index, 0, 1, 1, reset_zero);
+            break;
+        case MODEL::RECESSIVE:
+            dosage_score(scratch, index, 0, 0, 1, reset_zero);
             break;
-        case MODEL::DOMINANT: dosage_score(index, 0, 1, 1, reset_zero); break;
-        case MODEL::RECESSIVE: dosage_score(index, 0, 0, 1, reset_zero); break;
-        default: dosage_score(index, 0, 1, 2, reset_zero); break;
+        default: dosage_score(scratch, index, 0, 1, 2, reset_zero); break;
         }
         return;
     }
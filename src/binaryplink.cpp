@@ -173,9 +173,7 @@ std::vector<Sample_ID> BinaryPlink::gen_sample_vector()
     famfile.close();
     m_tmp_genotype.resize(unfiltered_sample_ctl * 2, 0);
     // m_prs_info.reserve(m_sample_ct);
-    for (size_t i = 0; i < m_sample_ct; ++i) {
-        m_prs_info.emplace_back(PRS());
-    }
+    m_prs_info.resize(m_sample_ct);
     m_in_regression.resize(m_sample_include.size(), 0);
     return sample_name;
 }
@@ -272,8 +270,8 @@ BinaryPlink::gen_snp_vector(const double geno, const double maf,
 
                 // SNP not found in the target file
 
-                if (target->m_existed_snps_index.find(bim_info[+BIM::RS])
-                    == target->m_existed_snps_index.end())
+                if (!target->m_existed_snps_index.contains(target->m_existed_snps,
+                                                           bim_info[+BIM::RS]))
                 {
 
                     continue;
@@ -298,6 +296,13 @@ BinaryPlink::gen_snp_vector(const double geno, const double maf,
                 {
                     continue;
                 }
+                // the genotypes of SNPs not in the base file are never read
+                if (m_base_filter
+                    && !m_base_snps.contains(bim_info[+BIM::RS]))
+                {
+                    m_num_not_in_base++;
+                    continue;
+                }
             }
             /** check if this is from a new chromosome **/
             if (chr.compare(prev_chr) != 0) {
@@ -372,9 +377,7 @@ BinaryPlink::gen_snp_vector(const double geno, const double maf,
                 continue;
             }
 
-            if (m_existed_snps_index.find(bim_info[+BIM::RS])
-                != m_existed_snps_index.end())
-            {
+            if (m_existed_snps_index.contains(snp_info, bim_info[+BIM::RS])) {
                 duplicated_snp.insert(bim_info[+BIM::RS]);
             }
             else if (!ambiguous(bim_info[+BIM::A1], bim_info[+BIM::A2])
@@ -437,7 +440,6 @@ BinaryPlink::gen_snp_vector(const double geno, const double maf,
                 m_num_ambig +=
                     ambiguous(bim_info[+BIM::A1], bim_info[+BIM::A2]);
                 if (!m_is_ref) {
-                    m_existed_snps_index[bim_info[+BIM::RS]] = snp_info.size();
                     // TODO: When working with SNP class, we need to add in the
                     // aA AA aa variable to avoid re-calculating the mean
                     if (has_count)
@@ -451,11 +453,13 @@ BinaryPlink::gen_snp_vector(const double geno, const double maf,
                                                   loc, bim_info[+BIM::A1],
                                                   bim_info[+BIM::A2], prefix,
                                                   byte_pos));
+                    m_existed_snps_index.insert(snp_info, snp_info.size() - 1);
                 }
                 else
                 {
                     auto&& target_index =
-                        target->m_existed_snps_index[bim_info[+BIM::RS]];
+                        target->m_existed_snps_index.find(
+                            target->m_existed_snps, bim_info[+BIM::RS]);
                     if (!target->m_existed_snps[target_index].matching(
                             chr_code, loc, bim_info[+BIM::A1],
                             bim_info[+BIM::A2], dummy))
@@ -641,35 +645,43 @@ void BinaryPlink::check_bed(const std::string& bed_name, size_t num_marker)
 BinaryPlink::~BinaryPlink() {}
 
 
-void BinaryPlink::read_score(std::vector<size_t>& index, bool reset_zero)
+void BinaryPlink::read_score(Score_Scratch& scratch,
+                             const std::vector<size_t>& index,
+                             bool reset_zero) const
 {
     // region_index should be the background index
     switch (m_model)
     {
-    case MODEL::HETEROZYGOUS: read_score(index, 0, 1, 0, reset_zero); break;
-    case MODEL::DOMINANT: read_score(index, 0, 1, 1, reset_zero); break;
-    case MODEL::RECESSIVE: read_score(index, 0, 0, 1, reset_zero); break;
-    default: read_score(index, 0, 1, 2, reset_zero); break;
+    case MODEL::HETEROZYGOUS:
+        read_score(scratch, index, 0, 1, 0, reset_zero);
+        break;
+    case MODEL::DOMINANT:
+        read_score(scratch, index, 0, 1, 1, reset_zero);
+        break;
+    case MODEL::RECESSIVE:
+        read_score(scratch, index, 0, 0, 1, reset_zero);
+        break;
+    default:
+        read_score(scratch, index, 0, 1, 2, reset_zero);
+        break;
     }
 }
 
 
-void BinaryPlink::read_score(std::vector<size_t>& index_bound,
+void BinaryPlink::read_score(Score_Scratch& scratch,
+                             const std::vector<size_t>& index_bound,
                              uint32_t homcom_wt, uint32_t het_wt,
-                             uint32_t homrar_wt, bool reset_zero)
+                             uint32_t homrar_wt, bool reset_zero) const
 {
     double stat, maf, adj_score, miss_score;
     const uintptr_t final_mask = get_final_mask(m_sample_ct);
     // for array size
     const uintptr_t unfiltered_sample_ctl =
         BITCT_TO_WORDCT(m_unfiltered_sample_ct);
-    std::vector<uintptr_t> genotype(unfiltered_sample_ctl * 2, 0);
-    const uintptr_t unfiltered_sample_ct4 = (m_unfiltered_sample_ct + 3) / 4;
-    uintptr_t* lbptr;
-    uintptr_t ulii;
-    uint32_t uii;
-    uint32_t ujj;
-    uint32_t ukk;
+    auto&& score_block = scratch.score_block;
+    // the scratch is used by the threads of the competitive permutation, so
+    // its samples are not split across the thread pool
+    score_block.init(m_sample_ct, unfiltered_sample_ctl * 2, 1);
     uint32_t homrar_ct;
     uint32_t missing_ct = 0;
     uint32_t het_ct = 0;
@@ -684,47 +696,20 @@ void BinaryPlink::read_score(std::vector<size_t>& index_bound,
     const bool is_centre = (m_missing_score == MISSING_SCORE::CENTER);
     const bool mean_impute = (m_missing_score == MISSING_SCORE::MEAN_IMPUTE);
     bool not_first = !reset_zero;
-    m_cur_file = ""; // just close it
-    if (m_bed_file.is_open()) {
-        m_bed_file.close();
-    }
     // index is w.r.t. partition, which contain all the information
     for (auto&& i_snp : index_bound) {
         // for each SNP
-        auto&& cur_snp = m_existed_snps[i_snp];
-        if (m_cur_file.empty() || m_cur_file.compare(cur_snp.file_name()) != 0)
-        {
-            // If we are processing a new file
-            if (m_bed_file.is_open()) {
-                m_bed_file.close();
-            }
-            m_cur_file = cur_snp.file_name();
-            std::string bedname = m_cur_file + ".bed";
-            m_bed_file.open(bedname.c_str(), std::ios::binary);
-            if (!m_bed_file.is_open()) {
-                std::string error_message =
-                    "Error: Cannot open bed file: " + bedname;
-                throw std::runtime_error(error_message);
-            }
-            m_prev_loc = 0;
-        }
-        // current location of the snp in the bed file
-        // allow for quick jumping
-        // very useful for read score as most SNPs might not
-        // be next to each other
-        std::streampos cur_line = cur_snp.byte_pos();
-        if (m_prev_loc != cur_line
-            && !m_bed_file.seekg(cur_line, std::ios_base::beg))
-        {
-            throw std::runtime_error("Error: Cannot read the bed file!");
-        }
-        m_prev_loc = cur_line + (std::streampos) unfiltered_sample_ct4;
+        const SNP& cur_snp = m_existed_snps[i_snp];
+        uintptr_t* genotype = score_block.next_genotype();
+        // the bed files were opened by prepare_null_score
+        auto&& bed = m_bed_files.find(cur_snp.file_name());
         // loadbuf_raw is the temporary
         // loadbuff is where the genotype will be located
-        if (load_and_collapse_incl(m_unfiltered_sample_ct, m_sample_ct,
-                                   m_sample_include.data(), final_mask, false,
-                                   m_bed_file, m_tmp_genotype.data(),
-                                   genotype.data()))
+        if (bed == m_bed_files.end()
+            || load_and_collapse_incl(m_unfiltered_sample_ct, m_sample_ct,
+                                      m_sample_include.data(), final_mask,
+                                      false, bed->second, cur_snp.byte_pos(),
+                                      scratch.tmp_genotype.data(), genotype))
         {
             throw std::runtime_error("Error: Cannot read the bed file!");
         }
@@ -733,17 +718,15 @@ void BinaryPlink::read_score(std::vector<size_t>& index_bound,
         genovec_3freq(genotype.data(), sample_include2.data(), pheno_nm_ctv2,
                       &missing_ct, &het_ct, &homcom_ct);
                       */
+        // the SNPs are shared by all threads, so the counts are not cached
+        // here. They are normally already known from the observed PRS
         cur_snp.get_counts(homcom_ct, het_ct, homrar_ct, missing_ct);
         if (homcom_ct + het_ct + homrar_ct + missing_ct == 0) {
-            genovec_3freq(genotype.data(), m_sample_mask.data(), pheno_nm_ctv2,
+            genovec_3freq(genotype, m_sample_mask.data(), pheno_nm_ctv2,
                           &missing_ct, &het_ct, &homcom_ct);
-            cur_snp.set_counts(homcom_ct, het_ct, homrar_ct, missing_ct);
         }
         nanal = m_sample_ct - missing_ct;
-        if (nanal == 0) {
-            cur_snp.invalidate();
-            continue;
-        }
+        if (nanal == 0) continue;
         homcom_weight = homcom_wt;
         het_weight = het_wt;
         homrar_weight = homrar_wt;
@@ -765,51 +748,20 @@ void BinaryPlink::read_score(std::vector<size_t>& index_bound,
 
         // now we go through the SNP vector
 
-        lbptr = genotype.data();
-        uii = 0;
-        ulii = 0;
-        do
-        {
-            ulii = ~(*lbptr++);
-            if (uii + BITCT2 > m_unfiltered_sample_ct) {
-                ulii &= (ONELU << ((m_unfiltered_sample_ct & (BITCT2 - 1)) * 2))
-                        - ONELU;
-            }
-            ujj = 0;
-            while (ujj < BITCT) {
-                ukk = (ulii >> ujj) & 3;
-                auto&& sample_prs = m_prs_info[uii + (ujj / 2)];
-                // now we will get all genotypes (0, 1, 2, 3)
-                switch (ukk)
-                {
-                default:
-                    sample_prs.num_snp = sample_prs.num_snp * not_first + 1;
-                    sample_prs.prs = sample_prs.prs * not_first
-                                     + homcom_weight * stat * 0.5 - adj_score;
-                    break;
-                case 1:
-                    sample_prs.num_snp = sample_prs.num_snp * not_first + 1;
-                    sample_prs.prs = sample_prs.prs * not_first
-                                     + het_weight * stat * 0.5 - adj_score;
-                    break;
-                case 3:
-                    sample_prs.num_snp = sample_prs.num_snp * not_first + 1;
-                    sample_prs.prs = sample_prs.prs * not_first
-                                     + homrar_weight * stat * 0.5 - adj_score;
-                    break;
-                case 2:
-                    sample_prs.prs = sample_prs.prs * not_first + miss_score;
-                    sample_prs.num_snp =
-                        sample_prs.num_snp * not_first + miss_count;
-                    break;
-                }
-                ulii &= ~((3 * ONELU) << ujj);
-                ujj += 2;
-            }
-            uii += BITCT2;
-        } while (uii < m_sample_ct);
-        not_first = true;
+        // lookup table indexed by the 2-bit PLINK genotype code
+        const double weight[4] = {homrar_weight * stat * 0.5 - adj_score,
+                                  miss_score,
+                                  het_weight * stat * 0.5 - adj_score,
+                                  homcom_weight * stat * 0.5 - adj_score};
+        const int32_t count[4] = {1, (int32_t) miss_count, 1, 1};
+        score_block.push(weight, count);
+        if (score_block.full()) {
+            score_block.apply(scratch.prs_info.prs.data(),
+                              scratch.prs_info.num_snp.data(), not_first);
+        }
     }
+    score_block.apply(scratch.prs_info.prs.data(),
+                      scratch.prs_info.num_snp.data(), not_first);
 }
 
 
@@ -822,12 +774,6 @@ void BinaryPlink::read_score(size_t start_index, size_t end_bound,
     // for array size
     const uintptr_t unfiltered_sample_ctl =
         BITCT_TO_WORDCT(m_unfiltered_sample_ct);
-    const uintptr_t unfiltered_sample_ct4 = (m_unfiltered_sample_ct + 3) / 4;
-    uintptr_t* lbptr;
-    uintptr_t ulii;
-    uint32_t uii;
-    uint32_t ujj;
-    uint32_t ukk;
     uint32_t homrar_ct = 0;
     uint32_t missing_ct = 0;
     uint32_t het_ct = 0;
@@ -844,50 +790,23 @@ void BinaryPlink::read_score(size_t start_index, size_t end_bound,
     bool not_first = !set_zero;
     intptr_t nanal;
     double stat, maf, adj_score, miss_score;
-    m_cur_file = ""; // just close it
-    if (m_bed_file.is_open()) {
-        m_bed_file.close();
-    }
     // index is w.r.t. partition, which contain all the information
-    std::vector<uintptr_t> genotype(unfiltered_sample_ctl * 2, 0);
+    m_score_block.init(m_sample_ct, unfiltered_sample_ctl * 2, m_thread);
     for (size_t i_snp = start_index; i_snp < end_bound; ++i_snp) {
         // for each SNP
         auto&& cur_snp = m_existed_snps[i_snp];
-        if (m_cur_file.empty() || m_cur_file.compare(cur_snp.file_name()) != 0)
-        {
-            // If we are processing a new file
-            if (m_bed_file.is_open()) {
-                m_bed_file.close();
-            }
-            m_cur_file = cur_snp.file_name();
-            std::string bedname = m_cur_file + ".bed";
-            m_bed_file.open(bedname.c_str(), std::ios::binary);
-            if (!m_bed_file.is_open()) {
-                std::string error_message =
-                    "Error: Cannot open bed file: " + bedname;
-                throw std::runtime_error(error_message);
-            }
-            m_prev_loc = 0;
-        }
+        uintptr_t* genotype = m_score_block.next_genotype();
         // only read this SNP if it falls within our region of interest
         if (!cur_snp.in(region_index)) continue;
-        // current location of the snp in the bed file
-        // allow for quick jumping
-        // very useful for read score as most SNPs might not
-        // be next to each other
-        std::streampos cur_line = cur_snp.byte_pos();
-        if (m_prev_loc != cur_line
-            && !m_bed_file.seekg(cur_line, std::ios_base::beg))
-        {
-            throw std::runtime_error("Error: Cannot read the bed file!");
-        }
-        m_prev_loc = cur_line + (std::streampos) unfiltered_sample_ct4;
+        auto&& bed = bed_file(cur_snp.file_name());
+        // SNPs are sorted by their position in the file
+        bed.advise_sequential();
         // loadbuf_raw is the temporary
         // loadbuff is where the genotype will be located
         if (load_and_collapse_incl(m_unfiltered_sample_ct, m_sample_ct,
                                    m_sample_include.data(), final_mask, false,
-                                   m_bed_file, m_tmp_genotype.data(),
-                                   genotype.data()))
+                                   bed, cur_snp.byte_pos(),
+                                   m_tmp_genotype.data(), genotype))
         {
             throw std::runtime_error("Error: Cannot read the bed file!");
         }
@@ -900,7 +819,7 @@ void BinaryPlink::read_score(size_t start_index, size_t end_bound,
             cur_snp.get_counts(homcom_ct, het_ct, homrar_ct, missing_ct);
 
         if (!has_count) {
-            genovec_3freq(genotype.data(), m_sample_mask.data(), pheno_nm_ctv2,
+            genovec_3freq(genotype, m_sample_mask.data(), pheno_nm_ctv2,
                           &missing_ct, &het_ct, &homcom_ct);
             cur_snp.set_counts(homcom_ct, het_ct, homrar_ct, missing_ct);
         }
@@ -932,51 +851,20 @@ void BinaryPlink::read_score(size_t start_index, size_t end_bound,
 
         // now we go through the SNP vector
 
-        lbptr = genotype.data();
-        uii = 0;
-        ulii = 0;
-        do
-        {
-            ulii = ~(*lbptr++);
-            if (uii + BITCT2 > m_unfiltered_sample_ct) {
-                ulii &= (ONELU << ((m_unfiltered_sample_ct & (BITCT2 - 1)) * 2))
-                        - ONELU;
-            }
-            ujj = 0;
-            while (ujj < BITCT) {
-                ukk = (ulii >> ujj) & 3;
-                auto&& sample_prs = m_prs_info[uii + (ujj / 2)];
-                // now we will get all genotypes (0, 1, 2, 3)
-                switch (ukk)
-                {
-                default:
-                    sample_prs.num_snp = sample_prs.num_snp * not_first + 1;
-                    sample_prs.prs = sample_prs.prs * not_first
-                                     + homcom_weight * stat * 0.5 - adj_score;
-                    break;
-                case 1:
-                    sample_prs.num_snp = sample_prs.num_snp * not_first + 1;
-                    sample_prs.prs = sample_prs.prs * not_first
-                                     + het_weight * stat * 0.5 - adj_score;
-                    break;
-                case 3:
-                    sample_prs.num_snp = sample_prs.num_snp * not_first + 1;
-                    sample_prs.prs = sample_prs.prs * not_first
-                                     + homrar_weight * stat * 0.5 - adj_score;
-                    break;
-                case 2:
-                    sample_prs.prs = sample_prs.prs * not_first + miss_score;
-                    sample_prs.num_snp =
-                        sample_prs.num_snp * not_first + miss_count;
-                    break;
-                }
-                ulii &= ~((3 * ONELU) << ujj);
-                ujj += 2;
-            }
-            uii += BITCT2;
-        } while (uii < m_sample_ct);
-        not_first = true;
+        // lookup table indexed by the 2-bit PLINK genotype code
+        const double weight[4] = {homrar_weight * stat * 0.5 - adj_score,
+                                  miss_score,
+                                  het_weight * stat * 0.5 - adj_score,
+                                  homcom_weight * stat * 0.5 - adj_score};
+        const int32_t count[4] = {1, (int32_t) miss_count, 1, 1};
+        m_score_block.push(weight, count);
+        if (m_score_block.full()) {
+            m_score_block.apply(m_prs_info.prs.data(),
+                                m_prs_info.num_snp.data(), not_first);
+        }
     }
+    m_score_block.apply(m_prs_info.prs.data(), m_prs_info.num_snp.data(),
+                        not_first);
 }
 void BinaryPlink::read_score(size_t start_index, size_t end_bound,
                              const size_t region_index, bool set_zero)
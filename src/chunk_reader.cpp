@@ -0,0 +1,352 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "chunk_reader.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+bool Chunk_Reader::is_bgzf_header(const unsigned char* data, size_t size,
+                                  size_t& block_size)
+{
+    // gzip member with FEXTRA set, and a BC subfield holding the block size
+    // (see the SAM specification)
+    if (size < 18 || data[0] != 31 || data[1] != 139 || data[2] != 8
+        || (data[3] & 4) == 0)
+        return false;
+    const size_t extra_length = data[10] | (data[11] << 8);
+    if (size < 12 + extra_length) return false;
+    size_t i_extra = 12;
+    while (i_extra + 4 <= 12 + extra_length) {
+        const size_t sub_length = data[i_extra + 2] | (data[i_extra + 3] << 8);
+        if (data[i_extra] == 'B' && data[i_extra + 1] == 'C'
+            && sub_length == 2 && i_extra + 6 <= 12 + extra_length)
+        {
+            block_size =
+                static_cast<size_t>(data[i_extra + 4] | (data[i_extra + 5] << 8))
+                + 1;
+            return block_size >= 12 + extra_length + 8;
+        }
+        i_extra += 4 + sub_length;
+    }
+    return false;
+}
+
+bool Chunk_Reader::open(const std::string& file_name)
+{
+    close();
+    std::ifstream file(file_name.c_str(), std::ios::binary | std::ios::ate);
+    if (!file.is_open()) return false;
+    m_file_size = static_cast<size_t>(file.tellg());
+    file.close();
+    m_file_name = file_name;
+    const size_t dot = file_name.find_last_of(".");
+    m_gz_input =
+        (dot != std::string::npos && file_name.substr(dot + 1) == "gz");
+    if (m_file_size != 0) {
+        m_mmap.open(file_name);
+        m_mmap.advise_sequential();
+    }
+    if (!m_gz_input) return true;
+    size_t block_size = 0;
+    m_bgzf = m_mmap.is_open()
+             && is_bgzf_header(m_mmap.data(), m_mmap.size(), block_size);
+    if (m_bgzf) {
+        m_producer = std::thread(&Chunk_Reader::inflate_bgzf, this);
+        return true;
+    }
+    // normal gz file are read through zlib, which also handle concatenated
+    // gz members
+    m_mmap.close();
+    m_gz = gzopen(file_name.c_str(), "rb");
+    if (m_gz == nullptr) return false;
+    gzbuffer(m_gz, 1 << 18);
+    m_producer = std::thread(&Chunk_Reader::inflate_gz, this);
+    return true;
+}
+
+void Chunk_Reader::close()
+{
+    if (m_producer.joinable()) {
+        // the producer might be waiting for space in the queue, so we keep
+        // taking its blocks until it acknowledge the stop
+        m_stop = true;
+        Gz_Block block;
+        while (!m_eof) {
+            m_queue.pop(block);
+            m_eof = block.last;
+        }
+        m_producer.join();
+    }
+    if (m_gz != nullptr) gzclose(m_gz);
+    m_gz = nullptr;
+    m_mmap.close();
+    m_remain.clear();
+    m_file_name.clear();
+    m_remain_start = 0;
+    m_offset = 0;
+    m_file_size = 0;
+    m_gz_input = false;
+    m_bgzf = false;
+    m_stop = false;
+    m_eof = false;
+}
+
+void Chunk_Reader::inflate_gz()
+{
+    bool finished = false;
+    while (!finished) {
+        Gz_Block block;
+        block.data.resize(m_chunk_size);
+        const int num_read = gzread(m_gz, block.data.data(),
+                                    static_cast<unsigned>(m_chunk_size));
+        if (num_read < 0) {
+            block.error = "Error: Failed to decompress " + m_file_name;
+            block.data.clear();
+        }
+        else
+        {
+            block.data.resize(static_cast<size_t>(num_read));
+        }
+        block.offset = static_cast<size_t>(gzoffset(m_gz));
+        block.last = (num_read <= 0) || m_stop;
+        finished = block.last;
+        m_queue.push(std::move(block), max_queued_blocks);
+    }
+}
+
+void Chunk_Reader::inflate_bgzf_blocks(
+    const std::vector<Bgzf_Block>& bgzf_blocks, size_t begin, size_t end,
+    std::vector<char>& output) const
+{
+    size_t total = 0;
+    for (size_t i = begin; i < end; ++i) total += bgzf_blocks[i].inflated_length;
+    // one extra byte so that next_out is never null, and so that we can tell
+    // when a block inflate to more than its ISIZE
+    output.resize(total + 1);
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    // 16 + MAX_WBITS let zlib read the gzip header and check the CRC
+    if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+        throw std::runtime_error("Error: Failed to decompress " + m_file_name);
+    }
+    size_t output_offset = 0;
+    for (size_t i = begin; i < end; ++i) {
+        auto&& cur_block = bgzf_blocks[i];
+        stream.next_in =
+            const_cast<Bytef*>(m_mmap.data() + cur_block.offset);
+        stream.avail_in = static_cast<uInt>(cur_block.length);
+        stream.next_out =
+            reinterpret_cast<Bytef*>(output.data() + output_offset);
+        stream.avail_out = static_cast<uInt>(cur_block.inflated_length + 1);
+        const int status = inflate(&stream, Z_FINISH);
+        if (status != Z_STREAM_END || stream.avail_out != 1) {
+            inflateEnd(&stream);
+            throw std::runtime_error("Error: Failed to decompress "
+                                     + m_file_name + ", the file might be "
+                                                     "corrupted");
+        }
+        output_offset += cur_block.inflated_length;
+        inflateReset(&stream);
+    }
+    inflateEnd(&stream);
+    output.resize(total);
+}
+
+void Chunk_Reader::inflate_bgzf()
+{
+    // every worker inflate about m_chunk_size bytes before the results are
+    // queued in file order
+    const size_t file_size = m_mmap.size();
+    const unsigned char* data = m_mmap.data();
+    std::vector<Bgzf_Block> bgzf_blocks;
+    // index into bgzf_blocks where each worker start, plus the end
+    std::vector<size_t> task_start;
+    std::vector<std::vector<char>> output(m_num_thread);
+    std::vector<std::string> error_message(m_num_thread);
+    size_t offset = 0;
+    bool finished = false;
+    while (!finished) {
+        bgzf_blocks.clear();
+        task_start.assign(1, 0);
+        size_t inflated = 0;
+        while (task_start.size() <= m_num_thread && offset < file_size) {
+            Bgzf_Block cur_block;
+            if (!is_bgzf_header(data + offset, file_size - offset,
+                                cur_block.length)
+                || cur_block.length > file_size - offset)
+            {
+                Gz_Block block;
+                block.error = "Error: Malformed BGZF block in " + m_file_name;
+                block.last = true;
+                m_queue.push(std::move(block), max_queued_blocks);
+                return;
+            }
+            const unsigned char* isize = data + offset + cur_block.length - 4;
+            cur_block.offset = offset;
+            cur_block.inflated_length = static_cast<size_t>(isize[0])
+                                        | (static_cast<size_t>(isize[1]) << 8)
+                                        | (static_cast<size_t>(isize[2]) << 16)
+                                        | (static_cast<size_t>(isize[3]) << 24);
+            bgzf_blocks.push_back(cur_block);
+            offset += cur_block.length;
+            inflated += cur_block.inflated_length;
+            if (inflated >= m_chunk_size) {
+                task_start.push_back(bgzf_blocks.size());
+                inflated = 0;
+            }
+        }
+        if (task_start.back() != bgzf_blocks.size())
+            task_start.push_back(bgzf_blocks.size());
+        const size_t num_task = task_start.size() - 1;
+        auto worker = [&](size_t i_task) {
+            try
+            {
+                inflate_bgzf_blocks(bgzf_blocks, task_start[i_task],
+                                    task_start[i_task + 1], output[i_task]);
+            }
+            catch (const std::runtime_error& error)
+            {
+                error_message[i_task] = error.what();
+            }
+        };
+        Thread_Pool::global().run(num_task, worker);
+        finished = (offset >= file_size) || m_stop;
+        for (size_t i_task = 0; i_task < num_task; ++i_task) {
+            Gz_Block block;
+            block.data.swap(output[i_task]);
+            block.error.swap(error_message[i_task]);
+            block.offset =
+                (i_task + 1 == num_task)
+                    ? offset
+                    : bgzf_blocks[task_start[i_task + 1]].offset;
+            block.last = !block.error.empty()
+                         || (finished && i_task + 1 == num_task);
+            const bool failed = !block.error.empty();
+            m_queue.push(std::move(block), max_queued_blocks);
+            if (failed) return;
+        }
+        if (num_task == 0) {
+            // empty file
+            Gz_Block block;
+            block.offset = offset;
+            block.last = true;
+            m_queue.push(std::move(block), max_queued_blocks);
+        }
+    }
+}
+
+bool Chunk_Reader::fetch(std::vector<char>& buffer)
+{
+    if (m_eof) return false;
+    Gz_Block block;
+    m_queue.pop(block);
+    m_eof = block.last;
+    m_offset = block.offset;
+    if (!block.error.empty()) throw std::runtime_error(block.error);
+    buffer.insert(buffer.end(), block.data.begin(), block.data.end());
+    return true;
+}
+
+bool Chunk_Reader::getline(std::string& line)
+{
+    if (!m_gz_input) {
+        if (m_offset >= m_mmap.size()) return false;
+        const char* begin =
+            reinterpret_cast<const char*>(m_mmap.data()) + m_offset;
+        const size_t remain = m_mmap.size() - m_offset;
+        const char* new_line =
+            static_cast<const char*>(std::memchr(begin, '\n', remain));
+        const size_t length =
+            (new_line == nullptr) ? remain : static_cast<size_t>(new_line - begin);
+        line.assign(begin, length);
+        m_offset += (new_line == nullptr) ? length : length + 1;
+        return true;
+    }
+    size_t searched = m_remain_start;
+    while (true) {
+        auto&& new_line =
+            std::find(m_remain.begin() + searched, m_remain.end(), '\n');
+        if (new_line != m_remain.end()) {
+            line.assign(m_remain.begin() + m_remain_start, new_line);
+            m_remain_start = static_cast<size_t>(new_line - m_remain.begin()) + 1;
+            return true;
+        }
+        // drop the lines already returned before we get the next block
+        m_remain.erase(m_remain.begin(), m_remain.begin() + m_remain_start);
+        m_remain_start = 0;
+        searched = m_remain.size();
+        if (!fetch(m_remain)) {
+            if (m_remain.empty()) return false;
+            line.assign(m_remain.begin(), m_remain.end());
+            m_remain.clear();
+            return true;
+        }
+    }
+}
+
+bool Chunk_Reader::next(std::vector<char>& buffer, const char*& begin,
+                        const char*& end)
+{
+    if (!m_gz_input) {
+        const size_t file_size = m_mmap.size();
+        if (m_offset >= file_size) return false;
+        const char* data = reinterpret_cast<const char*>(m_mmap.data());
+        size_t block_end = std::min(m_offset + m_chunk_size, file_size);
+        // extend the block to the end of its last line
+        const char* new_line = static_cast<const char*>(
+            std::memchr(data + block_end - 1, '\n', file_size - block_end + 1));
+        block_end = (new_line == nullptr)
+                        ? file_size
+                        : static_cast<size_t>(new_line - data) + 1;
+        begin = data + m_offset;
+        end = data + block_end;
+        m_offset = block_end;
+        return true;
+    }
+    buffer.assign(m_remain.begin() + m_remain_start, m_remain.end());
+    m_remain.clear();
+    m_remain_start = 0;
+    size_t searched = 0;
+    while (true) {
+        const bool fetched = fetch(buffer);
+        // find the last complete line in the block
+        size_t last = buffer.size();
+        while (last > searched && buffer[last - 1] != '\n') --last;
+        if (last > searched) {
+            m_remain.assign(buffer.begin() + last, buffer.end());
+            buffer.resize(last);
+            break;
+        }
+        searched = buffer.size();
+        if (!fetched) {
+            if (buffer.empty()) return false;
+            break;
+        }
+    }
+    begin = buffer.data();
+    end = buffer.data() + buffer.size();
+    return true;
+}
+
+double Chunk_Reader::progress() const
+{
+    if (m_file_size == 0) return 100.0;
+    return std::min(100.0, static_cast<double>(m_offset)
+                               / static_cast<double>(m_file_size) * 100.0);
+}
@@ -51,6 +51,8 @@ Commander::Commander()
 
 
     clumping.no_clump = false;
+    clumping.sweep = false;
+    clumping.ld_cache = "";
     clumping.proxy = -1;
     clumping.p_value = 1;
     clumping.r2 = 0.1;
@@ -65,6 +67,7 @@ Commander::Commander()
     misc.print_all_scores = false;
     misc.ignore_fid = false;
     misc.logit_perm = false;
+    misc.score_perm = false;
     misc.memory = 0;
     misc.pearson = false;
     misc.permutation = 0;
@@ -75,6 +78,7 @@ Commander::Commander()
     misc.seed = 0;
 
     reference_panel.allow_inter = 0;
+    reference_panel.bgen_index = 0;
     reference_panel.file_name = "";
     reference_panel.multi_name = "";
     reference_panel.type = "bed";
@@ -126,6 +130,7 @@ Commander::Commander()
 
     target.include_nonfounders = false;
     target.name = "";
+    target.dosage_cache = "";
     target.multi_name = "";
     target.pheno_file = "";
     target.type = "bed";
@@ -167,6 +172,8 @@ bool Commander::init(int argc, char* argv[], Reporter& reporter)
         {"allow-inter", no_argument, &reference_panel.allow_inter, 1},
         {"all-score", no_argument, &misc.print_all_scores, 1},
         {"beta", no_argument, &base.is_beta, 1},
+        {"bgen-index", no_argument, &reference_panel.bgen_index, 1},
+        {"clump-sweep", no_argument, &clumping.sweep, 1},
         {"hard", no_argument, &prs_snp_filtering.is_hard_coded, 1},
         {"ignore-fid", no_argument, &misc.ignore_fid, 1},
         {"index", no_argument, &base.is_index, 1},
@@ -180,6 +187,7 @@ bool Commander::init(int argc, char* argv[], Reporter& reporter)
         {"nonfounders", no_argument, &target.include_nonfounders, 1},
         {"fastscore", no_argument, &p_thresholds.fastscore, 1},
         {"pearson", no_argument, &misc.pearson, 1},
+        {"score-perm", no_argument, &misc.score_perm, 1},
         {"print-snp", no_argument, &misc.print_snp, 1},
         // long flags, need to work on them
         {"A1", required_argument, NULL, 0},
@@ -193,6 +201,7 @@ bool Commander::init(int argc, char* argv[], Reporter& reporter)
         {"clump-p", required_argument, NULL, 0},
         {"clump-r2", required_argument, NULL, 0},
         {"cov-factor", required_argument, NULL, 0},
+        {"dosage-cache", required_argument, NULL, 0},
         {"exclude", required_argument, NULL, 0},
         {"extract", required_argument, NULL, 0},
         {"feature", required_argument, NULL, 0},
@@ -201,6 +210,7 @@ bool Commander::init(int argc, char* argv[], Reporter& reporter)
         {"info-base", required_argument, NULL, 0},
         {"info", required_argument, NULL, 0},
         {"keep", required_argument, NULL, 0},
+        {"ld-cache", required_argument, NULL, 0},
         {"ld-keep", required_argument, NULL, 0},
         {"ld-list", required_argument, NULL, 0},
         {"ld-type", required_argument, NULL, 0},
@@ -242,9 +252,9 @@ bool Commander::process(int argc, char* argv[], const char* optString,
 #ifdef _WIN32
     SYSTEM_INFO sysinfo;
     GetSystemInfo(&sysinfo);
-    max_threads = sysinfo.dwNumberOfProcessors;
+    max_threads = (known_procs == -1) ? 1 : known_procs;
     int32_t known_procs = max_threads;
-#else
+    max_threads = (known_procs == -1) ? 1 : known_procs;
     int32_t known_procs = sysconf(_SC_NPROCESSORS_ONLN);
     max_threads = (known_procs == -1) ? 1 : known_procs;
 #endif
@@ -332,6 +342,9 @@ bool Commander::process(int argc, char* argv[], const char* optString,
                            command, error_messages);
             }
             // Long opts for reference_panel
+            else if (command.compare("ld-cache") == 0)
+                set_string(optarg, message_store, clumping.ld_cache, dummy,
+                           command, error_messages);
             else if (command.compare("ld-keep") == 0)
                 set_string(optarg, message_store, reference_panel.keep_file,
                            dummy, command, error_messages);
@@ -433,6 +446,9 @@ bool Commander::process(int argc, char* argv[], const char* optString,
                                  prslice.size, prslice.provided, error,
                                  command);
             // Long opts for target
+            else if (command.compare("dosage-cache") == 0)
+                set_string(optarg, message_store, target.dosage_cache, dummy,
+                           command, error_messages);
             else if (command.compare("keep") == 0)
                 set_string(optarg, message_store, target.keep_file, dummy,
                            command, error_messages);
@@ -588,6 +604,7 @@ bool Commander::process(int argc, char* argv[], const char* optString,
     if (base.is_beta) message_store["beta"] = "";
     if (base.is_index) message_store["index"] = "";
     if (base.no_default) message_store["no-default"] = "";
+    if (clumping.sweep) message_store["clump-sweep"] = "";
     if (clumping.no_clump) message_store["no-clump"] = "";
     if (prs_snp_filtering.is_hard_coded) message_store["hard"] = "";
     if (prs_snp_filtering.keep_ambig) message_store["keep-ambig"] = "";
@@ -595,12 +612,14 @@ bool Commander::process(int argc, char* argv[], const char* optString,
     if (misc.ignore_fid) message_store["ignore-fid"] = "";
     if (misc.logit_perm) message_store["logit-perm"] = "";
     if (misc.pearson) message_store["pearson"] = "";
+    if (misc.score_perm) message_store["score-perm"] = "";
     if (misc.print_snp) message_store["print-snp"] = "";
     if (p_thresholds.fastscore) message_store["fastscore"] = "";
     if (p_thresholds.no_full) message_store["no-full"] = "";
     if (prs_calculation.no_regress) message_store["no-regress"] = "";
     if (target.include_nonfounders) message_store["nonfounders"] = "";
     if (reference_panel.allow_inter) message_store["allow-intermediate"] = "";
+    if (reference_panel.bgen_index) message_store["bgen-index"] = "";
     std::chrono::time_point<std::chrono::system_clock> start;
     start = std::chrono::system_clock::now();
     std::time_t start_time = std::chrono::system_clock::to_time_t(start);
@@ -729,6 +748,15 @@ void Commander::set_help_message()
         "                            separated by comma without space. \n"
         "                            Default: T if --beta and F if --beta is "
         "not\n"
+        "    --dosage-cache          File storing the dosages of the BGEN "
+        "target.\n"
+        "                            If the file exists and was generated "
+        "from the same\n"
+        "                            target, samples and filters, the "
+        "dosages are read\n"
+        "                            from it. Otherwise, it is written when "
+        "the target\n"
+        "                            is loaded. Ignored with --hard\n"
         "    --geno                  Filter SNPs based on gentype missingness\n"
         "    --info                  Filter SNPs based on info score. Only "
         "used\n"
@@ -809,6 +837,13 @@ void Commander::set_help_message()
         "clumping\n"
         "                            reference and for hard coding PRS "
         "calculation\n"
+        "    --bgen-index            Read the variants of the BGEN files from "
+        "an index\n"
+        "                            (<bgen file>.idx) instead of scanning the "
+        "BGEN files.\n"
+        "                            The index is generated when it doesn't "
+        "exist or\n"
+        "                            when the BGEN file has changed\n"
         "    --hard-thres            Hard threshold for dosage data. Any call "
         "less than\n"
         "                            this will be treated as missing. Note "
@@ -835,6 +870,14 @@ void Commander::set_help_message()
           "                            Default: "
         + std::to_string(clumping.p_value)
         + "\n"
+          "    --clump-sweep           Calculate the LD in genomic order "
+          "instead of\n"
+          "                            p-value order, and clump using the "
+          "stored LD.\n"
+          "                            Gives the same result, but reads the "
+          "LD reference\n"
+          "                            sequentially at the cost of "
+          "computing more LD\n"
           "    --ld            | -L    LD reference file. Use for LD "
           "calculation. If not\n"
           "                            provided, will use the post-filtered "
@@ -843,6 +886,17 @@ void Commander::set_help_message()
           "chromosome input\n"
           "                            Please see --target for more "
           "information\n"
+          "    --ld-cache              File storing the LD calculated from the "
+          "LD reference.\n"
+          "                            If the file exists and was generated "
+          "from the same\n"
+          "                            reference and samples, the LD is read "
+          "from it\n"
+          "                            instead of calculated. Otherwise, or for "
+          "any\n"
+          "                            chromosome not covered by the file, the "
+          "LD is\n"
+          "                            calculated and written to the file\n"
           "    --ld-list               File containing prefix of LD reference "
           "files.\n"
           "                            Similar to --ld but allow more \n"
@@ -1080,6 +1134,12 @@ void Commander::set_help_message()
           "                            use value larger than 10,000\n"
           "    --print-snp             Print all SNPs used to construct the "
           "best PRS\n"
+          "    --score-perm            With --logit-perm, use the logistic "
+          "score test\n"
+          "                            for the permutations instead of "
+          "refitting the\n"
+          "                            logistic model. Much faster but "
+          "approximate\n"
           "    --seed          | -s    Seed used for permutation. If not "
           "provided,\n"
           "                            system time will be used as seed. When "
@@ -1115,31 +1175,14 @@ void Commander::base_check(std::map<std::string, std::string>& message,
         // check the base file and get the corresponding index
 
         std::string line;
-        if (base.name.substr(base.name.find_last_of(".") + 1).compare("gz")
-            == 0)
-        {
-            GZSTREAM_NAMESPACE::igzstream in(base.name.c_str());
-            if (!in.good()) {
-                error = true;
-                error_message.append(
-                    "Error: Cannot open base file (gz) to read!\n");
-                return;
-            }
-            std::getline(in, line);
-            in.close();
-        }
-        else
-        {
-            std::ifstream base_test;
-            base_test.open(base.name.c_str());
-            if (!base_test.is_open()) {
-                error = true;
-                error_message.append("Error: Cannot open base file to read!\n");
-                return;
-            }
-            std::getline(base_test, line);
-            base_test.close();
+        Chunk_Reader base_test;
+        if (!base_test.open(base.name)) {
+            error = true;
+            error_message.append("Error: Cannot open base file to read!\n");
+            return;
         }
+        base_test.getline(line);
+        base_test.close();
         // check the base file header is correct
         std::vector<std::string> token = misc::split(line);
         int max_size = token.size();
@@ -1831,16 +1874,15 @@ void Commander::covariate_check(bool& error, std::string& error_message)
             included.insert(trans);
         }
     }
-    std::ifstream cov_file;
-    cov_file.open(covariate.file_name.c_str());
-    if (!cov_file.is_open()) {
+    Chunk_Reader cov_file;
+    if (!cov_file.open(covariate.file_name)) {
         error = true;
         error_message.append(
             "Error: Cannot open covariate file: " + covariate.file_name + "\n");
         return;
     }
     std::string line;
-    std::getline(cov_file, line);
+    cov_file.getline(line);
     if (line.empty()) {
         error = true;
         error_message.append("Error: First line of covariate file is empty!\n");
@@ -1915,6 +1957,11 @@ void Commander::filter_check(bool& error, std::string& error_message)
         error_message.append(
             "Error: Hard threshold must be between 0 and 1!\n");
     }
+    if (!target.dosage_cache.empty() && target.type.compare("bgen") != 0) {
+        error = true;
+        error_message.append(
+            "Error: --dosage-cache is only supported for bgen target!\n");
+    }
     if (!prs_snp_filtering.extract_file.empty()
         && !prs_snp_filtering.exclude_file.empty())
     {
@@ -1962,6 +2009,12 @@ void Commander::misc_check(std::map<std::string, std::string>& message,
         error_message.append(
             "Warning: Permutation not required, --logit-perm has no effect\n");
     }
+    if (!misc.logit_perm && misc.score_perm) {
+        error_message.append(
+            "Warning: --score-perm only works with --logit-perm, it has no "
+            "effect\n");
+        misc.score_perm = false;
+    }
     if (prs_calculation.no_regress) misc.print_all_scores = true;
     if (misc.thread == 1) message["thread"] = "1";
     message["out"] = misc.out;
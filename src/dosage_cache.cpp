@@ -0,0 +1,172 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "dosage_cache.hpp"
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <sys/stat.h>
+
+const char Dosage_Cache::magic[9] = "PRSiceDC";
+const uint32_t Dosage_Cache::version;
+
+namespace
+{
+// magic, version, width, number of sample, variant and record, key length
+const uint64_t fixed_header_size =
+    8 + 2 * sizeof(uint32_t) + 3 * sizeof(uint64_t) + sizeof(uint32_t);
+
+template <typename T>
+void write(std::ofstream& file, const T& value)
+{
+    file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+T read(const unsigned char*& ptr)
+{
+    T value;
+    std::memcpy(&value, ptr, sizeof(T));
+    ptr += sizeof(T);
+    return value;
+}
+}
+
+uint64_t Dosage_Cache::data_offset() const
+{
+    const uint64_t size = fixed_header_size + m_key.size() + m_status.size();
+    // start the records on a new cache line
+    return (size + 63) / 64 * 64;
+}
+
+bool Dosage_Cache::load(const std::string& file_name, const std::string& key,
+                        const size_t num_sample, const size_t num_variant)
+{
+    m_mmap.close();
+    m_reused = false;
+    struct stat file_stat;
+    if (stat(file_name.c_str(), &file_stat) != 0) return false;
+    m_mmap.open(file_name);
+    const unsigned char* ptr = m_mmap.data();
+    if (!m_mmap.contains(0, fixed_header_size)
+        || std::memcmp(ptr, magic, sizeof(magic) - 1) != 0)
+    {
+        m_mmap.close();
+        throw std::runtime_error("Error: " + file_name
+                                 + " is not a PRSice dosage cache file!");
+    }
+    ptr += sizeof(magic) - 1;
+    const uint32_t file_version = read<uint32_t>(ptr);
+    const uint32_t width = read<uint32_t>(ptr);
+    const uint64_t file_sample = read<uint64_t>(ptr);
+    const uint64_t file_variant = read<uint64_t>(ptr);
+    const uint64_t num_record = read<uint64_t>(ptr);
+    const uint32_t key_length = read<uint32_t>(ptr);
+    if (file_version != version || file_sample != num_sample
+        || file_variant != num_variant || key_length != key.size()
+        || !m_mmap.contains(fixed_header_size, key_length)
+        || key.compare(0, key.size(), reinterpret_cast<const char*>(ptr),
+                       key_length)
+               != 0)
+    {
+        m_mmap.close();
+        return false;
+    }
+    ptr += key_length;
+    m_key = key;
+    m_num_sample = num_sample;
+    m_width = width;
+    m_num_record = num_record;
+    m_status.resize(num_variant);
+    m_data_offset = data_offset();
+    if ((width != 0 && width != 8 && width != 16)
+        || !m_mmap.contains(m_data_offset, num_record * record_size()))
+    {
+        m_mmap.close();
+        throw std::runtime_error("Error: Dosage cache file is corrupted!");
+    }
+    std::memcpy(m_status.data(), ptr, num_variant);
+    m_file_name = file_name;
+    m_reused = true;
+    // records are read in the order they were written
+    m_mmap.advise_sequential();
+    return true;
+}
+
+void Dosage_Cache::create(const std::string& file_name, const std::string& key,
+                          const size_t num_sample, const size_t num_variant)
+{
+    m_mmap.close();
+    m_reused = false;
+    m_file_name = file_name;
+    m_key = key;
+    m_num_sample = num_sample;
+    m_num_record = 0;
+    m_width = 0;
+    m_status.assign(num_variant, Status::UNCHECKED);
+    m_data_offset = data_offset();
+    const std::string tmp_name = file_name + ".tmp";
+    m_records.open(tmp_name.c_str(), std::ios::binary | std::ios::trunc);
+    if (!m_records.is_open()) {
+        throw std::runtime_error("Error: Cannot open file: " + tmp_name
+                                 + " to write");
+    }
+    // the header is written by finish, when we know the number of records
+    const std::vector<char> header(m_data_offset, 0);
+    m_records.write(header.data(), header.size());
+}
+
+uint64_t Dosage_Cache::add(const unsigned char* record, const uint32_t width)
+{
+    if (m_width == 0) m_width = width;
+    if (width != m_width) {
+        throw std::runtime_error(
+            "Error: Inconsistent width in dosage cache record");
+    }
+    const uint64_t offset = record_offset(m_num_record);
+    m_records.write(reinterpret_cast<const char*>(record), record_size());
+    ++m_num_record;
+    return offset;
+}
+
+void Dosage_Cache::finish()
+{
+    if (!m_records.is_open()) return;
+    const std::string tmp_name = m_file_name + ".tmp";
+    m_records.seekp(0);
+    m_records.write(magic, sizeof(magic) - 1);
+    write(m_records, version);
+    write(m_records, m_width);
+    write(m_records, m_num_sample);
+    write(m_records, static_cast<uint64_t>(m_status.size()));
+    write(m_records, m_num_record);
+    write(m_records, static_cast<uint32_t>(m_key.size()));
+    m_records.write(m_key.data(), m_key.size());
+    m_records.write(reinterpret_cast<const char*>(m_status.data()),
+                    m_status.size());
+    m_records.close();
+    if (!m_records) {
+        throw std::runtime_error("Error: Failed to write the dosage cache: "
+                                 + tmp_name);
+    }
+    std::remove(m_file_name.c_str());
+    if (std::rename(tmp_name.c_str(), m_file_name.c_str()) != 0) {
+        throw std::runtime_error("Error: Failed to write the dosage cache: "
+                                 + m_file_name);
+    }
+    m_mmap.open(m_file_name);
+    m_mmap.advise_sequential();
+}
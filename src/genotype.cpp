@@ -16,6 +16,7 @@
 
 #include "genotype.hpp"
 
+const size_t Genotype::max_base_chunks;
 
 std::vector<std::string> Genotype::set_genotype_files(const std::string& prefix)
 {
@@ -127,9 +128,8 @@ void Genotype::init_chr(int num_auto, bool no_x, bool no_y, bool no_xy,
 std::unordered_set<std::string> Genotype::load_snp_list(std::string input,
                                                         Reporter& reporter)
 {
-    std::ifstream in;
-    in.open(input.c_str());
-    if (!in.is_open()) {
+    Chunk_Reader in;
+    if (!in.open(input)) {
         std::string error_message = "Error: Cannot open file: " + input;
         throw std::runtime_error(error_message);
     }
@@ -139,7 +139,7 @@ std::unordered_set<std::string> Genotype::load_snp_list(std::string input,
     std::string message;
     // allow the input to be slightly more flexible
     // determined by Header
-    std::getline(in, line);
+    in.getline(line);
     misc::trim(line);
     std::vector<std::string> token = misc::split(line);
     bool has_three_columns = (token.size() >= 3);
@@ -183,9 +183,9 @@ std::unordered_set<std::string> Genotype::load_snp_list(std::string input,
             "Only one column detected, will assume only SNP ID is provided";
         reporter.report(message);
     }
-    in.clear();
-    in.seekg(0, std::ios::beg);
-    while (std::getline(in, line)) {
+    // start again from the header
+    in.open(input);
+    while (in.getline(line)) {
         misc::trim(line);
         if (line.empty()) continue;
         std::vector<std::string> token = misc::split(line);
@@ -323,6 +323,10 @@ void Genotype::load_snps(const std::string out_prefix,
             std::to_string(m_num_maf_filter)
             + " variant(s) excluded based on INFO score threshold\n");
     }
+    if (m_num_not_in_base != 0) {
+        message.append(std::to_string(m_num_not_in_base)
+                       + " variant(s) not found in base file\n");
+    }
     if (!m_is_ref) {
         message.append(std::to_string(m_marker_ct) + " variant(s) included\n");
     }
@@ -333,10 +337,202 @@ void Genotype::load_snps(const std::string out_prefix,
     }
     if (verbose) reporter.report(message);
     m_snp_selection_list.clear();
+    m_base_snps.clear();
+    m_base_filter = false;
 }
 
 Genotype::~Genotype() {}
 
+void Genotype::parse_base_chunk(const std::vector<int>& index,
+                                Base_Chunk& chunk) const
+{
+    chunk.records.clear();
+    chunk.num_line = 0;
+    chunk.num_not_found = 0;
+    const size_t max_index = index[+BASE_INDEX::MAX];
+    // begin and end of each column, we don't need anything beyond max_index
+    std::vector<const char*> token_begin(max_index + 1),
+        token_end(max_index + 1);
+    const char* line_begin = chunk.begin;
+    while (line_begin < chunk.end) {
+        const char* line_end = static_cast<const char*>(
+            std::memchr(line_begin, '\n', chunk.end - line_begin));
+        if (line_end == nullptr) line_end = chunk.end;
+        const char* next_line = line_end + 1;
+        // same as misc::trim
+        while (line_begin < line_end && std::isspace(*line_begin)) ++line_begin;
+        while (line_end > line_begin && std::isspace(*(line_end - 1)))
+            --line_end;
+        if (line_begin == line_end) {
+            line_begin = next_line;
+            continue;
+        }
+        ++chunk.num_line;
+        // same as misc::split, with empty columns ignored
+        size_t num_token = 0;
+        const char* ptr = line_begin;
+        while (ptr < line_end && num_token <= max_index) {
+            while (ptr < line_end && (*ptr == '\t' || *ptr == ' ')) ++ptr;
+            if (ptr == line_end) break;
+            token_begin[num_token] = ptr;
+            while (ptr < line_end && *ptr != '\t' && *ptr != ' ') ++ptr;
+            token_end[num_token++] = ptr;
+        }
+        if (num_token <= max_index) {
+            // read_base will throw when it reach this record
+            Base_Record record;
+            record.line = line_begin;
+            record.line_length = static_cast<size_t>(line_end - line_begin);
+            record.column_error = true;
+            chunk.records.push_back(record);
+            return;
+        }
+        line_begin = next_line;
+        const int rs_col = index[+BASE_INDEX::RS];
+        const size_t snp_index = m_existed_snps_index.find(
+            m_existed_snps, token_begin[rs_col],
+            token_end[rs_col] - token_begin[rs_col]);
+        if (snp_index == SNP_Index::npos) {
+            ++chunk.num_not_found;
+            continue;
+        }
+        Base_Record record;
+        record.snp_index = snp_index;
+        const int chr_col = index[+BASE_INDEX::CHR];
+        if (chr_col >= 0) {
+            // get_chrom_code_raw needs a terminator after the chromosome
+            char chr[8] = {0};
+            std::memcpy(
+                chr, token_begin[chr_col],
+                std::min<size_t>(sizeof(chr) - 1,
+                                 token_end[chr_col] - token_begin[chr_col]));
+            record.chr_code = get_chrom_code_raw(chr);
+            if (token_end[chr_col] - token_begin[chr_col]
+                >= static_cast<std::ptrdiff_t>(sizeof(chr)))
+                record.chr_code = -1;
+        }
+        const int ref_col = index[+BASE_INDEX::REF];
+        if (ref_col >= 0) {
+            record.ref = token_begin[ref_col];
+            record.ref_length = token_end[ref_col] - token_begin[ref_col];
+        }
+        const int alt_col = index[+BASE_INDEX::ALT];
+        if (alt_col >= 0) {
+            record.alt = token_begin[alt_col];
+            record.alt_length = token_end[alt_col] - token_begin[alt_col];
+        }
+        const int bp_col = index[+BASE_INDEX::BP];
+        if (bp_col >= 0) {
+            record.loc_ok = misc::parse_int(token_begin[bp_col],
+                                            token_end[bp_col], record.loc)
+                            && record.loc >= 0;
+        }
+        const int maf_col = index[+BASE_INDEX::MAF];
+        if (maf_col >= 0) {
+            record.maf_ok = misc::parse_double(
+                token_begin[maf_col], token_end[maf_col], record.maf);
+        }
+        const int maf_case_col = index[+BASE_INDEX::MAF_CASE];
+        if (maf_case_col >= 0) {
+            record.maf_case_ok =
+                misc::parse_double(token_begin[maf_case_col],
+                                   token_end[maf_case_col], record.maf_case);
+        }
+        const int info_col = index[+BASE_INDEX::INFO];
+        if (info_col >= 0) {
+            record.info_ok = misc::parse_double(
+                token_begin[info_col], token_end[info_col], record.info_score);
+        }
+        const int p_col = index[+BASE_INDEX::P];
+        record.pvalue_ok = misc::parse_double(token_begin[p_col],
+                                              token_end[p_col], record.pvalue);
+        const int stat_col = index[+BASE_INDEX::STAT];
+        record.stat_ok = misc::parse_double(token_begin[stat_col],
+                                            token_end[stat_col], record.stat);
+        chunk.records.push_back(record);
+    }
+}
+
+void Genotype::load_base_snps(const Commander& c_commander)
+{
+    // SNP sets are looked up among the target SNPs before the base file is
+    // read, so all target SNPs are kept
+    if (!c_commander.single_snp_set().empty()
+        || !c_commander.multi_snp_sets().empty())
+        return;
+    const std::string input = c_commander.base_name();
+    const int rs_col = c_commander.index()[+BASE_INDEX::RS];
+    Chunk_Reader snp_file;
+    snp_file.set_thread(m_thread);
+    if (!snp_file.open(input)) {
+        std::string error_message = "Error: Cannot open base file: " + input;
+        throw std::runtime_error(error_message);
+    }
+    std::string line;
+    if (!c_commander.is_index()) snp_file.getline(line);
+    // the IDs are found on all threads, one block of lines per thread. Lines
+    // without the SNP column are left for read_base to report
+    struct ID_Chunk
+    {
+        const char* begin = nullptr;
+        const char* end = nullptr;
+        std::vector<std::pair<const char*, size_t>> ids;
+    };
+    const size_t num_thread = std::max<size_t>(
+        1, std::min<size_t>(m_thread, max_base_chunks));
+    std::vector<ID_Chunk> chunks(num_thread);
+    std::vector<std::vector<char>> buffers(num_thread);
+    m_base_snps.clear();
+    size_t num_chunk = num_thread;
+    while (num_chunk == num_thread) {
+        num_chunk = 0;
+        while (num_chunk < num_thread
+               && snp_file.next(buffers[num_chunk], chunks[num_chunk].begin,
+                                chunks[num_chunk].end))
+        {
+            ++num_chunk;
+        }
+        auto worker = [&](size_t i_chunk) {
+            auto&& chunk = chunks[i_chunk];
+            chunk.ids.clear();
+            const char* line_begin = chunk.begin;
+            while (line_begin < chunk.end) {
+                const char* line_end = static_cast<const char*>(
+                    std::memchr(line_begin, '\n', chunk.end - line_begin));
+                if (line_end == nullptr) line_end = chunk.end;
+                const char* next_line = line_end + 1;
+                // same tokenization as parse_base_chunk
+                while (line_begin < line_end && std::isspace(*line_begin))
+                    ++line_begin;
+                while (line_end > line_begin && std::isspace(*(line_end - 1)))
+                    --line_end;
+                const char* ptr = line_begin;
+                int column = 0;
+                while (ptr < line_end) {
+                    while (ptr < line_end && (*ptr == '\t' || *ptr == ' '))
+                        ++ptr;
+                    if (ptr == line_end) break;
+                    const char* token = ptr;
+                    while (ptr < line_end && *ptr != '\t' && *ptr != ' ')
+                        ++ptr;
+                    if (column++ == rs_col) {
+                        chunk.ids.emplace_back(token, ptr - token);
+                        break;
+                    }
+                }
+                line_begin = next_line;
+            }
+        };
+        Thread_Pool::global().run(num_chunk, worker);
+        for (size_t i_chunk = 0; i_chunk < num_chunk; ++i_chunk) {
+            for (auto&& id : chunks[i_chunk].ids)
+                m_base_snps.insert(id.first, id.second);
+        }
+    }
+    snp_file.close();
+    m_base_filter = true;
+}
+
 void Genotype::read_base(const Commander& c_commander, Region& region,
                          Reporter& reporter)
 {
@@ -344,8 +540,6 @@ void Genotype::read_base(const Commander& c_commander, Region& region,
 
     std::vector<int> index = c_commander.index();
     const std::string input = c_commander.base_name();
-    GZSTREAM_NAMESPACE::igzstream gz_snp_file;
-    std::ifstream snp_file;
     std::ofstream mismatch_snp_record;
     const double info_threshold = c_commander.base_info_score();
     const double maf_control = c_commander.maf_base_control();
@@ -355,26 +549,12 @@ void Genotype::read_base(const Commander& c_commander, Region& region,
     const bool no_full = c_commander.no_full();
     // now coordinates obtained from target file instead. Coordinate information
     // in base file only use for validation
-    bool gz_input = false;
-    if (input.substr(input.find_last_of(".") + 1).compare("gz") == 0) {
-        gz_snp_file.open(input.c_str());
-        if (!gz_snp_file.good()) {
-            std::string error_message =
-                "Error: Cannot open base file (gz) to read!\n";
-            throw std::runtime_error(error_message);
-        }
-        gz_input = true;
-    }
-
-    if (!gz_input) {
-        snp_file.open(input.c_str());
-        if (!snp_file.is_open()) {
-            std::string error_message =
-                "Error: Cannot open base file: " + input;
-            throw std::runtime_error(error_message);
-        }
+    Chunk_Reader snp_file;
+    snp_file.set_thread(m_thread);
+    if (!snp_file.open(input)) {
+        std::string error_message = "Error: Cannot open base file: " + input;
+        throw std::runtime_error(error_message);
     }
-    size_t max_index = index[+BASE_INDEX::MAX];
     std::string line;
     std::string message = "Base file: " + input + "\n";
     std::string mismatch_snp_record_name = c_commander.out() + ".mismatch";
@@ -386,7 +566,6 @@ void Genotype::read_base(const Commander& c_commander, Region& region,
     const double bound_inter = c_commander.inter();
 
     threshold = (!no_full) ? 1.0 : threshold;
-    std::vector<std::string> token;
 
     // exclude indicates we don't want this SNP
     // Some QC counts
@@ -394,7 +573,6 @@ void Genotype::read_base(const Commander& c_commander, Region& region,
     std::string ref_allele;
     std::string alt_allele;
     double maf = 1;
-    double info_score = 1;
     double pvalue = 2.0;
     double stat = 0.0;
     size_t num_duplicated = 0;
@@ -418,309 +596,273 @@ void Genotype::read_base(const Commander& c_commander, Region& region,
     int category = -1;
     double pthres = 0.0;
     int32_t chr_code;
-    std::unordered_set<std::string> dup_index;
 
     // Actual reading the file, will do a bunch of QC
-    size_t file_length = 0;
-    if (gz_input) {
-        // gzstream does not support seek, so we can't display progress bar
-        if (!c_commander.is_index()) {
-            std::getline(gz_snp_file, line);
+    if (!c_commander.is_index()) {
+        snp_file.getline(line);
+        if (snp_file.is_gz()) {
             message.append("GZ file detected. Header of file is:\n");
             message.append(line + "\n\n");
         }
-        reporter.report("Due to library restrictions, we cannot display "
-                        "progress bar for gz");
-    }
-    else
-    {
-        snp_file.seekg(0, snp_file.end);
-        file_length = snp_file.tellg();
-        snp_file.clear();
-        snp_file.seekg(0, snp_file.beg);
-        if (!c_commander.is_index()) std::getline(snp_file, line);
     }
     std::unordered_set<int> unique_thresholds;
     std::vector<bool> retain_snp(m_existed_snps.size(), false);
+    // replace the set of rs_id, as every SNP we see is in m_existed_snps
+    std::vector<bool> seen_snp(m_existed_snps.size(), false);
     double prev_progress = 0.0;
-
-    // very ugly, might want to use polymorphism (is this the right word) as an
-    // alternative solution
-    while ((!gz_input && std::getline(snp_file, line))
-           || (gz_input && std::getline(gz_snp_file, line)))
-    {
-        if (!gz_input) {
-            double progress =
-                (double) snp_file.tellg() / (double) (file_length) *100;
-            if (progress - prev_progress > 0.01) {
-                fprintf(stderr, "\rReading %03.2f%%", progress);
-                prev_progress = progress;
-            }
-        }
-        misc::trim(line);
-        if (line.empty()) continue;
-        num_line_in_base++;
-        exclude = false;
-        token = misc::split(line);
-        has_chr = false;
-        has_bp = false;
-        if (token.size() <= max_index) {
-            std::string error_message = line;
-            error_message.append("\nMore index than column in data");
-            throw std::runtime_error(error_message);
-        }
-
-        rs_id = token[index[+BASE_INDEX::RS]];
-        if (m_existed_snps_index.find(rs_id) != m_existed_snps_index.end()
-            && dup_index.find(rs_id) == dup_index.end())
+    // tokenizing and number conversion are done on all threads, one block of
+    // lines per thread. The QC is then done here in file order so that
+    // duplicates, the mismatch file and the error messages are the same as
+    // reading the file line by line
+    const size_t num_thread = std::max<size_t>(
+        1, std::min<size_t>(m_thread, max_base_chunks));
+    std::vector<Base_Chunk> chunks(num_thread);
+    std::vector<std::vector<char>> buffers(num_thread);
+    std::vector<std::string> error_message(num_thread);
+    size_t num_chunk = num_thread;
+    while (num_chunk == num_thread) {
+        num_chunk = 0;
+        while (num_chunk < num_thread
+               && snp_file.next(buffers[num_chunk], chunks[num_chunk].begin,
+                                chunks[num_chunk].end))
         {
-            dup_index.insert(rs_id);
-            auto&& cur_snp = m_existed_snps[m_existed_snps_index[rs_id]];
-            chr_code = -1;
-            if (index[+BASE_INDEX::CHR] >= 0) {
-                chr_code =
-                    get_chrom_code_raw(token[index[+BASE_INDEX::CHR]].c_str());
-                if (((const uint32_t) chr_code) > m_max_code) {
-                    if (chr_code != -1) {
-                        if (chr_code >= MAX_POSSIBLE_CHROM) {
-                            chr_code =
-                                m_xymt_codes[chr_code - MAX_POSSIBLE_CHROM];
-                            // this is the sex chromosomes
-                            // we don't need to output the error as they will be
-                            // filtered out before by the genotype read anyway
-                            exclude = true;
-                            num_haploid++;
-                        }
-                        else
-                        {
-                            exclude = true;
-                            chr_code = -1;
-                            num_chr_filter++;
+            ++num_chunk;
+        }
+        auto worker = [&](size_t i_chunk) {
+            try
+            {
+                parse_base_chunk(index, chunks[i_chunk]);
+            }
+            catch (const std::exception& error)
+            {
+                error_message[i_chunk] = error.what();
+            }
+        };
+        Thread_Pool::global().run(num_chunk, worker);
+        for (size_t i_chunk = 0; i_chunk < num_chunk; ++i_chunk) {
+            if (!error_message[i_chunk].empty())
+                throw std::runtime_error(error_message[i_chunk]);
+            num_line_in_base += chunks[i_chunk].num_line;
+            num_not_found += chunks[i_chunk].num_not_found;
+            for (auto&& record : chunks[i_chunk].records) {
+                if (record.column_error) {
+                    std::string error_message(record.line, record.line_length);
+                    error_message.append("\nMore index than column in data");
+                    throw std::runtime_error(error_message);
+                }
+                if (seen_snp[record.snp_index]) {
+                    num_duplicated++;
+                    continue;
+                }
+                seen_snp[record.snp_index] = true;
+                auto&& cur_snp = m_existed_snps[record.snp_index];
+                rs_id = cur_snp.rs();
+                exclude = false;
+                chr_code = record.chr_code;
+                if (index[+BASE_INDEX::CHR] >= 0) {
+                    if (((const uint32_t) chr_code) > m_max_code) {
+                        if (chr_code != -1) {
+                            if (chr_code >= MAX_POSSIBLE_CHROM) {
+                                chr_code =
+                                    m_xymt_codes[chr_code - MAX_POSSIBLE_CHROM];
+                                // this is the sex chromosomes
+                                // we don't need to output the error as they
+                                // will be filtered out before by the genotype
+                                // read anyway
+                                exclude = true;
+                                num_haploid++;
+                            }
+                            else
+                            {
+                                exclude = true;
+                                chr_code = -1;
+                                num_chr_filter++;
+                            }
                         }
                     }
+                    else if (is_set(m_haploid_mask.data(), chr_code)
+                             || chr_code == m_xymt_codes[X_OFFSET]
+                             || chr_code == m_xymt_codes[Y_OFFSET])
+                    {
+                        exclude = true;
+                        num_haploid++;
+                    }
                 }
-                else if (is_set(m_haploid_mask.data(), chr_code)
-                         || chr_code == m_xymt_codes[X_OFFSET]
-                         || chr_code == m_xymt_codes[Y_OFFSET])
-                {
-                    exclude = true;
-                    num_haploid++;
-                }
-            }
-            has_chr = (chr_code != -1);
-            ref_allele = (index[+BASE_INDEX::REF] >= 0)
-                             ? token[index[+BASE_INDEX::REF]]
-                             : "";
-            alt_allele = (index[+BASE_INDEX::ALT] >= 0)
-                             ? token[index[+BASE_INDEX::ALT]]
-                             : "";
-            std::transform(ref_allele.begin(), ref_allele.end(),
-                           ref_allele.begin(), ::toupper);
-            std::transform(alt_allele.begin(), alt_allele.end(),
-                           alt_allele.begin(), ::toupper);
-            int loc = -1;
-            if (index[+BASE_INDEX::BP] >= 0) {
-                // obtain the SNP coordinate
-                try
-                {
-                    loc = misc::convert<int>(
-                        token[index[+BASE_INDEX::BP]].c_str());
-                    if (loc < 0) {
+                has_chr = (chr_code != -1);
+                ref_allele.assign(record.ref, record.ref_length);
+                alt_allele.assign(record.alt, record.alt_length);
+                std::transform(ref_allele.begin(), ref_allele.end(),
+                               ref_allele.begin(), ::toupper);
+                std::transform(alt_allele.begin(), alt_allele.end(),
+                               alt_allele.begin(), ::toupper);
+                int loc = -1;
+                has_bp = false;
+                if (index[+BASE_INDEX::BP] >= 0) {
+                    if (!record.loc_ok) {
                         std::string error_message =
-                            "Error: " + rs_id + " has negative loci!\n";
+                            "Error: Non-numeric loci for " + rs_id + "!\n";
                         throw std::runtime_error(error_message);
                     }
+                    loc = record.loc;
                     has_bp = true;
                 }
-                catch (const std::runtime_error& error)
-                {
-                    std::string error_message =
-                        "Error: Non-numeric loci for " + rs_id + "!\n";
-                    throw std::runtime_error(error_message);
-                }
-            }
-            maf = 1;
-            maf_filtered = false;
-            if (index[+BASE_INDEX::MAF] >= 0) {
-                try
-                {
-                    maf = misc::convert<double>(
-                        token[index[+BASE_INDEX::MAF]].c_str());
-                }
-                catch (const std::runtime_error& error)
-                {
-                    num_maf_filter++;
-                    exclude = true;
-                    maf_filtered = true;
-                }
-                if (maf < maf_control) {
-                    num_maf_filter++;
-                    exclude = true;
-                    maf_filtered = true;
-                }
-            }
-            if (index[+BASE_INDEX::MAF_CASE] >= 0) {
-                try
-                {
-                    maf = misc::convert<double>(
-                        token[index[+BASE_INDEX::MAF_CASE]].c_str());
-                }
-                catch (const std::runtime_error& error)
-                {
-                    num_maf_filter += !maf_filtered;
-                    exclude = true;
-                }
-                if (maf < maf_case) {
-                    num_maf_filter += !maf_filtered;
-                    exclude = true;
+                maf = 1;
+                maf_filtered = false;
+                if (index[+BASE_INDEX::MAF] >= 0) {
+                    if (!record.maf_ok) {
+                        num_maf_filter++;
+                        exclude = true;
+                        maf_filtered = true;
+                    }
+                    else
+                    {
+                        maf = record.maf;
+                    }
+                    if (maf < maf_control) {
+                        num_maf_filter++;
+                        exclude = true;
+                        maf_filtered = true;
+                    }
                 }
-            }
-            info_score = 1;
-            if (index[+BASE_INDEX::INFO] >= 0) {
-                // obtain the INFO score
-                try
-                {
-                    info_score = misc::convert<double>(
-                        token[index[+BASE_INDEX::INFO]].c_str());
+                if (index[+BASE_INDEX::MAF_CASE] >= 0) {
+                    if (!record.maf_case_ok) {
+                        num_maf_filter += !maf_filtered;
+                        exclude = true;
+                    }
+                    else
+                    {
+                        maf = record.maf_case;
+                    }
+                    if (maf < maf_case) {
+                        num_maf_filter += !maf_filtered;
+                        exclude = true;
+                    }
                 }
-                catch (const std::runtime_error& error)
-                {
+                if (index[+BASE_INDEX::INFO] >= 0) {
                     // if no info score, just assume it doesn't pass the QC
-                    num_info_filter++;
-                    exclude = true;
-                }
-                if (info_score < info_threshold) {
-                    num_info_filter++;
-                    exclude = true;
+                    if (!record.info_ok) {
+                        num_info_filter++;
+                        exclude = true;
+                    }
+                    else if (record.info_score < info_threshold)
+                    {
+                        num_info_filter++;
+                        exclude = true;
+                    }
                 }
-            }
-            flipped = false;
-            if (!cur_snp.matching(chr_code, loc, ref_allele, alt_allele,
-                                  flipped))
-            {
-                // Mismatched SNPs
-                if (!mismatch_snp_record.is_open()) {
-                    mismatch_snp_record.open(mismatch_snp_record_name.c_str());
+                flipped = false;
+                if (!cur_snp.matching(chr_code, loc, ref_allele, alt_allele,
+                                      flipped))
+                {
+                    // Mismatched SNPs
                     if (!mismatch_snp_record.is_open()) {
-                        throw std::runtime_error(
-                            std::string("Cannot open mismatch file to write: "
-                                        + mismatch_snp_record_name));
+                        mismatch_snp_record.open(
+                            mismatch_snp_record_name.c_str());
+                        if (!mismatch_snp_record.is_open()) {
+                            throw std::runtime_error(std::string(
+                                "Cannot open mismatch file to write: "
+                                + mismatch_snp_record_name));
+                        }
+                        mismatch_snp_record
+                            << "File_Type\tRS_ID\tCHR_Target\tCHR_"
+                               "File\tBP_Target\tBP_File\tA1_"
+                               "Target\tA1_File\tA2_Target\tA2_"
+                               "File\n";
                     }
-                    mismatch_snp_record << "File_Type\tRS_ID\tCHR_Target\tCHR_"
-                                           "File\tBP_Target\tBP_File\tA1_"
-                                           "Target\tA1_File\tA2_Target\tA2_"
-                                           "File\n";
+                    std::string chr_out =
+                        (has_chr) ? std::to_string(chr_code) : "-";
+                    std::string loc_out = (has_bp) ? std::to_string(loc) : "-";
+                    std::string alt_allele_out =
+                        (alt_allele.empty()) ? "-" : alt_allele;
+                    mismatch_snp_record
+                        << "Base\t" << rs_id << "\t" << cur_snp.chr() << "\t"
+                        << chr_out << "\t" << cur_snp.loc() << "\t" << loc_out
+                        << "\t" << cur_snp.ref() << "\t" << ref_allele << "\t"
+                        << cur_snp.alt() << "\t" << alt_allele_out << "\n";
+                    num_mismatched++;
+                    exclude = true;
                 }
-                auto&& target_index = m_existed_snps_index[rs_id];
-                std::string chr_out =
-                    (has_chr) ? std::to_string(chr_code) : "-";
-                std::string loc_out = (has_bp) ? std::to_string(loc) : "-";
-                std::string alt_allele_out =
-                    (alt_allele.empty()) ? "-" : alt_allele;
-                mismatch_snp_record
-                    << "Base\t" << rs_id << "\t"
-                    << m_existed_snps[target_index].chr() << "\t" << chr_out
-                    << "\t" << m_existed_snps[target_index].loc() << "\t"
-                    << loc_out << "\t" << m_existed_snps[target_index].ref()
-                    << "\t" << ref_allele << "\t"
-                    << m_existed_snps[target_index].alt() << "\t"
-                    << alt_allele_out << "\n";
-                num_mismatched++;
-                exclude = true;
-            }
-            pvalue = 2.0;
-            try
-            {
-                pvalue = misc::convert<double>(token[index[+BASE_INDEX::P]]);
-                if (pvalue < 0.0 || pvalue > 1.0) {
-                    std::string error_message =
-                        "Error: Invalid p-value for " + rs_id + "!\n";
-                    throw std::runtime_error(error_message);
+                // p-value outside of [0, 1] is treated as not converted
+                pvalue = record.pvalue;
+                if (!record.pvalue_ok || pvalue < 0.0 || pvalue > 1.0) {
+                    pvalue = 2.0;
+                    exclude = true;
+                    num_not_converted++;
                 }
                 else if (pvalue > threshold)
                 {
                     exclude = true;
                     num_excluded++;
                 }
-            }
-            catch (const std::runtime_error& error)
-            {
-                exclude = true;
-                num_not_converted++;
-            }
-            stat = 0.0;
-            try
-            {
-                stat = misc::convert<double>(token[index[+BASE_INDEX::STAT]]);
-                if (stat < 0 && !beta) {
-                    num_negative_stat++;
+                stat = 0.0;
+                if (!record.stat_ok) {
+                    num_not_converted++;
                     exclude = true;
                 }
-                else if (!beta)
-                    stat = log(stat);
-            }
-            catch (const std::runtime_error& error)
-            {
-                num_not_converted++;
-                exclude = true;
-            }
-
-            if (!alt_allele.empty() && ambiguous(ref_allele, alt_allele)) {
-                num_ambiguous++;
-                exclude = !m_keep_ambig;
-            }
-            if (!exclude) {
-                category = -1;
-                pthres = 0.0;
-                if (fastscore) {
-                    category = c_commander.get_category(pvalue);
-                    pthres = c_commander.get_threshold(category);
-                }
                 else
                 {
-                    // calculate the threshold instead
-                    if (pvalue > bound_end && !no_full) {
-                        category = std::ceil((bound_end + 0.1 - bound_start)
-                                             / bound_inter);
-                        pthres = 1.0;
+                    stat = record.stat;
+                    if (stat < 0 && !beta) {
+                        num_negative_stat++;
+                        exclude = true;
+                    }
+                    else if (!beta)
+                        stat = log(stat);
+                }
+
+                if (!alt_allele.empty() && ambiguous(ref_allele, alt_allele)) {
+                    num_ambiguous++;
+                    exclude = !m_keep_ambig;
+                }
+                if (!exclude) {
+                    category = -1;
+                    pthres = 0.0;
+                    if (fastscore) {
+                        category = c_commander.get_category(pvalue);
+                        pthres = c_commander.get_threshold(category);
                     }
                     else
                     {
-                        category =
-                            std::ceil((pvalue - bound_start) / bound_inter);
-                        category = (category < 0) ? 0 : category;
-                        pthres = category * bound_inter + bound_start;
+                        // calculate the threshold instead
+                        if (pvalue > bound_end && !no_full) {
+                            category =
+                                std::ceil((bound_end + 0.1 - bound_start)
+                                          / bound_inter);
+                            pthres = 1.0;
+                        }
+                        else
+                        {
+                            category =
+                                std::ceil((pvalue - bound_start) / bound_inter);
+                            category = (category < 0) ? 0 : category;
+                            pthres = category * bound_inter + bound_start;
+                        }
+                    }
+                    if (flipped) cur_snp.set_flipped();
+                    // ignore the SE as it currently serves no purpose
+                    // cur_snp.set_retain();
+                    retain_snp[record.snp_index] = true;
+                    num_retained++;
+                    cur_snp.set_statistic(stat, pvalue, category, pthres);
+                    if (unique_thresholds.find(category)
+                        == unique_thresholds.end())
+                    {
+                        unique_thresholds.insert(category);
+                        m_thresholds.push_back(pthres);
+                        // m_categories.push_back(category);
                     }
+                    m_max_category =
+                        (m_max_category < category) ? category : m_max_category;
                 }
-                if (flipped) cur_snp.set_flipped();
-                // ignore the SE as it currently serves no purpose
-                // cur_snp.set_retain();
-                retain_snp[m_existed_snps_index[rs_id]] = true;
-                num_retained++;
-                cur_snp.set_statistic(stat, pvalue, category, pthres);
-                if (unique_thresholds.find(category) == unique_thresholds.end())
-                {
-                    unique_thresholds.insert(category);
-                    m_thresholds.push_back(pthres);
-                    // m_categories.push_back(category);
-                }
-                m_max_category =
-                    (m_max_category < category) ? category : m_max_category;
             }
         }
-        else if (dup_index.find(rs_id) != dup_index.end())
-        {
-            num_duplicated++;
-        }
-        else
-        {
-            num_not_found++;
+        double progress = snp_file.progress();
+        if (progress - prev_progress > 0.01) {
+            fprintf(stderr, "\rReading %03.2f%%", progress);
+            prev_progress = progress;
         }
     }
-    if (gz_input)
-        gz_snp_file.close();
-    else
-        snp_file.close();
+    snp_file.close();
 
     fprintf(stderr, "\rReading %03.2f%%\n", 100.0);
 
@@ -737,54 +879,20 @@ void Genotype::read_base(const Commander& c_commander, Region& region,
     }
 
     m_existed_snps_index.clear();
+    m_existed_snps_index.reserve(m_existed_snps.size());
+    // region flags of all SNPs are kept in one bit matrix, one row per SNP
+    const size_t region_word = BITCT_TO_WORDCT(region.size());
+    m_region_flags.assign(m_existed_snps.size() * region_word, 0);
     // now m_existed_snps is ok and can be used directly
     size_t vector_index = 0;
-    // we do it here such that the m_existed_snps is sorted correctly
-    size_t low_bound = 0, last_snp = 0;
-    int prev_chr = 0, prev_loc = 0;
-    m_max_window_size = 0;
     for (auto&& cur_snp : m_existed_snps) {
-        if (prev_chr != cur_snp.chr()) {
-            prev_chr = cur_snp.chr();
-            prev_loc = cur_snp.loc();
-            low_bound = vector_index;
-        }
-        else if (cur_snp.loc() - prev_loc > m_clump_distance)
-        {
-            while (cur_snp.loc() - prev_loc > m_clump_distance
-                   && low_bound < vector_index)
-            {
-                low_bound++;
-                prev_loc = m_existed_snps[low_bound].loc();
-            }
-        }
-        // now low_bound should be the first SNP where the core index SNP need
-        // to read from
-        cur_snp.set_low_bound(low_bound);
-        // set this as the default
-        cur_snp.set_up_bound(m_existed_snps.size());
-        // update all previous SNPs that are out bounud
-        while (m_existed_snps[last_snp].chr() != cur_snp.chr()
-               || cur_snp.loc() - m_existed_snps[last_snp].loc()
-                      > m_clump_distance)
-        {
-            int low_bound = m_existed_snps[last_snp].low_bound();
-            m_existed_snps[last_snp++].set_up_bound(vector_index);
-            if (m_max_window_size < vector_index - low_bound) {
-                m_max_window_size = vector_index - low_bound;
-            }
-        }
-        m_existed_snps_index[cur_snp.rs()] = vector_index++;
         // cur_snp.set_flag( region.check(cur_snp.chr(), cur_snp.loc()));
-        cur_snp.set_flag(region);
-    }
-    for (int i = m_existed_snps.size() - 1; i >= 0; i--) {
-        auto&& cur_snp = m_existed_snps[i];
-        if (cur_snp.up_bound() != m_existed_snps.size()) break;
-        if (m_max_window_size < cur_snp.up_bound() - cur_snp.low_bound()) {
-            m_max_window_size = cur_snp.up_bound() - cur_snp.low_bound();
-        }
+        cur_snp.set_flag(region,
+                         m_region_flags.data() + vector_index * region_word);
+        m_existed_snps_index.insert(m_existed_snps, vector_index++);
     }
+    // we do it here such that the m_existed_snps is sorted correctly
+    set_clump_bounds();
     // Suggest that we want to release memory
     // but this is only a suggest as this is non-binding request
     // Proper way of releasing memory will be to do swarp. Yet that
@@ -858,6 +966,55 @@ void Genotype::read_base(const Commander& c_commander, Region& region,
     m_num_threshold = unique_thresholds.size();
 }
 
+void Genotype::set_clump_bounds()
+{
+    // the window of each SNP is [low_bound, up_bound) of m_existed_snps
+    size_t vector_index = 0;
+    size_t low_bound = 0, last_snp = 0;
+    int prev_chr = 0, prev_loc = 0;
+    m_max_window_size = 0;
+    for (auto&& cur_snp : m_existed_snps) {
+        if (prev_chr != cur_snp.chr()) {
+            prev_chr = cur_snp.chr();
+            prev_loc = cur_snp.loc();
+            low_bound = vector_index;
+        }
+        else if (cur_snp.loc() - prev_loc > m_clump_distance)
+        {
+            while (cur_snp.loc() - prev_loc > m_clump_distance
+                   && low_bound < vector_index)
+            {
+                low_bound++;
+                prev_loc = m_existed_snps[low_bound].loc();
+            }
+        }
+        // now low_bound should be the first SNP where the core index SNP need
+        // to read from
+        cur_snp.set_low_bound(low_bound);
+        // set this as the default
+        cur_snp.set_up_bound(m_existed_snps.size());
+        // update all previous SNPs that are out bounud
+        while (m_existed_snps[last_snp].chr() != cur_snp.chr()
+               || cur_snp.loc() - m_existed_snps[last_snp].loc()
+                      > m_clump_distance)
+        {
+            int low_bound = m_existed_snps[last_snp].low_bound();
+            m_existed_snps[last_snp++].set_up_bound(vector_index);
+            if (m_max_window_size < vector_index - low_bound) {
+                m_max_window_size = vector_index - low_bound;
+            }
+        }
+        vector_index++;
+    }
+    for (int i = m_existed_snps.size() - 1; i >= 0; i--) {
+        auto&& cur_snp = m_existed_snps[i];
+        if (cur_snp.up_bound() != m_existed_snps.size()) break;
+        if (m_max_window_size < cur_snp.up_bound() - cur_snp.low_bound()) {
+            m_max_window_size = cur_snp.up_bound() - cur_snp.low_bound();
+        }
+    }
+}
+
 void Genotype::set_info(const Commander& c_commander, const bool ld)
 {
     m_clump_p = c_commander.clump_p();
@@ -865,10 +1022,38 @@ void Genotype::set_info(const Commander& c_commander, const bool ld)
     m_clump_proxy = c_commander.proxy();
     m_use_proxy = c_commander.use_proxy();
     m_clump_distance = c_commander.clump_dist();
+    m_clump_sweep = c_commander.clump_sweep();
+    m_ld_cache = c_commander.ld_cache();
     m_model = c_commander.model();
     m_missing_score = c_commander.get_missing_score();
     m_scoring = c_commander.get_score();
     m_seed = c_commander.seed();
+    m_max_memory = c_commander.max_memory(misc::total_ram_available());
+}
+
+std::string Genotype::ld_cache_key() const
+{
+    // the genotype files can be large, so they are identified by their size
+    // and modification time. The variant and sample files are small enough
+    // to be checksummed. The founders used capture the --ld-keep /
+    // --ld-remove selection
+    if (!m_ld_cache_key.empty()) return m_ld_cache_key;
+    std::string key;
+    for (auto&& file_name : genotype_file_names()) {
+        key.append(misc::file_signature(file_name) + ";");
+    }
+    std::vector<std::string> file_names = variant_file_names();
+    if (!m_sample_file.empty()) file_names.push_back(m_sample_file);
+    for (auto&& file_name : file_names) {
+        key.append(LD_Cache::checksum(file_name) + ";");
+    }
+    key.append(std::to_string(m_unfiltered_sample_ct) + ";"
+               + std::to_string(m_founder_ct) + ";"
+               + LD_Cache::checksum(m_founder_info.data(),
+                                    m_founder_info.size() * sizeof(uintptr_t))
+               + ";" + std::to_string(m_hard_threshold));
+    m_ld_cache_key = key;
+    return key;
 }
 
 double Genotype::get_r2(bool core_missing, std::vector<uint32_t>& index_tots,
@@ -1022,8 +1207,7 @@ void Genotype::pearson_clump(Genotype& reference, Reporter& reporter)
     // pre-allocate the memory without bothering the memory pool stuff
     std::vector<uint32_t> ld_missing_count(m_max_window_size);
     std::unordered_set<double> used_thresholds;
-    const double min_r2 =
-        (m_use_proxy) ? std::min(m_clump_proxy, m_clump_r2) : m_clump_r2;
+    const double min_r2 = clump_r2_floor();
     double dxx;
     double dyy;
     double cov12;
@@ -1097,13 +1281,13 @@ void Genotype::pearson_clump(Genotype& reference, Reporter& reporter)
 
     // size required for haplotype likelihood and pearson is different
 
-    size_t total_required_size = 0;
-    size_t require_size = founder_ct_192_long * sizeof(intptr_t);
-    require_size = round_up_pow2(require_size, CACHELINE);
-    total_required_size = require_size * 2;
-    require_size = m_max_window_size * founder_ct_192_long * sizeof(intptr_t);
-    require_size = round_up_pow2(require_size, CACHELINE);
-    total_required_size += require_size * 2;
+    // sizes are in bytes, the index SNP and its mask followed by the window
+    // and its masks
+    const size_t index_size =
+        round_up_pow2(founder_ct_192_long * sizeof(intptr_t), CACHELINE);
+    const size_t window_size = round_up_pow2(
+        m_max_window_size * founder_ct_192_long * sizeof(intptr_t), CACHELINE);
+    const size_t total_required_size = index_size * 2 + window_size * 2;
     malloc_size_mb =
         total_required_size * sizeof(intptr_t) / (sizeof(char) * 1048576) + 1;
     if (llxx) {
@@ -1148,12 +1332,9 @@ void Genotype::pearson_clump(Genotype& reference, Reporter& reporter)
     uintptr_t* geno_mask_ptr = nullptr;
     uintptr_t num_core_snps = 0;
     index_geno = (uintptr_t*) bigstack_initial_base;
-    require_size = round_up_pow2(require_size, CACHELINE);
-    index_mask = index_geno + require_size;
-    window_data = index_mask + require_size;
-    require_size = m_max_window_size * founder_ct_192_long * sizeof(intptr_t);
-    require_size = round_up_pow2(require_size, CACHELINE);
-    geno_mask = window_data + require_size;
+    index_mask = index_geno + index_size / sizeof(uintptr_t);
+    window_data = index_mask + index_size / sizeof(uintptr_t);
+    geno_mask = window_data + window_size / sizeof(uintptr_t);
 
     uintptr_t* window_data_ptr = nullptr;
     unsigned char* g_bigstack_end =
@@ -1256,8 +1437,14 @@ void Genotype::pearson_clump(Genotype& reference, Reporter& reporter)
             dp_result[2] = ld_missing_count[cur_index] - reference.founder_ct();
             dp_result[3] = dp_result[1];
             dp_result[4] = dp_result[2];
-            ld_dot_prod(window_data_ptr, index_geno, geno_mask_ptr, index_mask,
-                        dp_result, founder_ct_mld_m1, founder_ct_mld_rem);
+            if (!ld_kernel::ld_dot_prod(window_data_ptr, index_geno,
+                                        geno_mask_ptr, index_mask,
+                                        founder_ct_192_long, dp_result))
+            {
+                ld_dot_prod(window_data_ptr, index_geno, geno_mask_ptr,
+                            index_mask, dp_result, founder_ct_mld_m1,
+                            founder_ct_mld_rem);
+            }
             non_missing_ctd = (double) ((int32_t) non_missing_ct);
             dxx = dp_result[1];
             dyy = dp_result[2];
@@ -1303,8 +1490,14 @@ void Genotype::pearson_clump(Genotype& reference, Reporter& reporter)
             dp_result[2] = ld_missing_count[0] - reference.founder_ct();
             dp_result[3] = dp_result[1];
             dp_result[4] = dp_result[2];
-            ld_dot_prod(window_data_ptr, index_geno, geno_mask_ptr, index_mask,
-                        dp_result, founder_ct_mld_m1, founder_ct_mld_rem);
+            if (!ld_kernel::ld_dot_prod(window_data_ptr, index_geno,
+                                        geno_mask_ptr, index_mask,
+                                        founder_ct_192_long, dp_result))
+            {
+                ld_dot_prod(window_data_ptr, index_geno, geno_mask_ptr,
+                            index_mask, dp_result, founder_ct_mld_m1,
+                            founder_ct_mld_rem);
+            }
             non_missing_ctd = (double) ((int32_t) non_missing_ct);
             dxx = dp_result[1];
             dyy = dp_result[2];
@@ -1358,15 +1551,14 @@ void Genotype::efficient_clumping(Genotype& reference, Reporter& reporter,
                                   bool const use_pearson)
 {
     /*
-     *	Threading doesn't speed things up too much
-     *	but will increase the memory usage, leading to the malloc
-     *	error users experiencing. So we will now use only 1 thread.
-     *	Also, we will go through each SNP one by one, reading
-     *	the binary from the SNPs one at a time. Then remove it
-     *	right after. This should be the fastest for PRSice. The
-     *	problem with this method is that the clumping might take
-     *	longer for PRSet due to I/O burden in the worst case
-     *	scenario (repeatingly reading and discarding the same SNP)
+     *	We go through each index SNP one by one in p-value order. The
+     *	genotypes are kept in a cache (see Genotype_Cache) so that SNPs
+     *	shared by neighbouring windows are only read once when memory
+     *	allows. With multiple threads, index SNPs with non-overlapping
+     *	windows are clumped at the same time (see clump_in_batches).
+     *	With --clump-sweep, the LD is instead computed in genomic order
+     *	and the clumping is done on the resulting LD graph (see
+     *	sweep_clumping)
      */
     /*
      * we now starts with
@@ -1385,437 +1577,880 @@ void Genotype::efficient_clumping(Genotype& reference, Reporter& reporter,
         pearson_clump(reference, reporter);
         return;
     }
-    const uintptr_t unfiltered_sample_ctl =
-        BITCT_TO_WORDCT(reference.unfiltered_sample_ct());
-    const uint32_t founder_ctv3 =
-        BITCT_TO_ALIGNED_WORDCT(reference.founder_ct());
-    const uint32_t founder_ctsplit = 3 * founder_ctv3;
-    const uintptr_t founder_ctl2 = QUATERCT_TO_WORDCT(reference.founder_ct());
     const uintptr_t founder_ctv2 =
         QUATERCT_TO_ALIGNED_WORDCT(reference.founder_ct());
-    std::vector<uintptr_t> genotype_vector(unfiltered_sample_ctl * 2);
     std::vector<bool> remain_core(m_existed_snps.size(), false);
-    const double min_r2 =
-        (m_use_proxy) ? std::min(m_clump_proxy, m_clump_r2) : m_clump_r2;
-    bool is_x = false;
-    double freq11;
-    double freq11_expected;
-    double freq1x;
-    double freq2x;
-    double freqx1;
-    double freqx2;
-    double dxx;
-    double r2 = -1.0;
-    std::vector<uintptr_t> index_data(3 * founder_ctsplit + founder_ctv3);
-    std::vector<uint32_t> index_tots(6);
-    // pre-allocate the memory without bothering the memory pool stuff
-    std::vector<uint32_t> ld_missing_count(m_max_window_size);
+    const double min_r2 = clump_r2_floor();
     // kinda stupid for me to use it but let's forget about it now
     std::vector<uintptr_t> founder_include2(founder_ctv2, 0);
     fill_quatervec_55(reference.founder_ct(), founder_include2.data());
-    std::unordered_set<int> unique_threshold;
     std::unordered_set<double> used_thresholds;
     m_thresholds.clear();
-// reference must have sorted
-
-// try and get a workspace
-#ifdef __APPLE__
-    int32_t mib[2];
-    size_t sztmp;
-#endif
-    unsigned char* bigstack_ua = nullptr; // ua = unaligned
-    unsigned char* bigstack_initial_base;
-    int64_t llxx;
-    intptr_t default_alloc_mb;
-    intptr_t malloc_size_mb = 0;
-#ifdef __APPLE__
-    mib[0] = CTL_HW;
-    mib[1] = HW_MEMSIZE;
-    llxx = 0;
-
-    sztmp = sizeof(int64_t);
-    sysctl(mib, 2, &llxx, &sztmp, nullptr, 0);
-    llxx /= 1048576;
-#else
-#ifdef _WIN32
-    MEMORYSTATUSEX memstatus;
-    memstatus.dwLength = sizeof(memstatus);
-    GlobalMemoryStatusEx(&memstatus);
-    llxx = memstatus.ullTotalPhys / 1048576;
-#else
-    llxx = ((uint64_t) sysconf(_SC_PHYS_PAGES))
-           * ((size_t) sysconf(_SC_PAGESIZE)) / 1048576;
-#endif
-#endif
-    if (!llxx) {
-        default_alloc_mb = BIGSTACK_DEFAULT_MB;
+    uintptr_t num_core_snps = 0;
+    std::vector<Clump_Workspace> workspace;
+    if (!m_ld_cache.empty()) {
+        cached_clumping(reference, reporter, founder_include2.data(), min_r2,
+                        remain_core, num_core_snps);
     }
-    else if (llxx < (BIGSTACK_MIN_MB * 2))
+    else if (m_clump_sweep)
     {
-        default_alloc_mb = BIGSTACK_MIN_MB;
+        init_clump_workspace(reference, reporter, true, workspace);
+        LD_Graph graph;
+        build_ld_graph(reference, founder_include2.data(), min_r2, workspace,
+                       false, std::vector<bool>(), graph);
+        clump_ld_graph(graph, remain_core, num_core_snps);
     }
     else
     {
-        default_alloc_mb = llxx / 2;
+        init_clump_workspace(reference, reporter, false, workspace);
+        if (workspace.size() > 1) {
+            clump_in_batches(reference, founder_include2.data(), min_r2,
+                             workspace, remain_core, num_core_snps);
+        }
+        else
+        {
+            double prev_progress = -1.0;
+            const size_t num_snp = m_existed_snps.size();
+            for (size_t i_snp = 0; i_snp < num_snp; ++i_snp) {
+                double progress = (double) i_snp / (double) num_snp * 100;
+                if (progress - prev_progress > 0.01) {
+                    fprintf(stderr, "\rClumping Progress: %03.2f%%",
+                            progress);
+                    prev_progress = progress;
+                }
+                auto&& cur_snp_index = m_sort_by_p_index[i_snp];
+                // skip any SNPs that are clumped
+                auto&& cur_target_snp = m_existed_snps[cur_snp_index];
+                if (cur_target_snp.clumped()
+                    || cur_target_snp.p_value() > m_clump_p)
+                    continue;
+                clump_index_snp(reference, cur_snp_index,
+                                founder_include2.data(), min_r2, false,
+                                workspace.front());
+                remain_core[cur_snp_index] = true;
+                num_core_snps++;
+            }
+        }
     }
-    if (!malloc_size_mb) {
-        malloc_size_mb = default_alloc_mb;
+    fprintf(stderr, "\rClumping Progress: %03.2f%%\n\n", 100.0);
+    // thresholds are recorded in the order the index SNPs would be visited
+    for (auto&& cur_snp_index : m_sort_by_p_index) {
+        if (!remain_core[cur_snp_index]) continue;
+        double thres = m_existed_snps[cur_snp_index].get_threshold();
+        if (used_thresholds.find(thres) == used_thresholds.end()) {
+            used_thresholds.insert(thres);
+            m_thresholds.push_back(thres);
+        }
     }
-    else if (malloc_size_mb < BIGSTACK_MIN_MB)
-    {
-        malloc_size_mb = BIGSTACK_MIN_MB;
+    m_existed_snps_index.clear();
+    m_num_threshold = m_thresholds.size();
+    if (num_core_snps != m_existed_snps.size()) {
+        // remain_core_snps' follow the post sorted order (p-value sorted)
+        // instead of m_existed_snps' index so we need to sort it first
+        m_existed_snps.erase(
+            std::remove_if(
+                m_existed_snps.begin(), m_existed_snps.end(),
+                [&remain_core, this](const SNP& s) {
+                    return !remain_core[&s - &*begin(m_existed_snps)];
+                }),
+            m_existed_snps.end());
+        m_existed_snps.shrink_to_fit();
     }
+    m_existed_snps_index.clear();
+
+    // no longer require the m_existed_snps_index
     std::string message = "";
-#ifndef __LP64__
-    if (malloc_size_mb > 2047) {
-        malloc_size_mb = 2047;
+    message.append("Number of variant(s) after clumping : "
+                   + std::to_string(m_existed_snps.size()) + "\n");
+    reporter.report(message);
+}
+
+
+void Genotype::init_clump_workspace(Genotype& reference, Reporter& reporter,
+                                    const bool window_only,
+                                    std::vector<Clump_Workspace>& workspace)
+{
+    const uintptr_t unfiltered_sample_ctl =
+        BITCT_TO_WORDCT(reference.unfiltered_sample_ct());
+    const uint32_t founder_ctv3 =
+        BITCT_TO_ALIGNED_WORDCT(reference.founder_ct());
+    const uint32_t founder_ctsplit = 3 * founder_ctv3;
+    const uintptr_t founder_ctv2 =
+        QUATERCT_TO_ALIGNED_WORDCT(reference.founder_ct());
+    // index SNPs with non-overlapping windows (e.g. on different chromosomes)
+    // can be clumped in parallel, as long as the reference can be read from
+    // multiple threads
+    size_t num_clump_thread = 1;
+    if (m_thread > 1 && m_existed_snps.size() > 1) {
+        std::unordered_set<std::string> ref_files;
+        for (auto&& snp : m_existed_snps) ref_files.insert(snp.ref_file_name());
+        if (reference.prepare_concurrent_read(ref_files)) {
+            num_clump_thread = m_thread;
+        }
+    }
+    // each thread keeps the decoded genotypes in a cache that must at least
+    // hold one clumping window. Any memory left (bounded by --memory) is used
+    // to hold more SNPs, up to the size of the largest chromosome, at which
+    // point every SNP is only read once
+    size_t max_chr_snp = 0, chr_snp = 0;
+    for (size_t i_snp = 0; i_snp < m_existed_snps.size(); ++i_snp) {
+        if (i_snp == 0
+            || m_existed_snps[i_snp].chr() != m_existed_snps[i_snp - 1].chr())
+        {
+            chr_snp = 0;
+        }
+        max_chr_snp = std::max(max_chr_snp, ++chr_snp);
+    }
+    const size_t snp_memory = founder_ctv2 * sizeof(uintptr_t);
+    const size_t min_cache_size = m_max_window_size + 1;
+    const size_t used_memory = misc::current_ram_usage();
+    const size_t available_memory =
+        (m_max_memory > used_memory) ? (m_max_memory - used_memory) * 0.5 : 0;
+    if (num_clump_thread > 1) {
+        // use less threads if we don't have enough memory for all of them
+        num_clump_thread = std::max<size_t>(
+            1, std::min<size_t>(num_clump_thread,
+                                available_memory
+                                    / (min_cache_size * snp_memory)));
+    }
+    // the sweep never goes back, so it only needs one window
+    size_t cache_size =
+        window_only
+            ? min_cache_size
+            : std::max<size_t>(min_cache_size,
+                               std::min<size_t>(max_chr_snp,
+                                                available_memory
+                                                    / num_clump_thread
+                                                    / snp_memory));
+    workspace.resize(num_clump_thread);
+    while (true) {
+        try
+        {
+            for (auto&& cur_workspace : workspace) {
+                cur_workspace.cache.init(cache_size, founder_ctv2);
+            }
+            break;
+        }
+        catch (const std::bad_alloc&)
+        {
+            if (cache_size == min_cache_size) {
+                throw std::runtime_error(
+                    "Error: Not enough memory for clumping!");
+            }
+            cache_size = std::max(min_cache_size, (cache_size * 3) / 4);
+        }
     }
-#endif
+    for (auto&& cur_workspace : workspace) {
+        cur_workspace.index_data.resize(3 * founder_ctsplit + founder_ctv3);
+        cur_workspace.index_tots.resize(6);
+        if (num_clump_thread > 1) {
+            cur_workspace.rawbuf.resize(unfiltered_sample_ctl * 2);
+        }
+    }
+    std::string message =
+        std::to_string(m_max_memory / 1048576) + " MB RAM available; reserving "
+        + std::to_string(num_clump_thread * cache_size * snp_memory / 1048576
+                         + 1)
+        + " MB for clumping\n";
+    reporter.report(message);
+}
 
-    // size required for haplotype likelihood and pearson is different
-    malloc_size_mb =
-        (m_max_window_size + 1) * founder_ctv2 * sizeof(intptr_t) / 1048576 + 1;
-    if (llxx) {
-        message = std::to_string(llxx) + " MB RAM detected; reserving "
-                  + std::to_string(malloc_size_mb) + " MB for clumping\n";
+uintptr_t* Genotype::clump_genotype(Genotype& reference,
+                                    const size_t snp_index,
+                                    uintptr_t* founder_include2,
+                                    const bool concurrent,
+                                    Clump_Workspace& workspace)
+{
+    // the cache is at least as large as the window, so SNPs within the
+    // window never push each other out of the cache
+    uintptr_t* genotype = workspace.cache.find(snp_index);
+    if (genotype != nullptr) return genotype;
+    const uintptr_t founder_ctl2 = QUATERCT_TO_WORDCT(reference.founder_ct());
+    const uintptr_t founder_ctv2 =
+        QUATERCT_TO_ALIGNED_WORDCT(reference.founder_ct());
+    genotype = workspace.cache.insert(snp_index);
+    genotype[founder_ctv2 - 2] = 0;
+    genotype[founder_ctv2 - 1] = 0;
+    auto&& snp = m_existed_snps[snp_index];
+    if (concurrent) {
+        reference.read_genotype_concurrent(genotype, snp.ref_byte_pos(),
+                                           snp.ref_file_name(),
+                                           workspace.rawbuf.data());
     }
     else
     {
-        message = "Failed to calculate system memory. Attemping to reserve"
-                  + std::to_string(malloc_size_mb) + " MB for clumping\n";
+        reference.read_genotype(genotype, snp.ref_byte_pos(),
+                                snp.ref_file_name());
     }
-    bigstack_ua =
-        (unsigned char*) malloc(malloc_size_mb * 1048576 * sizeof(char));
-    // if fail, return nullptr which will then get into the while loop
-    while (!bigstack_ua) {
-        malloc_size_mb = (malloc_size_mb * 3) / 4;
-        if (malloc_size_mb < BIGSTACK_MIN_MB) {
-            malloc_size_mb = BIGSTACK_MIN_MB;
-        }
-        bigstack_ua =
-            (unsigned char*) malloc(malloc_size_mb * 1048576 * sizeof(char));
-        if (bigstack_ua) {
-            message.append(
-                "Allocated " + std::to_string(malloc_size_mb)
-                + " MB successfully, after larger attempt(s) failed\n");
+    uint32_t* geno_counts = workspace.cache.counts(snp_index);
+    genovec_3freq(genotype, founder_include2, founder_ctl2, &(geno_counts[0]),
+                  &(geno_counts[1]), &(geno_counts[2]));
+    return genotype;
+}
+
+void Genotype::set_clump_index(Genotype& reference, const size_t cur_snp_index,
+                               uintptr_t* founder_include2,
+                               const bool concurrent,
+                               Clump_Workspace& workspace)
+{
+    const uintptr_t founder_ctl2 = QUATERCT_TO_WORDCT(reference.founder_ct());
+    const uintptr_t founder_ctv2 =
+        QUATERCT_TO_ALIGNED_WORDCT(reference.founder_ct());
+    std::vector<uintptr_t>& index_data = workspace.index_data;
+    std::vector<uint32_t>& index_tots = workspace.index_tots;
+    uintptr_t* index_genotype = clump_genotype(
+        reference, cur_snp_index, founder_include2, concurrent, workspace);
+    std::fill(index_data.begin(), index_data.end(), 0);
+    vec_datamask(reference.founder_ct(), 0, index_genotype, founder_include2,
+                 index_data.data());
+    index_tots[0] = popcount2_longs(index_data.data(), founder_ctl2);
+    vec_datamask(reference.founder_ct(), 2, index_genotype, founder_include2,
+                 &(index_data[founder_ctv2]));
+    index_tots[1] = popcount2_longs(&(index_data[founder_ctv2]), founder_ctl2);
+    vec_datamask(reference.founder_ct(), 3, index_genotype, founder_include2,
+                 &(index_data[2 * founder_ctv2]));
+    index_tots[2] =
+        popcount2_longs(&(index_data[2 * founder_ctv2]), founder_ctl2);
+    workspace.index_complete = workspace.cache.counts(cur_snp_index)[0] == 0;
+}
+
+double Genotype::clump_r2(Genotype& reference, const size_t pair_snp_index,
+                          uintptr_t* founder_include2, const bool concurrent,
+                          Clump_Workspace& workspace)
+{
+    const uintptr_t founder_ctl2 = QUATERCT_TO_WORDCT(reference.founder_ct());
+    const uintptr_t founder_ctv2 =
+        QUATERCT_TO_ALIGNED_WORDCT(reference.founder_ct());
+    std::vector<uintptr_t>& index_data = workspace.index_data;
+    std::vector<uint32_t>& index_tots = workspace.index_tots;
+    bool is_x = false;
+    double freq11;
+    double freq11_expected;
+    double freq1x;
+    double freq2x;
+    double freqx1;
+    double freqx2;
+    double dxx;
+    double r2 = -1.0;
+    uintptr_t* pair_genotype = clump_genotype(
+        reference, pair_snp_index, founder_include2, concurrent, workspace);
+    uint32_t counts[18];
+    const uint32_t* pair_counts = workspace.cache.counts(pair_snp_index);
+    if (workspace.index_complete && pair_counts[0] == 0) {
+        // without missing calls, the index SNP is split into three
+        // disjoint bitplanes and we only need the counts on the het and
+        // homset planes. The hom-ref plane is the remainder
+        uint32_t plane_counts[4];
+        ld_kernel::genovec_bitplane_freq(
+            pair_genotype, &(index_data[founder_ctv2]),
+            &(index_data[2 * founder_ctv2]), founder_ctl2, plane_counts);
+        counts[0] = 0;
+        counts[1] = pair_counts[1] - plane_counts[0] - plane_counts[2];
+        counts[2] = pair_counts[2] - plane_counts[1] - plane_counts[3];
+        counts[3] = 0;
+        counts[4] = plane_counts[0];
+        counts[5] = plane_counts[1];
+        counts[6] = 0;
+        counts[7] = plane_counts[2];
+        counts[8] = plane_counts[3];
+    }
+    else
+    {
+        ld_kernel::genovec_3x3freq(pair_genotype, index_data.data(),
+                                   founder_ctv2, founder_ctl2, counts);
+    }
+    counts[0] = index_tots[0] - counts[0] - counts[1] - counts[2];
+    counts[3] = index_tots[1] - counts[3] - counts[4] - counts[5];
+    counts[6] = index_tots[2] - counts[6] - counts[7] - counts[8];
+    if (!em_phase_hethet_nobase(counts, is_x, is_x, &freq1x, &freq2x, &freqx1,
+                                &freqx2, &freq11))
+    {
+        freq11_expected = freqx1 * freq1x;
+        dxx = freq11 - freq11_expected;
+        // if r^2 threshold is 0, let everything else through but
+        // exclude the apparent zeroes.  Zeroes *are* included if
+        // r2_thresh is negative,
+        // though (only nans are rejected then).
+        if (fabs(dxx) < SMALL_EPSILON
+            || fabs(freq11_expected * freq2x * freqx2) < SMALL_EPSILON)
+        {
+            r2 = 0.0;
         }
-        else if (malloc_size_mb == BIGSTACK_MIN_MB)
+        else
         {
-            throw std::runtime_error("Failed to allocate required memory");
+            r2 = dxx * dxx / (freq11_expected * freq2x * freqx2);
         }
     }
-    // force 64-byte align to make cache line sensitivity work
-    reporter.report(message);
-    bigstack_initial_base =
-        (unsigned char*) round_up_pow2((uintptr_t) bigstack_ua, CACHELINE);
-
-    // we need this for pearson ld calculation
-    uintptr_t* window_data = nullptr;
-    uintptr_t num_core_snps = 0;
-    window_data = (uintptr_t*) bigstack_initial_base;
-    uintptr_t* window_data_ptr = nullptr;
-    unsigned char* g_bigstack_end =
-        &(bigstack_initial_base[(malloc_size_mb * 1048576
-                                 - (uintptr_t)(bigstack_initial_base
-                                               - bigstack_ua))
-                                & (~(CACHELINE - ONELU))]);
-    // m_max_window_size represent the maximum number of SNPs required for any
-    // one window
-    // and max_window_size is the number of windows we can handle in one round
-    // given the memory that we have
+    return r2;
+}
 
-    uintptr_t max_window_size =
-        (((uintptr_t) g_bigstack_end) - ((uintptr_t) bigstack_initial_base))
-        / (founder_ctv2 * sizeof(intptr_t));
-    if (use_pearson) {
-        // we need more memory for pearson because we also need the storage for
-        // the geno mask
-        max_window_size /= 2;
-    }
-    g_bigstack_end = nullptr;
-    uintptr_t cur_window_size = 0;
-    if (!max_window_size) {
-        throw std::runtime_error("Error: Not enough memory for clumping!");
+void Genotype::clump_index_snp(Genotype& reference, const size_t cur_snp_index,
+                               uintptr_t* founder_include2,
+                               const double min_r2, const bool concurrent,
+                               Clump_Workspace& workspace)
+{
+    auto&& cur_target_snp = m_existed_snps[cur_snp_index];
+    size_t start = cur_target_snp.low_bound();
+    size_t end = cur_target_snp.up_bound();
+    set_clump_index(reference, cur_snp_index, founder_include2, concurrent,
+                    workspace);
+    // transversing on TARGET
+    for (size_t i_pair = start; i_pair < end; ++i_pair) {
+        if (i_pair == cur_snp_index) continue;
+        auto&& pair_target_snp = m_existed_snps[i_pair];
+        if (pair_target_snp.clumped() || pair_target_snp.p_value() > m_clump_p)
+            continue;
+        double r2 = clump_r2(reference, i_pair, founder_include2, concurrent,
+                             workspace);
+        if (r2 >= min_r2) {
+            cur_target_snp.clump(pair_target_snp, r2, m_clump_proxy);
+        }
     }
-    // point to the middle of the bigstack?
-    double prev_progress = -1.0;
-    const size_t num_snp = m_existed_snps.size();
+    cur_target_snp.set_clumped();
+}
 
+void Genotype::build_ld_graph(Genotype& reference, uintptr_t* founder_include2,
+                              const double min_r2,
+                              std::vector<Clump_Workspace>& workspace,
+                              const bool all_pairs,
+                              const std::vector<bool>& skip_snp,
+                              LD_Graph& graph)
+{
+    // Instead of jumping around the genome in p-value order, go through the
+    // SNPs in genomic order and record every pair with r2 >= min_r2 in a
+    // sparse LD graph. For a pair, only the SNP that comes first in p-value
+    // order can clump the other (by the time the second one is processed,
+    // the first one is already clumped), so unless all_pairs is set, each
+    // pair is only computed once, with the same SNP as the index as in
+    // clump_index_snp. Otherwise, the r2 is computed in both direction
+    // regardless of the p-value, so that the graph can be used with any
+    // other base file (see --ld-cache).
+    // With multiple threads, each thread sweeps its own part of the genome
+    const size_t num_snp = m_existed_snps.size();
+    const size_t num_thread = workspace.size();
+    graph.offset.assign(num_snp + 1, 0);
+    graph.neighbour.clear();
+    graph.r2.clear();
+    if (num_snp == 0) return;
+    std::vector<size_t> rank(num_snp);
     for (size_t i_snp = 0; i_snp < num_snp; ++i_snp) {
-        double progress = (double) i_snp / (double) num_snp * 100;
-        if (progress - prev_progress > 0.01) {
-            fprintf(stderr, "\rClumping Progress: %03.2f%%", progress);
-            prev_progress = progress;
+        rank[m_sort_by_p_index[i_snp]] = i_snp;
+    }
+    auto include = [&](const size_t snp_index) {
+        return all_pairs || m_existed_snps[snp_index].p_value() <= m_clump_p;
+    };
+    std::vector<LD_Graph> partial_graph(num_thread);
+    std::vector<std::string> error_message(num_thread);
+    std::atomic<size_t> num_processed(0);
+    const size_t range_size = (num_snp + num_thread - 1) / num_thread;
+    auto worker = [&](const size_t i_thread) {
+        const size_t first = std::min(num_snp, i_thread * range_size);
+        const size_t last = std::min(num_snp, first + range_size);
+        LD_Graph& cur_graph = partial_graph[i_thread];
+        cur_graph.offset.assign(1, 0);
+        double prev_progress = -1.0;
+        try
+        {
+            for (size_t i_snp = first; i_snp < last; ++i_snp) {
+                if (i_thread == 0) {
+                    double progress =
+                        (double) num_processed / (double) num_snp * 100;
+                    if (progress - prev_progress > 0.01) {
+                        fprintf(stderr, "\rClumping Progress: %03.2f%%",
+                                progress);
+                        prev_progress = progress;
+                    }
+                }
+                ++num_processed;
+                if (include(i_snp) && (skip_snp.empty() || !skip_snp[i_snp]))
+                {
+                    auto&& cur_snp = m_existed_snps[i_snp];
+                    bool index_ready = false;
+                    for (size_t i_pair = cur_snp.low_bound();
+                         i_pair < cur_snp.up_bound(); ++i_pair)
+                    {
+                        if (i_pair == i_snp || !include(i_pair)
+                            || (!all_pairs && rank[i_pair] <= rank[i_snp]))
+                            continue;
+                        if (!index_ready) {
+                            set_clump_index(reference, i_snp, founder_include2,
+                                            num_thread > 1,
+                                            workspace[i_thread]);
+                            index_ready = true;
+                        }
+                        double r2 =
+                            clump_r2(reference, i_pair, founder_include2,
+                                     num_thread > 1, workspace[i_thread]);
+                        if (r2 >= min_r2) {
+                            cur_graph.neighbour.push_back(i_pair);
+                            cur_graph.r2.push_back(r2);
+                        }
+                    }
+                }
+                cur_graph.offset.push_back(cur_graph.neighbour.size());
+            }
         }
-        auto&& cur_snp_index = m_sort_by_p_index[i_snp];
-        // skip any SNPs that are clumped
+        catch (const std::runtime_error& error)
+        {
+            error_message[i_thread] = error.what();
+        }
+    };
+    Thread_Pool::global().run(num_thread, worker);
+    for (auto&& error : error_message) {
+        if (!error.empty()) throw std::runtime_error(error);
+    }
+    // merge the graph from each thread
+    size_t i_snp = 0;
+    for (auto&& cur_graph : partial_graph) {
+        for (size_t i = 1; i < cur_graph.offset.size(); ++i) {
+            graph.offset[i_snp + i] =
+                graph.neighbour.size() + cur_graph.offset[i];
+        }
+        i_snp += cur_graph.offset.size() - 1;
+        graph.neighbour.insert(graph.neighbour.end(),
+                               cur_graph.neighbour.begin(),
+                               cur_graph.neighbour.end());
+        graph.r2.insert(graph.r2.end(), cur_graph.r2.begin(),
+                        cur_graph.r2.end());
+        cur_graph = LD_Graph();
+    }
+}
+
+void Genotype::clump_ld_graph(const LD_Graph& graph,
+                              std::vector<bool>& remain_core,
+                              uintptr_t& num_core_snps)
+{
+    // the usual greedy clumping, in p-value order, but on the graph
+    for (auto&& cur_snp_index : m_sort_by_p_index) {
         auto&& cur_target_snp = m_existed_snps[cur_snp_index];
         if (cur_target_snp.clumped() || cur_target_snp.p_value() > m_clump_p)
             continue;
-        // with the new change, all SNPs are stored in target
-        // so we can safely ignore the finding in reference
-        // though we still need to get the sample size information
-        // from the reference panel
-        // Any SNP with p-value less than clump-p will be ignored
-        // because they can never be an index SNP and thus are not of our
-        // interested
-
-        // set the missing information
-        // contain_missing == 3 = has missing
-        size_t start = cur_target_snp.low_bound();
-        size_t end = cur_target_snp.up_bound();
-        window_data_ptr = window_data;
-        cur_window_size = 0;
-        // transversing on TARGET
-        for (size_t i_pair = start; i_pair < cur_snp_index; i_pair++) {
-            auto&& pair_target_snp = m_existed_snps[i_pair];
+        for (size_t i_edge = graph.offset[cur_snp_index];
+             i_edge < graph.offset[cur_snp_index + 1]; ++i_edge)
+        {
+            auto&& pair_target_snp = m_existed_snps[graph.neighbour[i_edge]];
             if (pair_target_snp.clumped()
                 || pair_target_snp.p_value() > m_clump_p)
                 continue;
-            window_data_ptr[founder_ctv2 - 2] = 0;
-            window_data_ptr[founder_ctv2 - 1] = 0;
-            if (++cur_window_size == max_window_size) {
-                throw std::runtime_error("Error: Out of memory!");
-            }
-            reference.read_genotype(window_data_ptr,
-                                    pair_target_snp.ref_byte_pos(),
-                                    pair_target_snp.ref_file_name());
-            window_data_ptr = &(window_data_ptr[founder_ctv2]);
+            cur_target_snp.clump(pair_target_snp, graph.r2[i_edge],
+                                 m_clump_proxy);
         }
+        cur_target_snp.set_clumped();
+        remain_core[cur_snp_index] = true;
+        num_core_snps++;
+    }
+}
 
-        if (++cur_window_size == max_window_size) {
-            throw std::runtime_error("Error: Out of memory!");
+std::vector<size_t> Genotype::chr_start() const
+{
+    std::vector<size_t> start;
+    for (size_t i_snp = 0; i_snp < m_existed_snps.size(); ++i_snp) {
+        if (i_snp == 0
+            || m_existed_snps[i_snp].chr() != m_existed_snps[i_snp - 1].chr())
+        {
+            start.push_back(i_snp);
         }
-        window_data_ptr[founder_ctv2 - 2] = 0;
-        window_data_ptr[founder_ctv2 - 1] = 0;
-        std::fill(index_data.begin(), index_data.end(), 0);
-        reference.read_genotype(window_data_ptr, cur_target_snp.ref_byte_pos(),
-                                cur_target_snp.ref_file_name());
-        vec_datamask(reference.founder_ct(), 0, window_data_ptr,
-                     founder_include2.data(), index_data.data());
-        index_tots[0] = popcount2_longs(index_data.data(), founder_ctl2);
-        vec_datamask(reference.founder_ct(), 2, window_data_ptr,
-                     founder_include2.data(), &(index_data[founder_ctv2]));
-        index_tots[1] =
-            popcount2_longs(&(index_data[founder_ctv2]), founder_ctl2);
-        vec_datamask(reference.founder_ct(), 3, window_data_ptr,
-                     founder_include2.data(), &(index_data[2 * founder_ctv2]));
-        index_tots[2] =
-            popcount2_longs(&(index_data[2 * founder_ctv2]), founder_ctl2);
-        window_data_ptr = window_data;
-        for (size_t i_pair = start; i_pair < cur_snp_index; i_pair++) {
-            auto&& pair_target_snp = m_existed_snps[i_pair];
-            if (pair_target_snp.clumped()
-                || pair_target_snp.p_value() > m_clump_p)
-                continue;
-            r2 = -1;
-            uint32_t counts[18];
-            genovec_3freq(window_data_ptr, index_data.data(), founder_ctl2,
-                          &(counts[0]), &(counts[1]), &(counts[2]));
-            counts[0] = index_tots[0] - counts[0] - counts[1] - counts[2];
-            genovec_3freq(window_data_ptr, &(index_data[founder_ctv2]),
-                          founder_ctl2, &(counts[3]), &(counts[4]),
-                          &(counts[5]));
-            counts[3] = index_tots[1] - counts[3] - counts[4] - counts[5];
-            genovec_3freq(window_data_ptr, &(index_data[2 * founder_ctv2]),
-                          founder_ctl2, &(counts[6]), &(counts[7]),
-                          &(counts[8]));
-            counts[6] = index_tots[2] - counts[6] - counts[7] - counts[8];
-            if (!em_phase_hethet_nobase(counts, is_x, is_x, &freq1x, &freq2x,
-                                        &freqx1, &freqx2, &freq11))
+    }
+    start.push_back(m_existed_snps.size());
+    return start;
+}
+
+bool Genotype::match_ld_block(const LD_Cache::Block& block,
+                              const size_t first, const size_t last,
+                              std::vector<size_t>& snp_index) const
+{
+    if (block.distance < m_clump_distance
+        || block.r2_floor > clump_r2_floor())
+        return false;
+    std::unordered_map<std::string, size_t> block_index;
+    for (size_t i = 0; i < block.snp_id.size(); ++i) {
+        block_index[block.snp_id[i]] = i;
+    }
+    snp_index.assign(block.snp_id.size(), m_existed_snps.size());
+    for (size_t i_snp = first; i_snp < last; ++i_snp) {
+        auto&& idx = block_index.find(m_existed_snps[i_snp].rs());
+        if (idx == block_index.end()) return false;
+        snp_index[idx->second] = i_snp;
+    }
+    return true;
+}
+
+std::vector<int> Genotype::ld_cache_missing(Genotype& reference,
+                                            Reporter& reporter)
+{
+    reporter.report("Checking LD cache: " + m_ld_cache);
+    LD_Cache ld_cache;
+    if (!ld_cache.load(m_ld_cache, reference.ld_cache_key())) {
+        reporter.report("LD cache not found or generated with a different "
+                        "reference panel / sample set. It will be "
+                        "(re)generated");
+    }
+    const std::vector<size_t> start = chr_start();
+    std::vector<int> missing;
+    LD_Cache::Block block;
+    std::vector<size_t> snp_index;
+    for (size_t i_chr = 0; i_chr + 1 < start.size(); ++i_chr) {
+        const int chr = m_existed_snps[start[i_chr]].chr();
+        if (!ld_cache.get(chr, block)
+            || !match_ld_block(block, start[i_chr], start[i_chr + 1],
+                               snp_index))
+        {
+            missing.push_back(chr);
+        }
+    }
+    return missing;
+}
+
+void Genotype::build_ld_cache(const std::vector<int>& chrs,
+                              Reporter& reporter)
+{
+    // The blocks must be usable with any base file, so they hold every pair
+    // of variants of the reference within the clumping window, in both
+    // direction, and not only the pairs among the SNPs of the current run
+    const std::unordered_set<int> selected(chrs.begin(), chrs.end());
+    m_existed_snps.erase(
+        std::remove_if(m_existed_snps.begin(), m_existed_snps.end(),
+                       [&selected](const SNP& s) {
+                           return selected.find(s.chr()) == selected.end();
+                       }),
+        m_existed_snps.end());
+    m_existed_snps_index.clear();
+    if (!sort_by_p()) return;
+    set_clump_bounds();
+    reporter.report("Calculating LD of " + std::to_string(chrs.size())
+                    + " chromosome(s) for the LD cache, using "
+                    + std::to_string(m_existed_snps.size()) + " variant(s)");
+    const double min_r2 = clump_r2_floor();
+    std::vector<uintptr_t> founder_include2(
+        QUATERCT_TO_ALIGNED_WORDCT(m_founder_ct), 0);
+    fill_quatervec_55(m_founder_ct, founder_include2.data());
+    std::vector<Clump_Workspace> workspace;
+    init_clump_workspace(*this, reporter, true, workspace);
+    LD_Graph graph;
+    build_ld_graph(*this, founder_include2.data(), min_r2, workspace, true,
+                   std::vector<bool>(), graph);
+    workspace.clear();
+    fprintf(stderr, "\rClumping Progress: %03.2f%%\n\n", 100.0);
+    LD_Cache ld_cache;
+    ld_cache.load(m_ld_cache, ld_cache_key());
+    const std::vector<size_t> start = chr_start();
+    for (size_t i_chr = 0; i_chr + 1 < start.size(); ++i_chr) {
+        const size_t first = start[i_chr], last = start[i_chr + 1];
+        LD_Cache::Block block;
+        block.distance = m_clump_distance;
+        block.r2_floor = min_r2;
+        block.offset.push_back(0);
+        for (size_t i_snp = first; i_snp < last; ++i_snp) {
+            block.snp_id.push_back(m_existed_snps[i_snp].rs());
+            for (size_t i_edge = graph.offset[i_snp];
+                 i_edge < graph.offset[i_snp + 1]; ++i_edge)
             {
-                freq11_expected = freqx1 * freq1x;
-                dxx = freq11 - freq11_expected;
-                // if r^2 threshold is 0, let everything else through but
-                // exclude the apparent zeroes.  Zeroes *are* included if
-                // r2_thresh is negative,
-                // though (only nans are rejected then).
-                if (fabs(dxx) < SMALL_EPSILON
-                    || fabs(freq11_expected * freq2x * freqx2) < SMALL_EPSILON)
-                {
-                    r2 = 0.0;
-                }
-                else
-                {
-                    r2 = dxx * dxx / (freq11_expected * freq2x * freqx2);
-                }
+                block.neighbour.push_back(graph.neighbour[i_edge] - first);
+                block.r2.push_back(graph.r2[i_edge]);
             }
-            window_data_ptr = &(window_data_ptr[founder_ctv2]);
+            block.offset.push_back(block.neighbour.size());
+        }
+        ld_cache.set(m_existed_snps[first].chr(), block);
+    }
+    ld_cache.save(m_ld_cache);
+    reporter.report("LD cache written to " + m_ld_cache);
+}
 
-            if (r2 >= min_r2) {
-                cur_target_snp.clump(pair_target_snp, r2, m_clump_proxy);
+void Genotype::cached_clumping(Genotype& reference, Reporter& reporter,
+                               uintptr_t* founder_include2,
+                               const double min_r2,
+                               std::vector<bool>& remain_core,
+                               uintptr_t& num_core_snps)
+{
+    // The cache holds the r2 of every pair of the reference in both
+    // direction (see build_ld_cache), so the pairs of this run are looked up
+    // in the block of each chromosome. The chromosomes that are still not
+    // covered (e.g. the cache couldn't be written) are calculated here
+    const size_t num_snp = m_existed_snps.size();
+    LD_Cache ld_cache;
+    ld_cache.load(m_ld_cache, reference.ld_cache_key());
+    LD_Graph graph;
+    graph.offset.assign(num_snp + 1, 0);
+    const std::vector<size_t> start = chr_start();
+    std::vector<bool> cached(num_snp, false);
+    LD_Cache::Block block;
+    std::vector<size_t> snp_index;
+    size_t num_cached_chr = 0;
+    for (size_t i_chr = 0; i_chr + 1 < start.size(); ++i_chr) {
+        const size_t first = start[i_chr], last = start[i_chr + 1];
+        if (!ld_cache.get(m_existed_snps[first].chr(), block)
+            || !match_ld_block(block, first, last, snp_index))
+            continue;
+        std::vector<std::vector<std::pair<size_t, double>>> edges(last - first);
+        for (size_t i = 0; i < block.snp_id.size(); ++i) {
+            const size_t i_snp = snp_index[i];
+            if (i_snp == num_snp) continue;
+            auto&& cur_snp = m_existed_snps[i_snp];
+            for (size_t i_edge = block.offset[i];
+                 i_edge < block.offset[i + 1]; ++i_edge)
+            {
+                const size_t i_pair = snp_index[block.neighbour[i_edge]];
+                if (i_pair < cur_snp.low_bound() || i_pair >= cur_snp.up_bound()
+                    || block.r2[i_edge] < min_r2)
+                    continue;
+                edges[i_snp - first].emplace_back(i_pair, block.r2[i_edge]);
             }
         }
-        for (size_t i_pair = cur_snp_index + 1; i_pair < end; ++i_pair) {
-            window_data_ptr = window_data;
-            auto&& pair_target_snp = m_existed_snps[i_pair];
-            if (pair_target_snp.clumped()
-                || pair_target_snp.p_value() > m_clump_p)
-                continue;
-            window_data_ptr[founder_ctv2 - 2] = 0;
-            window_data_ptr[founder_ctv2 - 1] = 0;
-
-            reference.read_genotype(window_data_ptr,
-                                    pair_target_snp.ref_byte_pos(),
-                                    pair_target_snp.ref_file_name());
+        for (size_t i_snp = first; i_snp < last; ++i_snp) {
+            auto&& cur_edges = edges[i_snp - first];
+            // the pairs must be visited in genomic order
+            std::sort(cur_edges.begin(), cur_edges.end());
+            // graph.offset[i_snp + 1] temporary holds the edge count
+            graph.offset[i_snp + 1] = cur_edges.size();
+            for (auto&& edge : cur_edges) {
+                graph.neighbour.push_back(edge.first);
+                graph.r2.push_back(edge.second);
+            }
+            cached[i_snp] = true;
+        }
+        num_cached_chr++;
+    }
+    reporter.report(std::to_string(num_cached_chr) + " of "
+                    + std::to_string(start.size() - 1)
+                    + " chromosome(s) found in the LD cache");
+    if (num_cached_chr + 1 == start.size()) {
+        for (size_t i_snp = 0; i_snp < num_snp; ++i_snp) {
+            graph.offset[i_snp + 1] += graph.offset[i_snp];
+        }
+        clump_ld_graph(graph, remain_core, num_core_snps);
+        return;
+    }
+    std::vector<Clump_Workspace> workspace;
+    init_clump_workspace(reference, reporter, true, workspace);
+    LD_Graph computed;
+    build_ld_graph(reference, founder_include2, min_r2, workspace, true,
+                   cached, computed);
+    // the cached edges are stored in the order of the SNPs
+    LD_Graph merged;
+    merged.offset.assign(num_snp + 1, 0);
+    size_t cached_edge = 0;
+    for (size_t i_snp = 0; i_snp < num_snp; ++i_snp) {
+        if (cached[i_snp]) {
+            const size_t num_edge = graph.offset[i_snp + 1];
+            merged.neighbour.insert(
+                merged.neighbour.end(),
+                graph.neighbour.begin() + cached_edge,
+                graph.neighbour.begin() + cached_edge + num_edge);
+            merged.r2.insert(merged.r2.end(), graph.r2.begin() + cached_edge,
+                             graph.r2.begin() + cached_edge + num_edge);
+            cached_edge += num_edge;
+        }
+        else
+        {
+            merged.neighbour.insert(
+                merged.neighbour.end(),
+                computed.neighbour.begin() + computed.offset[i_snp],
+                computed.neighbour.begin() + computed.offset[i_snp + 1]);
+            merged.r2.insert(merged.r2.end(),
+                             computed.r2.begin() + computed.offset[i_snp],
+                             computed.r2.begin() + computed.offset[i_snp + 1]);
+        }
+        merged.offset[i_snp + 1] = merged.neighbour.size();
+    }
+    clump_ld_graph(merged, remain_core, num_core_snps);
+}
 
-            r2 = -1;
-            uint32_t counts[18];
-            genovec_3freq(window_data_ptr, index_data.data(), founder_ctl2,
-                          &(counts[0]), &(counts[1]), &(counts[2]));
-            counts[0] = index_tots[0] - counts[0] - counts[1] - counts[2];
-            genovec_3freq(window_data_ptr, &(index_data[founder_ctv2]),
-                          founder_ctl2, &(counts[3]), &(counts[4]),
-                          &(counts[5]));
-            counts[3] = index_tots[1] - counts[3] - counts[4] - counts[5];
-            genovec_3freq(window_data_ptr, &(index_data[2 * founder_ctv2]),
-                          founder_ctl2, &(counts[6]), &(counts[7]),
-                          &(counts[8]));
-            counts[6] = index_tots[2] - counts[6] - counts[7] - counts[8];
-            if (!em_phase_hethet_nobase(counts, is_x, is_x, &freq1x, &freq2x,
-                                        &freqx1, &freqx2, &freq11))
+void Genotype::clump_in_batches(Genotype& reference,
+                                uintptr_t* founder_include2,
+                                const double min_r2,
+                                std::vector<Clump_Workspace>& workspace,
+                                std::vector<bool>& remain_core,
+                                uintptr_t& num_core_snps)
+{
+    // An index SNP only touches the SNPs within [low_bound, up_bound). So
+    // going down the p-value sorted list, any index SNP whose window doesn't
+    // overlap with the window of any SNP before it that is still waiting to
+    // be processed can be clumped right away, in parallel with the others,
+    // and give the same result as the serial run
+    const size_t num_thread = workspace.size();
+    const size_t max_batch_size = num_thread * 64;
+    const size_t max_scan = num_thread * 256;
+    const size_t num_snp = m_sort_by_p_index.size();
+    std::vector<size_t> batch;
+    // start -> end of the windows seen in this round, merged when overlap
+    std::map<size_t, size_t> blocked;
+    double prev_progress = -1.0;
+    size_t i_snp = 0;
+    auto done = [this](const size_t snp_index) {
+        return m_existed_snps[snp_index].clumped()
+               || m_existed_snps[snp_index].p_value() > m_clump_p;
+    };
+    while (true) {
+        while (i_snp < num_snp && done(m_sort_by_p_index[i_snp])) ++i_snp;
+        if (i_snp == num_snp) break;
+        double progress = (double) i_snp / (double) num_snp * 100;
+        if (progress - prev_progress > 0.01) {
+            fprintf(stderr, "\rClumping Progress: %03.2f%%", progress);
+            prev_progress = progress;
+        }
+        batch.clear();
+        blocked.clear();
+        for (size_t i_scan = i_snp; i_scan < num_snp && i_scan - i_snp < max_scan
+                                    && batch.size() < max_batch_size;
+             ++i_scan)
+        {
+            const size_t cur_snp_index = m_sort_by_p_index[i_scan];
+            if (done(cur_snp_index)) continue;
+            size_t low = m_existed_snps[cur_snp_index].low_bound();
+            size_t up = m_existed_snps[cur_snp_index].up_bound();
+            // check for overlap
+            auto next = blocked.upper_bound(low);
+            bool overlap = (next != blocked.end() && next->first < up);
+            if (next != blocked.begin() && std::prev(next)->second > low) {
+                overlap = true;
+            }
+            if (!overlap) batch.push_back(cur_snp_index);
+            // the window is blocked for every SNP after this one, even if
+            // this SNP has to wait for the next round
+            if (next != blocked.begin() && std::prev(next)->second >= low) {
+                --next;
+                low = next->first;
+                up = std::max(up, next->second);
+                next = blocked.erase(next);
+            }
+            while (next != blocked.end() && next->first <= up) {
+                up = std::max(up, next->second);
+                next = blocked.erase(next);
+            }
+            blocked[low] = up;
+        }
+        std::atomic<size_t> next_job(0);
+        std::vector<std::string> error_message(num_thread);
+        auto worker = [&](const size_t i_thread) {
+            try
             {
-                freq11_expected = freqx1 * freq1x;
-                dxx = freq11 - freq11_expected;
-                // if r^2 threshold is 0, let everything else through but
-                // exclude the apparent zeroes.  Zeroes *are* included if
-                // r2_thresh is negative,
-                // though (only nans are rejected then).
-                if (fabs(dxx) < SMALL_EPSILON
-                    || fabs(freq11_expected * freq2x * freqx2) < SMALL_EPSILON)
-                {
-                    r2 = 0.0;
-                }
-                else
-                {
-                    r2 = dxx * dxx / (freq11_expected * freq2x * freqx2);
+                size_t job;
+                while ((job = next_job++) < batch.size()) {
+                    clump_index_snp(reference, batch[job], founder_include2,
+                                    min_r2, true, workspace[i_thread]);
                 }
             }
-
-            if (r2 >= min_r2) {
-                cur_target_snp.clump(pair_target_snp, r2, m_clump_proxy);
+            catch (const std::runtime_error& error)
+            {
+                error_message[i_thread] = error.what();
+                next_job = batch.size();
             }
+        };
+        const size_t num_worker = std::min(num_thread, batch.size());
+        Thread_Pool::global().run(num_worker, worker);
+        for (auto&& error : error_message) {
+            if (!error.empty()) throw std::runtime_error(error);
         }
-        cur_target_snp.set_clumped();
-        remain_core[cur_snp_index] = true;
-        num_core_snps++;
-        double thres = cur_target_snp.get_threshold();
-        if (used_thresholds.find(thres) == used_thresholds.end()) {
-            used_thresholds.insert(thres);
-            m_thresholds.push_back(thres);
-            // m_categories.push_back(cur_target_snp.category());
+        for (auto&& cur_snp_index : batch) {
+            remain_core[cur_snp_index] = true;
+            num_core_snps++;
         }
     }
-    fprintf(stderr, "\rClumping Progress: %03.2f%%\n\n", 100.0);
-    window_data = nullptr;
-    window_data_ptr = nullptr;
-    free(bigstack_ua);
-    bigstack_ua = nullptr;
-    bigstack_initial_base = nullptr;
-
-    m_existed_snps_index.clear();
-    m_num_threshold = m_thresholds.size();
-    if (num_core_snps != m_existed_snps.size()) {
-        // remain_core_snps' follow the post sorted order (p-value sorted)
-        // instead of m_existed_snps' index so we need to sort it first
-        m_existed_snps.erase(
-            std::remove_if(
-                m_existed_snps.begin(), m_existed_snps.end(),
-                [&remain_core, this](const SNP& s) {
-                    return !remain_core[&s - &*begin(m_existed_snps)];
-                }),
-            m_existed_snps.end());
-        m_existed_snps.shrink_to_fit();
-    }
-    m_existed_snps_index.clear();
-
-    // no longer require the m_existed_snps_index
-    message = "";
-    message.append("Number of variant(s) after clumping : "
-                   + std::to_string(m_existed_snps.size()) + "\n");
-    reporter.report(message);
 }
 
-
 bool Genotype::prepare_prsice(Reporter& reporter)
 {
     if (m_existed_snps.size() == 0) return false;
     // first, sort the threshold
     std::sort(m_thresholds.begin(), m_thresholds.end());
-    std::sort(begin(m_existed_snps), end(m_existed_snps),
-              [](SNP const& t1, SNP const& t2) {
-                  if (t1.category() == t2.category()) {
-                      if (t1.file_name().compare(t2.file_name()) == 0) {
-                          return t1.byte_pos() < t2.byte_pos();
+    // sort compact keys and move each SNP once, instead of swapping the SNPs
+    // around during the sort
+    struct Sort_Key
+    {
+        intptr_t category;
+        uint32_t file_rank;
+        std::streamoff byte_pos;
+        size_t index;
+    };
+    const std::vector<uint32_t> file_rank = SNP::pooled_rank();
+    std::vector<Sort_Key> keys(m_existed_snps.size());
+    for (size_t i_snp = 0; i_snp < m_existed_snps.size(); ++i_snp) {
+        auto&& snp = m_existed_snps[i_snp];
+        keys[i_snp] = {snp.category(), file_rank[snp.file_id()],
+                       static_cast<std::streamoff>(snp.byte_pos()), i_snp};
+    }
+    std::sort(keys.begin(), keys.end(),
+              [](const Sort_Key& k1, const Sort_Key& k2) {
+                  if (k1.category == k2.category) {
+                      if (k1.file_rank == k2.file_rank) {
+                          return k1.byte_pos < k2.byte_pos;
                       }
                       else
-                          return t1.file_name().compare(t2.file_name()) < 0;
+                          return k1.file_rank < k2.file_rank;
                   }
                   else
-                      return t1.category() < t2.category();
+                      return k1.category < k2.category;
               });
+    std::vector<SNP> sorted_snps;
+    sorted_snps.reserve(m_existed_snps.size());
+    for (auto&& key : keys) {
+        sorted_snps.push_back(std::move(m_existed_snps[key.index]));
+    }
+    m_existed_snps.swap(sorted_snps);
+    // the index points into the old order
+    m_existed_snps_index.clear();
     return true;
 }
 
-void Genotype::get_null_score(const size_t& set_size, const size_t& prev_size,
+void Genotype::prepare_null_score()
+{
+    std::unordered_set<std::string> file_names;
+    for (auto&& i_snp : m_background_snp_index) {
+        file_names.insert(m_existed_snps[i_snp].file_name());
+    }
+    // formats that can't be read concurrently will use the file handle of
+    // the scratch instead
+    prepare_concurrent_read(file_names);
+}
+
+void Genotype::init_null_score(Score_Scratch& scratch) const
+{
+    scratch.prs_info.resize(m_prs_info.size());
+    scratch.tmp_genotype.assign(m_tmp_genotype.size(), 0);
+    scratch.cur_file.clear();
+    scratch.mean_score = 0.0;
+    scratch.score_sd = 0.0;
+}
+
+void Genotype::get_null_score(Score_Scratch& scratch, const size_t& set_size,
+                              const size_t& prev_size,
                               const std::vector<size_t>& background_list,
                               const bool first_run,
-                              const bool require_statistic)
+                              const bool require_statistic) const
 {
     // selection_list = permuted list of SNP index
     if (m_existed_snps.size() == 0 || set_size >= m_existed_snps.size()) return;
     std::vector<size_t> selected_snp_index(background_list.begin() + prev_size,
                                            background_list.begin() + set_size);
     std::sort(selected_snp_index.begin(), selected_snp_index.end());
-    read_score(selected_snp_index, first_run);
+    read_score(scratch, selected_snp_index, first_run);
     if (require_statistic) {
-        misc::RunningStat rs;
-        size_t num_prs = m_prs_info.size();
-        for (size_t i = 0; i < num_prs; ++i) {
-            if (!IS_SET(m_sample_include, i)) continue;
-            if (m_prs_info[i].num_snp == 0) {
-                rs.push(0.0);
-            }
-            else
-            {
-                rs.push(m_prs_info[i].get_prs());
-            }
-        }
-        m_mean_score = rs.mean();
-        m_score_sd = rs.sd();
+        update_score_statistic(scratch.prs_info, scratch.mean_score,
+                               scratch.score_sd);
     }
 }
 
-
-void Genotype::get_null_score(const size_t& set_size,
-                              const size_t& num_selected_snps,
-                              // const std::vector<size_t>& selection_list,
-                              const std::vector<size_t>& background_list,
-                              const bool require_statistic)
+void Genotype::update_score_statistic(const PRS& prs_info, double& mean_score,
+                                      double& score_sd) const
 {
-    // selection_list = permuted list of SNP index
-    if (m_existed_snps.size() == 0 || set_size >= m_existed_snps.size()) return;
-    std::vector<size_t> selected_snp_index(
-        background_list.begin(), background_list.begin() + num_selected_snps);
-    std::sort(selected_snp_index.begin(), selected_snp_index.end());
-    read_score(selected_snp_index, true);
-    if (require_statistic) {
-        misc::RunningStat rs;
-        size_t num_prs = m_prs_info.size();
-        for (size_t i = 0; i < num_prs; ++i) {
-            if (!IS_SET(m_sample_include, i)) continue;
-            if (m_prs_info[i].num_snp == 0) {
-                rs.push(0.0);
-            }
-            else
-            {
-                rs.push(m_prs_info[i].get_prs());
-            }
+    // accumulated serially in sample order, so that the mean and SD don't
+    // depend on --thread
+    misc::RunningStat rs;
+    const size_t num_prs = prs_info.size();
+    for (size_t i = 0; i < num_prs; ++i) {
+        if (!IS_SET(m_sample_include, i)) continue;
+        if (prs_info.num_snp[i] == 0) {
+            rs.push(0.0);
+        }
+        else
+        {
+            rs.push(prs_info.get_prs(i));
         }
-        m_mean_score = rs.mean();
-        m_score_sd = rs.sd();
     }
+    mean_score = rs.mean();
+    score_sd = rs.sd();
 }
+
 bool Genotype::get_score(int& cur_index, int& cur_category,
                          double& cur_threshold, size_t& num_snp_included,
                          const size_t region_index, const bool cumulate,
@@ -1852,20 +2487,7 @@ bool Genotype::get_score(int& cur_index, int& cur_category,
     read_score(cur_index, end_index, region_index, (!cumulate || first_run));
     cur_index = end_index;
     if (require_statistic) {
-        misc::RunningStat rs;
-        size_t num_prs = m_prs_info.size();
-        for (size_t i = 0; i < num_prs; ++i) {
-            if (!IS_SET(m_sample_include, i)) continue;
-            if (m_prs_info[i].num_snp == 0) {
-                rs.push(0.0);
-            }
-            else
-            {
-                rs.push(m_prs_info[i].get_prs());
-            }
-        }
-        m_mean_score = rs.mean();
-        m_score_sd = rs.sd();
+        update_score_statistic();
     }
     return true;
 }
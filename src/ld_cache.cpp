@@ -0,0 +1,299 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "ld_cache.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <zlib.h>
+
+const char LD_Cache::magic[9] = "PRSiceLD";
+const uint32_t LD_Cache::version;
+
+namespace
+{
+template <typename T>
+void append(std::vector<unsigned char>& buffer, const T& value)
+{
+    const unsigned char* ptr = reinterpret_cast<const unsigned char*>(&value);
+    buffer.insert(buffer.end(), ptr, ptr + sizeof(T));
+}
+
+template <typename T>
+void append(std::vector<unsigned char>& buffer, const std::vector<T>& values)
+{
+    if (values.empty()) return;
+    const unsigned char* ptr =
+        reinterpret_cast<const unsigned char*>(values.data());
+    buffer.insert(buffer.end(), ptr, ptr + sizeof(T) * values.size());
+}
+
+// read from a block, throw if we run pass the end
+class Block_Reader
+{
+public:
+    Block_Reader(const std::vector<unsigned char>& buffer) : m_buffer(buffer)
+    {
+    }
+    template <typename T>
+    void read(T& value)
+    {
+        check(sizeof(T));
+        std::memcpy(&value, m_buffer.data() + m_pos, sizeof(T));
+        m_pos += sizeof(T);
+    }
+    template <typename T>
+    void read(std::vector<T>& values, const size_t num)
+    {
+        check(sizeof(T) * num);
+        values.resize(num);
+        if (num == 0) return;
+        std::memcpy(values.data(), m_buffer.data() + m_pos, sizeof(T) * num);
+        m_pos += sizeof(T) * num;
+    }
+    void read(std::string& value, const size_t length)
+    {
+        check(length);
+        value.assign(
+            reinterpret_cast<const char*>(m_buffer.data() + m_pos), length);
+        m_pos += length;
+    }
+
+private:
+    void check(const size_t length) const
+    {
+        if (m_pos + length > m_buffer.size()) {
+            throw std::runtime_error("Error: LD cache file is corrupted!");
+        }
+    }
+    const std::vector<unsigned char>& m_buffer;
+    size_t m_pos = 0;
+};
+}
+
+std::string LD_Cache::checksum(const void* data, const size_t size)
+{
+    uLong crc = crc32(0L, Z_NULL, 0);
+    const Bytef* ptr = reinterpret_cast<const Bytef*>(data);
+    size_t remain = size;
+    while (remain > 0) {
+        // crc32 takes an uInt length
+        const uInt length = static_cast<uInt>(
+            std::min<size_t>(remain, 1u << 30));
+        crc = crc32(crc, ptr, length);
+        ptr += length;
+        remain -= length;
+    }
+    char hex[9];
+    std::snprintf(hex, sizeof(hex), "%08lx",
+                  static_cast<unsigned long>(crc & 0xffffffffUL));
+    return std::string(hex);
+}
+
+std::string LD_Cache::checksum(const std::string& file_name)
+{
+    std::ifstream file(file_name.c_str(), std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Error: Cannot open file: " + file_name);
+    }
+    std::vector<char> buffer(1 << 22);
+    uLong crc = crc32(0L, Z_NULL, 0);
+    uint64_t file_size = 0;
+    while (file) {
+        file.read(buffer.data(), buffer.size());
+        const std::streamsize length = file.gcount();
+        if (length <= 0) break;
+        crc = crc32(crc, reinterpret_cast<const Bytef*>(buffer.data()),
+                    static_cast<uInt>(length));
+        file_size += static_cast<uint64_t>(length);
+    }
+    char hex[9];
+    std::snprintf(hex, sizeof(hex), "%08lx",
+                  static_cast<unsigned long>(crc & 0xffffffffUL));
+    return std::string(hex) + ":" + std::to_string(file_size);
+}
+
+bool LD_Cache::load(const std::string& file_name, const std::string& key)
+{
+    m_index.clear();
+    m_file_name.clear();
+    m_key = key;
+    std::ifstream file(file_name.c_str(), std::ios::binary);
+    if (!file.is_open()) return false;
+    char file_magic[sizeof(magic)] = {0};
+    uint32_t file_version = 0;
+    uint32_t key_length = 0;
+    file.read(file_magic, sizeof(magic) - 1);
+    file.read(reinterpret_cast<char*>(&file_version), sizeof(file_version));
+    file.read(reinterpret_cast<char*>(&key_length), sizeof(key_length));
+    if (!file || std::strcmp(file_magic, magic) != 0) {
+        throw std::runtime_error("Error: " + file_name
+                                 + " is not a PRSice LD cache file!");
+    }
+    if (file_version != version) return false;
+    std::string file_key(key_length, '\0');
+    file.read(&file_key[0], key_length);
+    if (!file || file_key != key) return false;
+    uint32_t num_block = 0;
+    file.read(reinterpret_cast<char*>(&num_block), sizeof(num_block));
+    for (uint32_t i_block = 0; i_block < num_block; ++i_block) {
+        int32_t chr;
+        Index index;
+        file.read(reinterpret_cast<char*>(&chr), sizeof(chr));
+        file.read(reinterpret_cast<char*>(&index.file_offset),
+                  sizeof(index.file_offset));
+        file.read(reinterpret_cast<char*>(&index.compressed_size),
+                  sizeof(index.compressed_size));
+        file.read(reinterpret_cast<char*>(&index.raw_size),
+                  sizeof(index.raw_size));
+        if (!file) {
+            throw std::runtime_error("Error: LD cache file is corrupted!");
+        }
+        m_index[chr] = index;
+    }
+    m_file_name = file_name;
+    return true;
+}
+
+std::vector<unsigned char> LD_Cache::read_block(const Index& index) const
+{
+    if (!index.data.empty()) return index.data;
+    std::ifstream file(m_file_name.c_str(), std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Error: Cannot open LD cache file: "
+                                 + m_file_name);
+    }
+    std::vector<unsigned char> data(index.compressed_size);
+    file.seekg(static_cast<std::streamoff>(index.file_offset));
+    file.read(reinterpret_cast<char*>(data.data()), data.size());
+    if (!file) {
+        throw std::runtime_error("Error: LD cache file is corrupted!");
+    }
+    return data;
+}
+
+bool LD_Cache::get(const int chr, Block& block) const
+{
+    auto&& index = m_index.find(chr);
+    if (index == m_index.end()) return false;
+    std::vector<unsigned char> compressed = read_block(index->second);
+    std::vector<unsigned char> raw(index->second.raw_size);
+    uLongf raw_size = raw.size();
+    if (uncompress(raw.data(), &raw_size, compressed.data(), compressed.size())
+            != Z_OK
+        || raw_size != raw.size())
+    {
+        throw std::runtime_error("Error: LD cache file is corrupted!");
+    }
+    Block_Reader reader(raw);
+    uint64_t num_snp, num_edge;
+    reader.read(block.distance);
+    reader.read(block.r2_floor);
+    reader.read(num_snp);
+    block.snp_id.resize(num_snp);
+    for (auto&& id : block.snp_id) {
+        uint32_t length;
+        reader.read(length);
+        reader.read(id, length);
+    }
+    reader.read(block.offset, num_snp + 1);
+    num_edge = block.offset.back();
+    reader.read(block.neighbour, num_edge);
+    reader.read(block.r2, num_edge);
+    return true;
+}
+
+void LD_Cache::set(const int chr, const Block& block)
+{
+    std::vector<unsigned char> raw;
+    append(raw, block.distance);
+    append(raw, block.r2_floor);
+    append(raw, static_cast<uint64_t>(block.snp_id.size()));
+    for (auto&& id : block.snp_id) {
+        append(raw, static_cast<uint32_t>(id.size()));
+        raw.insert(raw.end(), id.begin(), id.end());
+    }
+    append(raw, block.offset);
+    append(raw, block.neighbour);
+    append(raw, block.r2);
+    Index index;
+    uLongf compressed_size = compressBound(raw.size());
+    index.data.resize(compressed_size);
+    if (compress2(index.data.data(), &compressed_size, raw.data(), raw.size(),
+                  Z_BEST_SPEED)
+        != Z_OK)
+    {
+        throw std::runtime_error("Error: Failed to compress the LD cache!");
+    }
+    index.data.resize(compressed_size);
+    index.compressed_size = compressed_size;
+    index.raw_size = raw.size();
+    m_index[chr] = std::move(index);
+}
+
+void LD_Cache::save(const std::string& file_name)
+{
+    std::vector<unsigned char> header;
+    header.insert(header.end(), magic, magic + sizeof(magic) - 1);
+    append(header, version);
+    append(header, static_cast<uint32_t>(m_key.size()));
+    header.insert(header.end(), m_key.begin(), m_key.end());
+    append(header, static_cast<uint32_t>(m_index.size()));
+    const size_t index_size =
+        m_index.size()
+        * (sizeof(int32_t) + 3 * sizeof(uint64_t));
+    uint64_t file_offset = header.size() + index_size;
+    for (auto&& index : m_index) {
+        append(header, static_cast<int32_t>(index.first));
+        append(header, file_offset);
+        append(header, index.second.compressed_size);
+        append(header, index.second.raw_size);
+        file_offset += index.second.compressed_size;
+    }
+    // write to a temporary file first, as the blocks we didn't change are
+    // copied from the original file
+    const std::string tmp_name = file_name + ".tmp";
+    std::ofstream file(tmp_name.c_str(), std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Error: Cannot open file: " + tmp_name
+                                 + " to write");
+    }
+    file.write(reinterpret_cast<const char*>(header.data()), header.size());
+    for (auto&& index : m_index) {
+        std::vector<unsigned char> data = read_block(index.second);
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    }
+    file.close();
+    if (!file) {
+        throw std::runtime_error("Error: Failed to write the LD cache: "
+                                 + tmp_name);
+    }
+    std::remove(file_name.c_str());
+    if (std::rename(tmp_name.c_str(), file_name.c_str()) != 0) {
+        throw std::runtime_error("Error: Failed to write the LD cache: "
+                                 + file_name);
+    }
+    // the blocks are now in the new file
+    file_offset = header.size();
+    for (auto&& index : m_index) {
+        index.second.file_offset = file_offset;
+        index.second.data.clear();
+        file_offset += index.second.compressed_size;
+    }
+    m_file_name = file_name;
+}
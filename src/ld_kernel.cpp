@@ -0,0 +1,553 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "ld_kernel.hpp"
+#include "plink_common.hpp"
+#include <algorithm>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define LD_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+namespace ld_kernel
+{
+namespace
+{
+typedef void (*kernel_function)(const uintptr_t*, const uintptr_t*,
+                                const uintptr_t, const uintptr_t, uint32_t*);
+typedef void (*bitplane_function)(const uintptr_t*, const uintptr_t*,
+                                  const uintptr_t*, const uintptr_t,
+                                  uint32_t*);
+typedef void (*dot_prod_function)(const uintptr_t*, const uintptr_t*,
+                                  const uintptr_t*, const uintptr_t*,
+                                  const uintptr_t, int32_t*);
+
+// acc holds the even, odd and and count for each mask, as in genovec_3freq
+inline void finalize(const uint64_t acc[9], uint32_t counts[9])
+{
+    for (size_t k = 0; k < 3; ++k) {
+        counts[3 * k] = acc[3 * k] - acc[3 * k + 2];
+        counts[3 * k + 1] = acc[3 * k + 1] - acc[3 * k + 2];
+        counts[3 * k + 2] = acc[3 * k + 2];
+    }
+}
+
+// words that don't fill a whole vector
+inline void scalar_tail(const uintptr_t* __restrict geno_vec,
+                        const uintptr_t* __restrict index_data,
+                        const uintptr_t mask_stride, uintptr_t i_word,
+                        const uintptr_t sample_ctl2, uint64_t acc[9])
+{
+    for (; i_word < sample_ctl2; ++i_word) {
+        const uintptr_t geno = geno_vec[i_word];
+        const uintptr_t geno_hi = geno >> 1;
+        for (size_t k = 0; k < 3; ++k) {
+            const uintptr_t mask = index_data[k * mask_stride + i_word];
+            acc[3 * k] += popcount2_long(geno & mask);
+            acc[3 * k + 1] += popcount2_long(geno_hi & mask);
+            acc[3 * k + 2] += popcount2_long(geno & geno_hi & mask);
+        }
+    }
+}
+
+void plink_kernel(const uintptr_t* __restrict geno_vec,
+                  const uintptr_t* __restrict index_data,
+                  const uintptr_t mask_stride, const uintptr_t sample_ctl2,
+                  uint32_t counts[9])
+{
+    for (size_t k = 0; k < 3; ++k) {
+        genovec_3freq(geno_vec, &(index_data[k * mask_stride]), sample_ctl2,
+                      &(counts[3 * k]), &(counts[3 * k + 1]),
+                      &(counts[3 * k + 2]));
+    }
+}
+
+// without missing calls, the high bit of the genotype is set for het and
+// homset, and the low bit is only set for homset
+void bitplane_generic(const uintptr_t* __restrict geno_vec,
+                      const uintptr_t* __restrict het_plane,
+                      const uintptr_t* __restrict hom_plane,
+                      const uintptr_t sample_ctl2, uint32_t counts[4])
+{
+    uintptr_t acc[4] = {0, 0, 0, 0};
+    for (uintptr_t i_word = 0; i_word < sample_ctl2; ++i_word) {
+        const uintptr_t geno = geno_vec[i_word];
+        const uintptr_t geno_hi = geno >> 1;
+        const uintptr_t geno_het = geno_hi & (~geno);
+        const uintptr_t geno_hom = geno_hi & geno;
+        acc[0] += popcount2_long(geno_het & het_plane[i_word]);
+        acc[1] += popcount2_long(geno_hom & het_plane[i_word]);
+        acc[2] += popcount2_long(geno_het & hom_plane[i_word]);
+        acc[3] += popcount2_long(geno_hom & hom_plane[i_word]);
+    }
+    for (size_t i = 0; i < 4; ++i) counts[i] = acc[i];
+}
+
+#ifdef LD_KERNEL_X86
+// return_vals update of ld_dot_prod_batch for word_ct words. Per sample,
+// zero is set if either genotype is 0 / missing and opposite (high bit) if
+// they are -1 and 1, so x * y = 1 - zero - 2 * opposite
+void dot_prod_generic(const uintptr_t* __restrict vec1,
+                      const uintptr_t* __restrict vec2,
+                      const uintptr_t* __restrict mask1,
+                      const uintptr_t* __restrict mask2,
+                      const uintptr_t word_ct, int32_t return_vals[5])
+{
+    uint64_t acc[5] = {0, 0, 0, 0, 0};
+    for (uintptr_t i_word = 0; i_word < word_ct; ++i_word) {
+        const uintptr_t x = vec1[i_word];
+        const uintptr_t y = vec2[i_word];
+        const uintptr_t x_masked = x & mask2[i_word];
+        const uintptr_t y_masked = y & mask1[i_word];
+        const uintptr_t zero = (x | y) & FIVEMASK;
+        const uintptr_t opposite = (x ^ y) & AAAAMASK & ~(zero << 1);
+        acc[0] += popcount_long(zero) + 2 * popcount_long(opposite);
+        acc[1] += popcount_long(x_masked) + popcount_long(x_masked & AAAAMASK);
+        acc[2] += popcount_long(y_masked) + popcount_long(y_masked & AAAAMASK);
+        acc[3] += popcount_long(x_masked & FIVEMASK);
+        acc[4] += popcount_long(y_masked & FIVEMASK);
+    }
+    return_vals[0] -= static_cast<int32_t>(acc[0]);
+    for (size_t i = 1; i < 5; ++i)
+        return_vals[i] += static_cast<int32_t>(acc[i]);
+}
+
+__attribute__((target("avx2"))) inline __m256i
+popcount_epi8(const __m256i val)
+{
+    const __m256i lookup =
+        _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1,
+                         1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    const __m256i lo = _mm256_and_si256(val, low_mask);
+    const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(val, 4), low_mask);
+    return _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                           _mm256_shuffle_epi8(lookup, hi));
+}
+
+__attribute__((target("avx2"))) void
+avx2_kernel(const uintptr_t* __restrict geno_vec,
+            const uintptr_t* __restrict index_data,
+            const uintptr_t mask_stride, const uintptr_t sample_ctl2,
+            uint32_t counts[9])
+{
+    // All the masked values only have bits at even positions, so we can
+    // shift the second of every two vectors to the odd positions and count
+    // both vectors with a single popcount.
+    // Each byte can count up to 8 per iteration, so they need to be moved
+    // into the 64 bit accumulators at least every 31 iterations
+    const uintptr_t max_block = 31;
+    const uintptr_t pair_ct = sample_ctl2 / 8;
+    uint64_t acc[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+    uintptr_t i_pair = 0;
+    while (i_pair < pair_ct) {
+        const uintptr_t block_end = std::min(pair_ct, i_pair + max_block);
+        __m256i byte_acc[9];
+        for (size_t i = 0; i < 9; ++i) byte_acc[i] = _mm256_setzero_si256();
+        for (; i_pair < block_end; ++i_pair) {
+            const uintptr_t i_word = i_pair * 8;
+            const __m256i geno0 = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(&(geno_vec[i_word])));
+            const __m256i geno1 = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(&(geno_vec[i_word + 4])));
+            // value of the second vector are shifted to the odd positions
+            const __m256i even[3] = {
+                geno0, _mm256_srli_epi64(geno0, 1),
+                _mm256_and_si256(geno0, _mm256_srli_epi64(geno0, 1))};
+            const __m256i odd[3] = {
+                _mm256_slli_epi64(geno1, 1), geno1,
+                _mm256_and_si256(geno1, _mm256_slli_epi64(geno1, 1))};
+            for (size_t k = 0; k < 3; ++k) {
+                const uintptr_t* mask_ptr =
+                    &(index_data[k * mask_stride + i_word]);
+                const __m256i mask0 = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(mask_ptr));
+                const __m256i mask1 = _mm256_slli_epi64(
+                    _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i*>(mask_ptr + 4)),
+                    1);
+                for (size_t j = 0; j < 3; ++j) {
+                    byte_acc[3 * k + j] = _mm256_add_epi8(
+                        byte_acc[3 * k + j],
+                        popcount_epi8(
+                            _mm256_or_si256(_mm256_and_si256(even[j], mask0),
+                                            _mm256_and_si256(odd[j], mask1))));
+                }
+            }
+        }
+        for (size_t i = 0; i < 9; ++i) {
+            alignas(32) uint64_t sum[4];
+            _mm256_store_si256(
+                reinterpret_cast<__m256i*>(sum),
+                _mm256_sad_epu8(byte_acc[i], _mm256_setzero_si256()));
+            acc[i] += sum[0] + sum[1] + sum[2] + sum[3];
+        }
+    }
+    scalar_tail(geno_vec, index_data, mask_stride, pair_ct * 8, sample_ctl2,
+                acc);
+    finalize(acc, counts);
+}
+
+__attribute__((target("avx2"))) void
+bitplane_avx2(const uintptr_t* __restrict geno_vec,
+              const uintptr_t* __restrict het_plane,
+              const uintptr_t* __restrict hom_plane,
+              const uintptr_t sample_ctl2, uint32_t counts[4])
+{
+    // same packing of two vectors into one popcount as avx2_kernel
+    const __m256i even_mask = _mm256_set1_epi64x(FIVEMASK);
+    const uintptr_t max_block = 31;
+    const uintptr_t pair_ct = sample_ctl2 / 8;
+    uint64_t acc[4] = {0, 0, 0, 0};
+    uintptr_t i_pair = 0;
+    while (i_pair < pair_ct) {
+        const uintptr_t block_end = std::min(pair_ct, i_pair + max_block);
+        __m256i byte_acc[4];
+        for (size_t i = 0; i < 4; ++i) byte_acc[i] = _mm256_setzero_si256();
+        for (; i_pair < block_end; ++i_pair) {
+            const uintptr_t i_word = i_pair * 8;
+            const __m256i geno0 = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(&(geno_vec[i_word])));
+            const __m256i geno1 = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(&(geno_vec[i_word + 4])));
+            const __m256i hi0 = _mm256_and_si256(_mm256_srli_epi64(geno0, 1),
+                                                 even_mask);
+            const __m256i hi1 = _mm256_andnot_si256(even_mask, geno1);
+            const __m256i lo1 = _mm256_slli_epi64(geno1, 1);
+            // het and homset of the first vector at the even positions and
+            // of the second vector at the odd positions
+            const __m256i geno_het = _mm256_or_si256(
+                _mm256_andnot_si256(geno0, hi0), _mm256_andnot_si256(lo1, hi1));
+            const __m256i geno_hom = _mm256_or_si256(
+                _mm256_and_si256(geno0, hi0), _mm256_and_si256(lo1, hi1));
+            const __m256i het = _mm256_or_si256(
+                _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(&(het_plane[i_word]))),
+                _mm256_slli_epi64(
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+                        &(het_plane[i_word + 4]))),
+                    1));
+            const __m256i hom = _mm256_or_si256(
+                _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(&(hom_plane[i_word]))),
+                _mm256_slli_epi64(
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+                        &(hom_plane[i_word + 4]))),
+                    1));
+            byte_acc[0] = _mm256_add_epi8(
+                byte_acc[0], popcount_epi8(_mm256_and_si256(geno_het, het)));
+            byte_acc[1] = _mm256_add_epi8(
+                byte_acc[1], popcount_epi8(_mm256_and_si256(geno_hom, het)));
+            byte_acc[2] = _mm256_add_epi8(
+                byte_acc[2], popcount_epi8(_mm256_and_si256(geno_het, hom)));
+            byte_acc[3] = _mm256_add_epi8(
+                byte_acc[3], popcount_epi8(_mm256_and_si256(geno_hom, hom)));
+        }
+        for (size_t i = 0; i < 4; ++i) {
+            alignas(32) uint64_t sum[4];
+            _mm256_store_si256(
+                reinterpret_cast<__m256i*>(sum),
+                _mm256_sad_epu8(byte_acc[i], _mm256_setzero_si256()));
+            acc[i] += sum[0] + sum[1] + sum[2] + sum[3];
+        }
+    }
+    uint32_t tail[4];
+    const uintptr_t done = pair_ct * 8;
+    bitplane_generic(&(geno_vec[done]), &(het_plane[done]),
+                     &(hom_plane[done]), sample_ctl2 - done, tail);
+    for (size_t i = 0; i < 4; ++i) counts[i] = acc[i] + tail[i];
+}
+
+__attribute__((target("avx2"))) void
+dot_prod_avx2(const uintptr_t* __restrict vec1,
+              const uintptr_t* __restrict vec2,
+              const uintptr_t* __restrict mask1,
+              const uintptr_t* __restrict mask2, const uintptr_t word_ct,
+              int32_t return_vals[5])
+{
+    // same terms as dot_prod_generic. A byte counts at most 24 per vector
+    // (for zero + 2 * opposite), so the byte counts are summed every 10
+    const __m256i even_mask = _mm256_set1_epi64x(FIVEMASK);
+    const __m256i odd_mask = _mm256_set1_epi64x(AAAAMASK);
+    const uintptr_t max_block = 10;
+    const uintptr_t vec_ct = word_ct / 4;
+    uint64_t acc[5] = {0, 0, 0, 0, 0};
+    uintptr_t i_vec = 0;
+    while (i_vec < vec_ct) {
+        const uintptr_t block_end = std::min(vec_ct, i_vec + max_block);
+        __m256i byte_acc[5];
+        for (size_t i = 0; i < 5; ++i) byte_acc[i] = _mm256_setzero_si256();
+        for (; i_vec < block_end; ++i_vec) {
+            const uintptr_t i_word = i_vec * 4;
+            const __m256i x = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(&(vec1[i_word])));
+            const __m256i y = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(&(vec2[i_word])));
+            const __m256i x_masked = _mm256_and_si256(
+                x, _mm256_loadu_si256(
+                       reinterpret_cast<const __m256i*>(&(mask2[i_word]))));
+            const __m256i y_masked = _mm256_and_si256(
+                y, _mm256_loadu_si256(
+                       reinterpret_cast<const __m256i*>(&(mask1[i_word]))));
+            const __m256i zero =
+                _mm256_and_si256(_mm256_or_si256(x, y), even_mask);
+            const __m256i opposite = _mm256_andnot_si256(
+                _mm256_slli_epi64(zero, 1),
+                _mm256_and_si256(_mm256_xor_si256(x, y), odd_mask));
+            const __m256i opposite_ct = popcount_epi8(opposite);
+            byte_acc[0] = _mm256_add_epi8(
+                byte_acc[0],
+                _mm256_add_epi8(popcount_epi8(zero),
+                                _mm256_add_epi8(opposite_ct, opposite_ct)));
+            byte_acc[1] = _mm256_add_epi8(
+                byte_acc[1],
+                _mm256_add_epi8(
+                    popcount_epi8(x_masked),
+                    popcount_epi8(_mm256_and_si256(x_masked, odd_mask))));
+            byte_acc[2] = _mm256_add_epi8(
+                byte_acc[2],
+                _mm256_add_epi8(
+                    popcount_epi8(y_masked),
+                    popcount_epi8(_mm256_and_si256(y_masked, odd_mask))));
+            byte_acc[3] = _mm256_add_epi8(
+                byte_acc[3],
+                popcount_epi8(_mm256_and_si256(x_masked, even_mask)));
+            byte_acc[4] = _mm256_add_epi8(
+                byte_acc[4],
+                popcount_epi8(_mm256_and_si256(y_masked, even_mask)));
+        }
+        for (size_t i = 0; i < 5; ++i) {
+            alignas(32) uint64_t sum[4];
+            _mm256_store_si256(
+                reinterpret_cast<__m256i*>(sum),
+                _mm256_sad_epu8(byte_acc[i], _mm256_setzero_si256()));
+            acc[i] += sum[0] + sum[1] + sum[2] + sum[3];
+        }
+    }
+    const uintptr_t done = vec_ct * 4;
+    dot_prod_generic(&(vec1[done]), &(vec2[done]), &(mask1[done]),
+                     &(mask2[done]), word_ct - done, return_vals);
+    return_vals[0] -= static_cast<int32_t>(acc[0]);
+    for (size_t i = 1; i < 5; ++i)
+        return_vals[i] += static_cast<int32_t>(acc[i]);
+}
+
+// GCC's _mm512_reduce_add_epi64, _mm512_srli_epi64 and _mm512_andnot_si512
+// pass an undefined vector through the builtin, which -Wall reports as
+// uninitialized once inlined. The kernels use a plain store and the zero
+// masked forms instead, which compile to the same instructions
+__attribute__((target("avx512f"))) inline uint64_t
+reduce_add_avx512(const __m512i vec)
+{
+    alignas(64) uint64_t lanes[8];
+    _mm512_store_si512(reinterpret_cast<__m512i*>(lanes), vec);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < 8; ++i) sum += lanes[i];
+    return sum;
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq"))) void
+avx512_kernel(const uintptr_t* __restrict geno_vec,
+              const uintptr_t* __restrict index_data,
+              const uintptr_t mask_stride, const uintptr_t sample_ctl2,
+              uint32_t counts[9])
+{
+    __m512i vec_acc[9];
+    for (size_t i = 0; i < 9; ++i) vec_acc[i] = _mm512_setzero_si512();
+    for (uintptr_t i_word = 0; i_word < sample_ctl2; i_word += 8) {
+        // masked load for the last few words so we don't need a scalar tail
+        const uintptr_t remain = sample_ctl2 - i_word;
+        const __mmask8 load_mask =
+            (remain >= 8) ? 0xff : static_cast<__mmask8>((1u << remain) - 1);
+        const __m512i geno =
+            _mm512_maskz_loadu_epi64(load_mask, &(geno_vec[i_word]));
+        const __m512i geno_hi = _mm512_maskz_srli_epi64(0xff, geno, 1);
+        const __m512i geno_and = _mm512_and_si512(geno, geno_hi);
+        for (size_t k = 0; k < 3; ++k) {
+            const __m512i mask = _mm512_maskz_loadu_epi64(
+                load_mask, &(index_data[k * mask_stride + i_word]));
+            vec_acc[3 * k] = _mm512_add_epi64(
+                vec_acc[3 * k],
+                _mm512_popcnt_epi64(_mm512_and_si512(geno, mask)));
+            vec_acc[3 * k + 1] = _mm512_add_epi64(
+                vec_acc[3 * k + 1],
+                _mm512_popcnt_epi64(_mm512_and_si512(geno_hi, mask)));
+            vec_acc[3 * k + 2] = _mm512_add_epi64(
+                vec_acc[3 * k + 2],
+                _mm512_popcnt_epi64(_mm512_and_si512(geno_and, mask)));
+        }
+    }
+    uint64_t acc[9];
+    for (size_t i = 0; i < 9; ++i) {
+        acc[i] = reduce_add_avx512(vec_acc[i]);
+    }
+    finalize(acc, counts);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq"))) void
+bitplane_avx512(const uintptr_t* __restrict geno_vec,
+                const uintptr_t* __restrict het_plane,
+                const uintptr_t* __restrict hom_plane,
+                const uintptr_t sample_ctl2, uint32_t counts[4])
+{
+    __m512i vec_acc[4];
+    for (size_t i = 0; i < 4; ++i) vec_acc[i] = _mm512_setzero_si512();
+    for (uintptr_t i_word = 0; i_word < sample_ctl2; i_word += 8) {
+        const uintptr_t remain = sample_ctl2 - i_word;
+        const __mmask8 load_mask =
+            (remain >= 8) ? 0xff : static_cast<__mmask8>((1u << remain) - 1);
+        const __m512i geno =
+            _mm512_maskz_loadu_epi64(load_mask, &(geno_vec[i_word]));
+        const __m512i geno_hi = _mm512_maskz_srli_epi64(0xff, geno, 1);
+        const __m512i geno_het = _mm512_maskz_andnot_epi64(0xff, geno, geno_hi);
+        const __m512i geno_hom = _mm512_and_si512(geno, geno_hi);
+        const __m512i het =
+            _mm512_maskz_loadu_epi64(load_mask, &(het_plane[i_word]));
+        const __m512i hom =
+            _mm512_maskz_loadu_epi64(load_mask, &(hom_plane[i_word]));
+        vec_acc[0] = _mm512_add_epi64(
+            vec_acc[0], _mm512_popcnt_epi64(_mm512_and_si512(geno_het, het)));
+        vec_acc[1] = _mm512_add_epi64(
+            vec_acc[1], _mm512_popcnt_epi64(_mm512_and_si512(geno_hom, het)));
+        vec_acc[2] = _mm512_add_epi64(
+            vec_acc[2], _mm512_popcnt_epi64(_mm512_and_si512(geno_het, hom)));
+        vec_acc[3] = _mm512_add_epi64(
+            vec_acc[3], _mm512_popcnt_epi64(_mm512_and_si512(geno_hom, hom)));
+    }
+    for (size_t i = 0; i < 4; ++i) {
+        counts[i] = static_cast<uint32_t>(reduce_add_avx512(vec_acc[i]));
+    }
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq"))) void
+dot_prod_avx512(const uintptr_t* __restrict vec1,
+                const uintptr_t* __restrict vec2,
+                const uintptr_t* __restrict mask1,
+                const uintptr_t* __restrict mask2, const uintptr_t word_ct,
+                int32_t return_vals[5])
+{
+    const __m512i even_mask = _mm512_set1_epi64(FIVEMASK);
+    const __m512i odd_mask = _mm512_set1_epi64(AAAAMASK);
+    __m512i vec_acc[5];
+    for (size_t i = 0; i < 5; ++i) vec_acc[i] = _mm512_setzero_si512();
+    for (uintptr_t i_word = 0; i_word < word_ct; i_word += 8) {
+        const uintptr_t remain = word_ct - i_word;
+        const __mmask8 load_mask =
+            (remain >= 8) ? 0xff : static_cast<__mmask8>((1u << remain) - 1);
+        const __m512i x = _mm512_maskz_loadu_epi64(load_mask, &(vec1[i_word]));
+        const __m512i y = _mm512_maskz_loadu_epi64(load_mask, &(vec2[i_word]));
+        const __m512i x_masked = _mm512_and_si512(
+            x, _mm512_maskz_loadu_epi64(load_mask, &(mask2[i_word])));
+        const __m512i y_masked = _mm512_and_si512(
+            y, _mm512_maskz_loadu_epi64(load_mask, &(mask1[i_word])));
+        const __m512i zero = _mm512_and_si512(_mm512_or_si512(x, y), even_mask);
+        const __m512i opposite = _mm512_maskz_andnot_epi64(
+            0xff, _mm512_maskz_slli_epi64(0xff, zero, 1),
+            _mm512_and_si512(_mm512_xor_si512(x, y), odd_mask));
+        const __m512i opposite_ct = _mm512_popcnt_epi64(opposite);
+        vec_acc[0] = _mm512_add_epi64(
+            vec_acc[0],
+            _mm512_add_epi64(_mm512_popcnt_epi64(zero),
+                             _mm512_add_epi64(opposite_ct, opposite_ct)));
+        vec_acc[1] = _mm512_add_epi64(
+            vec_acc[1],
+            _mm512_add_epi64(
+                _mm512_popcnt_epi64(x_masked),
+                _mm512_popcnt_epi64(_mm512_and_si512(x_masked, odd_mask))));
+        vec_acc[2] = _mm512_add_epi64(
+            vec_acc[2],
+            _mm512_add_epi64(
+                _mm512_popcnt_epi64(y_masked),
+                _mm512_popcnt_epi64(_mm512_and_si512(y_masked, odd_mask))));
+        vec_acc[3] = _mm512_add_epi64(
+            vec_acc[3],
+            _mm512_popcnt_epi64(_mm512_and_si512(x_masked, even_mask)));
+        vec_acc[4] = _mm512_add_epi64(
+            vec_acc[4],
+            _mm512_popcnt_epi64(_mm512_and_si512(y_masked, even_mask)));
+    }
+    return_vals[0] -= static_cast<int32_t>(reduce_add_avx512(vec_acc[0]));
+    for (size_t i = 1; i < 5; ++i) {
+        return_vals[i] +=
+            static_cast<int32_t>(reduce_add_avx512(vec_acc[i]));
+    }
+}
+#endif
+
+struct Dispatch
+{
+    kernel_function kernel = plink_kernel;
+    bitplane_function bitplane = bitplane_generic;
+    // the SSE2 ld_dot_prod of Genotype is used without a wider kernel
+    dot_prod_function dot_prod = nullptr;
+    Dispatch()
+    {
+#ifdef LD_KERNEL_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")
+            && __builtin_cpu_supports("avx512vpopcntdq"))
+        {
+            kernel = avx512_kernel;
+            bitplane = bitplane_avx512;
+            dot_prod = dot_prod_avx512;
+        }
+        else if (__builtin_cpu_supports("avx2"))
+        {
+            kernel = avx2_kernel;
+            bitplane = bitplane_avx2;
+            dot_prod = dot_prod_avx2;
+        }
+#endif
+    }
+};
+
+const Dispatch& dispatch()
+{
+    // initialized once, thread safe in C++11
+    static const Dispatch selected;
+    return selected;
+}
+}
+
+void genovec_3x3freq(const uintptr_t* __restrict geno_vec,
+                     const uintptr_t* __restrict index_data,
+                     const uintptr_t mask_stride, const uintptr_t sample_ctl2,
+                     uint32_t counts[9])
+{
+    dispatch().kernel(geno_vec, index_data, mask_stride, sample_ctl2, counts);
+}
+
+void genovec_bitplane_freq(const uintptr_t* __restrict geno_vec,
+                           const uintptr_t* __restrict het_plane,
+                           const uintptr_t* __restrict hom_plane,
+                           const uintptr_t sample_ctl2, uint32_t counts[4])
+{
+    dispatch().bitplane(geno_vec, het_plane, hom_plane, sample_ctl2, counts);
+}
+
+bool ld_dot_prod(const uintptr_t* __restrict vec1,
+                 const uintptr_t* __restrict vec2,
+                 const uintptr_t* __restrict mask1,
+                 const uintptr_t* __restrict mask2, const uintptr_t word_ct,
+                 int32_t return_vals[5])
+{
+    const dot_prod_function dot_prod = dispatch().dot_prod;
+    if (dot_prod == nullptr) return false;
+    dot_prod(vec1, vec2, mask1, mask2, word_ct, return_vals);
+    return true;
+}
+}
@@ -28,6 +28,7 @@
 #include "prsice.hpp"
 #include "region.hpp"
 #include "reporter.hpp"
+#include "thread_pool.hpp"
 int main(int argc, char* argv[])
 {
     Reporter reporter;
@@ -43,6 +44,8 @@ int main(int argc, char* argv[])
         {
             return -1; // all error messages should have printed
         }
+        // threads are started once here and shared by the whole run
+        Thread_Pool::global().set_num_thread(commander.thread());
         bool verbose = true;
         // this allow us to generate the appropriate object (i.e. binaryplink /
         // binarygen)
@@ -60,6 +63,8 @@ int main(int argc, char* argv[])
                                       commander.remove_sample_file(), verbose,
                                       reporter);
             if (commander.use_ref()) target_file->expect_reference();
+            target_file->use_dosage_cache(commander.dosage_cache());
+            target_file->load_base_snps(commander);
             target_file->load_snps(
                 commander.out(), commander.extract_file(),
                 commander.exclude_file(), commander.geno(), commander.maf(),
@@ -156,6 +161,58 @@ int main(int argc, char* argv[])
                     reporter.report(error_message);
                     return -1;
                 }
+                if (!commander.ld_cache().empty() && !commander.pearson()) {
+                    // the LD cache doesn't depend on the base file, so the
+                    // chromosomes it doesn't cover are calculated from every
+                    // variant of the LD reference that pass the QC, not only
+                    // from the SNPs of this run
+                    std::vector<int> missing_chr =
+                        target_file->ld_cache_missing(
+                            commander.use_ref() ? *reference_file
+                                                : *target_file,
+                            reporter);
+                    if (!missing_chr.empty()) {
+                        Genotype* ld_panel = nullptr;
+                        try
+                        {
+                            ld_panel = factory.createGenotype(
+                                commander.use_ref() ? commander.ref_name()
+                                                    : commander.target_name(),
+                                commander.use_ref() ? commander.ref_type()
+                                                    : commander.target_type(),
+                                commander.use_ref() ? commander.ref_list()
+                                                    : commander.target_list(),
+                                commander.thread(), commander.ignore_fid(),
+                                commander.nonfounders(),
+                                commander.keep_ambig(), reporter, commander);
+                            ld_panel->load_samples(
+                                commander.use_ref()
+                                    ? commander.ld_keep_file()
+                                    : commander.keep_sample_file(),
+                                commander.use_ref()
+                                    ? commander.ld_remove_file()
+                                    : commander.remove_sample_file(),
+                                false, reporter);
+                            Region no_exclusion("", reporter);
+                            ld_panel->load_snps(
+                                commander.out() + ".ld_cache", "", "",
+                                commander.geno(), commander.maf(),
+                                commander.info(), commander.hard_threshold(),
+                                commander.hard_coded(), no_exclusion, false,
+                                reporter);
+                            ld_panel->set_info(commander);
+                            ld_panel->build_ld_cache(missing_chr, reporter);
+                        }
+                        catch (const std::runtime_error& error)
+                        {
+                            // clumping can still go on without the cache
+                            reporter.report(error.what());
+                            reporter.report("Warning: Failed to update the "
+                                            "LD cache");
+                        }
+                        delete ld_panel;
+                    }
+                }
                 target_file->efficient_clumping(
                     commander.use_ref() ? *reference_file : *target_file,
                     reporter, commander.pearson());
@@ -16,6 +16,10 @@
 
 
 #include "misc.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
 
 namespace misc
 {
@@ -189,4 +193,138 @@ std::vector<std::string> split(const std::string& seq,
         result.push_back(seq.substr(prev, std::string::npos));
     return result;
 }
+bool parse_int(const char* begin, const char* end, int& value)
+{
+    const char* ptr = begin;
+    bool negative = false;
+    if (ptr != end && (*ptr == '+' || *ptr == '-')) {
+        negative = (*ptr == '-');
+        ++ptr;
+    }
+    if (ptr == end) return false;
+    // accumulate the magnitude in a long long, which can hold the magnitude
+    // of INT_MIN, and stop as soon as it is out of range
+    const long long limit =
+        negative ? -static_cast<long long>(std::numeric_limits<int>::min())
+                 : std::numeric_limits<int>::max();
+    long long result = 0;
+    for (; ptr != end; ++ptr) {
+        const unsigned digit = static_cast<unsigned char>(*ptr) - '0';
+        if (digit > 9) return false;
+        result = result * 10 + digit;
+        if (result > limit) return false;
+    }
+    value = static_cast<int>(negative ? -result : result);
+    return true;
+}
+
+std::string file_signature(const std::string& file_name)
+{
+    struct stat file_stat;
+    if (stat(file_name.c_str(), &file_stat) != 0) {
+        throw std::runtime_error("Error: Cannot open file: " + file_name);
+    }
+    return std::to_string(static_cast<uint64_t>(file_stat.st_size)) + ":"
+           + std::to_string(static_cast<int64_t>(file_stat.st_mtime));
+}
+
+bool parse_double(const char* begin, const char* end, double& value)
+{
+    // powers of 10 that are exactly representable as a double
+    static const double exact_power[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const char* ptr = begin;
+    bool negative = false;
+    if (ptr != end && (*ptr == '+' || *ptr == '-')) {
+        negative = (*ptr == '-');
+        ++ptr;
+    }
+    // check the format, and get the significant digits and decimal exponent
+    // on the way. Anything the stream wouldn't accept (e.g. inf, nan, hex)
+    // is rejected here
+    uint64_t mantissa = 0;
+    int num_digit = 0, exponent = 0;
+    bool has_digit = false;
+    for (; ptr != end && static_cast<unsigned>(*ptr - '0') < 10; ++ptr) {
+        has_digit = true;
+        if (mantissa == 0 && *ptr == '0') continue;
+        if (num_digit < 19) {
+            mantissa = mantissa * 10 + static_cast<unsigned>(*ptr - '0');
+        }
+        else
+        {
+            ++exponent;
+        }
+        ++num_digit;
+    }
+    if (ptr != end && *ptr == '.') {
+        ++ptr;
+        for (; ptr != end && static_cast<unsigned>(*ptr - '0') < 10; ++ptr) {
+            has_digit = true;
+            if (mantissa == 0 && *ptr == '0') {
+                --exponent;
+                continue;
+            }
+            if (num_digit < 19) {
+                mantissa = mantissa * 10 + static_cast<unsigned>(*ptr - '0');
+                --exponent;
+            }
+            ++num_digit;
+        }
+    }
+    if (!has_digit) return false;
+    if (ptr != end && (*ptr == 'e' || *ptr == 'E')) {
+        ++ptr;
+        bool negative_exp = false;
+        if (ptr != end && (*ptr == '+' || *ptr == '-')) {
+            negative_exp = (*ptr == '-');
+            ++ptr;
+        }
+        if (ptr == end) return false;
+        int exp_value = 0;
+        for (; ptr != end; ++ptr) {
+            const unsigned digit = static_cast<unsigned char>(*ptr) - '0';
+            if (digit > 9) return false;
+            if (exp_value < 100000) exp_value = exp_value * 10 + digit;
+        }
+        exponent += negative_exp ? -exp_value : exp_value;
+    }
+    if (ptr != end) return false;
+    // When the significant digits and the power of 10 are both exact, one
+    // multiplication or division gives the correctly rounded result
+    // (Clinger's fast path), which is what strtod would return
+    if (mantissa == 0) {
+        value = negative ? -0.0 : 0.0;
+        return true;
+    }
+    if (num_digit <= 19 && mantissa <= (uint64_t(1) << 53) && exponent >= -22
+        && exponent <= 22)
+    {
+        double result = static_cast<double>(mantissa);
+        result = (exponent < 0) ? result / exact_power[-exponent]
+                                : result * exact_power[exponent];
+        value = negative ? -result : result;
+        return true;
+    }
+    // otherwise leave it to strtod, which need a null terminated string
+    char local[64];
+    std::string copy;
+    const char* str = local;
+    const size_t length = static_cast<size_t>(end - begin);
+    if (length < sizeof(local)) {
+        std::memcpy(local, begin, length);
+        local[length] = '\0';
+    }
+    else
+    {
+        copy.assign(begin, end);
+        str = copy.c_str();
+    }
+    const double result = std::strtod(str, nullptr);
+    // the stream reject overflow
+    if (std::isinf(result)) return false;
+    value = result;
+    return true;
+}
 }
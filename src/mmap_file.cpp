@@ -0,0 +1,130 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mmap_file.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+void MemoryMappedFile::open(const std::string& file_name)
+{
+    close();
+#ifdef _WIN32
+    m_file = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                         nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                         nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Error: Cannot open file: " + file_name);
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(m_file, &file_size)) {
+        close();
+        throw std::runtime_error("Error: Cannot determine size of file: "
+                                 + file_name);
+    }
+    m_size = static_cast<size_t>(file_size.QuadPart);
+    if (m_size == 0) {
+        close();
+        throw std::runtime_error("Error: Empty file: " + file_name);
+    }
+    m_map = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_map == nullptr) {
+        close();
+        throw std::runtime_error("Error: Cannot map file: " + file_name);
+    }
+    m_data = static_cast<unsigned char*>(
+        MapViewOfFile(m_map, FILE_MAP_READ, 0, 0, 0));
+    if (m_data == nullptr) {
+        close();
+        throw std::runtime_error("Error: Cannot map file: " + file_name);
+    }
+#else
+    int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw std::runtime_error("Error: Cannot open file: " + file_name);
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1) {
+        ::close(fd);
+        throw std::runtime_error("Error: Cannot determine size of file: "
+                                 + file_name);
+    }
+    m_size = static_cast<size_t>(file_stat.st_size);
+    if (m_size == 0) {
+        ::close(fd);
+        throw std::runtime_error("Error: Empty file: " + file_name);
+    }
+    void* mapped = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping holds its own reference to the file
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        m_size = 0;
+        throw std::runtime_error("Error: Cannot map file: " + file_name);
+    }
+    m_data = static_cast<unsigned char*>(mapped);
+#endif
+    m_file_name = file_name;
+}
+
+void MemoryMappedFile::close()
+{
+#ifdef _WIN32
+    if (m_data != nullptr) UnmapViewOfFile(m_data);
+    if (m_map != nullptr) CloseHandle(m_map);
+    if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+    m_map = nullptr;
+    m_file = INVALID_HANDLE_VALUE;
+#else
+    if (m_data != nullptr) munmap(m_data, m_size);
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_advice = Advice::NORMAL;
+    m_file_name.clear();
+}
+
+void MemoryMappedFile::advise_sequential()
+{
+    if (m_data == nullptr || m_advice == Advice::SEQUENTIAL) return;
+#ifndef _WIN32
+    madvise(m_data, m_size, MADV_SEQUENTIAL);
+#endif
+    m_advice = Advice::SEQUENTIAL;
+}
+
+void MemoryMappedFile::advise_random()
+{
+    if (m_data == nullptr || m_advice == Advice::RANDOM) return;
+#ifndef _WIN32
+    madvise(m_data, m_size, MADV_RANDOM);
+#endif
+    m_advice = Advice::RANDOM;
+}
+
+void MemoryMappedFile::will_need(uint64_t offset, uint64_t length)
+{
+#ifndef _WIN32
+    if (m_data == nullptr || !contains(offset, length)) return;
+    // madvise require the address to be page aligned
+    static const uint64_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t start = offset - (offset % page_size);
+    madvise(m_data + start, length + (offset - start), MADV_WILLNEED);
+#endif
+}
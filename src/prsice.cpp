@@ -28,15 +28,14 @@ void PRSice::pheno_check(const Commander& c_commander, Reporter& reporter)
     }
     else
     {
-        std::ifstream pheno;
-        pheno.open(pheno_file.c_str());
-        if (!pheno.is_open()) {
+        Chunk_Reader pheno;
+        if (!pheno.open(pheno_file)) {
             std::string error_message =
                 "Cannot open phenotype file: " + pheno_file;
             throw std::runtime_error(error_message);
         }
         std::string line;
-        std::getline(pheno, line); // assume header line
+        pheno.getline(line); // assume header line
         if (line.empty()) {
             throw std::runtime_error(
                 "Cannot have empty header line for phenotype file!");
@@ -113,6 +112,7 @@ void PRSice::init_matrix(const Commander& c_commander, const size_t pheno_index,
     m_null_r2 = 0.0;
     m_phenotype = Eigen::VectorXd::Zero(0);
     m_independent_variables.resize(0, 0);
+    m_perm_bank.resize(0, 0);
     m_sample_with_phenotypes.clear();
     m_null_store.clear();
 
@@ -165,6 +165,11 @@ void PRSice::init_matrix(const Commander& c_commander, const size_t pheno_index,
                 n_thread, true);
         }
     }
+    if (!no_regress) {
+        init_projection(c_commander.is_binary(pheno_index));
+        if (c_commander.permutation() != 0)
+            build_perm_bank(c_commander, c_commander.is_binary(pheno_index));
+    }
 }
 
 void PRSice::update_sample_included(Genotype& target)
@@ -218,9 +223,8 @@ void PRSice::gen_pheno_vec(Genotype& target, const std::string& pheno_file_name,
         int pheno_col_index =
             pheno_info.col[pheno_index]; // obtain the phenotype index
         pheno_name = pheno_info.name[pheno_index];
-        std::ifstream pheno_file;
-        pheno_file.open(pheno_file_name.c_str());
-        if (!pheno_file.is_open()) {
+        Chunk_Reader pheno_file;
+        if (!pheno_file.open(pheno_file_name)) {
             std::string error_message =
                 "Cannot open phenotype file: " + pheno_file_name;
             throw std::runtime_error(error_message);
@@ -230,7 +234,7 @@ void PRSice::gen_pheno_vec(Genotype& target, const std::string& pheno_file_name,
         std::unordered_map<std::string, std::string> phenotype_info;
         std::vector<std::string> token;
         // do not remove header line as that won't match anyway
-        while (std::getline(pheno_file, line)) {
+        while (pheno_file.getline(line)) {
             misc::trim(line);
             if (line.empty()) continue;
             token = misc::split(line);
@@ -526,7 +530,7 @@ void PRSice::process_cov_file(
 {
     // first, go through the covariate and generate the factor level vector for
 
-    std::ifstream cov;
+    Chunk_Reader cov;
     std::vector<std::pair<std::string, size_t>> valid_sample_index;
     std::vector<std::string> token;
     std::vector<uint32_t> current_factor_level(factor_cov_index.size(), 0);
@@ -537,13 +541,12 @@ void PRSice::process_cov_file(
     int num_valid = 0, index = 0;
     bool valid = true;
     factor_levels.resize(factor_cov_index.size());
-    cov.open(cov_file.c_str());
-    if (!cov.is_open()) {
+    if (!cov.open(cov_file)) {
         throw std::runtime_error("Error: Cannot open covariate file: "
                                  + cov_file);
     }
     size_t num_factors = factor_cov_index.size();
-    while (std::getline(cov, line)) {
+    while (cov.getline(line)) {
         misc::trim(line);
         if (line.empty()) continue;
         // we don't need to remove header as we will use the FID/IID to map
@@ -757,9 +760,8 @@ void PRSice::gen_cov_matrix(const std::string& c_cov_file,
     m_independent_variables.col(1).setOnes();
     // now we only need to fill in the independent matrix without worry about
     // other stuff
-    std::ifstream cov;
-    cov.open(c_cov_file.c_str());
-    if (!cov.is_open()) {
+    Chunk_Reader cov;
+    if (!cov.open(c_cov_file)) {
         std::string error_message =
             "Error: Cannot open covariate file: " + c_cov_file;
         throw std::runtime_error(error_message);
@@ -770,7 +772,7 @@ void PRSice::gen_cov_matrix(const std::string& c_cov_file,
     uint32_t cur_cov_index = 0, cur_factor_index = 0,
              num_factor = factor_cov_index.size(),
              num_cov = cov_header_index.size();
-    while (std::getline(cov, line)) {
+    while (cov.getline(line)) {
         misc::trim(line);
         if (line.empty()) continue;
         token = misc::split(line);
@@ -833,7 +835,9 @@ void PRSice::run_prsice(const Commander& c_commander, const Region& region,
     Eigen::setNbThreads(num_thread);
     m_best_index = -1;
     m_num_snp_included = 0;
-    m_perm_result.resize(m_num_perm, 2);
+    // each permutation keeps its largest statistic, so any observed statistic
+    // must be able to beat the starting value
+    m_perm_result.assign(m_num_perm, std::numeric_limits<double>::lowest());
     m_best_sample_score.clear();
     // if m_prs_results is small (or 0), initialize by resize
     // otherwise, resize do nothing, but then we can change p-threshold to -1
@@ -989,8 +993,9 @@ void PRSice::regress_score(Genotype& target, const double threshold,
     if (m_target_binary[pheno_index]) {
         try
         {
-            Regression::glm(m_phenotype, m_independent_variables, p_value, r2,
-                            coefficient, se, 25, thread, true);
+            Regression::glm(m_phenotype, m_independent_variables, m_null_eta,
+                            m_glm_workspace, p_value, r2, coefficient, se, 25,
+                            thread, true);
         }
         catch (const std::runtime_error& error)
         {
@@ -1010,9 +1015,8 @@ void PRSice::regress_score(Genotype& target, const double threshold,
     }
     else
     {
-        Regression::linear_regression(m_phenotype, m_independent_variables,
-                                      p_value, r2, r2_adjust, coefficient, se,
-                                      thread, true);
+        fast_linear_regression(m_independent_variables, p_value, r2,
+                               r2_adjust, coefficient, se, thread);
     }
 
     // If this is the best r2, then we will add it
@@ -1046,8 +1050,10 @@ void PRSice::process_permutations()
     // can't generate an empirical p-value if there is no observed p-value
     if (m_best_index == -1) return;
     // double best_p = m_prs_results[m_best_index].p;
-    double best_t = m_prs_results[m_best_index].coefficient
-                    / m_prs_results[m_best_index].se;
+    // the best threshold is picked by R2 whatever the sign of its
+    // coefficient, so the test is two-sided
+    const double best_t = std::fabs(m_prs_results[m_best_index].coefficient
+                                    / m_prs_results[m_best_index].se);
     size_t num_better = 0;
     num_better = std::count_if(m_perm_result.begin(), m_perm_result.end(),
                                [&best_t](double t) { return t > best_t; });
@@ -1056,199 +1062,407 @@ void PRSice::process_permutations()
         (double) (num_better + 1.0) / (double) (m_num_perm + 1.0);
 }
 
+void PRSice::build_perm_bank(const Commander& c_commander, const bool is_binary)
+{
+    // The permuted phenotypes only depend on the seed and the phenotype, so
+    // they are generated once here and shared by all thresholds and regions
+    const size_t num_regress_sample = m_phenotype.rows();
+    const size_t valid_memory =
+        c_commander.max_memory(misc::total_ram_available());
+    // the score test also keep the residual and weight of each null model
+    const bool score_null = is_binary && m_logit_perm && m_score_perm;
+    const size_t perm_memory =
+        num_regress_sample * sizeof(double) * (score_null ? 3 : 1);
+    // leave half of the memory for everything else
+    const size_t bank_size = std::min(
+        m_num_perm, valid_memory / 2 / std::max<size_t>(1, perm_memory));
+    m_perm_rng.seed(m_seed);
+    m_perm_bank.resize(num_regress_sample, bank_size);
+    for (size_t i_perm = 0; i_perm < bank_size; ++i_perm) {
+        m_perm_bank.col(i_perm) = m_phenotype;
+        std::shuffle(m_perm_bank.col(i_perm).data(),
+                     m_perm_bank.col(i_perm).data() + num_regress_sample,
+                     m_perm_rng);
+    }
+    m_perm_null_rss = null_rss(m_perm_bank);
+    m_perm_score_null.clear();
+    if (!score_null) return;
+    m_perm_score_null.resize(bank_size);
+    fit_score_null(m_perm_bank, m_perm_score_null, c_commander.thread());
+}
+
+void PRSice::fit_score_null(const Eigen::MatrixXd& perm_pheno,
+                            std::vector<Regression::Logit_Score_Null>& null_model,
+                            size_t n_thread) const
+{
+    const size_t num_perm = perm_pheno.cols();
+    const size_t job_size = (num_perm + n_thread - 1) / n_thread;
+    std::vector<std::string> error_messages(n_thread);
+    auto fit = [&](size_t i_thread) {
+        Regression::GLM_Workspace workspace;
+        const size_t end = std::min((i_thread + 1) * job_size, num_perm);
+        try
+        {
+            for (size_t i = i_thread * job_size; i < end; ++i) {
+                Regression::logit_score_null(perm_pheno.col(i),
+                                             m_covariates, workspace,
+                                             null_model[i]);
+            }
+        }
+        catch (const std::runtime_error& error)
+        {
+            error_messages[i_thread] = error.what();
+        }
+    };
+    Thread_Pool::global().run(n_thread, fit);
+    for (auto&& error : error_messages) {
+        if (!error.empty())
+            throw std::runtime_error(
+                "Error: Null model of the permuted phenotype did not "
+                "converge: "
+                + error);
+    }
+}
+
+void PRSice::run_null_perm_score(const size_t n_thread)
+{
+    // the null (covariate only) model of each permutation doesn't depend on
+    // the PRS, so only the score test is needed for each threshold
+    const Eigen::VectorXd prs = m_independent_variables.col(1);
+    auto score_block = [&](const std::vector<Regression::Logit_Score_Null>&
+                               null_model,
+                           size_t processed) {
+        const size_t num_perm = null_model.size();
+        const size_t job_size = (num_perm + n_thread - 1) / n_thread;
+        auto score = [&](size_t i_thread) {
+            const size_t end = std::min((i_thread + 1) * job_size, num_perm);
+            for (size_t i = i_thread * job_size; i < end; ++i) {
+                // compared with |coefficient / se| of the best threshold
+                const double obs_t = std::fabs(Regression::logit_score_test(
+                    null_model[i], m_covariates, prs));
+                // each permutation is only touched by one thread
+                auto&& best_t = m_perm_result[processed + i];
+                if (best_t < obs_t) best_t = obs_t;
+            }
+        };
+        Thread_Pool::global().run(n_thread, score);
+        m_analysis_done += num_perm;
+        print_progress();
+    };
+    score_block(m_perm_score_null, 0);
+    // permutations that don't fit into the memory are regenerated and their
+    // null model refitted in blocks
+    const size_t block_size = 256;
+    const size_t num_regress_sample = m_phenotype.rows();
+    std::mt19937 rand_gen = m_perm_rng;
+    Eigen::MatrixXd block;
+    std::vector<Regression::Logit_Score_Null> block_null;
+    size_t processed = m_perm_score_null.size();
+    while (processed < m_num_perm) {
+        const size_t num_perm = std::min(block_size, m_num_perm - processed);
+        block.resize(num_regress_sample, num_perm);
+        for (size_t i_perm = 0; i_perm < num_perm; ++i_perm) {
+            block.col(i_perm) = m_phenotype;
+            std::shuffle(block.col(i_perm).data(),
+                         block.col(i_perm).data() + num_regress_sample,
+                         rand_gen);
+        }
+        block_null.resize(num_perm);
+        fit_score_null(block, block_null, n_thread);
+        score_block(block_null, processed);
+        processed += num_perm;
+    }
+}
+
+void PRSice::init_projection(const bool is_binary)
+{
+    // orthonormal basis of the intercept and covariates, everything except the
+    // PRS column
+    const size_t num_regress_sample = m_phenotype.rows();
+    const size_t num_col = m_independent_variables.cols();
+    m_covariates.resize(num_regress_sample, num_col - 1);
+    m_covariates.col(0) = m_independent_variables.col(0);
+    m_covariates.rightCols(num_col - 2) =
+        m_independent_variables.rightCols(num_col - 2);
+    Eigen::ColPivHouseholderQR<Eigen::MatrixXd> decomposed(m_covariates);
+    m_cov_basis =
+        decomposed.householderQ()
+        * Eigen::MatrixXd::Identity(num_regress_sample, decomposed.rank());
+    m_pheno_residual =
+        m_phenotype - m_cov_basis * (m_cov_basis.transpose() * m_phenotype);
+    m_pheno_total_ss = (m_phenotype.array() - m_phenotype.mean()).square().sum();
+    m_null_eta.resize(0);
+    if (is_binary) {
+        // the PRS usually explain little of the phenotype, so the null model
+        // is a good starting point for the glm of every threshold
+        Regression::glm_fit(m_phenotype, m_covariates, Eigen::VectorXd(),
+                            m_glm_workspace);
+        if (m_glm_workspace.converge) m_null_eta = m_glm_workspace.eta;
+    }
+}
+
+Eigen::VectorXd PRSice::perm_eta_start() const
+{
+    // permuted phenotypes are unrelated to the PRS and covariates and they
+    // all have the same mean, so the intercept only fit is a good start
+    const double mean = m_phenotype.mean();
+    return Eigen::VectorXd::Constant(m_phenotype.rows(),
+                                     std::log(mean / (1 - mean)));
+}
+
+void PRSice::fast_linear_regression(const Eigen::MatrixXd& independent,
+                                    double& p_value, double& r2,
+                                    double& r2_adjust, double& coeff,
+                                    double& standard_error,
+                                    size_t thread) const
+{
+    if (!Regression::projected_linear_regression(
+            m_pheno_residual, m_pheno_total_ss, m_cov_basis,
+            independent.col(1), p_value, r2, r2_adjust, coeff,
+            standard_error))
+    {
+        Regression::linear_regression(m_phenotype, independent, p_value, r2,
+                                      r2_adjust, coeff, standard_error, thread,
+                                      true);
+    }
+}
+
+Eigen::VectorXd PRSice::null_rss(const Eigen::Ref<const Eigen::MatrixXd>& perm_pheno) const
+{
+    // y is a permutation of the phenotype, so |y|^2 is always the same
+    const double pheno_ss = m_phenotype.squaredNorm();
+    return (pheno_ss
+            - (m_cov_basis.transpose() * perm_pheno)
+                  .colwise()
+                  .squaredNorm()
+                  .array())
+        .max(0.0)
+        .matrix()
+        .transpose();
+}
+
+void PRSice::next_perm_pheno(std::mt19937& rand_gen, const size_t i_perm,
+                             Eigen::VectorXd& perm_pheno) const
+{
+    if (i_perm < static_cast<size_t>(m_perm_bank.cols())) {
+        perm_pheno = m_perm_bank.col(i_perm);
+        return;
+    }
+    perm_pheno = m_phenotype;
+    std::shuffle(perm_pheno.data(), perm_pheno.data() + perm_pheno.rows(),
+                 rand_gen);
+}
+
 void PRSice::permutation(Genotype& target, const size_t n_thread,
                          bool is_binary)
 {
-
-    Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic> perm_matrix(
-        m_phenotype.rows());
     Eigen::setNbThreads(n_thread);
-    int rank = 0;
     // logit_perm can only be true if it is binary trait and user used the
     // --logit-perm flag
     // can always do the following if
     // 1. QT trait (!is_binary)
     // 2. Not require logit perm
-    Eigen::ColPivHouseholderQR<Eigen::MatrixXd> decomposed;
-    Eigen::VectorXd pre_se_calulated;
-    bool run_glm = true;
     if (!is_binary || !m_logit_perm) {
-        decomposed.compute(m_independent_variables);
-        rank = decomposed.rank();
-        Eigen::MatrixXd R = decomposed.matrixR()
-                                .topLeftCorner(rank, rank)
-                                .triangularView<Eigen::Upper>();
-        pre_se_calulated = (R.transpose() * R).inverse().diagonal();
-        run_glm = false;
+        run_null_perm_linear(n_thread);
     }
-    if (n_thread == 1) {
-        run_null_perm_no_thread(decomposed, rank, pre_se_calulated, run_glm);
+    else if (m_score_perm)
+    {
+        run_null_perm_score(n_thread);
+    }
+    else if (n_thread == 1)
+    {
+        run_null_perm_no_thread();
     }
     else
     {
-        Thread_Queue<std::pair<Eigen::VectorXd, size_t>> set_perm_queue;
-        std::thread producer(&PRSice::gen_null_pheno, this,
-                             std::ref(set_perm_queue), n_thread - 1);
-        std::vector<std::thread> consume_store;
-        for (size_t i = 0; i < n_thread - 1; ++i) {
-            consume_store.push_back(
-                std::thread(&PRSice::consume_null_pheno, this,
-                            std::ref(set_perm_queue), std::ref(decomposed),
-                            rank, std::cref(pre_se_calulated), run_glm));
-        }
-        producer.join();
-        for (auto&& consume : consume_store) consume.join();
+        run_null_perm_glm(n_thread);
     }
 }
 
-void PRSice::run_null_perm_no_thread(
-    Eigen::ColPivHouseholderQR<Eigen::MatrixXd>& decomposed, int rank,
-    const Eigen::VectorXd& pre_se, bool run_glm)
+void PRSice::run_null_perm_linear(const size_t n_thread)
 {
-    size_t processed = 0;
-    std::mt19937 rand_gen{m_seed};
-    // Eigen::setNbThreads(1);
+    // With the covariates (and intercept) Z fixed, the PRS coefficient of a
+    // permuted phenotype y is x_r'y / x_r'x_r, where x_r is the PRS residual
+    // on Z, and its RSS is the RSS of y on Z (precomputed for the bank) minus
+    // (x_r'y)^2 / x_r'x_r. So each threshold only needs one x_r'Y product
     const size_t num_regress_sample = m_phenotype.rows();
-    const bool intercept = true;
-    Eigen::VectorXd perm_pheno = m_phenotype;
-    if (run_glm) {
-        while (processed < m_num_perm) {
-            perm_pheno = m_phenotype;
-            std::shuffle(perm_pheno.data(),
-                         perm_pheno.data() + num_regress_sample, rand_gen);
-            m_analysis_done++;
-            print_progress();
-            double coefficient, se, r2, obs_p;
-            // double obs_p = 2.0; // for safety reason, make sure it is out
-            // bound
-            double obs_t = -1;
-            Regression::glm(perm_pheno, m_independent_variables, obs_p, r2,
-                            coefficient, se, 25, 1, true);
-            obs_t = coefficient / se;
-            m_perm_result[processed] =
-                std::min(obs_t, m_perm_result[processed]);
-            processed++;
-        }
-    }
-    else
-    {
-        Eigen::VectorXd beta;
-        Eigen::VectorXd se;
-        while (processed < m_num_perm) {
-            // perm_pheno = m_phenotype;
-            std::shuffle(perm_pheno.data(),
-                         perm_pheno.data() + num_regress_sample, rand_gen);
-            m_analysis_done++;
-            print_progress();
-            // double obs_p = 2.0; // for safety reason, make sure it is out
-            // bound
-            double obs_t = -1;
-            beta = decomposed.solve(perm_pheno);
-            int rdf = num_regress_sample - rank;
-            double rss =
-                (m_independent_variables * beta - perm_pheno).squaredNorm();
-            int se_index = intercept;
-            for (int ind = 0; ind < beta.rows(); ++ind) {
-                if (decomposed.colsPermutation().indices()(ind) == intercept) {
-                    se_index = ind;
-                    break;
-                }
+    const size_t block_size = 256;
+    const Eigen::VectorXd prs = m_independent_variables.col(1);
+    const Eigen::VectorXd prs_residual =
+        prs - m_cov_basis * (m_cov_basis.transpose() * prs);
+    const double prs_ss = prs_residual.squaredNorm();
+    // same criterion as the observed statistic, which is calculated with the
+    // QR (fast_linear_regression) when the PRS is (nearly) collinear with the
+    // covariates
+    const bool estimable = !Regression::collinear(prs_ss, prs.squaredNorm());
+    const double rdf = num_regress_sample - m_cov_basis.cols() - 1;
+    // regress the permutations [start, end) of perm_pheno, which contain the
+    // permutations from processed onward
+    auto regress_block = [&](const Eigen::Ref<const Eigen::MatrixXd>& perm_pheno,
+                             const Eigen::Ref<const Eigen::VectorXd>& rss_null,
+                             size_t processed, size_t start, size_t end) {
+        if (start >= end) return;
+        const Eigen::VectorXd cross =
+            perm_pheno.middleCols(start, end - start).transpose()
+            * prs_residual;
+        for (size_t i_perm = start; i_perm < end; ++i_perm) {
+            const double cur_cross = cross(i_perm - start);
+            const double coefficient = cur_cross / prs_ss;
+            const double rss =
+                std::max(rss_null(i_perm) - cur_cross * coefficient, 0.0);
+            const double se = std::sqrt(rss / rdf / prs_ss);
+            const double obs_t = std::fabs(coefficient / se);
+            // each permutation is only touched by one thread
+            auto&& best_t = m_perm_result[processed + i_perm];
+            if (best_t < obs_t) best_t = obs_t;
+        }
+    };
+    auto regress_parallel = [&](const Eigen::Ref<const Eigen::MatrixXd>& perm_pheno,
+                                const Eigen::Ref<const Eigen::VectorXd>& rss_null,
+                                size_t processed) {
+        const size_t num_perm = perm_pheno.cols();
+        if (!estimable) {
+            // rare, so simply use the QR for each permutation, which uses
+            // the Eigen threads
+            double p_value, r2, r2_adjust, coefficient, se;
+            for (size_t i_perm = 0; i_perm < num_perm; ++i_perm) {
+                Regression::linear_regression(
+                    perm_pheno.col(i_perm), m_independent_variables, p_value,
+                    r2, r2_adjust, coefficient, se, n_thread, true);
+                const double obs_t = std::fabs(coefficient / se);
+                auto&& best_t = m_perm_result[processed + i_perm];
+                if (best_t < obs_t) best_t = obs_t;
             }
-            double resvar = rss / (double) rdf;
-            se = (pre_se * resvar).array().sqrt();
-            obs_t = std::abs(beta(intercept) / se(se_index));
-            m_perm_result[processed] =
-                std::min(obs_t, m_perm_result[processed]);
-            processed++;
-        }
+            return;
+        }
+        const size_t job_size = (num_perm + n_thread - 1) / n_thread;
+        Thread_Pool::global().run(n_thread, [&](size_t i_job) {
+            regress_block(perm_pheno, rss_null, processed,
+                          std::min(i_job * job_size, num_perm),
+                          std::min((i_job + 1) * job_size, num_perm));
+        });
+    };
+    const size_t bank_size = m_perm_bank.cols();
+    if (bank_size > 0) {
+        regress_parallel(m_perm_bank, m_perm_null_rss, 0);
+        m_analysis_done += bank_size;
+        print_progress();
+    }
+    // permutations that don't fit into the memory are regenerated in blocks
+    // (as a separate task, one block ahead of the regression)
+    std::mt19937 rand_gen = m_perm_rng;
+    auto fill_block = [&](Eigen::MatrixXd& block, Eigen::VectorXd& rss_null,
+                          size_t num_perm) {
+        block.resize(num_regress_sample, num_perm);
+        for (size_t i_perm = 0; i_perm < num_perm; ++i_perm) {
+            block.col(i_perm) = m_phenotype;
+            std::shuffle(block.col(i_perm).data(),
+                         block.col(i_perm).data() + num_regress_sample,
+                         rand_gen);
+        }
+        rss_null = null_rss(block);
+    };
+    Eigen::MatrixXd blocks[2];
+    Eigen::VectorXd rss_blocks[2];
+    size_t cur_block = 0;
+    size_t processed = bank_size;
+    if (processed < m_num_perm)
+        fill_block(blocks[cur_block], rss_blocks[cur_block],
+                   std::min(block_size, m_num_perm - processed));
+    while (processed < m_num_perm) {
+        const size_t num_perm = blocks[cur_block].cols();
+        const size_t num_next =
+            std::min(block_size, m_num_perm - processed - num_perm);
+        Thread_Pool::Task_Group generator;
+        if (num_next > 0) {
+            const size_t next_block = 1 - cur_block;
+            Thread_Pool::global().submit(generator, [&, next_block, num_next] {
+                fill_block(blocks[next_block], rss_blocks[next_block],
+                           num_next);
+            });
+        }
+        regress_parallel(blocks[cur_block], rss_blocks[cur_block], processed);
+        Thread_Pool::global().wait(generator);
+        processed += num_perm;
+        cur_block = 1 - cur_block;
+        m_analysis_done += num_perm;
+        print_progress();
     }
 }
 
-void PRSice::gen_null_pheno(Thread_Queue<std::pair<Eigen::VectorXd, size_t>>& q,
-                            size_t num_consumer)
+void PRSice::run_null_perm_no_thread()
 {
     size_t processed = 0;
-    std::mt19937 rand_gen{m_seed};
-    Eigen::setNbThreads(1);
-    const size_t num_regress_sample = m_phenotype.rows();
-    Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic> perm_matrix(
-        m_phenotype.rows());
-
+    std::mt19937 rand_gen = m_perm_rng;
+    // Eigen::setNbThreads(1);
+    Eigen::VectorXd perm_pheno = m_phenotype;
+    const Eigen::VectorXd eta_start = perm_eta_start();
+    Regression::GLM_Workspace workspace;
     while (processed < m_num_perm) {
-        // make sure it doesn't cause some crazy error
-        Eigen::VectorXd null_pheno = m_phenotype;
-        std::shuffle(null_pheno.data(), null_pheno.data() + num_regress_sample,
-                     rand_gen);
-        // q.push(p, num_consumer);
-        q.emplace(std::make_pair(null_pheno, processed), num_consumer);
+        next_perm_pheno(rand_gen, processed, perm_pheno);
         m_analysis_done++;
         print_progress();
+        double coefficient, se, r2, obs_p;
+        // double obs_p = 2.0; // for safety reason, make sure it is out
+        // bound
+        double obs_t = -1;
+        Regression::glm(perm_pheno, m_independent_variables, eta_start,
+                        workspace, obs_p, r2, coefficient, se, 25, 1, true);
+        obs_t = std::fabs(coefficient / se);
+        if (m_perm_result[processed] < obs_t) m_perm_result[processed] = obs_t;
         processed++;
     }
-    // send termination signal to the consumers
-    for (size_t i = 0; i < num_consumer; ++i) {
-        q.push(std::pair<Eigen::VectorXd, size_t>(Eigen::VectorXd(1), 0),
-               num_consumer);
-    }
 }
 
-void PRSice::consume_null_pheno(
-    Thread_Queue<std::pair<Eigen::VectorXd, size_t>>& q,
-    Eigen::ColPivHouseholderQR<Eigen::MatrixXd>& decomposed, int rank,
-    const Eigen::VectorXd& pre_se, bool run_glm)
+void PRSice::run_null_perm_glm(const size_t n_thread)
 {
-    const size_t n = m_phenotype.rows();
-    const bool intercept = true;
-    std::vector<double> temp_store;
-    std::vector<size_t> temp_index;
-    Eigen::VectorXd beta, se;
-    int rdf = n - rank;
-    while (true) {
-        std::pair<Eigen::VectorXd, size_t> input;
-        q.pop(input);
-        // all job finished
-
-        if (std::get<0>(input).rows() == 1) break;
-        double coefficient, se_res, r2, obs_p;
-        // double obs_p = 2.0; // for safety reason, make sure it is out bound
-        double obs_t = -1;
-        if (run_glm) {
-            Regression::glm(std::get<0>(input), m_independent_variables, obs_p,
-                            r2, coefficient, se_res, 25, 1, true);
-            obs_t = coefficient / se_res;
-        }
-        else
-        {
-
-            beta = decomposed.solve(std::get<0>(input));
-            // Eigen::MatrixXd fitted = m_independent_variables * beta;
-            double rss = (m_independent_variables * beta - std::get<0>(input))
-                             .squaredNorm();
-            size_t se_index = intercept;
-            for (size_t ind = 0; ind < (size_t) beta.rows(); ++ind) {
-                if (decomposed.colsPermutation().indices()(ind) == intercept) {
-                    se_index = ind;
-                    break;
-                }
+    // run the glm of a block of permutations at a time, each job working on a
+    // contiguous piece of the block with its own workspace
+    const size_t block_size = 256;
+    const size_t num_regress_sample = m_phenotype.rows();
+    const size_t bank_size = m_perm_bank.cols();
+    const Eigen::VectorXd eta_start = perm_eta_start();
+    std::vector<Regression::GLM_Workspace> workspace(n_thread);
+    std::mt19937 rand_gen = m_perm_rng;
+    Eigen::MatrixXd block;
+    size_t processed = 0;
+    while (processed < m_num_perm) {
+        const size_t num_perm = std::min(
+            block_size,
+            (processed < bank_size ? bank_size : m_num_perm) - processed);
+        if (processed >= bank_size) {
+            block.resize(num_regress_sample, num_perm);
+            for (size_t i_perm = 0; i_perm < num_perm; ++i_perm) {
+                block.col(i_perm) = m_phenotype;
+                std::shuffle(block.col(i_perm).data(),
+                             block.col(i_perm).data() + num_regress_sample,
+                             rand_gen);
             }
-            double resvar = rss / (double) rdf;
-            se = (pre_se * resvar).array().sqrt();
-            obs_t = std::fabs(beta(intercept) / se(se_index));
-            // obs_p = misc::calc_tprob(tval, n);
-        }
-        temp_store.push_back(obs_t);
-        temp_index.push_back(std::get<1>(input));
-    }
-
-    std::lock_guard<std::mutex> lock(lock_guard);
-    for (size_t i = 0; i < temp_store.size(); ++i) {
-        double obs_t = temp_store[i];
-        auto&& index = temp_index[i];
-        if (m_perm_result[index] < obs_t) {
-            m_perm_result[index] = obs_t;
         }
+        const Eigen::MatrixXd& perm_pheno =
+            (processed < bank_size) ? m_perm_bank : block;
+        const size_t offset = (processed < bank_size) ? processed : 0;
+        const size_t job_size = (num_perm + n_thread - 1) / n_thread;
+        Thread_Pool::global().run(n_thread, [&](size_t i_job) {
+            const size_t end = std::min((i_job + 1) * job_size, num_perm);
+            for (size_t i_perm = i_job * job_size; i_perm < end; ++i_perm) {
+                double coefficient, se_res, r2, obs_p;
+                Regression::glm(perm_pheno.col(offset + i_perm),
+                                m_independent_variables, eta_start,
+                                workspace[i_job], obs_p, r2, coefficient,
+                                se_res, 25, 1, true);
+                const double obs_t = std::fabs(coefficient / se_res);
+                // each permutation is only touched by one job
+                auto&& best_t = m_perm_result[processed + i_perm];
+                if (best_t < obs_t) best_t = obs_t;
+            }
+        });
+        processed += num_perm;
+        m_analysis_done += num_perm;
+        print_progress();
     }
 }
+
 void PRSice::thread_perm(
     Eigen::ColPivHouseholderQR<Eigen::MatrixXd>& decomposed, size_t start,
     size_t end, int rank, const Eigen::VectorXd& pre_se, size_t processed)
@@ -1688,6 +1902,9 @@ void PRSice::null_set_no_thread(
     std::mt19937 g(m_seed);
     const size_t num_background = target.num_background();
     std::vector<size_t> background = target.background_index();
+    Genotype::Score_Scratch scratch;
+    target.prepare_null_score();
+    target.init_null_score(scratch);
     bool first_run = true;
     while (processed < num_perm) {
         size_t begin = 0;
@@ -1710,12 +1927,12 @@ void PRSice::null_set_no_thread(
             // a lot of reading if the set sizes are very similar
 
             // read in genotype here
-            target.get_null_score(set_size.first, prev_size, background,
-                                  first_run, require_standardize);
+            target.get_null_score(scratch, set_size.first, prev_size,
+                                  background, first_run, require_standardize);
             prev_size = set_size.first;
             for (size_t sample_id = 0; sample_id < num_sample; ++sample_id) {
-                m_independent_variables(sample_id, 1) =
-                    target.calculate_score(m_score, m_matrix_index[sample_id]);
+                m_independent_variables(sample_id, 1) = target.calculate_score(
+                    scratch, m_score, m_matrix_index[sample_id]);
             }
             m_analysis_done++;
             print_progress();
@@ -1726,9 +1943,8 @@ void PRSice::null_set_no_thread(
             }
             else
             {
-                Regression::linear_regression(
-                    m_phenotype, m_independent_variables, obs_p, r2, r2_adjust,
-                    coefficient, se, 1, true);
+                fast_linear_regression(m_independent_variables, obs_p, r2,
+                                       r2_adjust, coefficient, se);
                 t_value = std::abs(coefficient / se);
             }
             // set_size second contain the indexs to each set with this size
@@ -1796,52 +2012,78 @@ void PRSice::null_set_no_thread(Genotype& target, int& num_significant,
 }
 
 void PRSice::produce_null_prs(
-    Thread_Queue<std::pair<std::vector<double>, uint32_t>>& q, Genotype& target,
-    size_t num_consumer, std::map<uint32_t, std::vector<uint32_t>>& set_index,
-    const size_t num_perm, const bool require_standardize)
+    Slot_Ring<Null_PRS>& q, const Genotype& target,
+    Genotype::Score_Scratch& scratch,
+    const std::map<uint32_t, std::vector<uint32_t>>& set_index,
+    std::atomic<size_t>& next_block, const size_t num_perm,
+    const bool require_standardize, const std::atomic<bool>& stop)
 {
+    // each block of permutations has its own random stream, derived from the
+    // seed and the block index, so the null PRS don't depend on which
+    // producer picked up the block
+    const size_t block_size = 16;
     const uint32_t max_size = set_index.rbegin()->first;
     const size_t num_sample = m_matrix_index.size();
-    const size_t num_regress_sample = m_independent_variables.rows();
     const size_t num_background = target.num_background();
-    size_t processed = 0;
+    const std::vector<size_t> background_index = target.background_index();
+    std::vector<size_t> background;
     size_t prev_size = 0;
-    std::mt19937 g(m_seed);
-    std::vector<size_t> background = target.background_index();
     bool first_run = true;
-    while (processed < num_perm) {
-        size_t begin = 0;
-        // size_t num_snp = set_size;
-        size_t num_snp = max_size;
-        while (num_snp--) {
-            std::uniform_int_distribution<int> dist(begin, num_background - 1);
-            size_t r = background[begin];
-            size_t advance_index = dist(g);
-            background[begin] = background[advance_index];
-            background[advance_index] = r;
-            ++begin;
-        }
-        first_run = true;
-        prev_size = 0;
-        for (auto&& set_size : set_index) {
-            target.get_null_score(set_size.first, prev_size, background,
-                                  first_run, require_standardize);
-            prev_size = set_size.first;
-            std::vector<double> prs(num_regress_sample, 0);
-            for (size_t sample_id = 0; sample_id < num_sample; ++sample_id) {
-                prs[sample_id] =
-                    target.calculate_score(m_score, m_matrix_index[sample_id]);
+    while (!stop) {
+        const size_t i_block = next_block++;
+        const size_t start = i_block * block_size;
+        if (start >= num_perm) break;
+        const size_t end = std::min(start + block_size, num_perm);
+        std::seed_seq seed{static_cast<uint32_t>(m_seed),
+                           static_cast<uint32_t>(i_block)};
+        std::mt19937 g(seed);
+        background = background_index;
+        for (size_t i_perm = start; i_perm < end && !stop; ++i_perm) {
+            size_t begin = 0;
+            size_t num_snp = max_size;
+            while (num_snp--) {
+                std::uniform_int_distribution<int> dist(begin,
+                                                        num_background - 1);
+                size_t advance_index = dist(g);
+                std::swap(background[begin], background[advance_index]);
+                ++begin;
+            }
+            first_run = true;
+            prev_size = 0;
+            for (auto&& set_size : set_index) {
+                target.get_null_score(scratch, set_size.first, prev_size,
+                                      background, first_run,
+                                      require_standardize);
+                prev_size = set_size.first;
+                // write directly into a free slot
+                const size_t slot = q.acquire();
+                auto&& null_prs = q[slot];
+                for (size_t sample_id = 0; sample_id < num_sample; ++sample_id)
+                {
+                    null_prs.prs[sample_id] = target.calculate_score(
+                        scratch, m_score, m_matrix_index[sample_id]);
+                }
+                null_prs.set_size = set_size.first;
+                null_prs.last = false;
+                q.publish(slot);
+                {
+                    std::unique_lock<std::mutex> locker(m_thread_mutex);
+                    m_analysis_done++;
+                    print_progress();
+                }
+                first_run = false;
             }
-            q.emplace(std::make_pair(prs, set_size.first), num_consumer);
-            m_analysis_done++;
-            print_progress();
-            first_run = false;
         }
-        processed++;
     }
+}
+
+void PRSice::stop_consumers(Slot_Ring<Null_PRS>& q, size_t num_consumer)
+{
     // send termination signal to the consumers
     for (size_t i = 0; i < num_consumer; ++i) {
-        q.emplace(std::make_pair(std::vector<double>(), 0), num_consumer);
+        const size_t slot = q.acquire();
+        q[slot].last = true;
+        q.publish(slot);
     }
 }
 // might want to remove num_selected_snps?
@@ -1891,8 +2133,7 @@ void PRSice::produce_null_prs(Thread_Queue<std::vector<double>>& q,
 }
 */
 void PRSice::consume_prs(
-    Thread_Queue<std::pair<std::vector<double>, uint32_t>>& q,
-    std::map<uint32_t, std::vector<uint32_t>>& set_index,
+    Slot_Ring<Null_PRS>& q, std::map<uint32_t, std::vector<uint32_t>>& set_index,
     std::vector<double>& ori_t_value, std::vector<uint32_t>& set_perm_res,
     const bool is_binary)
 {
@@ -1902,28 +2143,32 @@ void PRSice::consume_prs(
     std::vector<uint32_t> temp_perm_res(set_perm_res.size(), 0);
     double coefficient, se, r2, r2_adjust;
     double obs_p = 2.0; // for safety reason, make sure it is out bound
-    std::pair<std::vector<double>, uint32_t> prs_info;
 
     while (true) {
-        q.pop(prs_info);
-        if (std::get<0>(prs_info).empty()) {
+        const size_t slot = q.consume();
+        auto&& null_prs = q[slot];
+        if (null_prs.last) {
             // all job finished
+            q.release(slot);
             break;
         }
         for (size_t i_sample = 0; i_sample < num_regress_sample; ++i_sample) {
-            independent(i_sample, 1) = std::get<0>(prs_info)[i_sample];
+            independent(i_sample, 1) = null_prs.prs[i_sample];
         }
+        const uint32_t set_size = null_prs.set_size;
+        // the producer can refill the slot while we regress
+        q.release(slot);
         if (is_binary) {
             Regression::glm(m_phenotype, independent, obs_p, r2, coefficient,
                             se, 25, 1, true);
         }
         else
         {
-            Regression::linear_regression(m_phenotype, independent, obs_p, r2,
-                                          r2_adjust, coefficient, se, 1, true);
+            fast_linear_regression(independent, obs_p, r2, r2_adjust,
+                                   coefficient, se);
         }
         double t_value = std::abs(coefficient / se);
-        auto&& index = set_index[std::get<1>(prs_info)];
+        auto&& index = set_index[set_size];
         for (auto&& ref : index) {
             temp_perm_res[ref] += (ori_t_value[ref] < t_value);
         }
@@ -2040,23 +2285,78 @@ void PRSice::run_competitive(Genotype& target, const Commander& commander,
     }
     // they will be pushing around the PRS and the number of SNPs for this PRS
     if (num_thread > 1) {
-        Thread_Queue<std::pair<std::vector<double>, uint32_t>> set_perm_queue;
-        std::thread producer(&PRSice::produce_null_prs, this,
-                             std::ref(set_perm_queue), std::ref(target),
-                             num_thread - 1, std::ref(set_index), num_perm,
-                             require_standardize);
-
-        std::vector<std::thread> consumer_store;
-
-        for (size_t i_thread = 0; i_thread < num_thread - 1; ++i_thread) {
-            consumer_store.push_back(std::thread(
-                &PRSice::consume_prs, this, std::ref(set_perm_queue),
-                std::ref(set_index), std::ref(ori_t_value),
-                std::ref(set_perm_res), is_binary));
+        // half of the threads read the genotypes and calculate the null PRS,
+        // each with its own scratch, the others run the regressions. They
+        // block on each other through the ring, so they run on their own
+        // threads instead of the pool, where a waiting thread might pick up
+        // a consumer while a producer is suspended underneath it. This thread
+        // is the first producer
+        const size_t num_producer = num_thread / 2;
+        const size_t num_consumer = num_thread - num_producer;
+        target.prepare_null_score();
+        std::vector<Genotype::Score_Scratch> scratch(num_producer);
+        for (auto&& producer_scratch : scratch) {
+            target.init_null_score(producer_scratch);
+        }
+        // two slots per consumer, so that the producers can work ahead
+        Null_PRS init;
+        init.prs.resize(num_regress_sample, 0);
+        Slot_Ring<Null_PRS> set_perm_queue(2 * num_consumer, init);
+        std::atomic<size_t> next_block(0);
+        std::atomic<size_t> num_running(num_producer);
+        std::atomic<bool> failed(false);
+        std::mutex error_mutex;
+        std::string error_message;
+        auto record_error = [&](const std::exception& error) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (error_message.empty()) error_message = error.what();
+        };
+        auto producer = [&](size_t i_producer) {
+            try
+            {
+                produce_null_prs(set_perm_queue, target, scratch[i_producer],
+                                 set_index, next_block, num_perm,
+                                 require_standardize, failed);
+            }
+            catch (const std::exception& error)
+            {
+                failed = true;
+                record_error(error);
+            }
+            // the last producer to finish stops the consumers
+            if (--num_running == 0)
+                stop_consumers(set_perm_queue, num_consumer);
+        };
+        auto consumer = [&]() {
+            try
+            {
+                consume_prs(set_perm_queue, set_index, ori_t_value,
+                            set_perm_res, is_binary);
+            }
+            catch (const std::exception& error)
+            {
+                // keep emptying the queue until the producers stop, so that
+                // they don't wait for a slot forever
+                failed = true;
+                record_error(error);
+                bool last = false;
+                while (!last) {
+                    const size_t slot = set_perm_queue.consume();
+                    last = set_perm_queue[slot].last;
+                    set_perm_queue.release(slot);
+                }
+            }
+        };
+        std::vector<std::thread> thread_store;
+        for (size_t i_producer = 1; i_producer < num_producer; ++i_producer) {
+            thread_store.push_back(std::thread(producer, i_producer));
         }
-
-        producer.join();
-        for (auto&& thread : consumer_store) thread.join();
+        for (size_t i_thread = 0; i_thread < num_consumer; ++i_thread) {
+            thread_store.push_back(std::thread(consumer));
+        }
+        producer(0);
+        for (auto&& thread : thread_store) thread.join();
+        if (!error_message.empty()) throw std::runtime_error(error_message);
     }
     else
     {
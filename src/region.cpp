@@ -1063,7 +1063,7 @@ bool Region::check_exclusion(const std::string& chr, const size_t loc)
 }
 
 void Region::update_flag(const int chr, const std::string& rs, size_t loc,
-                         std::vector<uintptr_t>& flag)
+                         uintptr_t* flag)
 {
     flag[0] |= ONELU;
     m_region_snp_count[0]++;
@@ -64,6 +64,40 @@ void linear_regression(const Eigen::VectorXd& y, const Eigen::MatrixXd& A,
     p_value = misc::calc_tprob(tval, n);
 }
 
+bool projected_linear_regression(const Eigen::VectorXd& y_residual,
+                                 const double total_ss,
+                                 const Eigen::MatrixXd& cov_basis,
+                                 const Eigen::Ref<const Eigen::VectorXd>& x,
+                                 double& p_value, double& r2,
+                                 double& r2_adjust, double& coeff,
+                                 double& standard_error)
+{
+    // By Frisch-Waugh-Lovell, the coefficient of x is the regression of
+    // y_residual on x_residual (x regressed on the covariates), and the RSS
+    // of the full model is the null RSS minus the sum of square explained by
+    // x_residual
+    const Eigen::VectorXd x_residual =
+        x - cov_basis * (cov_basis.transpose() * x);
+    const double sxx = x_residual.squaredNorm();
+    // leave the (nearly) rank deficient case to the QR
+    if (collinear(sxx, x.squaredNorm())) return false;
+    const double sxy = x_residual.dot(y_residual);
+    const double null_rss = y_residual.squaredNorm();
+    const double rss = std::max(null_rss - sxy * sxy / sxx, 0.0);
+
+    int n = x.rows();
+    int rank = cov_basis.cols() + 1;
+    int rdf = n - rank;
+    const int df_int = 1; // always has intercept
+    r2 = (total_ss > 0) ? 1.0 - rss / total_ss : 0.0;
+    r2_adjust = 1.0 - (1.0 - r2) * ((double) (n - df_int) / (double) rdf);
+
+    coeff = sxy / sxx;
+    standard_error = std::sqrt(rss / (double) rdf / sxx);
+    p_value = misc::calc_tprob(coeff / standard_error, n);
+    return true;
+}
+
 Eigen::VectorXd logit_variance(const Eigen::VectorXd& eta)
 {
     Eigen::VectorXd ans = eta;
@@ -204,73 +238,71 @@ double binomial_dev_resids_sum(const Eigen::VectorXd& y,
 
 // This is an unsafe version of R's glm.fit
 // unsafe as in I have skipped some of the checking
-void glm(const Eigen::VectorXd& y, const Eigen::MatrixXd& x, double& p_value,
-         double& r2, double& coeff, double& standard_error, size_t max_iter,
-         size_t thread, bool intercept)
+void glm_fit(const Eigen::VectorXd& y, const Eigen::MatrixXd& x,
+             const Eigen::VectorXd& eta_start, GLM_Workspace& workspace,
+             size_t max_iter)
 {
-    Eigen::setNbThreads(thread);
-    Eigen::MatrixXd A = x;
-    int nobs = y.rows();
-    int nvars = A.cols();
-    Eigen::VectorXd weights = Eigen::VectorXd::Ones(nobs);
-    Eigen::VectorXd mustart =
-        (weights.array() * y.array() + 0.5) / (weights.array() + 1);
-    Eigen::VectorXd eta =
-        (mustart.array() / (1 - mustart.array())).array().log();
-    Eigen::VectorXd mu = logit_linkinv(eta);
+    const int nobs = y.rows();
+    const int nvars = x.cols();
+    auto&& eta = workspace.eta;
+    auto&& mu = workspace.mu;
+    auto&& mu_eta_val = workspace.mu_eta_val;
+    auto&& z = workspace.z;
+    auto&& w = workspace.w;
+    auto&& weighted_x = workspace.weighted_x;
+    auto&& qr = workspace.qr;
+    if (eta_start.rows() == nobs) {
+        eta = eta_start;
+    }
+    else
+    {
+        // weights are all 1, so mustart = (y + 0.5) / 2
+        eta = ((y.array() + 0.5) / 2.0).unaryExpr([](double mustart) {
+            return std::log(mustart / (1 - mustart));
+        });
+    }
+    mu = logit_linkinv(eta);
+    const Eigen::VectorXd weights = Eigen::VectorXd::Ones(nobs);
     double devold = binomial_dev_resids_sum(y, mu, weights), dev = 0.0;
     // Iterative reweighting
-    Eigen::MatrixXd A_tmp;
-    Eigen::VectorXd varmu, mu_eta_val, z, w, good, fit, start;
-    bool converge = false;
-    Eigen::ColPivHouseholderQR<Eigen::MatrixXd> qr;
+    z.resize(nobs);
+    w.resize(nobs);
+    weighted_x.resize(nobs, nvars);
     qr.setThreshold(
         std::min(1e-7, std::numeric_limits<double>::epsilon() / 1000));
+    workspace.converge = false;
     for (size_t iter = 0; iter < max_iter; ++iter) {
-        // varmu = (weights.array()>0).select(mu.array()*(1-mu.array()),0);
         mu_eta_val = logit_mu_eta(eta);
-        //			good = (weights.array()>0 && mu_eta_val.array() !=
-        // 0).select(weights.array(), 0);
-        good = (mu_eta_val.array() != 0).select(mu_eta_val.array(), 0);
-        z = weights;
-        w = weights;
-        size_t i_good = 0;
-        //			for(size_t i_weights=0; i_weights < weights.rows();
-        //++i_weights){
-        for (size_t i_weights = 0; i_weights < good.rows(); ++i_weights) {
-            if (good(i_weights) > 0) {
+        for (int i = 0; i < nobs; ++i) {
+            // observations with zero mu.eta don't contribute to the fit, so
+            // give them a zero weight instead of dropping them
+            if (mu_eta_val(i) != 0) {
                 // because offset is 0, we ignore it
-                z(i_good) =
-                    eta(i_weights)
-                    + (y(i_weights) - mu(i_weights)) / mu_eta_val(i_weights);
-                w(i_good) =
-                    std::sqrt(mu_eta_val(i_weights) * mu_eta_val(i_weights)
-                              / (mu(i_weights) * (1 - mu(i_weights))));
-                A.row(i_good) = A.row(i_weights);
-                i_good++;
+                z(i) = eta(i) + (y(i) - mu(i)) / mu_eta_val(i);
+                w(i) = std::sqrt(mu_eta_val(i) * mu_eta_val(i)
+                                 / (mu(i) * (1 - mu(i))));
+            }
+            else
+            {
+                z(i) = 0;
+                w(i) = 0;
             }
         }
-        z.conservativeResize(i_good);
-        w.conservativeResize(i_good);
-        A.conservativeResize(i_good, nvars);
-        A_tmp = A;
-        for (size_t i = 0; i < nvars; ++i) {
-            A_tmp.col(i) = A.col(i).array() * w.array();
-        }
-        qr.compute(A_tmp);
-        start = qr.solve(Eigen::MatrixXd(z.array() * w.array()));
+        weighted_x.noalias() = w.asDiagonal() * x;
+        qr.compute(weighted_x);
+        workspace.beta = qr.solve((z.array() * w.array()).matrix());
         if (nobs < qr.rank()) {
             std::string error_message =
                 "X matrix has rank " + std::to_string(qr.rank()) + "but only "
                 + std::to_string(nobs) + " observations";
             throw std::runtime_error(error_message);
         }
-        eta = A * start;
+        eta.noalias() = x * workspace.beta;
         mu = logit_linkinv(eta);
         dev = binomial_dev_resids_sum(y, mu, weights);
         // R only use 1e-8 here
         if (fabs(dev - devold) / (0.1 + fabs(dev)) < 1e-8) {
-            converge = true;
+            workspace.converge = true;
             break;
         }
         else
@@ -278,31 +310,36 @@ void glm(const Eigen::VectorXd& y, const Eigen::MatrixXd& x, double& p_value,
             devold = dev;
         }
     }
+    workspace.deviance = dev;
+}
+
+void glm(const Eigen::VectorXd& y, const Eigen::MatrixXd& x,
+         const Eigen::VectorXd& eta_start, GLM_Workspace& workspace,
+         double& p_value, double& r2, double& coeff, double& standard_error,
+         size_t max_iter, size_t thread, bool intercept)
+{
+    Eigen::setNbThreads(thread);
+    const int nobs = y.rows();
+    glm_fit(y, x, eta_start, workspace, max_iter);
     r2 = 0;
     coeff = 0;
     p_value = -1;
-    if (!converge) throw std::runtime_error("GLM algorithm did not converge");
-    Eigen::VectorXd residuals =
-        (y.array() - mu.array()) / (logit_mu_eta(eta).array());
-    int sum_good = 0;
-    int weight_bad = 0;
-    for (size_t i = 0; i < good.rows(); ++i) {
-        if (good(i) != 0) sum_good++;
-        if (weights(i) == 0) weight_bad++;
-    }
+    if (!workspace.converge)
+        throw std::runtime_error("GLM algorithm did not converge");
+    const Eigen::VectorXd weights = Eigen::VectorXd::Ones(nobs);
     Eigen::VectorXd wtdmu =
-        (intercept) ? Eigen::VectorXd::Constant(
-                          nobs, (weights.array() * y.array()).array().sum()
-                                    / weights.array().sum())
+        (intercept) ? Eigen::VectorXd::Constant(nobs, y.mean())
                     : logit_linkinv(Eigen::VectorXd::Zero(nobs));
     double nulldev = binomial_dev_resids_sum(y, wtdmu, weights);
+    auto&& qr = workspace.qr;
+    auto&& start = workspace.beta;
     int rank = qr.rank();
     Eigen::MatrixXd R =
         qr.matrixQR().topLeftCorner(rank, rank).triangularView<Eigen::Upper>();
     Eigen::VectorXd se =
         ((R.transpose() * R).inverse().diagonal()).array().sqrt();
     // again, we are ony interested in one of the variable
-    r2 = (1.0 - std::exp((dev - nulldev) / (double) nobs))
+    r2 = (1.0 - std::exp((workspace.deviance - nulldev) / (double) nobs))
          / (1 - std::exp(-nulldev / (double) nobs));
     size_t se_index = intercept;
     for (size_t ind = 0; ind < start.rows(); ++ind) {
@@ -317,4 +354,44 @@ void glm(const Eigen::VectorXd& y, const Eigen::MatrixXd& x, double& p_value,
     p_value = misc::chiprob_p(tvalue * tvalue, 1);
     standard_error = se(se_index);
 }
+
+void glm(const Eigen::VectorXd& y, const Eigen::MatrixXd& x, double& p_value,
+         double& r2, double& coeff, double& standard_error, size_t max_iter,
+         size_t thread, bool intercept)
+{
+    GLM_Workspace workspace;
+    glm(y, x, Eigen::VectorXd(), workspace, p_value, r2, coeff, standard_error,
+        max_iter, thread, intercept);
+}
+
+void logit_score_null(const Eigen::VectorXd& y, const Eigen::MatrixXd& cov,
+                      GLM_Workspace& workspace, Logit_Score_Null& null_model,
+                      size_t max_iter)
+{
+    // start from the intercept only fit, which is usually close
+    const double mean = y.mean();
+    glm_fit(y, cov,
+            Eigen::VectorXd::Constant(y.rows(), std::log(mean / (1 - mean))),
+            workspace, max_iter);
+    if (!workspace.converge)
+        throw std::runtime_error("GLM algorithm did not converge");
+    null_model.residual = y - workspace.mu;
+    null_model.weight = workspace.mu.array() * (1 - workspace.mu.array());
+    null_model.information.compute(cov.transpose() * null_model.weight.asDiagonal()
+                                   * cov);
+}
+
+double logit_score_test(const Logit_Score_Null& null_model,
+                        const Eigen::MatrixXd& cov,
+                        const Eigen::Ref<const Eigen::VectorXd>& x)
+{
+    // U = x'(y - mu), V = x'Wx - x'WZ (Z'WZ)^-1 Z'Wx
+    const Eigen::VectorXd weighted_x = null_model.weight.cwiseProduct(x);
+    const Eigen::VectorXd cross = cov.transpose() * weighted_x;
+    const double score = x.dot(null_model.residual);
+    const double variance =
+        x.dot(weighted_x) - cross.dot(null_model.information.solve(cross));
+    if (!(variance > 0)) return 0.0;
+    return score / std::sqrt(variance);
+}
 }
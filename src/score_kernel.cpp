@@ -0,0 +1,365 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "score_kernel.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCORE_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+namespace score_kernel
+{
+namespace
+{
+typedef void (*kernel_function)(const unsigned char*, const size_t,
+                                const size_t, const double*, const int32_t*,
+                                double*, int32_t*, const bool);
+typedef void (*unpack_function)(const unsigned char*, const size_t,
+                                const uint32_t, double*);
+
+template <bool reset>
+inline void scalar_loop(const unsigned char* genotype, const size_t start,
+                        const size_t end, const double* weight,
+                        const int32_t* count, double* prs, int32_t* num_snp)
+{
+    for (size_t i = start; i < end; ++i) {
+        const uint32_t code = (genotype[i / 4] >> ((i % 4) * 2)) & 3;
+        if (reset) {
+            prs[i] = weight[code];
+            num_snp[i] = count[code];
+        }
+        else
+        {
+            prs[i] += weight[code];
+            num_snp[i] += count[code];
+        }
+    }
+}
+
+void scalar_kernel(const unsigned char* genotype, const size_t start,
+                   const size_t end, const double* weight,
+                   const int32_t* count, double* prs, int32_t* num_snp,
+                   const bool reset)
+{
+    if (reset)
+        scalar_loop<true>(genotype, start, end, weight, count, prs, num_snp);
+    else
+        scalar_loop<false>(genotype, start, end, weight, count, prs, num_snp);
+}
+
+void scalar_unpack(const unsigned char* data, const size_t num_value,
+                   const uint32_t bits, double* probability)
+{
+    const double max_value = (double) ((1u << bits) - 1);
+    if (bits == 8) {
+        for (size_t i = 0; i < num_value; ++i) {
+            probability[i] = data[i] / max_value;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < num_value; ++i) {
+            probability[i] =
+                (data[2 * i] | ((uint32_t) data[2 * i + 1] << 8)) / max_value;
+        }
+    }
+}
+
+#ifdef SCORE_KERNEL_X86
+// SSE2 has no variable shuffle, so we expand the 4 entry tables into 16
+// entry tables covering every possible nibble (2 samples) instead
+template <bool reset>
+__attribute__((target("sse2"))) void
+sse2_loop(const unsigned char* genotype, const size_t start, const size_t end,
+          const double* weight, const int32_t* count, double* prs,
+          int32_t* num_snp)
+{
+    alignas(16) double weight_table[16][2];
+    alignas(16) int32_t count_table[16][2];
+    for (uint32_t nibble = 0; nibble < 16; ++nibble) {
+        weight_table[nibble][0] = weight[nibble & 3];
+        weight_table[nibble][1] = weight[nibble >> 2];
+        count_table[nibble][0] = count[nibble & 3];
+        count_table[nibble][1] = count[nibble >> 2];
+    }
+    size_t i = start;
+    for (; i + 4 <= end; i += 4) {
+        const unsigned char byte = genotype[i / 4];
+        const uint32_t lo = byte & 15, hi = byte >> 4;
+        const __m128d w_lo = _mm_load_pd(weight_table[lo]);
+        const __m128d w_hi = _mm_load_pd(weight_table[hi]);
+        const __m128i c = _mm_unpacklo_epi64(
+            _mm_loadl_epi64((const __m128i*) count_table[lo]),
+            _mm_loadl_epi64((const __m128i*) count_table[hi]));
+        if (reset) {
+            _mm_storeu_pd(prs + i, w_lo);
+            _mm_storeu_pd(prs + i + 2, w_hi);
+            _mm_storeu_si128((__m128i*) (num_snp + i), c);
+        }
+        else
+        {
+            _mm_storeu_pd(prs + i, _mm_add_pd(_mm_loadu_pd(prs + i), w_lo));
+            _mm_storeu_pd(prs + i + 2,
+                          _mm_add_pd(_mm_loadu_pd(prs + i + 2), w_hi));
+            _mm_storeu_si128(
+                (__m128i*) (num_snp + i),
+                _mm_add_epi32(_mm_loadu_si128((const __m128i*) (num_snp + i)),
+                              c));
+        }
+    }
+    scalar_loop<reset>(genotype, i, end, weight, count, prs, num_snp);
+}
+
+void sse2_kernel(const unsigned char* genotype, const size_t start,
+                 const size_t end, const double* weight, const int32_t* count,
+                 double* prs, int32_t* num_snp, const bool reset)
+{
+    if (reset)
+        sse2_loop<true>(genotype, start, end, weight, count, prs, num_snp);
+    else
+        sse2_loop<false>(genotype, start, end, weight, count, prs, num_snp);
+}
+
+// AVX2 can look up the 4 entry tables directly with a permute. The 4 doubles
+// of the weight table are treated as 8 floats so that permutevar8x32 can
+// select the two halves of each double
+template <bool reset>
+__attribute__((target("avx2"))) void
+avx2_loop(const unsigned char* genotype, const size_t start, const size_t end,
+          const double* weight, const int32_t* count, double* prs,
+          int32_t* num_snp)
+{
+    const __m256 weight_table = _mm256_castpd_ps(_mm256_loadu_pd(weight));
+    const __m256i count_table =
+        _mm256_setr_epi32(count[0], count[1], count[2], count[3], count[0],
+                          count[1], count[2], count[3]);
+    const __m256i shift = _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14);
+    const __m256i mask = _mm256_set1_epi32(3);
+    const __m256i lo_select = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    const __m256i hi_select = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+    const __m256i odd = _mm256_setr_epi32(0, 1, 0, 1, 0, 1, 0, 1);
+    size_t i = start;
+    for (; i + 8 <= end; i += 8) {
+        // 8 samples = 16 bits
+        uint16_t bits;
+        std::memcpy(&bits, genotype + i / 4, sizeof(bits));
+        const __m256i code = _mm256_and_si256(
+            _mm256_srlv_epi32(_mm256_set1_epi32(bits), shift), mask);
+        const __m256i c = _mm256_permutevar8x32_epi32(count_table, code);
+        const __m256i lo_index = _mm256_add_epi32(
+            _mm256_slli_epi32(_mm256_permutevar8x32_epi32(code, lo_select), 1),
+            odd);
+        const __m256i hi_index = _mm256_add_epi32(
+            _mm256_slli_epi32(_mm256_permutevar8x32_epi32(code, hi_select), 1),
+            odd);
+        const __m256d w_lo = _mm256_castps_pd(
+            _mm256_permutevar8x32_ps(weight_table, lo_index));
+        const __m256d w_hi = _mm256_castps_pd(
+            _mm256_permutevar8x32_ps(weight_table, hi_index));
+        if (reset) {
+            _mm256_storeu_pd(prs + i, w_lo);
+            _mm256_storeu_pd(prs + i + 4, w_hi);
+            _mm256_storeu_si256((__m256i*) (num_snp + i), c);
+        }
+        else
+        {
+            _mm256_storeu_pd(prs + i,
+                             _mm256_add_pd(_mm256_loadu_pd(prs + i), w_lo));
+            _mm256_storeu_pd(prs + i + 4,
+                             _mm256_add_pd(_mm256_loadu_pd(prs + i + 4), w_hi));
+            _mm256_storeu_si256(
+                (__m256i*) (num_snp + i),
+                _mm256_add_epi32(
+                    _mm256_loadu_si256((const __m256i*) (num_snp + i)), c));
+        }
+    }
+    scalar_loop<reset>(genotype, i, end, weight, count, prs, num_snp);
+}
+
+void avx2_kernel(const unsigned char* genotype, const size_t start,
+                 const size_t end, const double* weight, const int32_t* count,
+                 double* prs, int32_t* num_snp, const bool reset)
+{
+    if (reset)
+        avx2_loop<true>(genotype, start, end, weight, count, prs, num_snp);
+    else
+        avx2_loop<false>(genotype, start, end, weight, count, prs, num_snp);
+}
+
+// widen 4 values at a time to doubles. IEEE division is correctly rounded
+// in both, so the result doesn't depend on the kernel
+__attribute__((target("avx2"))) void
+avx2_unpack(const unsigned char* data, const size_t num_value,
+            const uint32_t bits, double* probability)
+{
+    const double max_value = (double) ((1u << bits) - 1);
+    const __m256d divisor = _mm256_set1_pd(max_value);
+    size_t i = 0;
+    if (bits == 8) {
+        for (; i + 4 <= num_value; i += 4) {
+            int32_t packed;
+            std::memcpy(&packed, data + i, sizeof(packed));
+            const __m128i value = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed));
+            _mm256_storeu_pd(probability + i,
+                             _mm256_div_pd(_mm256_cvtepi32_pd(value), divisor));
+        }
+    }
+    else
+    {
+        for (; i + 4 <= num_value; i += 4) {
+            const __m128i value = _mm_cvtepu16_epi32(
+                _mm_loadl_epi64((const __m128i*) (data + 2 * i)));
+            _mm256_storeu_pd(probability + i,
+                             _mm256_div_pd(_mm256_cvtepi32_pd(value), divisor));
+        }
+    }
+    scalar_unpack(data + i * bits / 8, num_value - i, bits, probability + i);
+}
+#endif
+
+struct Dispatch
+{
+    kernel_function kernel = scalar_kernel;
+    unpack_function unpack = scalar_unpack;
+    Dispatch()
+    {
+#ifdef SCORE_KERNEL_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            kernel = avx2_kernel;
+            unpack = avx2_unpack;
+        }
+        else if (__builtin_cpu_supports("sse2"))
+        {
+            kernel = sse2_kernel;
+        }
+#endif
+    }
+};
+
+const Dispatch& dispatch()
+{
+    // initialized once, thread safe in C++11
+    static const Dispatch selected;
+    return selected;
+}
+}
+
+void add_snp(const uintptr_t* genotype, const size_t sample_ct,
+             const double weight[4], const int32_t count[4], double* prs,
+             int32_t* num_snp, const bool reset)
+{
+    dispatch().kernel(reinterpret_cast<const unsigned char*>(genotype), 0,
+                      sample_ct, weight, count, prs, num_snp, reset);
+}
+
+void add_snp(const uintptr_t* genotype, const size_t sample_start,
+             const size_t sample_end, const double weight[4],
+             const int32_t count[4], double* prs, int32_t* num_snp,
+             const bool reset)
+{
+    assert(sample_start % 4 == 0);
+    dispatch().kernel(reinterpret_cast<const unsigned char*>(genotype),
+                      sample_start, sample_end, weight, count, prs, num_snp,
+                      reset);
+}
+
+void unpack_probability(const unsigned char* data, const size_t num_value,
+                        const uint32_t bits, double* probability)
+{
+    assert(bits == 8 || bits == 16);
+    dispatch().unpack(data, num_value, bits, probability);
+}
+
+const size_t SNP_Block::default_block_size;
+const size_t SNP_Block::sample_chunk;
+const size_t SNP_Block::min_shard_size;
+const size_t SNP_Block::shard_alignment;
+
+void SNP_Block::init(const size_t sample_ct, const size_t genotype_words,
+                     const size_t num_thread, const size_t block_size)
+{
+    m_num_snp = 0;
+    // don't bother with threads unless each of them has enough samples
+    m_num_shard = std::max<size_t>(
+        1, std::min(num_thread, sample_ct / min_shard_size));
+    if (m_sample_ct == sample_ct && m_genotype_words == genotype_words
+        && m_block_size == block_size)
+        return;
+    m_sample_ct = sample_ct;
+    m_genotype_words = genotype_words;
+    m_block_size = block_size;
+    m_genotype.assign(genotype_words * block_size, 0);
+    m_weight.assign(4 * block_size, 0.0);
+    m_count.assign(4 * block_size, 0);
+}
+
+void SNP_Block::push(const double weight[4], const int32_t count[4])
+{
+    assert(m_num_snp < m_block_size);
+    std::copy(weight, weight + 4, m_weight.begin() + m_num_snp * 4);
+    std::copy(count, count + 4, m_count.begin() + m_num_snp * 4);
+    ++m_num_snp;
+}
+
+void SNP_Block::apply_range(const size_t sample_start, const size_t sample_end,
+                            double* prs, int32_t* num_snp,
+                            const bool reset) const
+{
+    const kernel_function kernel = dispatch().kernel;
+    for (size_t start = sample_start; start < sample_end;
+         start += sample_chunk)
+    {
+        const size_t end = std::min(start + sample_chunk, sample_end);
+        for (size_t i_snp = 0; i_snp < m_num_snp; ++i_snp) {
+            kernel(reinterpret_cast<const unsigned char*>(
+                       m_genotype.data() + i_snp * m_genotype_words),
+                   start, end, &m_weight[i_snp * 4], &m_count[i_snp * 4], prs,
+                   num_snp, reset && i_snp == 0);
+        }
+    }
+}
+
+void SNP_Block::apply(double* prs, int32_t* num_snp, bool& not_first)
+{
+    if (m_num_snp == 0) return;
+    const bool reset = !not_first;
+    if (m_num_shard < 2) {
+        apply_range(0, m_sample_ct, prs, num_snp, reset);
+    }
+    else
+    {
+        // each thread owns a disjoint slice of the PRS. The slices are
+        // aligned so that no two threads write to the same cache line
+        size_t shard_size = (m_sample_ct + m_num_shard - 1) / m_num_shard;
+        shard_size = ((shard_size + shard_alignment - 1) / shard_alignment)
+                     * shard_alignment;
+        const size_t num_shard = (m_sample_ct + shard_size - 1) / shard_size;
+        Thread_Pool::global().run(num_shard, [&](size_t i_shard) {
+            const size_t start = i_shard * shard_size;
+            apply_range(start, std::min(start + shard_size, m_sample_ct), prs,
+                        num_snp, reset);
+        });
+    }
+    not_first = true;
+    m_num_snp = 0;
+}
+}
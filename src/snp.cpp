@@ -15,30 +15,181 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "snp.hpp"
+#include <cstring>
 
 SNP::~SNP() {}
 
+namespace
+{
+// strings shared by the SNPs, ID 0 is always the empty string. The strings are
+// stored in blocks that never move, and the table of blocks is allocated once,
+// so SNP::pooled can read a string without the mutex while intern adds others
+struct String_Pool
+{
+    static const uint32_t block_bits = 12;
+    static const uint32_t block_size = 1u << block_bits;
+    static const uint32_t max_block = 1u << 16;
+    String_Pool() : blocks(max_block)
+    {
+        blocks[0].reset(new std::string[block_size]);
+        num_string = 1;
+        ids.emplace(std::string(), 0);
+    }
+    const std::string& operator[](const uint32_t id) const
+    {
+        return blocks[id >> block_bits][id & (block_size - 1)];
+    }
+    std::vector<std::unique_ptr<std::string[]>> blocks;
+    uint32_t num_string;
+    std::unordered_map<std::string, uint32_t> ids;
+    std::mutex mutex;
+};
+String_Pool& string_pool()
+{
+    static String_Pool pool;
+    return pool;
+}
+// rs IDs of all SNPs, in blocks of 32-bit words. The ID of an rs ID is the
+// offset of its length word, its characters are in the following words and
+// never cross a block. As with String_Pool, the blocks never move and the
+// table of blocks is allocated once. Offset 0 is the empty ID
+struct RS_Arena
+{
+    static const uint32_t block_bits = 18;
+    static const uint32_t block_size = 1u << block_bits;
+    static const uint32_t max_block = 1u << (32 - block_bits);
+    RS_Arena() : blocks(max_block)
+    {
+        blocks[0].reset(new uint32_t[block_size]);
+        blocks[0][0] = 0;
+        end = 1;
+    }
+    std::vector<std::unique_ptr<uint32_t[]>> blocks;
+    // offset of the first free word
+    uint64_t end;
+    std::mutex mutex;
+};
+RS_Arena& rs_arena()
+{
+    static RS_Arena arena;
+    return arena;
+}
+}
+
+uint32_t SNP::add_rs(const std::string& rs_id)
+{
+    if (rs_id.empty()) return 0;
+    // length word and the characters
+    const uint64_t num_word = 1 + (rs_id.size() + 3) / 4;
+    if (num_word > RS_Arena::block_size) {
+        throw std::runtime_error("Error: SNP ID too long: "
+                                 + rs_id.substr(0, 64) + "...");
+    }
+    RS_Arena& arena = rs_arena();
+    std::lock_guard<std::mutex> lock(arena.mutex);
+    uint64_t offset = arena.end;
+    // start a new block if the ID doesn't fit in the current one
+    const uint64_t used = offset & (RS_Arena::block_size - 1);
+    if (used + num_word > RS_Arena::block_size)
+        offset += RS_Arena::block_size - used;
+    const uint64_t block = offset >> RS_Arena::block_bits;
+    if (block >= RS_Arena::max_block) {
+        throw std::runtime_error("Error: Too many SNPs");
+    }
+    if (!arena.blocks[block])
+        arena.blocks[block].reset(new uint32_t[RS_Arena::block_size]);
+    uint32_t* entry =
+        &arena.blocks[block][offset & (RS_Arena::block_size - 1)];
+    entry[0] = static_cast<uint32_t>(rs_id.size());
+    std::memcpy(entry + 1, rs_id.data(), rs_id.size());
+    arena.end = offset + num_word;
+    return static_cast<uint32_t>(offset);
+}
+
+const uint32_t* SNP::rs_entry(const uint32_t id)
+{
+    // the caller got id from add_rs, so the ID is already visible
+    const RS_Arena& arena = rs_arena();
+    return &arena.blocks[id >> RS_Arena::block_bits]
+                        [id & (RS_Arena::block_size - 1)];
+}
+
+uint32_t SNP::intern(const std::string& str)
+{
+    if (str.empty()) return 0;
+    String_Pool& pool = string_pool();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    auto&& id = pool.ids.find(str);
+    if (id != pool.ids.end()) return id->second;
+    const uint32_t new_id = pool.num_string;
+    const uint32_t block = new_id >> String_Pool::block_bits;
+    if (block >= String_Pool::max_block) {
+        throw std::runtime_error(
+            "Error: Too many distinct alleles and file names");
+    }
+    if (!pool.blocks[block])
+        pool.blocks[block].reset(new std::string[String_Pool::block_size]);
+    pool.blocks[block][new_id & (String_Pool::block_size - 1)] = str;
+    ++pool.num_string;
+    pool.ids.emplace(str, new_id);
+    return new_id;
+}
+
+const std::string& SNP::pooled(const uint32_t id)
+{
+    // the caller got id from intern, so the string is already visible
+    return string_pool()[id];
+}
+
+std::vector<uint32_t> SNP::pooled_rank()
+{
+    String_Pool& pool = string_pool();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    std::vector<uint32_t> order(pool.num_string);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&pool](uint32_t i1, uint32_t i2) {
+        return pool[i1] < pool[i2];
+    });
+    std::vector<uint32_t> rank(order.size());
+    for (size_t i = 0; i < order.size(); ++i) rank[order[i]] = i;
+    return rank;
+}
+
 std::vector<size_t> SNP::sort_by_p_chr(const std::vector<SNP>& input)
 {
+    // sort the keys instead of jumping around the SNP vector for every
+    // comparison
+    struct Sort_Key
+    {
+        double p_value;
+        int32_t chr;
+        int32_t loc;
+        size_t index;
+    };
+    std::vector<Sort_Key> keys(input.size());
+    for (size_t i = 0; i < input.size(); ++i) {
+        keys[i] = {input[i].m_p_value, input[i].m_chr, input[i].m_loc, i};
+    }
+    std::sort(keys.begin(), keys.end(),
+              [](const Sort_Key& k1, const Sort_Key& k2) {
+                  // plink do it with respect to the location instead of
+                  // statistic chr first such that SNPs within the same
+                  // chromosome will be processed together
+                  if (k1.chr == k2.chr) {
+                      if (k1.p_value == k2.p_value) {
+                          // in theory, we can also add in the stat and se,
+                          // but as they are double, there might be problem
+                          // (have tried to use stat and that cause seg fault)
+                          return k1.loc < k2.loc;
+                      }
+                      else
+                          return k1.p_value < k2.p_value;
+                  }
+                  else
+                      return k1.chr < k2.chr;
+              });
     std::vector<size_t> idx(input.size());
-    std::iota(idx.begin(), idx.end(), 0);
-    std::sort(idx.begin(), idx.end(), [&input](size_t i1, size_t i2) {
-        // plink do it with respect to the location instead of statistic
-        // chr first such that SNPs within the same chromosome will
-        // be processed together
-        if (input[i1].m_chr == input[i2].m_chr) {
-            if (input[i1].m_p_value == input[i2].m_p_value) {
-                // in theory, we can also add in the stat and se,
-                // but as they are double, there might be problem
-                // (have tried to use stat and that cause seg fault)
-                return input[i1].m_loc < input[i2].m_loc;
-            }
-            else
-                return input[i1].m_p_value < input[i2].m_p_value;
-        }
-        else
-            return input[i1].m_chr < input[i2].m_chr;
-    });
+    for (size_t i = 0; i < keys.size(); ++i) idx[i] = keys[i].index;
     return idx;
 }
 
@@ -47,11 +198,16 @@ void SNP::sort_snp_for_perm(std::vector<size_t>& index,
 {
     // now index is sorted, we want to sort the top select_size entry of index
     // by the file info
-    std::sort(index.begin(), index.end(), [&input](size_t i1, size_t i2) {
-        if (input[i1].m_target_file == input[i2].m_target_file) {
-            return input[i1].m_target_byte_pos < input[i2].m_target_byte_pos;
-        }
-        else
-            return (input[i1].m_target_file < input[i2].m_target_file);
-    });
+    const std::vector<uint32_t> file_rank = pooled_rank();
+    std::sort(index.begin(), index.end(),
+              [&input, &file_rank](size_t i1, size_t i2) {
+                  const uint32_t rank1 = file_rank[input[i1].m_target_file];
+                  const uint32_t rank2 = file_rank[input[i2].m_target_file];
+                  if (rank1 == rank2) {
+                      return input[i1].m_target_byte_pos
+                             < input[i2].m_target_byte_pos;
+                  }
+                  else
+                      return rank1 < rank2;
+              });
 }
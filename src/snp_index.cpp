@@ -0,0 +1,158 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "snp_index.hpp"
+#include <cstring>
+
+void SNP_Index::clear()
+{
+    // swap to actually release the memory
+    std::vector<Slot>().swap(m_slot);
+    m_size = 0;
+}
+
+void SNP_Index::reserve(const size_t num_snp)
+{
+    // keep the load factor at or below 0.5. The slots are empty when this is
+    // called, so they can be resized without the SNPs
+    if (m_size == 0 && m_slot.size() < num_snp * 2) {
+        size_t num_slot = 16;
+        while (num_slot < num_snp * 2) num_slot <<= 1;
+        m_slot.assign(num_slot, Slot());
+    }
+}
+
+size_t SNP_Index::slot(const std::vector<SNP>& snps, const char* rs_id,
+                       const size_t length, const uint64_t hash_value) const
+{
+    const size_t mask = m_slot.size() - 1;
+    const uint32_t short_hash = static_cast<uint32_t>(hash_value >> 32);
+    size_t i_slot = static_cast<size_t>(hash_value) & mask;
+    while (m_slot[i_slot].index != 0) {
+        if (m_slot[i_slot].hash == short_hash) {
+            const SNP& cur_snp = snps[m_slot[i_slot].index - 1];
+            if (cur_snp.rs_size() == length
+                && std::memcmp(cur_snp.rs_data(), rs_id, length) == 0)
+            {
+                break;
+            }
+        }
+        i_slot = (i_slot + 1) & mask;
+    }
+    return i_slot;
+}
+
+void SNP_Index::rehash(const std::vector<SNP>& snps, const size_t num_slot)
+{
+    std::vector<Slot> old_slot(num_slot);
+    old_slot.swap(m_slot);
+    const size_t mask = num_slot - 1;
+    for (auto&& entry : old_slot) {
+        if (entry.index == 0) continue;
+        const SNP& cur_snp = snps[entry.index - 1];
+        size_t i_slot = static_cast<size_t>(snp_id_hash(cur_snp.rs_data(),
+                                                        cur_snp.rs_size()))
+                        & mask;
+        while (m_slot[i_slot].index != 0) i_slot = (i_slot + 1) & mask;
+        m_slot[i_slot] = entry;
+    }
+}
+
+void SNP_Index::insert(const std::vector<SNP>& snps, const size_t index)
+{
+    if ((m_size + 1) * 2 > m_slot.size())
+        rehash(snps, m_slot.empty() ? 16 : m_slot.size() * 2);
+    const char* rs_id = snps[index].rs_data();
+    const size_t length = snps[index].rs_size();
+    const uint64_t hash_value = snp_id_hash(rs_id, length);
+    const size_t i_slot = slot(snps, rs_id, length, hash_value);
+    if (m_slot[i_slot].index == 0) ++m_size;
+    m_slot[i_slot].index = static_cast<uint32_t>(index + 1);
+    m_slot[i_slot].hash = static_cast<uint32_t>(hash_value >> 32);
+}
+
+size_t SNP_Index::find(const std::vector<SNP>& snps, const char* rs_id,
+                       const size_t length) const
+{
+    if (m_size == 0) return npos;
+    const size_t i_slot =
+        slot(snps, rs_id, length, snp_id_hash(rs_id, length));
+    if (m_slot[i_slot].index == 0) return npos;
+    return m_slot[i_slot].index - 1;
+}
+
+void SNP_ID_Set::clear()
+{
+    // swap to actually release the memory
+    std::vector<char>().swap(m_arena);
+    std::vector<Entry>().swap(m_entry);
+    std::vector<uint32_t>().swap(m_slot);
+}
+
+size_t SNP_ID_Set::slot(const char* rs_id, const size_t length,
+                        const uint64_t hash_value) const
+{
+    const size_t mask = m_slot.size() - 1;
+    const uint32_t short_hash = static_cast<uint32_t>(hash_value >> 32);
+    size_t i_slot = static_cast<size_t>(hash_value) & mask;
+    while (m_slot[i_slot] != 0) {
+        auto&& entry = m_entry[m_slot[i_slot] - 1];
+        if (entry.hash == short_hash && entry.length == length
+            && std::memcmp(m_arena.data() + entry.offset, rs_id, length) == 0)
+        {
+            break;
+        }
+        i_slot = (i_slot + 1) & mask;
+    }
+    return i_slot;
+}
+
+void SNP_ID_Set::rehash(const size_t num_slot)
+{
+    m_slot.assign(num_slot, 0);
+    const size_t mask = num_slot - 1;
+    for (size_t i_entry = 0; i_entry < m_entry.size(); ++i_entry) {
+        auto&& entry = m_entry[i_entry];
+        size_t i_slot =
+            static_cast<size_t>(
+                snp_id_hash(m_arena.data() + entry.offset, entry.length))
+            & mask;
+        while (m_slot[i_slot] != 0) i_slot = (i_slot + 1) & mask;
+        m_slot[i_slot] = static_cast<uint32_t>(i_entry + 1);
+    }
+}
+
+void SNP_ID_Set::insert(const char* rs_id, const size_t length)
+{
+    if ((m_entry.size() + 1) * 2 > m_slot.size())
+        rehash(m_slot.empty() ? 16 : m_slot.size() * 2);
+    const uint64_t hash_value = snp_id_hash(rs_id, length);
+    const size_t i_slot = slot(rs_id, length, hash_value);
+    if (m_slot[i_slot] != 0) return;
+    Entry entry;
+    entry.offset = m_arena.size();
+    entry.length = static_cast<uint32_t>(length);
+    entry.hash = static_cast<uint32_t>(hash_value >> 32);
+    m_arena.insert(m_arena.end(), rs_id, rs_id + length);
+    m_entry.push_back(entry);
+    m_slot[i_slot] = static_cast<uint32_t>(m_entry.size());
+}
+
+bool SNP_ID_Set::contains(const char* rs_id, const size_t length) const
+{
+    if (m_entry.empty()) return false;
+    return m_slot[slot(rs_id, length, snp_id_hash(rs_id, length))] != 0;
+}
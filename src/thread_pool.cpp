@@ -0,0 +1,210 @@
+// This file is part of PRSice2.0, copyright (C) 2016-2017
+// Shing Wan Choi, Jack Euesden, Cathryn M. Lewis, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+
+namespace
+{
+// the pool and deque owned by the current thread, if it is a worker
+thread_local const Thread_Pool* worker_pool = nullptr;
+thread_local size_t worker_index = 0;
+}
+
+Thread_Pool& Thread_Pool::global()
+{
+    static Thread_Pool pool;
+    return pool;
+}
+
+void Thread_Pool::set_num_thread(size_t num_thread)
+{
+    stop();
+    if (num_thread == 0) num_thread = 1;
+    m_stop = false;
+    m_deques.clear();
+    // always keep one deque so that tasks can be queued without any worker
+    const size_t num_worker = num_thread - 1;
+    for (size_t i = 0; i < std::max<size_t>(num_worker, 1); ++i)
+        m_deques.emplace_back(new Task_Deque);
+    for (size_t i = 0; i < num_worker; ++i)
+        m_workers.push_back(std::thread(&Thread_Pool::worker, this, i));
+}
+
+void Thread_Pool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto&& thread : m_workers) thread.join();
+    m_workers.clear();
+}
+
+void Thread_Pool::worker(size_t index)
+{
+    worker_pool = this;
+    worker_index = index;
+    while (true) {
+        if (run_one(index)) continue;
+        std::unique_lock<std::mutex> lock(m_sleep_mutex);
+        m_wake.wait(lock, [this] { return m_stop || m_num_queued > 0; });
+        if (m_stop && m_num_queued == 0) break;
+    }
+}
+
+bool Thread_Pool::run_one(size_t home)
+{
+    if (m_num_queued == 0) return false;
+    Task task;
+    bool found = false;
+    const size_t num_deque = m_deques.size();
+    if (home < num_deque) {
+        auto&& own = *m_deques[home];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            found = true;
+        }
+    }
+    // steal the oldest task from the others, which is usually the largest
+    // piece of work left
+    for (size_t i = 1; i <= num_deque && !found; ++i) {
+        auto&& victim = *m_deques[(home + i) % num_deque];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            found = true;
+        }
+    }
+    if (!found) return false;
+    m_num_queued--;
+    execute(task);
+    return true;
+}
+
+void Thread_Pool::execute(Task& task)
+{
+    Task_Group& group = *task.group;
+    try
+    {
+        task.work();
+    }
+    catch (const std::exception& error)
+    {
+        std::lock_guard<std::mutex> lock(group.m_mutex);
+        if (group.m_error.empty()) group.m_error = error.what();
+    }
+    // the waiter can only return after acquiring the mutex, so the group is
+    // still alive here
+    std::lock_guard<std::mutex> lock(group.m_mutex);
+    if (--group.m_pending == 0) group.m_done.notify_all();
+}
+
+void Thread_Pool::push(size_t index, std::vector<Task>& tasks, size_t begin,
+                       size_t end)
+{
+    auto&& target = *m_deques[index];
+    std::lock_guard<std::mutex> lock(target.mutex);
+    for (size_t i = begin; i < end; ++i)
+        target.tasks.push_back(std::move(tasks[i]));
+}
+
+void Thread_Pool::submit(Task_Group& group, std::function<void()> task)
+{
+    std::vector<std::function<void()>> tasks(1, std::move(task));
+    submit(group, tasks);
+}
+
+void Thread_Pool::submit(Task_Group& group,
+                         std::vector<std::function<void()>>& tasks)
+{
+    if (tasks.empty()) return;
+    if (m_deques.empty()) set_num_thread(1);
+    std::vector<Task> queued;
+    queued.reserve(tasks.size());
+    for (auto&& work : tasks) queued.push_back(Task{std::move(work), &group});
+    tasks.clear();
+    group.m_pending += queued.size();
+    // count the tasks before they are visible, so that m_num_queued never
+    // drops below the number of tasks in the deques
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_num_queued += queued.size();
+    }
+    const size_t num_deque = m_deques.size();
+    if (worker_pool == this) {
+        // a worker keeps its own tasks, the idle workers will steal them
+        push(worker_index, queued, 0, queued.size());
+    }
+    else
+    {
+        // spread the tasks across the workers in contiguous pieces
+        const size_t num_share = std::min(num_deque, queued.size());
+        const size_t share = (queued.size() + num_share - 1) / num_share;
+        const size_t first = m_next_deque++ % num_deque;
+        for (size_t i = 0; i < num_share; ++i) {
+            push((first + i) % num_deque, queued, i * share,
+                 std::min((i + 1) * share, queued.size()));
+        }
+    }
+    m_wake.notify_all();
+}
+
+void Thread_Pool::wait(Task_Group& group)
+{
+    size_t home = 0;
+    if (worker_pool == this)
+        home = worker_index;
+    else if (!m_deques.empty())
+        home = m_next_deque % m_deques.size();
+    while (group.m_pending > 0) {
+        if (run_one(home)) continue;
+        // the remaining tasks are running on the other threads, check again
+        // from time to time in case they queue more work for us
+        std::unique_lock<std::mutex> lock(group.m_mutex);
+        group.m_done.wait_for(lock, std::chrono::milliseconds(1),
+                              [&group] { return group.m_pending == 0; });
+    }
+    std::lock_guard<std::mutex> lock(group.m_mutex);
+    if (!group.m_error.empty()) {
+        std::string error = group.m_error;
+        group.m_error.clear();
+        throw std::runtime_error(error);
+    }
+}
+
+void Thread_Pool::run(size_t num_task, const std::function<void(size_t)>& task)
+{
+    if (num_task == 0) return;
+    if (num_task == 1 || m_workers.empty()) {
+        for (size_t i = 0; i < num_task; ++i) task(i);
+        return;
+    }
+    Task_Group group;
+    std::vector<std::function<void()>> tasks;
+    tasks.reserve(num_task);
+    for (size_t i = 0; i < num_task; ++i)
+        tasks.push_back([&task, i] { task(i); });
+    submit(group, tasks);
+    wait(group);
+}